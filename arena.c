@@ -0,0 +1,133 @@
+
+#include "arena.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* Every allocation is rounded up to this, so anything can be stored */
+#define ARENAALIGN 8
+#define ROUNDUP(size) (((size) + ARENAALIGN - 1) & ~(size_t)(ARENAALIGN - 1))
+
+static union {
+	uint8_t bytes[ARENASIZE];
+	/* Only here for the alignment */
+	long long align;
+} arena;
+
+static size_t arenaTop = 0;
+static size_t arenaPrevTop = 0;
+static bool arenaSealed = false;
+static struct memstats arenaAccount = {ARENASIZE, 0, 0, 0, 0};
+
+struct pool {
+	uint8_t *blocks;
+	size_t blocksize;
+	unsigned count;
+	/* Free blocks, each holding a pointer to the next */
+	void *freelist;
+	struct memstats stats;
+};
+
+void *arenaAlloc(size_t size)
+{
+	size = ROUNDUP(size);
+	if(arenaSealed || size > ARENASIZE - arenaTop) {
+		arenaAccount.failures++;
+		return NULL;
+	}
+	void *ptr = &arena.bytes[arenaTop];
+	arenaPrevTop = arenaTop;
+	arenaTop += size;
+	arenaAccount.inuse = arenaTop;
+	if(arenaTop > arenaAccount.peak)
+		arenaAccount.peak = arenaTop;
+	arenaAccount.allocations++;
+	return ptr;
+}
+
+void arenaRelease(void *ptr)
+{
+	if(!ptr || ptr != &arena.bytes[arenaPrevTop] || arenaTop == arenaPrevTop)
+		return;
+	arenaTop = arenaPrevTop;
+	arenaAccount.inuse = arenaTop;
+	arenaAccount.allocations--;
+}
+
+void arenaSeal(void)
+{
+	arenaSealed = true;
+}
+
+void arenaStats(struct memstats *stats)
+{
+	*stats = arenaAccount;
+}
+
+struct pool *poolCreate(size_t blocksize, unsigned count)
+{
+	/* Free blocks hold the free list link */
+	if(blocksize < sizeof(void *))
+		blocksize = sizeof(void *);
+	blocksize = ROUNDUP(blocksize);
+	if(count == 0 || blocksize * count / count != blocksize)
+		return NULL;
+	struct pool *pool = (struct pool *)arenaAlloc(sizeof(struct pool));
+	if(!pool)
+		return NULL;
+	pool->blocks = (uint8_t *)arenaAlloc(blocksize * count);
+	if(!pool->blocks) {
+		arenaRelease(pool);
+		return NULL;
+	}
+	pool->blocksize = blocksize;
+	pool->count = count;
+	pool->freelist = NULL;
+	unsigned i;
+	for(i = count; i > 0; i--) {
+		void *block = pool->blocks + (i - 1) * blocksize;
+		*(void **)block = pool->freelist;
+		pool->freelist = block;
+	}
+	memset(&pool->stats, 0, sizeof(pool->stats));
+	pool->stats.size = blocksize * count;
+	return pool;
+}
+
+void *poolAlloc(struct pool *pool)
+{
+	void *block = pool->freelist;
+	if(!block) {
+		pool->stats.failures++;
+		return NULL;
+	}
+	pool->freelist = *(void **)block;
+	pool->stats.inuse += pool->blocksize;
+	if(pool->stats.inuse > pool->stats.peak)
+		pool->stats.peak = pool->stats.inuse;
+	pool->stats.allocations++;
+	return block;
+}
+
+void poolFree(struct pool *pool, void *block)
+{
+	*(void **)block = pool->freelist;
+	pool->freelist = block;
+	pool->stats.inuse -= pool->blocksize;
+}
+
+unsigned poolIndex(struct pool *pool, void *block)
+{
+	return ((uint8_t *)block - pool->blocks) / pool->blocksize;
+}
+
+void *poolBlock(struct pool *pool, unsigned index)
+{
+	return pool->blocks + index * pool->blocksize;
+}
+
+void poolStats(struct pool *pool, struct memstats *stats)
+{
+	*stats = pool->stats;
+}
@@ -0,0 +1,92 @@
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Static memory for everything the drivers allocate.
+ *
+ * The arena is a fixed block, sized at build time with ARENASIZE, which
+ * objects are carved off of in order during setup(). Nothing is ever freed
+ * back to it, except that the most recent allocation can be handed back
+ * when an initialization fails. Once setup() is done the arena is sealed,
+ * and any later allocation from it fails and is counted.
+ *
+ * Objects created and destroyed while running come from pools of fixed
+ * size blocks, which are themselves carved out of the arena.
+ *
+ * Neither ever calls malloc, so the heap can't grow or fragment.
+ */
+#ifndef ARENASIZE
+#define ARENASIZE 4096
+#endif
+
+/* Allocation accounting, in bytes */
+struct memstats {
+	size_t size;
+	size_t inuse;
+	size_t peak;
+	unsigned allocations;
+	unsigned failures;
+};
+
+/* Allocates size bytes, aligned for any type, from the arena.
+ * Returns NULL if the arena is full or sealed.
+ * Preconditions: None
+ * Postconditions: The memory belongs to the caller for the rest of the run
+ */
+void *arenaAlloc(size_t size);
+
+/* Gives back memory from arenaAlloc. Only the most recent allocation can
+ * actually be reused, anything else stays allocated.
+ * Preconditions: ptr came from arenaAlloc, or is NULL
+ * Postconditions: ptr is invalid
+ */
+void arenaRelease(void *ptr);
+
+/* Stops any more memory from being allocated from the arena
+ * Preconditions: None
+ * Postconditions: arenaAlloc always fails
+ */
+void arenaSeal(void);
+
+void arenaStats(struct memstats *stats);
+
+struct pool;
+
+/* Creates a pool of count blocks of blocksize bytes each, in the arena
+ * Preconditions: A positive blocksize and count
+ * Postconditions: A valid pool, or NULL if the arena is out of room
+ */
+struct pool *poolCreate(size_t blocksize, unsigned count);
+
+/* Takes a block from the pool, or returns NULL if they're all in use
+ * Preconditions: A valid pool
+ * Postconditions: The block belongs to the caller until poolFree
+ */
+void *poolAlloc(struct pool *pool);
+
+/* Returns a block to the pool
+ * Preconditions: A valid pool, a block from poolAlloc on that pool
+ * Postconditions: The block is invalid
+ */
+void poolFree(struct pool *pool, void *block);
+
+/* Converts between blocks and their index in the pool, so they can be
+ * referred to by small integers
+ * Preconditions: A valid pool, a block of the pool or an index below count
+ */
+unsigned poolIndex(struct pool *pool, void *block);
+void *poolBlock(struct pool *pool, unsigned index);
+
+void poolStats(struct pool *pool, struct memstats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,649 @@
+/* Benchmarks of the hot paths.
+ *
+ * make bench builds them for the host, and ./bench reports the time per
+ * operation in ns. The modem and motor controller drivers run against the
+ * virtual hardware in host/, and TinyGPS is only included if its source
+ * is where the Makefile expects it.
+ *
+ * make benchfirmware builds the ones that don't need a peripheral into a
+ * firmware image instead, which reports the cycles per operation over the
+ * debug port, counted by the DWT cycle counter. Upload it with
+ * make uploadbench PORT=...
+ *
+ * Both report how many arena allocations each operation made, which
+ * should be none.
+ *
+ * bench -s schedulefile replays a trace of the scheduler's operations,
+ * from a TRACE build through logdecode -s, through the queued and ready
+ * heaps as the scheduler uses them, instead of the synthetic pattern.
+ * make bench HEAP=arity4 or HEAP=pairing builds it with the other heaps.
+ */
+
+#include "include.h"
+#include "heap.h"
+#include "list.h"
+#include "half.h"
+#include "telemetry.h"
+#include "arena.h"
+#include "config.h"
+#include "motor.h"
+
+#ifdef HOSTBENCH
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include "scheduler.h"
+#include "modem.h"
+#include "frame.h"
+#include "logging.h"
+#include "recorder.h"
+#include "hostarduino.h"
+#include "trace.h"
+#define BENCH_DRIVERS
+/* Operations per benchmark, scaled by each one's weight */
+#define BENCHOPS 1000000
+#else
+#include <Arduino.h>
+#include "cycles.h"
+#define BENCH_TINYGPS
+#define BENCHOPS 10000
+#endif
+
+#ifdef BENCH_TINYGPS
+#include "TinyGPS.h"
+#endif
+
+/* Nodes kept in the heap and list while they're benchmarked */
+#define BENCHDEPTH 16
+#define BENCHCAPACITY 32
+
+struct benchmark {
+  const char *name;
+  /* Operations run are BENCHOPS / weight */
+  unsigned weight;
+  void (*setup)(void);
+  void (*run)(unsigned ops);
+};
+
+/* Keeps the compiler from optimizing the work away */
+volatile uint32_t benchsink;
+
+/* Deterministic keys and values */
+static uint32_t benchrand = 1;
+static inline uint32_t benchRandom(void)
+{
+  benchrand = benchrand * 1664525 + 1013904223;
+  return benchrand;
+}
+
+static struct heap *hp;
+static struct hpnode heapnodes[BENCHCAPACITY];
+
+void heapSetup(void)
+{
+  hp = hpCreate(BENCHCAPACITY);
+  for(int i = 0; i < BENCHDEPTH; i++) {
+    hpNodeInit(&heapnodes[i]);
+    hpAdd(hp, &heapnodes[i], benchRandom() % 1000);
+  }
+}
+
+/* The scheduler's pattern, the earliest event comes out and goes back in
+ * further ahead
+ */
+void heapRun(unsigned ops)
+{
+  for(unsigned i = 0; i < ops; i++) {
+    struct hpnode *node = hpPeek(hp);
+    hpkey now = hpKey(hp, node);
+    hpTop(hp);
+    hpAdd(hp, node, now + benchRandom() % 1000);
+  }
+}
+
+static list *lst;
+
+void listSetup(void)
+{
+  lst = listCreateCapacity(BENCHCAPACITY);
+  for(int i = 0; i < BENCHDEPTH; i++)
+    listInsert(lst, &heapnodes[i]);
+}
+
+void listRun(unsigned ops)
+{
+  for(unsigned i = 0; i < ops; i++) {
+    listInsert(lst, &heapnodes[i % BENCHCAPACITY]);
+    listMoveForward(lst);
+    listDeleteCurrent(lst);
+  }
+}
+
+static uint16_t halves[256];
+
+void halfSetup(void)
+{
+  halfInit();
+  /* Mostly the sort of values the modem sends, some of everything else */
+  for(int i = 0; i < 256; i++)
+    halves[i] = i < 224 ? singleToHalf((int)(benchRandom() % 2001 - 1000) /
+				       1000.0f) : benchRandom();
+}
+
+void halfRun(unsigned ops)
+{
+  float sum = 0;
+  for(unsigned i = 0; i < ops; i++)
+    sum += halfToSingle(halves[i & 0xFF]);
+  benchsink = sum;
+}
+
+/* The conversion the modem used before half.c, less its debug output, to
+ * compare against. It gets subnormals, infinities and NaNs wrong.
+ */
+static float oldHalfToSingle(void *value)
+{
+  union dest {
+    float fp;
+    unsigned int val;
+  } data;
+  unsigned short source = *(unsigned short *)value;
+  if(source == 0)
+    return 0.0;
+  int sign = (source & 0x8000);
+  sign <<= 16;
+  int exp = (((source & 0x7C00) >> 10) - 15 + 127);
+  exp <<= 23;
+  int mantissa = (source & 0x3ff);
+  mantissa <<= 13;
+  data.val = sign + exp + mantissa;
+  return data.fp;
+}
+
+void oldHalfRun(unsigned ops)
+{
+  float sum = 0;
+  for(unsigned i = 0; i < ops; i++)
+    sum += oldHalfToSingle(&halves[i & 0xFF]);
+  benchsink = sum;
+}
+
+void halfQ15Run(unsigned ops)
+{
+  int32_t sum = 0;
+  for(unsigned i = 0; i < ops; i++)
+    sum += halfToQ15(halves[i & 0xFF]);
+  benchsink = sum;
+}
+
+/* A command from the half the base sent to the value sent to the motor
+ * controller, as it was done in float before motorScale
+ */
+void commandFloatRun(unsigned ops)
+{
+  int32_t sum = 0;
+  for(unsigned i = 0; i < ops; i++) {
+    char cmd = 'A';
+    int value = halfToSingle(halves[i & 0xFF]) * 0x7F;
+    if(value < 0) {
+      value = -value;
+      cmd = 'a';
+    }
+    sum += value + cmd;
+  }
+  benchsink = sum;
+}
+
+/* And as it's done now, in Q15 */
+void commandQ15Run(unsigned ops)
+{
+  int32_t sum = 0;
+  for(unsigned i = 0; i < ops; i++) {
+    char cmd = 'A';
+    sum += motorScale(halfToQ15(halves[i & 0xFF]), &cmd) + cmd;
+  }
+  benchsink = sum;
+}
+
+static struct telemetrycodec codec;
+static struct telemetrysample sample;
+
+void telemetrySetup(void)
+{
+  telemetryInit(&codec);
+  sample.mask = 0;
+  for(int i = 0; i < TELEMETRY_NFIELDS; i++) {
+    sample.values[i] = benchRandom() % 100000;
+    sample.mask |= 1ul << i;
+  }
+}
+
+/* A frame with every field, as it changes a little each time */
+void telemetryRun(unsigned ops)
+{
+  uint8_t frame[TELEMETRY_MAXFRAME];
+  for(unsigned i = 0; i < ops; i++) {
+    sample.values[i % TELEMETRY_NFIELDS] += (int)(benchRandom() % 21) - 10;
+    benchsink = telemetryEncode(&codec, &sample, frame, sizeof(frame));
+  }
+}
+
+#ifdef BENCH_TINYGPS
+static TinyGPS gps;
+static const char *sentences =
+  "$GPRMC,201547.000,A,3014.5527,N,09749.5808,W,0.24,163.05,040109,,*1A\r\n"
+  "$GPGGA,201548.000,3014.5529,N,09749.5808,W,1,07,1.5,225.6,M,-22.5,M,18.8,0000*78\r\n";
+
+/* An operation is one sentence */
+void gpsRun(unsigned ops)
+{
+  const char *c = sentences;
+  for(unsigned i = 0; i < ops; i++) {
+    do {
+      if(!*c)
+	c = sentences;
+      gps.encode(*c);
+    } while(*c++ != '\n');
+  }
+}
+#endif
+
+#ifdef BENCH_DRIVERS
+void motorWriteByte(USARTClass *serial, byte b);
+
+void motorRun(unsigned ops)
+{
+  for(unsigned i = 0; i < ops; i++)
+    motorWriteByte(&MOTORSERIAL, i & 0x7F);
+}
+
+static struct scheduler *scheduler;
+static struct modem *modem;
+/* A batch of the base's command frames, as many as the serial port holds */
+#define MODEMBATCH 128
+static struct hostevent modemevents[MODEMBATCH];
+
+void modemSetup(void)
+{
+  scheduler = schedulerInit();
+  /* The modem answers the +++, then the base connects */
+  static struct hostevent hello[sizeof("OK\r\nCONNECT") - 1];
+  const char *reply = "OK\r\nCONNECT";
+  for(size_t i = 0; i < sizeof(hello) / sizeof(hello[0]); i++) {
+    hello[i].time = 0;
+    hello[i].port = TRACE_MODEM;
+    hello[i].dir = TRACE_READ;
+    hello[i].value = reply[i];
+  }
+  hostLoad(hello, 4, TRACE_NPORTS);
+  modem = modemInit(&MODEMSERIAL, config.modembaud, config.modemtimeout);
+  hostLoad(hello + 4, sizeof(hello) / sizeof(hello[0]) - 4, TRACE_NPORTS);
+  modemUpdate(modem);
+  uint8_t frame[FRAME_MAXENCODED];
+  size_t len = 0, pos = 0;
+  for(int i = 0; i < MODEMBATCH; i++) {
+    if(pos == len) {
+      uint8_t command[4];
+      for(int j = 0; j < 4; j++)
+	command[j] = benchRandom();
+      len = frameEncode(frame, sizeof(frame), FRAME_BROADCAST, FRAME_COMMAND,
+			command, sizeof(command));
+      pos = 0;
+    }
+    modemevents[i].time = 0;
+    modemevents[i].port = TRACE_MODEM;
+    modemevents[i].dir = TRACE_READ;
+    modemevents[i].value = frame[pos++];
+  }
+}
+
+/* An operation is one byte parsed */
+void modemRun(unsigned ops)
+{
+  for(unsigned i = 0; i < ops; i += MODEMBATCH) {
+    hostLoad(modemevents, MODEMBATCH, TRACE_NPORTS);
+    modemUpdate(modem);
+    while(schedulerProcessEvents(scheduler));
+  }
+}
+
+void logRecord(unsigned, unsigned, ...)
+{
+}
+
+void recorderWrite(enum recordtype, unsigned, ...)
+{
+}
+
+void failsafeKick(void)
+{
+}
+
+void powerHold(uint32_t)
+{
+}
+
+void powerRelease(uint32_t)
+{
+}
+#endif
+
+static const struct benchmark benchmarks[] = {
+  {"hpTop/hpAdd", 1, heapSetup, heapRun},
+  {"listInsert/listDelete", 1, listSetup, listRun},
+  {"halfToSingle", 1, halfSetup, halfRun},
+  {"fltHalfToSingle (old)", 1, NULL, oldHalfRun},
+  {"halfToQ15", 1, NULL, halfQ15Run},
+  {"command, float", 1, NULL, commandFloatRun},
+  {"command, Q15", 1, NULL, commandQ15Run},
+  {"telemetryEncode", 10, telemetrySetup, telemetryRun},
+#ifdef BENCH_TINYGPS
+  {"TinyGPS sentence", 100, NULL, gpsRun},
+#endif
+#ifdef BENCH_DRIVERS
+  {"motorWriteByte", 1, NULL, motorRun},
+  {"modemUpdate byte", 1, modemSetup, modemRun},
+#endif
+};
+
+static const unsigned nbenchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+/* The time per operation, in ns on the host, cycles on the kayak */
+double benchTime(const struct benchmark *bench, unsigned ops);
+void benchReport(const char *name, double perop, double allocs);
+
+void benchRun(void)
+{
+  for(unsigned i = 0; i < nbenchmarks; i++) {
+    if(benchmarks[i].setup)
+      benchmarks[i].setup();
+  }
+  for(unsigned i = 0; i < nbenchmarks; i++) {
+    const struct benchmark *bench = &benchmarks[i];
+    unsigned ops = BENCHOPS / bench->weight;
+    /* Once to warm up */
+    bench->run(ops / 10 + 1);
+    struct memstats before, after;
+    arenaStats(&before);
+    double perop = benchTime(bench, ops);
+    arenaStats(&after);
+    benchReport(bench->name, perop,
+		(double)(after.allocations - before.allocations) / ops);
+  }
+}
+
+#ifdef HOSTBENCH
+
+double benchTime(const struct benchmark *bench, unsigned ops)
+{
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  bench->run(ops);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return ((end.tv_sec - start.tv_sec) * 1e9 +
+	  (end.tv_nsec - start.tv_nsec)) / ops;
+}
+
+void benchReport(const char *name, double perop, double allocs)
+{
+  printf("%-24s %10.1f ns/op %8.3f allocs/op\n", name, perop, allocs);
+}
+
+/* An operation from the scheduler's trace */
+struct schedop {
+  uint8_t op, event;
+  hpkey key;
+};
+
+/* Every index the trace can name, as the event is a byte */
+#define SCHEDEVENTS 0x100
+
+enum schedwhere {
+  SCHED_NONE,
+  SCHED_QUEUED,
+  SCHED_READY
+};
+
+static struct heap queued, ready;
+static struct hpslot queuedslots[HP_SLOTS(SCHEDEVENTS)],
+  readyslots[HP_SLOTS(SCHEDEVENTS)];
+static struct hpnode schednodes[SCHEDEVENTS];
+static uint8_t schedwhere[SCHEDEVENTS];
+static hpkey readyid;
+
+size_t scheduleLoad(const char *file, struct schedop **ops);
+unsigned scheduleReplay(const struct schedop *ops, size_t nops);
+void scheduleTake(struct heap *hp, struct hpnode *node);
+
+int scheduleBench(const char *file)
+{
+  struct schedop *ops;
+  size_t nops = scheduleLoad(file, &ops);
+  if(!nops) {
+    fprintf(stderr, "No scheduler operations in %s\n", file);
+    return 1;
+  }
+  hpInit(&queued, queuedslots, SCHEDEVENTS);
+  hpInit(&ready, readyslots, SCHEDEVENTS);
+  for(unsigned i = 0; i < SCHEDEVENTS; i++)
+    hpNodeInit(&schednodes[i]);
+  /* The trace is replayed from empty heaps each time round, as many times
+   * as it takes to make up BENCHOPS operations. Once to warm up.
+   */
+  unsigned skipped = scheduleReplay(ops, nops);
+  unsigned passes = (BENCHOPS + nops - 1) / nops;
+  double ns = 0;
+  for(unsigned i = 0; i < passes; i++) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    scheduleReplay(ops, nops);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns += (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  }
+  printf("%zu operations, %u skipped for events the trace didn't see "
+	 "queued\n", nops, skipped);
+  benchReport("scheduler trace", ns / ((double)passes * nops), 0);
+  free(ops);
+  return 0;
+}
+
+/* Reads the whole trace, so none of the parsing is timed */
+size_t scheduleLoad(const char *file, struct schedop **ops)
+{
+  FILE *input = fopen(file, "rb");
+  if(!input) {
+    perror(file);
+    *ops = NULL;
+    return 0;
+  }
+  size_t nops = 0, capacity = 0;
+  *ops = NULL;
+  int op;
+  while((op = fgetc(input)) != EOF) {
+    int event = fgetc(input);
+    if(event == EOF || op >= TRACE_SCHED_NOPS)
+      break;
+    hpkey key = 0;
+    if(op == TRACE_SCHED_REGISTER || op == TRACE_SCHED_RESCHEDULE) {
+      int c, shift = 0;
+      do {
+	c = fgetc(input);
+	if(c == EOF || shift > 28)
+	  break;
+	key |= (hpkey)(c & 0x7F) << shift;
+	shift += 7;
+      } while(c & 0x80);
+      if(c == EOF || (c & 0x80))
+	break;
+    }
+    if(nops == capacity) {
+      capacity = capacity ? capacity * 2 : 1024;
+      *ops = (struct schedop *)realloc(*ops, capacity * sizeof(**ops));
+      if(!*ops) {
+	fprintf(stderr, "Out of memory\n");
+	fclose(input);
+	return 0;
+      }
+    }
+    (*ops)[nops].op = op;
+    (*ops)[nops].event = event;
+    (*ops)[nops].key = key;
+    nops++;
+  }
+  fclose(input);
+  return nops;
+}
+
+/* Does to the heaps what the scheduler did, and returns how many of the
+ * operations didn't fit what was in them. The trace starts part way
+ * through, so it can name events queued before it began, and operations
+ * dropped for lack of room leave gaps.
+ */
+unsigned scheduleReplay(const struct schedop *ops, size_t nops)
+{
+  unsigned skipped = 0;
+  for(size_t i = 0; i < nops; i++) {
+    const struct schedop *op = &ops[i];
+    struct hpnode *node = &schednodes[op->event];
+    uint8_t *where = &schedwhere[op->event];
+    switch(op->op) {
+    case TRACE_SCHED_REGISTER:
+      if(*where != SCHED_NONE) {
+	skipped++;
+	break;
+      }
+      hpAdd(&queued, node, op->key);
+      *where = SCHED_QUEUED;
+      break;
+    case TRACE_SCHED_RESCHEDULE:
+      if(*where == SCHED_QUEUED) {
+	hpUpdate(&queued, node, op->key);
+      }
+      else if(*where == SCHED_READY) {
+	hpRemove(&ready, node);
+	hpAdd(&queued, node, op->key);
+	*where = SCHED_QUEUED;
+      }
+      else {
+	skipped++;
+      }
+      break;
+    case TRACE_SCHED_POST:
+      if(*where != SCHED_NONE) {
+	skipped++;
+	break;
+      }
+      hpAdd(&ready, node, readyid++);
+      *where = SCHED_READY;
+      break;
+    case TRACE_SCHED_CANCEL:
+      if(*where == SCHED_NONE) {
+	skipped++;
+	break;
+      }
+      hpRemove(*where == SCHED_QUEUED ? &queued : &ready, node);
+      *where = SCHED_NONE;
+      break;
+    case TRACE_SCHED_DUE:
+      if(*where != SCHED_QUEUED) {
+	skipped++;
+	break;
+      }
+      scheduleTake(&queued, node);
+      hpAdd(&ready, node, readyid++);
+      *where = SCHED_READY;
+      break;
+    case TRACE_SCHED_RUN:
+      if(*where != SCHED_READY) {
+	skipped++;
+	break;
+      }
+      scheduleTake(&ready, node);
+      *where = SCHED_NONE;
+      break;
+    }
+  }
+  /* Empty for the next time round */
+  for(unsigned i = 0; i < SCHEDEVENTS; i++) {
+    if(schedwhere[i] != SCHED_NONE)
+      hpRemove(schedwhere[i] == SCHED_QUEUED ? &queued : &ready,
+	       &schednodes[i]);
+    schedwhere[i] = SCHED_NONE;
+  }
+  return skipped;
+}
+
+/* The scheduler always takes the first event off. It's only somewhere
+ * else if the trace has a gap.
+ */
+void scheduleTake(struct heap *hp, struct hpnode *node)
+{
+  if(hpPeek(hp) == node)
+    hpTop(hp);
+  else
+    hpRemove(hp, node);
+}
+
+int main(int argc, char **argv)
+{
+  const char *schedule = NULL;
+  int opt;
+  while((opt = getopt(argc, argv, "s:")) != -1) {
+    switch(opt) {
+    case 's':
+      schedule = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-s schedulefile]\n", argv[0]);
+      return 1;
+    }
+  }
+  configLoad(&config);
+  /* Which heap.h was built with, as make bench HEAP=... picks */
+#if defined(HP_PAIRING)
+  printf("With the pairing heap\n");
+#elif HP_ARITY == 2
+  printf("With the binary heap\n");
+#else
+  printf("With the %d-ary heap\n", HP_ARITY);
+#endif
+  if(schedule)
+    return scheduleBench(schedule);
+  benchRun();
+  return 0;
+}
+
+#else
+
+double benchTime(const struct benchmark *bench, unsigned ops)
+{
+  uint32_t start = cyclesNow();
+  bench->run(ops);
+  return (double)(cyclesNow() - start) / ops;
+}
+
+void benchReport(const char *name, double perop, double allocs)
+{
+  DEBUGSERIAL.print(name);
+  DEBUGSERIAL.print(": ");
+  DEBUGSERIAL.print(perop, 1);
+  DEBUGSERIAL.print(" cycles/op, ");
+  DEBUGSERIAL.print(allocs, 3);
+  DEBUGSERIAL.println(" allocs/op");
+}
+
+void setup(void)
+{
+  configLoad(&config);
+  DEBUGSERIAL.begin(config.debugbaud);
+  cyclesInit();
+  benchRun();
+}
+
+void loop(void)
+{
+}
+
+#endif
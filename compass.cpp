@@ -3,36 +3,41 @@
 #include "compass.h"
 
 #include "scheduler.h"
+#include "logging.h"
+#include "arena.h"
+#include "trace.h"
 
 #define COMPASSADDRESS 0x60
 
 struct compass {
   TwoWire *wire;
   float bearing;
+  unsigned pollms;
 };
 
 void compassUpdate(struct compass *compass);
 
-struct compass *compassInit(TwoWire *wire)
+struct compass *compassInit(TwoWire *wire, unsigned pollms)
 {
   struct compass *cmp =
-    (struct compass *)malloc(sizeof(struct compass));
+    (struct compass *)arenaAlloc(sizeof(struct compass));
   if(!cmp) {
-    DEBUGSERIAL.print("Could not allocate memory for the compass!\r\n");
+    LOG(ALLOC_FAILED, LOGALLOC_COMPASS);
     return NULL;
   }
   cmp->wire = wire;
   cmp->wire->begin();
   cmp->bearing = 0.0 / 0.0;
-  registerTimer(100, (void (*)(void *))compassUpdate, cmp);
+  cmp->pollms = pollms;
+  registerTimer(pollms, (void (*)(void *))compassUpdate, cmp);
   return cmp;
 }
 
 void compassUpdate(struct compass *cmp)
 {
-  DEBUGPRINT("Compass Update\r\n");
+  LOG(COMPASS_UPDATE);
   cmp->wire->beginTransmission(COMPASSADDRESS);
-  cmp->wire->write(2);
+  cmp->wire->write(TRACEOUT(TRACE_COMPASS, 2));
   cmp->wire->endTransmission();
   
   cmp->wire->requestFrom(COMPASSADDRESS, 2);
@@ -43,12 +48,12 @@ void compassUpdate(struct compass *cmp)
     short intval;
   } bytes;
   while(!cmp->wire->available());
-  bytes.byteval[1] = cmp->wire->read();
-  bytes.byteval[0] = cmp->wire->read();
+  bytes.byteval[1] = TRACEIN(TRACE_COMPASS, cmp->wire->read());
+  bytes.byteval[0] = TRACEIN(TRACE_COMPASS, cmp->wire->read());
 //Read 2 bytes, combine and divide by 10 to return value to one
 //decimal value
   cmp->bearing = bytes.intval / 10.0;
-  registerTimer(100, (void (*)(void *))compassUpdate, cmp);
+  registerTimer(cmp->pollms, (void (*)(void *))compassUpdate, cmp);
 }
 
 float compassBearing(struct compass *cmp)
@@ -9,11 +9,12 @@
 struct compass;
 
 /* Returns a valid compass structure on success, NULL on failure
- * Preconditions: The scheduler is initialized
+ * The bearing is read every pollms.
+ * Preconditions: The scheduler is initialized, a positive poll period
  * Postconditions: An event to periodically update the compass bearing is 
  *								 registered, a valid compass object is returned
  */
-struct compass *compassInit(TwoWire *wire);
+struct compass *compassInit(TwoWire *wire, unsigned pollms);
 
 /* Returns the bearing of the compass relative to magnetic north
  * Preconditions: A valid compass object
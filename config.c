@@ -0,0 +1,221 @@
+#include "config.h"
+
+#include <string.h>
+
+#define CONFIGMAGIC 0x4B594B43
+
+/* Each copy of the parameter block starts with this */
+struct configheader {
+	uint32_t magic;
+	uint16_t version;
+	/* Bytes of parameters following the header */
+	uint16_t length;
+	uint32_t sequence;
+	/* Over the version, length, sequence and the parameters */
+	uint32_t crc;
+};
+
+/* The parameters have to fit in a page with the header */
+typedef char configfits[sizeof(struct configheader) + sizeof(struct config) <=
+			CONFIG_PAGESIZE ? 1 : -1];
+
+struct config config;
+
+#define CONFIGDEFAULT(name, field, def, min, max, link) def,
+static const uint32_t configDefault[CONFIG_NPARAMS] = {
+	CONFIGPARAMS(CONFIGDEFAULT)
+};
+#undef CONFIGDEFAULT
+#define CONFIGMIN(name, field, def, min, max, link) min,
+static const uint32_t configMin[CONFIG_NPARAMS] = {
+	CONFIGPARAMS(CONFIGMIN)
+};
+#undef CONFIGMIN
+#define CONFIGMAX(name, field, def, min, max, link) max,
+static const uint32_t configMax[CONFIG_NPARAMS] = {
+	CONFIGPARAMS(CONFIGMAX)
+};
+#undef CONFIGMAX
+#define CONFIGNAME(name, field, def, min, max, link) #name,
+static const char *configNames[CONFIG_NPARAMS] = {
+	CONFIGPARAMS(CONFIGNAME)
+};
+#undef CONFIGNAME
+#define CONFIGLINK(name, field, def, min, max, link) link,
+static const uint8_t configLink[CONFIG_NPARAMS] = {
+	CONFIGPARAMS(CONFIGLINK)
+};
+#undef CONFIGLINK
+
+/* Where the copy loaded came from, so the next save goes after it */
+static unsigned configPage = CONFIG_PAGES - 1;
+static uint32_t configSequence = 0;
+
+static uint32_t configCRC(uint32_t crc, const void *data, size_t len)
+{
+	/* CRC-32, a nibble at a time, so the table is small */
+	static const uint32_t table[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+		0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+		0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+	};
+	const uint8_t *bytes = data;
+	size_t i;
+	crc = ~crc;
+	for(i = 0; i < len; i++) {
+		crc = table[(crc ^ bytes[i]) & 0x0F] ^ (crc >> 4);
+		crc = table[(crc ^ (bytes[i] >> 4)) & 0x0F] ^ (crc >> 4);
+	}
+	return ~crc;
+}
+
+static uint32_t configHeaderCRC(const struct configheader *header,
+																const void *params)
+{
+	uint32_t crc = configCRC(0, &header->version,
+													 offsetof(struct configheader, crc) -
+													 offsetof(struct configheader, version));
+	return configCRC(crc, params, header->length);
+}
+
+void configDefaults(struct config *cfg)
+{
+	uint32_t *fields = (uint32_t *)cfg;
+	unsigned i;
+	for(i = 0; i < CONFIG_NPARAMS; i++)
+		fields[i] = configDefault[i];
+}
+
+bool configLoad(struct config *cfg)
+{
+	uint32_t page[CONFIG_PAGESIZE / sizeof(uint32_t)];
+	struct configheader *header = (struct configheader *)page;
+	uint8_t *params = (uint8_t *)(header + 1);
+	bool found = false;
+	unsigned i;
+	configDefaults(cfg);
+	for(i = 0; i < CONFIG_PAGES; i++) {
+		if(!configStoreRead(i, page))
+			continue;
+		/* Erased pages fail the magic, half written ones the CRC.
+		 * Blocks from newer firmware might mean something else, so only
+		 * older ones are trusted.
+		 */
+		if(header->magic != CONFIGMAGIC || header->version > CONFIG_VERSION ||
+			 header->length > CONFIG_PAGESIZE - sizeof(*header) ||
+			 header->crc != configHeaderCRC(header, params))
+			continue;
+		if(found && (int32_t)(header->sequence - configSequence) <= 0)
+			continue;
+		found = true;
+		configPage = i;
+		configSequence = header->sequence;
+		/* Anything the block is missing keeps its default */
+		configDefaults(cfg);
+		memcpy(cfg, params, header->length < sizeof(*cfg) ?
+					 header->length : sizeof(*cfg));
+	}
+	/* A damaged value is as bad as no value */
+	for(i = 0; found && i < CONFIG_NPARAMS; i++) {
+		uint32_t value = configGet(cfg, i);
+		if(value < configMin[i] || value > configMax[i])
+			((uint32_t *)cfg)[i] = configDefault[i];
+	}
+	return found;
+}
+
+bool configSave(const struct config *cfg)
+{
+	uint32_t page[CONFIG_PAGESIZE / sizeof(uint32_t)];
+	struct configheader *header = (struct configheader *)page;
+	memset(page, 0xFF, sizeof(page));
+	header->magic = CONFIGMAGIC;
+	header->version = CONFIG_VERSION;
+	header->length = sizeof(*cfg);
+	header->sequence = configSequence + 1;
+	memcpy(header + 1, cfg, sizeof(*cfg));
+	header->crc = configHeaderCRC(header, header + 1);
+	unsigned next = (configPage + 1) % CONFIG_PAGES;
+	if(!configStoreWrite(next, page))
+		return false;
+	configPage = next;
+	configSequence++;
+	return true;
+}
+
+bool configSet(struct config *cfg, unsigned param, uint32_t value)
+{
+	if(param >= CONFIG_NPARAMS || value < configMin[param] ||
+		 value > configMax[param])
+		return false;
+	((uint32_t *)cfg)[param] = value;
+	return true;
+}
+
+uint32_t configGet(const struct config *cfg, unsigned param)
+{
+	if(param >= CONFIG_NPARAMS)
+		return 0;
+	return ((const uint32_t *)cfg)[param];
+}
+
+bool configLinkSettable(unsigned param)
+{
+	return param < CONFIG_NPARAMS && configLink[param];
+}
+
+unsigned configRequest(struct config *cfg, const uint8_t *buf, size_t len)
+{
+	unsigned changed = 0;
+	size_t pos = 0;
+	while(pos < len) {
+		unsigned param = buf[pos++];
+		uint32_t value = 0;
+		unsigned shift = 0;
+		bool done = false;
+		while(pos < len && shift < 35) {
+			value |= (uint32_t)(buf[pos] & 0x7F) << shift;
+			shift += 7;
+			if(!(buf[pos++] & 0x80)) {
+				done = true;
+				break;
+			}
+		}
+		if(!done)
+			break;
+		if(!configLinkSettable(param))
+			continue;
+		if(configGet(cfg, param) != value && configSet(cfg, param, value))
+			changed++;
+	}
+	if(changed)
+		configSave(cfg);
+	return changed;
+}
+
+size_t configPutRequest(uint8_t *buf, size_t size, unsigned param,
+												uint32_t value)
+{
+	size_t i = 0;
+	if(size < 1)
+		return 0;
+	buf[i++] = param;
+	do {
+		if(i >= size)
+			return 0;
+		buf[i] = value & 0x7F;
+		value >>= 7;
+		if(value)
+			buf[i] |= 0x80;
+		i++;
+	} while(value);
+	return i;
+}
+
+const char *configName(unsigned param)
+{
+	if(param >= CONFIG_NPARAMS)
+		return NULL;
+	return configNames[param];
+}
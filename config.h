@@ -0,0 +1,166 @@
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Settings which can be tuned without reflashing.
+ *
+ * The settings are kept in a parameter block in flash, loaded into the
+ * config struct once at startup, and some can be changed over the modem link.
+ * Anything set at initialization, like the baud rates, takes effect at the
+ * next reset.
+ *
+ * The block is written to a different page each time, round robin over
+ * CONFIG_PAGES pages, so no one page wears out. Each copy has a sequence
+ * number and a CRC, and the newest good copy is the one loaded. If there
+ * isn't one, the defaults are used.
+ *
+ * On the kayak the pages are at the end of the second flash bank, on the
+ * host they're in a file.
+ *
+ * X(name, field, default, minimum, maximum, link)
+ * link is 1 if the base can change the parameter over the modem link.
+ * Only parameters read as the kayak runs, which can't cut it off from the
+ * base, are. The rest are only read at boot, or set up the link itself,
+ * and are changed with configtool.
+ * Parameters are only ever added to the end, and CONFIG_VERSION bumped,
+ * so a block saved by older firmware loads with defaults for the rest.
+ */
+#define CONFIGPARAMS(X) \
+	X(DEBUGBAUD, debugbaud, 115200, 1200, 921600, 0) \
+	X(GPSBAUD, gpsbaud, 38400, 1200, 115200, 0) \
+	X(MODEMBAUD, modembaud, 115200, 1200, 921600, 0) \
+	X(MOTORBAUD, motorbaud, 9600, 1200, 115200, 0) \
+	/* How long to look for the modem and motor controller, in ms */ \
+	X(MODEMTIMEOUT, modemtimeout, 1000, 1000, 60000, 0) \
+	X(MOTORTIMEOUT, motortimeout, 100, 10, 10000, 0) \
+	/* How often the motor controller and compass are read, in ms */ \
+	X(MOTORPOLL, motorpoll, 1000, 100, 60000, 0) \
+	X(COMPASSPOLL, compasspoll, 100, 20, 10000, 0) \
+	X(ESTIMATORPERIOD, estimatorperiod, 50, 10, 1000, 0) \
+	X(CONTROLPERIOD, controlperiod, 50, 10, 1000, 0) \
+	/* Bytes per second of telemetry the modem link can take */ \
+	X(TELEMETRYBUDGET, telemetrybudget, 1000, 10, 100000, 0) \
+	/* GetTickCount ticks per 10 ms */ \
+	X(TICKSPERTENMS, tickspertenms, 16, 1, 1000, 0) \
+	/* How often the GPS sends a burst of sentences, in ms */ \
+	X(GPSPERIOD, gpsperiod, 1000, 500, 10000, 1) \
+	/* How long the link can be silent before the modem is reset, in ms */ \
+	X(MODEMDROP, modemdrop, 5000, 500, 60000, 0) \
+	/* How long without a command before the motors are ramped down, \
+	 * how long the ramp takes, and how long the loop can hang before \
+	 * the processor is reset, in ms. The watchdog has to outlast the \
+	 * 1 s waits for the modem while setting up \
+	 */ \
+	X(FAILSAFETIMEOUT, failsafetimeout, 1000, 100, 10000, 0) \
+	X(FAILSAFERAMP, failsaferamp, 1000, 0, 10000, 0) \
+	X(WATCHDOG, watchdog, 2000, 1500, 15000, 0) \
+	/* Pin the modem's carrier detect is wired to, 0 if it isn't */ \
+	X(MODEMDCD, modemdcd, 0, 0, 53, 0) \
+	/* Which kayak this is, and the reply slots shared with the others, \
+	 * see frame.h. One slot for a kayak on its own \
+	 */ \
+	X(NODEID, nodeid, 1, 1, 254, 0) \
+	X(SLOTS, slots, 1, 1, 254, 0) \
+	X(SLOTLENGTH, slotlength, 50, 1, 10000, 0) \
+	/* Shaping of the motor powers, see shape.h. How often the motors \
+	 * are stepped in ms, the deadband and the cubic share of the curve \
+	 * in permille, how long the power takes to go from 0 to full and \
+	 * from full to 0 in ms, and whether the kayak mixes the powers into \
+	 * left and right thrust, 1, or the motor controller does, 0 \
+	 */ \
+	X(MOTORPERIOD, motorperiod, 20, 5, 1000, 1) \
+	X(STICKDEADBAND, stickdeadband, 30, 0, 500, 1) \
+	X(EXPO, expo, 300, 0, 1000, 1) \
+	X(MOTORRISE, motorrise, 1000, 0, 10000, 1) \
+	X(MOTORFALL, motorfall, 500, 0, 10000, 1) \
+	X(MOTORMIX, motormix, 0, 0, 1, 1) \
+	/* How long a frame from the base can stall part way before the \
+	 * rest of it is given up on, in ms \
+	 */ \
+	X(FRAMEGAP, framegap, 200, 10, 5000, 0)
+
+#define CONFIG_VERSION 7
+
+#define CONFIGFIELD(name, field, def, min, max, link) uint32_t field;
+struct config {
+	CONFIGPARAMS(CONFIGFIELD)
+};
+#undef CONFIGFIELD
+
+#define CONFIGID(name, field, def, min, max, link) CONFIG_##name,
+enum configparam {
+	CONFIGPARAMS(CONFIGID)
+	CONFIG_NPARAMS
+};
+#undef CONFIGID
+
+/* The settings in use */
+extern struct config config;
+
+/* Storage for the parameter block, in pages of CONFIG_PAGESIZE bytes */
+#define CONFIG_PAGESIZE 256
+#define CONFIG_PAGES 16
+
+/* Sets every parameter to its default
+ * Preconditions: None
+ * Postconditions: A valid configuration
+ */
+void configDefaults(struct config *cfg);
+
+/* Loads the newest good copy of the parameter block.
+ * Returns false, with cfg set to the defaults, if there isn't one.
+ * Preconditions: None
+ * Postconditions: A valid configuration
+ */
+bool configLoad(struct config *cfg);
+
+/* Writes the parameter block to the next page.
+ * Returns false if the write failed, the last copy is still good then.
+ * Preconditions: A valid configuration
+ */
+bool configSave(const struct config *cfg);
+
+/* Changes one parameter.
+ * Returns false if the parameter doesn't exist or the value is out of
+ * its range, in which case nothing is changed.
+ */
+bool configSet(struct config *cfg, unsigned param, uint32_t value);
+uint32_t configGet(const struct config *cfg, unsigned param);
+
+/* Whether the base can change a parameter over the modem link */
+bool configLinkSettable(unsigned param);
+
+/* Applies a request from the base, which is a list of
+ * parameter byte, varint value
+ * pairs, then saves the block if anything changed. Parameters the base
+ * can't change are skipped.
+ * Returns the number of parameters changed.
+ */
+unsigned configRequest(struct config *cfg, const uint8_t *buf, size_t len);
+
+/* Writes a request setting a parameter, for the base. Returns the number
+ * of bytes written, 0 if they don't fit.
+ */
+size_t configPutRequest(uint8_t *buf, size_t size, unsigned param,
+			uint32_t value);
+
+const char *configName(unsigned param);
+
+/* Provided by the storage, the flash on the kayak or a file on the host.
+ * Pages are numbered from 0 to CONFIG_PAGES - 1.
+ */
+bool configStoreRead(unsigned page, void *buf);
+bool configStoreWrite(unsigned page, const void *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,48 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* The host keeps the pages in this file, which is created erased */
+const char *configFile = "kayak.cfg";
+
+static FILE *configOpen(void)
+{
+	FILE *file = fopen(configFile, "r+b");
+	if(file)
+		return file;
+	file = fopen(configFile, "w+b");
+	if(!file)
+		return NULL;
+	uint8_t erased[CONFIG_PAGESIZE];
+	unsigned i;
+	memset(erased, 0xFF, sizeof(erased));
+	for(i = 0; i < CONFIG_PAGES; i++)
+		fwrite(erased, sizeof(erased), 1, file);
+	return file;
+}
+
+bool configStoreRead(unsigned page, void *buf)
+{
+	if(page >= CONFIG_PAGES)
+		return false;
+	FILE *file = configOpen();
+	if(!file)
+		return false;
+	bool good = fseek(file, page * CONFIG_PAGESIZE, SEEK_SET) == 0 &&
+		fread(buf, CONFIG_PAGESIZE, 1, file) == 1;
+	fclose(file);
+	return good;
+}
+
+bool configStoreWrite(unsigned page, const void *buf)
+{
+	if(page >= CONFIG_PAGES)
+		return false;
+	FILE *file = configOpen();
+	if(!file)
+		return false;
+	bool good = fseek(file, page * CONFIG_PAGESIZE, SEEK_SET) == 0 &&
+		fwrite(buf, CONFIG_PAGESIZE, 1, file) == 1;
+	return fclose(file) == 0 && good;
+}
@@ -0,0 +1,56 @@
+
+#include "config.h"
+
+#include <Arduino.h>
+
+/* The parameter block lives in the last pages of the second flash bank.
+ * The program runs out of the first bank, so it can keep going while the
+ * second is being written.
+ */
+#define CONFIGFLASHBASE (IFLASH1_ADDR + IFLASH1_SIZE - \
+			 CONFIG_PAGES * IFLASH1_PAGE_SIZE)
+/* Erase page and write page */
+#define EEFCCMD_EWP 0x03
+/* Wait states the flash needs while it's being written at 84 MHz */
+#define FLASHWRITEWAIT 6
+
+#if CONFIG_PAGESIZE != IFLASH1_PAGE_SIZE
+#error "The parameter block pages must be flash pages"
+#endif
+
+bool configStoreRead(unsigned page, void *buf)
+{
+  if(page >= CONFIG_PAGES)
+    return false;
+  memcpy(buf, (const void *)(CONFIGFLASHBASE + page * CONFIG_PAGESIZE),
+	 CONFIG_PAGESIZE);
+  return true;
+}
+
+bool configStoreWrite(unsigned page, const void *buf)
+{
+  if(page >= CONFIG_PAGES)
+    return false;
+  /* The flight recorder may still be programming a page */
+  while(!(EFC1->EEFC_FSR & EEFC_FSR_FRDY));
+  uint32_t address = CONFIGFLASHBASE + page * CONFIG_PAGESIZE;
+  volatile uint32_t *latch = (volatile uint32_t *)address;
+  const uint32_t *words = (const uint32_t *)buf;
+  uint32_t mode = EFC1->EEFC_FMR;
+  EFC1->EEFC_FMR = (mode & ~EEFC_FMR_FWS_Msk) | EEFC_FMR_FWS(FLASHWRITEWAIT);
+  /* Writing to the page's addresses fills the latch buffer, which the
+   * command then erases the page and programs it with
+   */
+  for(unsigned i = 0; i < CONFIG_PAGESIZE / sizeof(uint32_t); i++)
+    latch[i] = words[i];
+  unsigned flashpage = (address - IFLASH1_ADDR) / IFLASH1_PAGE_SIZE;
+  EFC1->EEFC_FCR = EEFC_FCR_FKEY(0x5A) | EEFC_FCR_FARG(flashpage) |
+    EEFC_FCR_FCMD(EEFCCMD_EWP);
+  uint32_t status;
+  while(!((status = EFC1->EEFC_FSR) & EEFC_FSR_FRDY));
+  EFC1->EEFC_FMR = mode;
+  if(status & (EEFC_FSR_FCMDE | EEFC_FSR_FLOCKE))
+    return false;
+  /* Make sure it took */
+  return memcmp((const void *)address, buf, CONFIG_PAGESIZE) == 0;
+}
@@ -0,0 +1,67 @@
+/* Reads and changes a kayak parameter block kept in a file, using the
+ * same code as the kayak does with its flash.
+ *
+ * Usage: configtool [-f file] [name=value ...]
+ * Prints every parameter after making the changes, marking the ones the
+ * base can also change over the modem link. The file defaults to
+ * kayak.cfg, and is created if it doesn't exist.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "config.h"
+
+extern "C" const char *configFile;
+
+int main(int argc, char **argv)
+{
+  int opt;
+  while((opt = getopt(argc, argv, "f:")) != -1) {
+    switch(opt) {
+    case 'f':
+      configFile = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-f file] [name=value ...]\n", argv[0]);
+      return 1;
+    }
+  }
+  if(!configLoad(&config))
+    printf("No parameter block in %s, starting from the defaults\n",
+	   configFile);
+  bool changed = false;
+  for(int i = optind; i < argc; i++) {
+    char *value = strchr(argv[i], '=');
+    if(!value) {
+      fprintf(stderr, "Expected name=value, not %s\n", argv[i]);
+      return 1;
+    }
+    *value++ = 0;
+    unsigned param;
+    for(param = 0; param < CONFIG_NPARAMS; param++) {
+      if(!strcasecmp(argv[i], configName(param)))
+	break;
+    }
+    if(param == CONFIG_NPARAMS) {
+      fprintf(stderr, "No parameter named %s\n", argv[i]);
+      return 1;
+    }
+    if(!configSet(&config, param, strtoul(value, NULL, 0))) {
+      fprintf(stderr, "%s is out of range for %s\n", value, argv[i]);
+      return 1;
+    }
+    changed = true;
+  }
+  if(changed && !configSave(&config)) {
+    fprintf(stderr, "Could not write %s\n", configFile);
+    return 1;
+  }
+  for(unsigned param = 0; param < CONFIG_NPARAMS; param++)
+    printf("%-16s %u%s\n", configName(param), configGet(&config, param),
+	   configLinkSettable(param) ? ", settable over the link" : "");
+  return 0;
+}
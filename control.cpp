@@ -0,0 +1,213 @@
+
+#include "control.h"
+
+#include <math.h>
+#include "scheduler.h"
+#include "logging.h"
+#include "arena.h"
+
+/* Heading hold gains, per degree of error, degree second of accumulated
+ * error, and degree per second of turning
+ */
+#define HEADINGKP 0.02f
+#define HEADINGKI 0.002f
+#define HEADINGKD 0.01f
+/* Limit on how much the integral term alone can rotate the kayak */
+#define INTEGRALLIMIT 0.3f
+/* Rotation commands smaller than this count as the stick being centered */
+#define ROTATEDEADBAND Q15(0.05)
+/* Waypoints closer than this many meters count as reached,
+ * and the power is scaled down within the slowing distance
+ */
+#define ARRIVALRADIUS 3.0f
+#define SLOWINGRADIUS 15.0f
+
+struct control {
+  struct motorctrl *motor;
+  struct compass *compass;
+  struct estimator *est;
+  unsigned period;
+  unsigned lastupdate;
+  enum controlmode mode;
+  /* Setpoints, kept in fixed point so manual control stays out of
+   * soft float
+   */
+  q15 forward, rotate;
+  float heading;
+  float wpx, wpy;
+  /* Scale on the output, from the failsafe */
+  q15 limit;
+  /* Whether the heading setpoint is being held in manual mode */
+  bool holding;
+  /* PID state */
+  float integral;
+  float prevheading;
+  bool hasprev;
+};
+
+void controlUpdate(struct control *ctrl);
+bool controlHeading(struct control *ctrl, float *heading);
+q15 controlPID(struct control *ctrl, float heading, float dt);
+float controlClamp(float value, float limit);
+
+struct control *controlInit(struct motorctrl *motor, struct compass *compass,
+			    struct estimator *est, unsigned periodms)
+{
+  if(!motor || periodms == 0)
+    return NULL;
+  struct control *ctrl = (struct control *)arenaAlloc(sizeof(struct control));
+  if(!ctrl) {
+    LOG(ALLOC_FAILED, LOGALLOC_CONTROL);
+    return NULL;
+  }
+  memset(ctrl, 0, sizeof(*ctrl));
+  ctrl->motor = motor;
+  ctrl->compass = compass;
+  ctrl->est = est;
+  ctrl->period = periodms;
+  ctrl->mode = CONTROL_MANUAL;
+  ctrl->limit = Q15_ONE;
+  ctrl->lastupdate = GetTickCount();
+  registerPeriodic(ctrl->period, (void (*)(void *))controlUpdate, ctrl);
+  return ctrl;
+}
+
+void controlManual(struct control *ctrl, q15 forward, q15 rotate)
+{
+  if(ctrl->mode != CONTROL_MANUAL) {
+    ctrl->mode = CONTROL_MANUAL;
+    ctrl->holding = false;
+  }
+  ctrl->forward = forward;
+  ctrl->rotate = rotate;
+}
+
+void controlSetHeading(struct control *ctrl, float heading, q15 forward)
+{
+  if(ctrl->mode == CONTROL_MANUAL && !ctrl->holding)
+    ctrl->integral = 0;
+  ctrl->mode = CONTROL_HEADING;
+  ctrl->heading = heading;
+  ctrl->forward = forward;
+}
+
+bool controlSetWaypoint(struct control *ctrl, long lat, long lng, q15 forward)
+{
+  if(!ctrl->est ||
+     !estimatorToLocal(ctrl->est, lat, lng, &ctrl->wpx, &ctrl->wpy))
+    return false;
+  if(ctrl->mode == CONTROL_MANUAL && !ctrl->holding)
+    ctrl->integral = 0;
+  ctrl->mode = CONTROL_WAYPOINT;
+  ctrl->forward = forward;
+  return true;
+}
+
+void controlLimit(struct control *ctrl, q15 limit)
+{
+  ctrl->limit = limit;
+}
+
+enum controlmode controlMode(struct control *ctrl)
+{
+  return ctrl->mode;
+}
+
+void controlUpdate(struct control *ctrl)
+{
+  unsigned now = GetTickCount();
+  float dt = (now - ctrl->lastupdate) / 1000.0f;
+  ctrl->lastupdate = now;
+  float heading;
+  bool hasheading = controlHeading(ctrl, &heading);
+  q15 forward = ctrl->forward,
+    rotate = 0;
+  switch(ctrl->mode) {
+  case CONTROL_MANUAL:
+    if(!hasheading || ctrl->rotate > ROTATEDEADBAND ||
+       ctrl->rotate < -ROTATEDEADBAND) {
+      /* The base is steering, so just do what it says */
+      rotate = ctrl->rotate;
+      ctrl->holding = false;
+    }
+    else {
+      if(!ctrl->holding) {
+	/* The stick was just centered, hold the heading from here on */
+	ctrl->holding = true;
+	ctrl->heading = heading;
+	ctrl->integral = 0;
+      }
+      rotate = controlPID(ctrl, heading, dt);
+    }
+    break;
+  case CONTROL_HEADING:
+    if(hasheading)
+      rotate = controlPID(ctrl, heading, dt);
+    break;
+  case CONTROL_WAYPOINT: {
+    struct pose pose = estimatorPose(ctrl->est);
+    float dx = ctrl->wpx - pose.x,
+      dy = ctrl->wpy - pose.y;
+    float distance = sqrtf(dx * dx + dy * dy);
+    if(distance < ARRIVALRADIUS) {
+      /* We're there, so stop and keep pointing the same way */
+      controlSetHeading(ctrl, heading, 0);
+      forward = 0;
+      break;
+    }
+    ctrl->heading = atan2f(dx, dy) * (float)(180.0 / M_PI);
+    if(distance < SLOWINGRADIUS)
+      forward = q15FromFloat(q15ToFloat(forward) * distance / SLOWINGRADIUS);
+    rotate = controlPID(ctrl, heading, dt);
+    break;
+  }
+  }
+  if(!hasheading)
+    ctrl->hasprev = false;
+  if(ctrl->limit != Q15_ONE) {
+    forward = q15Mul(forward, ctrl->limit);
+    rotate = q15Mul(rotate, ctrl->limit);
+  }
+  motorSetSpeed(ctrl->motor, forward, rotate);
+  if(ctrl->est)
+    estimatorCommand(ctrl->est, forward, rotate);
+}
+
+bool controlHeading(struct control *ctrl, float *heading)
+{
+  if(ctrl->est) {
+    struct pose pose = estimatorPose(ctrl->est);
+    *heading = pose.heading;
+    return pose.headingvalid;
+  }
+  if(ctrl->compass) {
+    *heading = compassBearing(ctrl->compass);
+    return !isnan(*heading);
+  }
+  return false;
+}
+
+q15 controlPID(struct control *ctrl, float heading, float dt)
+{
+  float err = headingDiff(heading, ctrl->heading);
+  /* Take the derivative of the measurement rather than the error,
+   * so changing the setpoint doesn't kick the motors
+   */
+  float rate = 0;
+  if(ctrl->hasprev && dt > 0)
+    rate = headingDiff(ctrl->prevheading, heading) / dt;
+  ctrl->prevheading = heading;
+  ctrl->hasprev = true;
+  ctrl->integral = controlClamp(ctrl->integral + HEADINGKI * err * dt,
+				INTEGRALLIMIT);
+  return q15FromFloat(HEADINGKP * err + ctrl->integral - HEADINGKD * rate);
+}
+
+float controlClamp(float value, float limit)
+{
+  if(value > limit)
+    return limit;
+  if(value < -limit)
+    return -limit;
+  return value;
+}
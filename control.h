@@ -0,0 +1,72 @@
+#ifndef _CONTROL_H_
+#define _CONTROL_H_
+
+#include "include.h"
+#include "motor.h"
+#include "compass.h"
+#include "estimator.h"
+
+struct control;
+
+enum controlmode {
+  /* Powers come straight from the base, but the heading is held
+   * whenever the base isn't asking for a rotation
+   */
+  CONTROL_MANUAL,
+  /* Hold a heading chosen by the base */
+  CONTROL_HEADING,
+  /* Steer towards a GPS waypoint, stopping when it's reached */
+  CONTROL_WAYPOINT,
+};
+
+/* Initializes the on-board controller, which drives the motors every
+ * periodms milliseconds from the setpoints it has been given.
+ * The heading comes from the estimator if there is one, otherwise straight
+ * from the compass. It's only steered by while the estimator has measured
+ * it recently. Waypoints need the estimator.
+ * Preconditions: The scheduler is initialized, a valid motor object,
+ *                a positive period
+ * Postconditions: A valid control object in manual mode with no power,
+ *                 or NULL on failure
+ */
+struct control *controlInit(struct motorctrl *motor, struct compass *compass,
+			    struct estimator *est, unsigned periodms);
+
+/* Sets the powers requested by the base, in the range motorSetSpeed takes.
+ * While rotate is close to 0, the heading the kayak had when the rotation
+ * stopped is held.
+ * Preconditions: A valid control object
+ * Postconditions: The controller is in manual mode
+ */
+void controlManual(struct control *, q15 forward, q15 rotate);
+
+/* Holds the heading given, in degrees from north, with the forward
+ * power given.
+ * Preconditions: A valid control object
+ * Postconditions: The controller is in heading mode
+ */
+void controlSetHeading(struct control *, float heading, q15 forward);
+
+/* Steers towards the waypoint at lat and lng, in millionths of a degree,
+ * with at most the forward power given.
+ * Returns false if there is no position estimate to steer with.
+ * Preconditions: A valid control object
+ * Postconditions: The controller is in waypoint mode, or unchanged
+ */
+bool controlSetWaypoint(struct control *, long lat, long lng, q15 forward);
+
+/* Scales everything the controller sends to the motors by limit, from
+ * 0 for no power at all to Q15_ONE for full control, without changing
+ * the setpoints or the mode. Used by the failsafe.
+ * Preconditions: A valid control object, limit is 0 to Q15_ONE
+ * Postconditions: The motors are driven at most limit of the way
+ */
+void controlLimit(struct control *, q15 limit);
+
+/* Returns the mode the controller is in
+ * Preconditions: A valid control object
+ * Postconditions: The control objects state remains the same
+ */
+enum controlmode controlMode(struct control *);
+
+#endif
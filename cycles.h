@@ -0,0 +1,29 @@
+#ifndef _CYCLES_H_
+#define _CYCLES_H_
+
+#include <Arduino.h>
+#include <stdint.h>
+
+/* Counts processor cycles with the Cortex-M3's DWT cycle counter, which
+ * runs at the core clock, 84 MHz, and wraps about every 51 seconds.
+ * Differences of two counts are right across a wrap, as long as less than
+ * that has passed. The counter stops in sleep and wait modes.
+ */
+
+/* Starts the counter
+ * Preconditions: None
+ * Postconditions: cyclesNow counts up from 0
+ */
+static inline void cyclesInit(void)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static inline uint32_t cyclesNow(void)
+{
+  return DWT->CYCCNT;
+}
+
+#endif
@@ -0,0 +1,183 @@
+
+#include "estimator.h"
+
+#include <math.h>
+#include "scheduler.h"
+#include "logging.h"
+#include "arena.h"
+
+/* Meters per millionth of a degree of latitude */
+#define METERSPERMICRODEG 0.1113195f
+/* Speed through the water at full forward power, and turning rate at full
+ * rotational power. Rough figures, only used between corrections.
+ */
+#define FULLSPEED 2.0f
+#define FULLTURNRATE 30.0f
+/* Time constant of the kayaks response to thrust, in seconds */
+#define THRUSTTAU 2.0f
+/* How much of the error is removed by each correction.
+ * The compass is trusted much more than the dead reckoned heading,
+ * and a GPS fix more than the dead reckoned position.
+ */
+#define COMPASSGAIN 0.2f
+#define POSITIONGAIN 0.5f
+#define VELOCITYGAIN 0.3f
+/* The GPS course is only a good measure of the heading when moving,
+ * and even then it includes drift, so only slowly learn the compass bias
+ */
+#define BIASGAIN 0.02f
+#define MINCOURSESPEED 0.5f
+/* How long the heading can go without being measured before it's no
+ * longer valid, in ms. Without a compass it's only measured by the GPS
+ * course, so not while stopped.
+ */
+#define HEADINGSTALE 5000
+
+struct estimator {
+  struct compass *compass;
+  unsigned period;
+  unsigned lastupdate;
+  /* The estimate itself */
+  struct pose pose;
+  /* Offset between the compass and the GPS course, which accounts for
+   * declination and the compass mounting
+   */
+  float compassbias;
+  /* When the heading was last measured, if it has been */
+  unsigned lastheading;
+  bool headingmeasured;
+  /* Last commanded powers */
+  q15 forward, rotate;
+  /* Reference fix the local plane is centered on */
+  long reflat, reflng;
+  float lngscale;
+};
+
+void estimatorUpdate(struct estimator *est);
+float headingWrap(float heading);
+
+struct estimator *estimatorInit(struct compass *compass, unsigned periodms)
+{
+  if(periodms == 0)
+    return NULL;
+  struct estimator *est =
+    (struct estimator *)arenaAlloc(sizeof(struct estimator));
+  if(!est) {
+    LOG(ALLOC_FAILED, LOGALLOC_ESTIMATOR);
+    return NULL;
+  }
+  memset(est, 0, sizeof(*est));
+  est->compass = compass;
+  est->period = periodms;
+  est->lastupdate = GetTickCount();
+  registerPeriodic(est->period, (void (*)(void *))estimatorUpdate, est);
+  return est;
+}
+
+void estimatorUpdate(struct estimator *est)
+{
+  unsigned now = GetTickCount();
+  float dt = (now - est->lastupdate) / 1000.0f;
+  est->lastupdate = now;
+  struct pose *p = &est->pose;
+  /* Predict the heading from the rotation command, then pull it towards
+   * what the compass says. The compass reads NaN until it's been read.
+   */
+  p->heading = headingWrap(p->heading +
+			   q15ToFloat(est->rotate) * FULLTURNRATE * dt);
+  if(est->compass) {
+    float bearing = compassBearing(est->compass);
+    if(!isnan(bearing)) {
+      float measured = headingWrap(bearing + est->compassbias);
+      p->heading = headingWrap(p->heading +
+			       COMPASSGAIN * headingDiff(p->heading, measured));
+      est->lastheading = now;
+      est->headingmeasured = true;
+    }
+  }
+  p->headingvalid = est->headingmeasured &&
+    now - est->lastheading <= HEADINGSTALE;
+  /* The velocity relaxes towards what the thrust would give
+   * along the current heading
+   */
+  float rad = p->heading * (float)(M_PI / 180.0);
+  float speed = q15ToFloat(est->forward) * FULLSPEED;
+  float relax = dt / (THRUSTTAU + dt);
+  p->vx += (speed * sinf(rad) - p->vx) * relax;
+  p->vy += (speed * cosf(rad) - p->vy) * relax;
+  p->x += p->vx * dt;
+  p->y += p->vy * dt;
+}
+
+void estimatorGPSFix(struct estimator *est, long lat, long lng,
+		     float course, float speed)
+{
+  struct pose *p = &est->pose;
+  if(!p->valid) {
+    /* First fix, so center the plane here */
+    est->reflat = lat;
+    est->reflng = lng;
+    est->lngscale = METERSPERMICRODEG *
+      cosf(lat / 1000000.0f * (float)(M_PI / 180.0));
+    p->valid = true;
+  }
+  float x, y;
+  estimatorToLocal(est, lat, lng, &x, &y);
+  p->x += (x - p->x) * POSITIONGAIN;
+  p->y += (y - p->y) * POSITIONGAIN;
+  if(isnan(course))
+    return;
+  float rad = course * (float)(M_PI / 180.0);
+  p->vx += (speed * sinf(rad) - p->vx) * VELOCITYGAIN;
+  p->vy += (speed * cosf(rad) - p->vy) * VELOCITYGAIN;
+  if(speed > MINCOURSESPEED) {
+    /* Moving fast enough for the course to say something about the heading */
+    float err = headingDiff(p->heading, course);
+    if(est->compass)
+      est->compassbias = headingDiff(0, est->compassbias + BIASGAIN * err);
+    else {
+      p->heading = headingWrap(p->heading + COMPASSGAIN * err);
+      est->lastheading = GetTickCount();
+      est->headingmeasured = true;
+      p->headingvalid = true;
+    }
+  }
+}
+
+void estimatorCommand(struct estimator *est, q15 forward, q15 rotate)
+{
+  est->forward = forward;
+  est->rotate = rotate;
+}
+
+struct pose estimatorPose(struct estimator *est)
+{
+  return est->pose;
+}
+
+bool estimatorToLocal(struct estimator *est, long lat, long lng,
+		      float *x, float *y)
+{
+  if(!est->pose.valid)
+    return false;
+  /* Subtract before converting, floats can't hold the full coordinates */
+  *x = (lng - est->reflng) * est->lngscale;
+  *y = (lat - est->reflat) * METERSPERMICRODEG;
+  return true;
+}
+
+float headingWrap(float heading)
+{
+  heading = fmodf(heading, 360.0f);
+  if(heading < 0)
+    heading += 360.0f;
+  return heading;
+}
+
+float headingDiff(float from, float to)
+{
+  float diff = headingWrap(to - from);
+  if(diff >= 180.0f)
+    diff -= 360.0f;
+  return diff;
+}
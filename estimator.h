@@ -0,0 +1,75 @@
+#ifndef _ESTIMATOR_H_
+#define _ESTIMATOR_H_
+
+#include "include.h"
+#include "compass.h"
+#include "fixed.h"
+
+struct estimator;
+
+/* The estimated pose of the kayak.
+ * Positions are in meters on a local flat plane centered on the first GPS
+ * fix, x pointing east and y pointing north. Velocities are in meters per
+ * second along the same axes, and the heading is in degrees clockwise from
+ * north, in the range 0 to 360.
+ */
+struct pose {
+  float x, y;
+  float vx, vy;
+  float heading;
+  /* Whether a GPS fix has been received, and so the position means anything */
+  bool valid;
+  /* Whether the heading has been measured, by the compass or the GPS
+   * course, recently enough to steer by, rather than only dead reckoned
+   */
+  bool headingvalid;
+};
+
+/* Initializes the position estimator and registers it with the scheduler,
+ * so that it runs every periodms milliseconds.
+ * The compass may be NULL, in which case the heading is dead reckoned
+ * from the motor commands and corrected with the GPS course.
+ * Preconditions: The scheduler is initialized, a positive period
+ * Postconditions: A valid estimator object, or NULL if out of memory
+ */
+struct estimator *estimatorInit(struct compass *compass, unsigned periodms);
+
+/* Corrects the estimate with a new GPS fix.
+ * lat and lng are in millionths of a degree, as returned by TinyGPS,
+ * course is in degrees from north and speed is in meters per second.
+ * A NaN course means the GPS gave no course or speed, so only the
+ * position is corrected.
+ * Preconditions: A valid estimator object
+ * Postconditions: The estimate is pulled towards the fix
+ */
+void estimatorGPSFix(struct estimator *, long lat, long lng,
+		     float course, float speed);
+
+/* Records the powers last commanded to the motors, in the same range as
+ * motorSetSpeed takes them. Used to predict the motion between fixes.
+ * Preconditions: A valid estimator object
+ * Postconditions: The commanded thrust is used for the following updates
+ */
+void estimatorCommand(struct estimator *, q15 forward, q15 rotate);
+
+/* Returns the current estimate of the kayaks pose
+ * Preconditions: A valid estimator object
+ * Postconditions: The estimator objects state remains the same
+ */
+struct pose estimatorPose(struct estimator *);
+
+/* Converts a latitude and longitude in millionths of a degree to the
+ * estimators local plane.
+ * Returns false if there is no reference fix yet.
+ * Preconditions: A valid estimator object, valid pointers for x and y
+ * Postconditions: The estimator objects state remains the same
+ */
+bool estimatorToLocal(struct estimator *, long lat, long lng,
+		      float *x, float *y);
+
+/* Returns the signed difference between two headings in degrees,
+ * in the range -180 to 180. Positive when to is clockwise of from.
+ */
+float headingDiff(float from, float to);
+
+#endif
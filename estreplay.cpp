@@ -0,0 +1,327 @@
+/* Runs the position estimator over a flight recorder download, feeding it
+ * the headings, commands and GPS fixes the kayak recorded, at the times
+ * they were recorded, against a virtual clock.
+ *
+ * Usage: estreplay [-v] [-f configfile] [file]
+ * Reads from stdin without a file. Get the download as for recdecode.
+ * The estimator's period is read from configfile, as with configtool.
+ * -v prints the estimate against each fix as it arrives.
+ *
+ * Reports how far the estimate had drifted from each GPS fix when the fix
+ * arrived, which is how well the dead reckoning between fixes did, and
+ * how long each update took, in ns and, on x86, in cycles of the time
+ * stamp counter. The timing includes the scheduler calling the update.
+ *
+ * The recorder only keeps the heading every RECORDERPERIOD, so the
+ * estimator sees the compass change less often than it did on the kayak.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define ESTREPLAY_CYCLES
+#endif
+
+#include "include.h"
+#include "estimator.h"
+#include "scheduler.h"
+#include "config.h"
+#include "recorder.h"
+#include "hostarduino.h"
+
+extern "C" const char *configFile;
+
+/* TinyGPS's values for a course or speed it hasn't parsed */
+#define GPSINVALID 999999999
+/* Meters per second in a hundredth of a knot */
+#define MPSPERCENTIKNOT 0.00514444f
+
+struct page {
+  uint32_t sequence;
+  uint8_t data[RECORDER_PAGESIZE];
+};
+
+struct replaystats {
+  unsigned records, fixes, restarts;
+  /* Drift of the estimate from each fix, in m */
+  unsigned drifts;
+  double drifttotal, driftmax;
+  /* Time taken by each update */
+  unsigned updates;
+  double nstotal, nsmax;
+#ifdef ESTREPLAY_CYCLES
+  uint64_t cyclestotal, cyclesmax;
+#endif
+};
+
+static bool verbose = false;
+static struct scheduler *scheduler;
+static struct estimator *est;
+static struct replaystats stats;
+/* The last heading recorded, which the compass reads */
+static float heading = NAN;
+/* What's added to the recorded ticks to get the virtual clock's */
+static uint32_t offset;
+static bool started = false;
+
+uint32_t get32(const uint8_t *buf);
+size_t getVarint(const uint8_t *buf, size_t len, uint32_t *value);
+int comparePages(const void *lhs, const void *rhs);
+bool replayPage(const struct page *page);
+void replayRecord(uint32_t ticks, unsigned type, const int32_t *values);
+void replayUntil(uint32_t ticks);
+void replayGPS(uint32_t ticks, const int32_t *values);
+void report(void);
+
+int main(int argc, char **argv)
+{
+  int opt;
+  while((opt = getopt(argc, argv, "vf:")) != -1) {
+    switch(opt) {
+    case 'v':
+      verbose = true;
+      break;
+    case 'f':
+      configFile = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-v] [-f configfile] [file]\n", argv[0]);
+      return 1;
+    }
+  }
+  FILE *input = stdin;
+  if(optind < argc) {
+    input = fopen(argv[optind], "rb");
+    if(!input) {
+      perror(argv[optind]);
+      return 1;
+    }
+  }
+  struct page *pages = NULL;
+  size_t npages = 0, capacity = 0;
+  unsigned bad = 0;
+  uint8_t data[RECORDER_PAGESIZE];
+  while(fread(data, 1, sizeof(data), input) == sizeof(data)) {
+    if(get32(data) != RECORDER_MAGIC) {
+      bad++;
+      continue;
+    }
+    if(npages == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      pages = (struct page *)realloc(pages, capacity * sizeof(*pages));
+      if(!pages) {
+	fprintf(stderr, "Out of memory\n");
+	return 1;
+      }
+    }
+    pages[npages].sequence = get32(data + 4);
+    memcpy(pages[npages].data, data, sizeof(data));
+    npages++;
+  }
+  if(input != stdin)
+    fclose(input);
+  if(bad)
+    fprintf(stderr, "Skipped %u pages without a header\n", bad);
+  qsort(pages, npages, sizeof(*pages), comparePages);
+
+  configLoad(&config);
+  hostLoad(NULL, 0, 0);
+  scheduler = schedulerInit();
+  est = estimatorInit((struct compass *)&heading, config.estimatorperiod);
+  if(!scheduler || !est) {
+    fprintf(stderr, "Couldn't start the estimator\n");
+    return 1;
+  }
+  for(size_t i = 0; i < npages; i++) {
+    if(i > 0 && pages[i].sequence == pages[i - 1].sequence)
+      continue;
+    if(!replayPage(&pages[i]))
+      break;
+  }
+  free(pages);
+  report();
+  return 0;
+}
+
+/* Returns false at a record the rest of the download can't be read past */
+bool replayPage(const struct page *page)
+{
+  const uint8_t *data = page->data;
+  uint32_t ticks = get32(data + 8);
+  size_t pos = RECORDER_HEADERSIZE;
+  while(pos < RECORDER_PAGESIZE && data[pos] != RECORDER_END) {
+    unsigned type = data[pos++];
+    uint32_t delta;
+    size_t used = getVarint(data + pos, RECORDER_PAGESIZE - pos, &delta);
+    if(!used)
+      return true;
+    pos += used;
+    ticks += delta;
+    if(type >= RECORD_NTYPES) {
+      fprintf(stderr, "Unknown record %u in page %u, is estreplay out of "
+	      "date?\n", type, page->sequence);
+      return false;
+    }
+    static const unsigned nfields[] = {
+#define RECORDNFIELDS(name, nfields, fields) nfields,
+      RECORDTYPES(RECORDNFIELDS)
+#undef RECORDNFIELDS
+    };
+    int32_t values[RECORDER_MAXFIELDS];
+    for(unsigned n = 0; n < nfields[type]; n++) {
+      uint32_t zigzag;
+      used = getVarint(data + pos, RECORDER_PAGESIZE - pos, &zigzag);
+      if(!used)
+	return true;
+      pos += used;
+      values[n] = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+    }
+    replayRecord(ticks, type, values);
+  }
+  return true;
+}
+
+void replayRecord(uint32_t ticks, unsigned type, const int32_t *values)
+{
+  stats.records++;
+  /* A boot after the first means the kayak restarted, and its clock with
+   * it. Carry on from where the virtual clock is.
+   */
+  if(!started || (type == RECORD_BOOT && ticks + offset < GetTickCount())) {
+    if(started)
+      stats.restarts++;
+    offset = GetTickCount() - ticks;
+    started = true;
+  }
+  replayUntil(ticks + offset);
+  switch(type) {
+  case RECORD_HEADING:
+    heading = values[0] / 10.0f;
+    break;
+  case RECORD_COMMAND:
+    estimatorCommand(est, values[0], values[1]);
+    break;
+  case RECORD_GPS:
+    replayGPS(ticks, values);
+    break;
+  }
+}
+
+/* Runs the estimator's updates up to the virtual time, a ms at a time so
+ * each runs when it's due
+ */
+void replayUntil(uint32_t ticks)
+{
+  while((int32_t)(ticks - GetTickCount()) > 0) {
+    delay(1);
+    for(;;) {
+      struct timespec start, end;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+#ifdef ESTREPLAY_CYCLES
+      uint64_t cycles = __rdtsc();
+#endif
+      if(!schedulerProcessEvents(scheduler))
+	break;
+#ifdef ESTREPLAY_CYCLES
+      cycles = __rdtsc() - cycles;
+#endif
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      double ns = (end.tv_sec - start.tv_sec) * 1e9 +
+	(end.tv_nsec - start.tv_nsec);
+      stats.updates++;
+      stats.nstotal += ns;
+      if(ns > stats.nsmax)
+	stats.nsmax = ns;
+#ifdef ESTREPLAY_CYCLES
+      stats.cyclestotal += cycles;
+      if(cycles > stats.cyclesmax)
+	stats.cyclesmax = cycles;
+#endif
+    }
+  }
+}
+
+/* Measures the drift before the fix corrects it, then passes it on as
+ * gpsFix does on the kayak
+ */
+void replayGPS(uint32_t ticks, const int32_t *values)
+{
+  long lat = values[0], lng = values[1];
+  struct pose pose = estimatorPose(est);
+  float x, y;
+  stats.fixes++;
+  if(pose.valid && estimatorToLocal(est, lat, lng, &x, &y)) {
+    double drift = hypot(x - pose.x, y - pose.y);
+    stats.drifts++;
+    stats.drifttotal += drift;
+    if(drift > stats.driftmax)
+      stats.driftmax = drift;
+    if(verbose)
+      printf("%10u fix %8.1f %8.1f  estimate %8.1f %8.1f  drift %6.1f m  "
+	     "heading %5.1f\n", ticks, x, y, pose.x, pose.y, drift,
+	     pose.heading);
+  }
+  float course = values[2] / 100.0f, speed = values[3] * MPSPERCENTIKNOT;
+  if(values[2] == GPSINVALID || values[3] == GPSINVALID)
+    course = NAN;
+  estimatorGPSFix(est, lat, lng, course, speed);
+}
+
+void report(void)
+{
+  printf("%u records, %u GPS fixes", stats.records, stats.fixes);
+  if(stats.restarts)
+    printf(", the kayak restarted %u times", stats.restarts);
+  printf("\n");
+  if(stats.drifts)
+    printf("Drift at each fix: mean %.2f m, max %.2f m\n",
+	   stats.drifttotal / stats.drifts, stats.driftmax);
+  if(!stats.updates)
+    return;
+  printf("%u updates: mean %.1f ns, max %.1f ns", stats.updates,
+	 stats.nstotal / stats.updates, stats.nsmax);
+#ifdef ESTREPLAY_CYCLES
+  printf("; mean %.1f cycles, max %llu cycles",
+	 (double)stats.cyclestotal / stats.updates,
+	 (unsigned long long)stats.cyclesmax);
+#endif
+  printf("\n");
+}
+
+float compassBearing(struct compass *compass)
+{
+  return *(float *)compass;
+}
+
+void logRecord(unsigned, unsigned, ...)
+{
+}
+
+int comparePages(const void *lhs, const void *rhs)
+{
+  uint32_t a = ((const struct page *)lhs)->sequence,
+    b = ((const struct page *)rhs)->sequence;
+  return a < b ? -1 : a > b;
+}
+
+uint32_t get32(const uint8_t *buf)
+{
+  return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+size_t getVarint(const uint8_t *buf, size_t len, uint32_t *value)
+{
+  *value = 0;
+  for(size_t i = 0; i < len && i < 5; i++) {
+    *value |= (uint32_t)(buf[i] & 0x7F) << (7 * i);
+    if(!(buf[i] & 0x80))
+      return i + 1;
+  }
+  return 0;
+}
@@ -0,0 +1,147 @@
+
+#include "failsafe.h"
+
+#include "scheduler.h"
+#include "logging.h"
+#include "recorder.h"
+#include "arena.h"
+#include "config.h"
+
+/* How often the limit is stepped down while ramping, in ms */
+#define FAILSAFEPERIOD 20
+/* The watchdog counts the slow clock divided by 128 */
+#define WATCHDOGHZ 256
+#define WATCHDOGMAX 0xFFF
+
+struct failsafe {
+  struct control *ctrl;
+  unsigned timeout;
+  unsigned ramp;
+  /* When the last command arrived */
+  unsigned lastcommand;
+  bool tripped;
+  /* The next check, or TIMER_NONE when there's nothing to check until
+   * the next command
+   */
+  timerhandle timer;
+  /* Whether any command has arrived since power on */
+  bool commanded;
+  unsigned trips;
+};
+
+/* Timer, checks how long it's been since the last command */
+void failsafeCheck(struct failsafe *fs);
+
+#ifdef __SAM3X8E__
+/* Arms the watchdog. Its mode can only be written once after a reset,
+ * and init() turns it off, so this has to happen first. Newer cores call
+ * watchdogSetup before init(), older ones like the one this is built
+ * against don't have it, so it also runs with the static constructors,
+ * before main(). Whichever is first sets the mode, the other is ignored.
+ * It keeps counting while the processor sleeps or waits, and the loop
+ * comes round at least every POWER_WAITMAX.
+ */
+__attribute__((constructor)) void watchdogSetup(void)
+{
+  configLoad(&config);
+  unsigned ticks = config.watchdog * WATCHDOGHZ / 1000;
+  if(ticks == 0)
+    ticks = 1;
+  if(ticks > WATCHDOGMAX)
+    ticks = WATCHDOGMAX;
+  WDT_Enable(WDT, WDT_MR_WDRSTEN | WDT_MR_WDDBGHLT | WDT_MR_WDV(ticks) |
+	     WDT_MR_WDD(ticks));
+}
+#endif
+
+struct failsafe *failsafeInit(struct control *ctrl, unsigned timeoutms,
+			      unsigned rampms)
+{
+  if(timeoutms == 0)
+    return NULL;
+  struct failsafe *fs = (struct failsafe *)arenaAlloc(sizeof(struct failsafe));
+  if(!fs) {
+    LOG(ALLOC_FAILED, LOGALLOC_FAILSAFE);
+    return NULL;
+  }
+  memset(fs, 0, sizeof(*fs));
+  fs->ctrl = ctrl;
+  fs->timeout = timeoutms;
+  fs->ramp = rampms;
+  fs->lastcommand = GetTickCount();
+  fs->tripped = true;
+  if(fs->ctrl)
+    controlLimit(fs->ctrl, 0);
+  /* Nothing to check until the first command */
+  fs->timer = TIMER_NONE;
+  return fs;
+}
+
+void failsafeCommand(struct failsafe *fs)
+{
+  unsigned now = GetTickCount();
+  if(fs->tripped) {
+    if(fs->commanded) {
+      LOG(FAILSAFE_CLEARED, now - fs->lastcommand);
+      RECORD(FAILSAFE, 0);
+    }
+    fs->tripped = false;
+    if(fs->ctrl)
+      controlLimit(fs->ctrl, Q15_ONE);
+  }
+  fs->commanded = true;
+  fs->lastcommand = now;
+  if(fs->timer == TIMER_NONE)
+    fs->timer = registerTimer(fs->timeout,
+			      (void (*)(void *))failsafeCheck, fs);
+}
+
+bool failsafeTripped(struct failsafe *fs)
+{
+  return fs->tripped;
+}
+
+unsigned failsafeTrips(struct failsafe *fs)
+{
+  return fs->trips;
+}
+
+void failsafeKick(void)
+{
+#ifdef __SAM3X8E__
+  WDT_Restart(WDT);
+#endif
+}
+
+void failsafeCheck(struct failsafe *fs)
+{
+  /* Only wakes up when the failsafe would trip, or to step the ramp, so
+   * it doesn't keep the processor out of wait mode
+   */
+  fs->timer = TIMER_NONE;
+  unsigned silent = GetTickCount() - fs->lastcommand;
+  if(silent < fs->timeout) {
+    fs->timer = registerTimer(fs->timeout - silent,
+			      (void (*)(void *))failsafeCheck, fs);
+    return;
+  }
+  if(!fs->tripped) {
+    fs->tripped = true;
+    fs->trips++;
+    LOG(FAILSAFE_TRIPPED, silent);
+    RECORD(FAILSAFE, 1);
+  }
+  /* Ramp down from whatever the controller was doing, rather than
+   * stopping dead
+   */
+  unsigned into = silent - fs->timeout;
+  q15 limit = 0;
+  if(into < fs->ramp)
+    limit = Q15_ONE - (q15)((uint32_t)Q15_ONE * into / fs->ramp);
+  if(fs->ctrl)
+    controlLimit(fs->ctrl, limit);
+  /* Once it's all the way down, the next command starts the checks again */
+  if(limit > 0)
+    fs->timer = registerTimer(FAILSAFEPERIOD,
+			      (void (*)(void *))failsafeCheck, fs);
+}
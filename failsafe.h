@@ -0,0 +1,58 @@
+
+#ifndef _FAILSAFE_H_
+#define _FAILSAFE_H_
+
+#include "include.h"
+#include "control.h"
+
+struct failsafe;
+
+/* Stops the kayak when the base stops commanding it, and resets the
+ * processor when the loop stops running.
+ *
+ * Every valid command from the base is timestamped with failsafeCommand.
+ * Once timeoutms pass without one, the failsafe trips, and the
+ * controller's output is ramped down to nothing over rampms, whatever
+ * mode it's in. The next command puts the controller back in charge.
+ * Until the first command arrives the motors are held off.
+ *
+ * The hardware watchdog is armed before the Arduino core starts, with the
+ * WATCHDOG parameter, and restarted by the main loop with failsafeKick,
+ * so if the loop stops running the processor resets. It's armed whether
+ * or not there's a failsafe object.
+ */
+
+/* Initializes the failsafe.
+ * The controller may be NULL, in which case the failsafe only reports.
+ * Preconditions: The scheduler is initialized, a positive timeout
+ * Postconditions: A valid failsafe object, or NULL if out of memory
+ */
+struct failsafe *failsafeInit(struct control *ctrl, unsigned timeoutms,
+			      unsigned rampms);
+
+/* Marks that a valid command has just arrived from the base.
+ * Preconditions: A valid failsafe object
+ * Postconditions: The failsafe isn't tripped
+ */
+void failsafeCommand(struct failsafe *);
+
+/* Whether the motors are being cut off for lack of commands
+ * Preconditions: A valid failsafe object
+ * Postconditions: The failsafe object is in the same state as before
+ */
+bool failsafeTripped(struct failsafe *);
+
+/* How many times the failsafe has tripped since power on, not counting
+ * the wait for the first command
+ * Preconditions: A valid failsafe object
+ * Postconditions: The failsafe object is in the same state as before
+ */
+unsigned failsafeTrips(struct failsafe *);
+
+/* Restarts the watchdog. Called every time around the loop, and between
+ * the steps of anything that blocks for longer, like looking for the
+ * modem and the motor controller while setting up.
+ */
+void failsafeKick(void);
+
+#endif
@@ -0,0 +1,53 @@
+
+#ifndef _FIXED_H_
+#define _FIXED_H_
+
+#include <stdint.h>
+
+/* Q15 fixed point: a value in [-1, 1) stored as value * 2^15 in 16 bits.
+ * -0x8000 is never produced, so that every value can be negated.
+ * The Due has no FPU, so these keep the command path out of soft float.
+ */
+typedef int16_t q15;
+
+#define Q15_ONE 0x7FFF
+
+/* Converts a constant to Q15 at compile time. Only use with constants,
+ * otherwise it pulls in soft float.
+ */
+#define Q15(x) ((q15)((x) * 32768.0 >= Q15_ONE ? Q15_ONE :		\
+		      (x) * 32768.0 <= -Q15_ONE ? -Q15_ONE :		\
+		      (x) * 32768.0 + ((x) < 0 ? -0.5 : 0.5)))
+
+/* Saturates a wider intermediate to the Q15 range */
+static inline q15 q15Clamp(int32_t value)
+{
+  if(value > Q15_ONE)
+    return Q15_ONE;
+  if(value < -Q15_ONE)
+    return -Q15_ONE;
+  return (q15)value;
+}
+
+/* Multiplies two Q15 values, rounding to nearest */
+static inline q15 q15Mul(q15 lhs, q15 rhs)
+{
+  return q15Clamp(((int32_t)lhs * rhs + 0x4000) >> 15);
+}
+
+/* Conversions to and from float, for the code that's in float anyway */
+static inline q15 q15FromFloat(float value)
+{
+  if(!(value > -1.0f))
+    return value != value ? 0 : -Q15_ONE;
+  if(value >= 1.0f)
+    return Q15_ONE;
+  return q15Clamp((int32_t)(value * 32768.0f + (value < 0 ? -0.5f : 0.5f)));
+}
+
+static inline float q15ToFloat(q15 value)
+{
+  return value / 32768.0f;
+}
+
+#endif
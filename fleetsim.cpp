@@ -0,0 +1,247 @@
+/* Simulates several kayaks sharing one radio channel with the base, to
+ * see how many of their replies collide with and without reply slots.
+ * Runs on the host, with the kayak's own framing and slot timing.
+ *
+ * Usage: fleetsim [-n kayaks] [-s slots] [-l slot ms] [-p command ms]
+ *                 [-t telemetry ms] [-r bytes/s] [-d seconds] [-x seed]
+ *
+ * The base sends a command every -p ms, alternately to everyone and to
+ * each kayak in turn, so -p should be a little longer than the slots
+ * take. Every kayak has a telemetry frame of random size due every -t ms,
+ * give or take a tenth, as the kayaks' loops aren't in step. It sends it
+ * as soon as it can: straight away with 1 slot, or in its slot with more,
+ * as sendTelemetry does. The channel carries -r bytes per second, and
+ * anything on it at the same time as anything else is lost. Everything
+ * that isn't is fed through the receivers of everyone but its sender,
+ * the kayaks hearing each other's replies as they would on the radio, so
+ * the addressing and the slot timing are checked too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "frame.h"
+
+#define MAXKAYAKS 32
+/* Most frames on the channel at once that are kept track of */
+#define MAXTX 256
+/* The base's transmissions are from this node */
+#define BASE 0
+
+struct tx {
+  /* In us */
+  uint64_t start, end;
+  /* BASE, or the kayak's node */
+  unsigned from;
+  uint8_t bytes[FRAME_MAXENCODED];
+  size_t len;
+  bool collided;
+};
+
+struct kayak {
+  struct framedecoder frames;
+  /* When the last frame from the base ended, in us */
+  uint64_t anchor;
+  uint64_t nextdue;
+  bool pending;
+  bool sending;
+  unsigned sent, lost, heard;
+};
+
+static struct tx txs[MAXTX];
+static unsigned ntx = 0;
+static struct kayak kayaks[MAXKAYAKS + 1];
+static uint32_t seed = 1;
+/* The base's commands lost to collisions */
+static unsigned commandslost;
+
+uint32_t simRandom(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+/* Puts a frame on the channel, marking it and anything it overlaps as
+ * collided
+ */
+void transmit(uint64_t now, unsigned from, unsigned address,
+	      enum frametype type, size_t payload, unsigned rate);
+
+/* Hands the frames that have finished to their receivers */
+void deliver(uint64_t now, unsigned n, unsigned *baseheard);
+
+/* Feeds a frame through a kayak's receiver, as modemDataByte does */
+void hear(struct kayak *kayak, const struct tx *tx);
+
+int main(int argc, char **argv)
+{
+  unsigned n = 4, nslots = 1, slotlen = 80, period = 400, telemetry = 400,
+    rate = 1000, duration = 600;
+  int opt;
+  while((opt = getopt(argc, argv, "n:s:l:p:t:r:d:x:")) != -1) {
+    switch(opt) {
+    case 'n':
+      n = atoi(optarg);
+      break;
+    case 's':
+      nslots = atoi(optarg);
+      break;
+    case 'l':
+      slotlen = atoi(optarg);
+      break;
+    case 'p':
+      period = atoi(optarg);
+      break;
+    case 't':
+      telemetry = atoi(optarg);
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      break;
+    case 'd':
+      duration = atoi(optarg);
+      break;
+    case 'x':
+      seed = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-n kayaks] [-s slots] [-l slot ms] "
+	      "[-p command ms] [-t telemetry ms] [-r bytes/s] [-d seconds] "
+	      "[-x seed]\n", argv[0]);
+      return 1;
+    }
+  }
+  if(n < 1 || n > MAXKAYAKS || period == 0 || telemetry == 0 || rate == 0) {
+    fprintf(stderr, "Need 1 to %d kayaks, and positive periods and rate\n",
+	    MAXKAYAKS);
+    return 1;
+  }
+  for(unsigned k = 1; k <= n; k++) {
+    frameDecoderInit(&kayaks[k].frames, k);
+    kayaks[k].nextdue = (simRandom() % telemetry) * 1000ull;
+  }
+  unsigned baseheard[MAXKAYAKS + 1] = {0};
+  unsigned commands = 0;
+  commandslost = 0;
+  /* A millisecond at a time, as the kayak's scheduler sees it */
+  for(uint64_t ms = 0; ms < duration * 1000ull; ms++) {
+    uint64_t now = ms * 1000;
+    deliver(now, n, baseheard);
+    if(ms % period == 0) {
+      unsigned address = commands % 2 ? (commands / 2) % n + 1 :
+	FRAME_BROADCAST;
+      transmit(now, BASE, address, FRAME_COMMAND, 4, rate);
+      commands++;
+    }
+    for(unsigned k = 1; k <= n; k++) {
+      struct kayak *kayak = &kayaks[k];
+      if(now >= kayak->nextdue) {
+	kayak->pending = true;
+	kayak->nextdue += telemetry * 900ull + simRandom() % (telemetry * 200);
+      }
+      if(!kayak->pending || kayak->sending ||
+	 frameSlotWait(ms, kayak->anchor / 1000, k - 1, nslots, slotlen))
+	continue;
+      kayak->pending = false;
+      kayak->sending = true;
+      kayak->sent++;
+      transmit(now, k, k, FRAME_TELEMETRY, 8 + simRandom() % 24, rate);
+    }
+  }
+  deliver(UINT64_MAX, n, baseheard);
+  printf("%u kayaks, %u slots of %u ms, %u bytes/s, %u s\n", n, nslots,
+	 slotlen, rate, duration);
+  printf("%4s %8s %8s %8s %8s %8s\n", "node", "sent", "lost", "received",
+	 "commands", "ignored");
+  unsigned sent = 0, lost = 0;
+  for(unsigned k = 1; k <= n; k++) {
+    struct kayak *kayak = &kayaks[k];
+    printf("%4u %8u %8u %8u %8u %8u\n", k, kayak->sent, kayak->lost,
+	   baseheard[k], kayak->heard, kayak->frames.ignored);
+    sent += kayak->sent;
+    lost += kayak->lost;
+    if(baseheard[k] + kayak->lost != kayak->sent)
+      printf("  the base heard %u from node %u that weren't lost\n",
+	     baseheard[k], k);
+  }
+  printf("%u of %u replies lost, %.1f%%\n", lost, sent,
+	 sent ? 100.0 * lost / sent : 0.0);
+  printf("%u of %u commands lost, %.1f%%\n", commandslost, commands,
+	 commands ? 100.0 * commandslost / commands : 0.0);
+  return 0;
+}
+
+void transmit(uint64_t now, unsigned from, unsigned address,
+	      enum frametype type, size_t payload, unsigned rate)
+{
+  if(ntx == MAXTX) {
+    fprintf(stderr, "Too many frames on the channel\n");
+    exit(1);
+  }
+  struct tx *tx = &txs[ntx++];
+  uint8_t data[FRAME_MAXPAYLOAD];
+  for(size_t i = 0; i < payload; i++)
+    data[i] = simRandom();
+  tx->len = frameEncode(tx->bytes, sizeof(tx->bytes), address, type, data,
+			payload);
+  tx->start = now;
+  tx->end = now + tx->len * 1000000ull / rate;
+  tx->from = from;
+  tx->collided = false;
+  for(unsigned i = 0; i < ntx - 1; i++)
+    if(txs[i].end > tx->start) {
+      txs[i].collided = true;
+      tx->collided = true;
+    }
+}
+
+void deliver(uint64_t now, unsigned n, unsigned *baseheard)
+{
+  static struct framedecoder base;
+  static bool started = false;
+  if(!started) {
+    frameDecoderInit(&base, FRAME_ANYADDRESS);
+    started = true;
+  }
+  unsigned kept = 0;
+  for(unsigned i = 0; i < ntx; i++) {
+    struct tx *tx = &txs[i];
+    if(tx->end > now) {
+      txs[kept++] = *tx;
+      continue;
+    }
+    if(tx->from != BASE) {
+      struct kayak *kayak = &kayaks[tx->from];
+      kayak->sending = false;
+      if(tx->collided) {
+	kayak->lost++;
+	continue;
+      }
+      for(size_t j = 0; j < tx->len; j++)
+	if(frameDecode(&base, tx->bytes[j]) && frameAddress(&base) <= n)
+	  baseheard[frameAddress(&base)]++;
+    }
+    else if(tx->collided) {
+      commandslost++;
+      continue;
+    }
+    for(unsigned k = 1; k <= n; k++)
+      if(k != tx->from)
+	hear(&kayaks[k], tx);
+  }
+  ntx = kept;
+}
+
+void hear(struct kayak *kayak, const struct tx *tx)
+{
+  for(size_t j = 0; j < tx->len; j++) {
+    if(frameDecode(&kayak->frames, tx->bytes[j]))
+      kayak->heard++;
+    if(tx->bytes[j] == FRAME_FLAG && frameIdle(&kayak->frames) &&
+       frameFromBase(&kayak->frames))
+      kayak->anchor = tx->end;
+  }
+}
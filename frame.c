@@ -0,0 +1,180 @@
+
+#include "frame.h"
+
+#include <string.h>
+
+static uint16_t frameCRC(uint16_t crc, const uint8_t *bytes, size_t len)
+{
+	/* CRC-16/CCITT, a nibble at a time, so the table is small */
+	static const uint16_t table[16] = {
+		0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+		0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+	};
+	size_t i;
+	for(i = 0; i < len; i++) {
+		crc = (crc << 4) ^ table[(crc >> 12) ^ (bytes[i] >> 4)];
+		crc = (crc << 4) ^ table[(crc >> 12) ^ (bytes[i] & 0x0F)];
+	}
+	return crc;
+}
+
+void frameDecoderInit(struct framedecoder *dec, unsigned address)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->address = address;
+}
+
+bool frameDecode(struct framedecoder *dec, uint8_t byte)
+{
+	uint16_t crc;
+	if(byte == FRAME_FLAG) {
+		if(!dec->inframe || dec->len == 0) {
+			/* An opening flag, or two in a row. Either way a frame starts here */
+			dec->inframe = true;
+			dec->len = 0;
+			dec->escaped = false;
+			dec->overflow = false;
+			dec->skipping = false;
+			return false;
+		}
+		dec->inframe = false;
+		if(dec->skipping)
+			return false;
+		/* The address, type and CRC at least */
+		if(dec->overflow || dec->escaped || dec->len < 4) {
+			dec->errors++;
+			return false;
+		}
+		crc = frameCRC(0xFFFF, dec->buf, dec->len - 2);
+		if((crc & 0xFF) != dec->buf[dec->len - 2] ||
+			 (crc >> 8) != dec->buf[dec->len - 1]) {
+			dec->errors++;
+			return false;
+		}
+		return true;
+	}
+	/* Frames for someone else are only read as far as their type */
+	if(!dec->inframe || (dec->skipping && dec->len >= 2))
+		return false;
+	if(byte == FRAME_ESCAPE) {
+		dec->escaped = true;
+		return false;
+	}
+	if(dec->escaped) {
+		byte ^= FRAME_XOR;
+		dec->escaped = false;
+	}
+	if(dec->len == 0 && dec->address != FRAME_ANYADDRESS &&
+		 byte != dec->address && byte != FRAME_BROADCAST) {
+		/* Not for us, don't bother with the rest */
+		dec->skipping = true;
+		dec->ignored++;
+	}
+	if(dec->len < sizeof(dec->buf))
+		dec->buf[dec->len++] = byte;
+	else
+		dec->overflow = true;
+	return false;
+}
+
+bool frameGap(struct framedecoder *dec, uint32_t now, uint32_t guard)
+{
+	bool cut = dec->inframe && now - dec->lastbyte > guard;
+	dec->lastbyte = now;
+	if(!cut)
+		return false;
+	dec->inframe = false;
+	if(!dec->skipping)
+		dec->errors++;
+	return true;
+}
+
+bool frameIdle(const struct framedecoder *dec)
+{
+	return !dec->inframe;
+}
+
+bool frameFromBase(const struct framedecoder *dec)
+{
+	return dec->len >= 2 && !(dec->buf[1] & FRAME_UPLINK);
+}
+
+unsigned frameAddress(const struct framedecoder *dec)
+{
+	return dec->buf[0];
+}
+
+enum frametype frameType(const struct framedecoder *dec)
+{
+	return (enum frametype)dec->buf[1];
+}
+
+const uint8_t *framePayload(const struct framedecoder *dec, size_t *len)
+{
+	*len = dec->len - 4;
+	return dec->buf + 2;
+}
+
+/* Appends a byte to a frame, escaping it if it needs it */
+static size_t framePut(uint8_t *buf, size_t size, size_t pos, uint8_t byte)
+{
+	if(byte == FRAME_FLAG || byte == FRAME_ESCAPE) {
+		if(pos + 2 > size)
+			return 0;
+		buf[pos++] = FRAME_ESCAPE;
+		byte ^= FRAME_XOR;
+	}
+	if(pos + 1 > size)
+		return 0;
+	buf[pos++] = byte;
+	return pos;
+}
+
+size_t frameEncode(uint8_t *buf, size_t size, unsigned address,
+									 enum frametype type, const void *payload, size_t len)
+{
+	const uint8_t *bytes = payload;
+	uint8_t head[2];
+	uint16_t crc;
+	size_t pos = 0, i;
+	if(len > FRAME_MAXPAYLOAD || size < 1)
+		return 0;
+	head[0] = address;
+	head[1] = type;
+	crc = frameCRC(0xFFFF, head, sizeof(head));
+	crc = frameCRC(crc, bytes, len);
+	buf[pos++] = FRAME_FLAG;
+	pos = framePut(buf, size, pos, head[0]);
+	if(pos)
+		pos = framePut(buf, size, pos, head[1]);
+	for(i = 0; pos && i < len; i++)
+		pos = framePut(buf, size, pos, bytes[i]);
+	if(pos)
+		pos = framePut(buf, size, pos, crc & 0xFF);
+	if(pos)
+		pos = framePut(buf, size, pos, crc >> 8);
+	if(!pos || pos + 1 > size)
+		return 0;
+	buf[pos++] = FRAME_FLAG;
+	return pos;
+}
+
+uint32_t frameSlotWait(uint32_t now, uint32_t anchor, unsigned slot,
+											 unsigned nslots, uint32_t slotlen)
+{
+	uint32_t into, start, cycle;
+	if(nslots <= 1 || slotlen == 0)
+		return 0;
+	into = now - anchor;
+	start = (slot % nslots) * slotlen;
+	cycle = nslots * slotlen;
+	if(into < start)
+		return start - into;
+	/* Only start in the first half, so the reply is over by the end */
+	if(into < start + (slotlen + 1) / 2)
+		return 0;
+	/* Missed it, the base should start the next cycle once this one's over */
+	if(into < cycle)
+		return cycle - into + start;
+	return slotlen;
+}
@@ -0,0 +1,167 @@
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Framing of the data channel between the kayak and the base, shared by
+ * both ends.
+ *
+ * A frame on the wire is:
+ *   FRAME_FLAG
+ *   address   1 byte. From the base, the kayak it's for, or
+ *             FRAME_BROADCAST for all of them. From a kayak, its own
+ *   type      1 byte, a frametype. FRAME_UPLINK is set in the types of
+ *             the frames kayaks send
+ *   payload   0 to FRAME_MAXPAYLOAD bytes
+ *   crc       2 bytes, CRC-16/CCITT over the address, type and payload,
+ *             little endian
+ *   FRAME_FLAG
+ * Between the flags, FRAME_FLAG and FRAME_ESCAPE bytes are sent as
+ * FRAME_ESCAPE followed by the byte xored with FRAME_XOR, so a flag only
+ * ever marks the edge of a frame. An empty frame is just a flag, so a
+ * receiver that gets out of step with the flags falls back in at the next
+ * frame, and anything that arrives between frames, like the modem saying
+ * NO CARRIER, can't be mistaken for data. A frame is sent all at once, so
+ * a receiver that hears nothing for a while in the middle of one gives up
+ * on it, see frameGap, and is between frames again for whatever comes
+ * after a frame that was cut off.
+ *
+ * Kayaks are numbered 1 to 254, by their NODEID parameter. A kayak's
+ * receiver skips over frames for the others without looking at them.
+ *
+ * Several kayaks share the channel by only replying in their own slot.
+ * Slot 0 starts as any frame from the base ends, whoever it's for, so all
+ * the kayaks agree on it, and each slot lasts the slot length. A reply
+ * from a kayak carries the kayak's address, so it's told apart from a
+ * frame the base sent to that kayak by FRAME_UPLINK, and doesn't move
+ * slot 0. A reply is
+ * only started in the first half of a slot, so the slot should be twice
+ * as long as the longest reply takes to send. Once the last slot is over
+ * the channel is the base's again, and nobody replies until it sends
+ * another frame.
+ */
+#define FRAME_FLAG 0x7E
+#define FRAME_ESCAPE 0x7D
+#define FRAME_XOR 0x20
+#define FRAME_MAXPAYLOAD 128
+/* Longest frame on the wire, if every byte is escaped */
+#define FRAME_MAXENCODED (2 + 2 * (2 + FRAME_MAXPAYLOAD + 2))
+#define FRAME_BROADCAST 0xFF
+/* Receives the frames for every address, as the base does */
+#define FRAME_ANYADDRESS 0x100
+/* Set in the type of every frame a kayak sends */
+#define FRAME_UPLINK 0x80
+
+enum frametype {
+	/* Base to kayak, 2 half precision values, forward then rotation power */
+	FRAME_COMMAND = 0,
+	/* Kayak to base, a telemetry frame */
+	FRAME_TELEMETRY = FRAME_UPLINK | 1,
+	/* Base to kayak, a telemetry subscription request */
+	FRAME_SUBSCRIBE = 2,
+	/* Base to kayak, a configuration request */
+	FRAME_CONFIG = 3,
+	/* Base to kayak, a setpoint for the kayak's controller, see setpoint.h */
+	FRAME_SETPOINT = 4,
+};
+
+/* Receiver state. The frame being received is kept here */
+struct framedecoder {
+	uint8_t buf[2 + FRAME_MAXPAYLOAD + 2];
+	size_t len;
+	/* Frames for other addresses are skipped, after their type */
+	unsigned address;
+	bool skipping;
+	/* Between flags */
+	bool inframe;
+	/* The last byte was FRAME_ESCAPE */
+	bool escaped;
+	/* The frame is too long, and will be dropped */
+	bool overflow;
+	/* When the last byte arrived, for frameGap */
+	uint32_t lastbyte;
+	/* Frames dropped for a bad CRC or length, or cut off */
+	unsigned errors;
+	/* Frames skipped for being for someone else */
+	unsigned ignored;
+};
+
+/* Initializes a receiver, between frames, for frames to address and
+ * broadcasts, or every frame with FRAME_ANYADDRESS
+ * Preconditions: A valid decoder object
+ * Postconditions: The decoder is waiting for a flag
+ */
+void frameDecoderInit(struct framedecoder *dec, unsigned address);
+
+/* Feeds the receiver a byte. Returns true once a whole frame with a good
+ * CRC has arrived, after which frameType and framePayload give its
+ * contents, until the next byte is fed in.
+ * Preconditions: A valid decoder object
+ * Postconditions: The byte is part of the frame, or between frames
+ */
+bool frameDecode(struct framedecoder *dec, uint8_t byte);
+
+/* Gives up on the frame being received if the last byte arrived more
+ * than guard before now, so the byte about to be fed in is taken to be
+ * between frames. Call with the time each byte arrives, in any unit, as
+ * long as it's the same every time. Returns true if a frame was given up
+ * on.
+ * Preconditions: A valid decoder object
+ * Postconditions: The decoder is between frames if the line was quiet
+ *                 for longer than guard
+ */
+bool frameGap(struct framedecoder *dec, uint32_t now, uint32_t guard);
+
+/* Whether the receiver is between frames, so the byte just fed in wasn't
+ * part of one. If that byte was FRAME_FLAG, a frame has just ended, good,
+ * bad, or for someone else
+ * Preconditions: A valid decoder object
+ * Postconditions: The decoders state remains the same
+ */
+bool frameIdle(const struct framedecoder *dec);
+
+/* Whether the frame that has just ended was sent by the base, by its
+ * type, whoever it was for and whether or not it was good
+ * Preconditions: A valid decoder object, frameIdle is true after a
+ *                FRAME_FLAG
+ * Postconditions: The decoders state remains the same
+ */
+bool frameFromBase(const struct framedecoder *dec);
+
+/* The frame frameDecode has just returned true for
+ * Preconditions: frameDecode has just returned true
+ */
+unsigned frameAddress(const struct framedecoder *dec);
+enum frametype frameType(const struct framedecoder *dec);
+const uint8_t *framePayload(const struct framedecoder *dec, size_t *len);
+
+/* Writes a frame with the address, type and payload given to buf.
+ * Returns the number of bytes written, or 0 if they don't fit or the
+ * payload is longer than FRAME_MAXPAYLOAD.
+ * Preconditions: buf has room for size bytes
+ * Postconditions: The frame is written to buf
+ */
+size_t frameEncode(uint8_t *buf, size_t size, unsigned address,
+									 enum frametype type, const void *payload, size_t len);
+
+/* How long until slot of nslots, each slotlen long, opens, given that the
+ * last frame from the base ended at anchor. 0 if it's open now. If the
+ * slot has been missed, the time it would open if the base started the
+ * next cycle straight away. Times are in any unit, as long as they're all
+ * the same. With 1 slot or fewer, the channel is always open.
+ */
+uint32_t frameSlotWait(uint32_t now, uint32_t anchor, unsigned slot,
+											 unsigned nslots, uint32_t slotlen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,670 @@
+/* The base station. Sends the kayaks their commands over the modem link,
+ * along with telemetry subscriptions and parameter changes, and decodes
+ * the telemetry they send back, with the same framing and telemetry code
+ * the kayak uses.
+ *
+ * Usage: groundstation [-b baud] [-r commands/s] [-a node] [-s slots]
+ *                      [-l slot ms] [-S field=ms] [-c name=value]
+ *                      [-H heading[,power] | -W lat,lng[,power] | -M]
+ *                      [-o log] [-d seconds] [-q] port
+ *        groundstation -D log
+ *
+ * Commands come from stdin, a line of forward then rotation power, each
+ * -1 to 1, at a time. The latest is sent -r times a second, 20 by
+ * default, to node -a, or to every kayak without it. With -s slots of
+ * -l ms, a command also waits for the kayaks to have had their slots to
+ * reply to the last one, see frame.h.
+ *
+ * -S subscribes to a telemetry field, by the name it's printed with, and
+ * -c changes a kayak parameter, one config.h marks as settable over the
+ * link. Both can be given more than once, and are sent once a second
+ * until the kayak replies.
+ *
+ * -H has the kayak hold a heading in degrees, and -W go to a position in
+ * degrees and stop there, at the forward power given, 0.5 by default.
+ * -M hands the steering back to the commands. The setpoint is sent along
+ * with the requests. While the kayak steers itself, the commands only
+ * keep its failsafe from tripping, unless the stick is pushed well off
+ * center, which takes back manual control.
+ *
+ * Every telemetry frame is printed, unless -q, and written to the -o log,
+ * which -D prints back. It runs until stdin closes, or for -d seconds,
+ * then prints how the link did. For a kayak without the hardware, point
+ * it at the port kayaksim prints.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "telemetry.h"
+#include "half.h"
+#include "config.h"
+#include "setpoint.h"
+
+/* The log is a header of LOGMAGIC then TELEMETRY_VERSION, followed by a
+ * record for every telemetry frame of
+ *   time      4 bytes, ms since the ground station started
+ *   node      1 byte
+ *   sequence  1 byte, the frame's
+ *   mask      4 bytes, bit n set if field n is present
+ *   values    4 bytes each, the fields in the mask, in order
+ * all little endian. Field numbers change between telemetry versions, so
+ * a log is only read back with the version it was written with.
+ */
+#define LOGMAGIC "KGSL"
+/* How often the requests are sent until the kayak replies, in ms */
+#define REQUESTPERIOD 1000
+#define MAXRATE 100
+#define NNODES 256
+
+struct fieldformat {
+  const char *name;
+  /* The field is in units of 1 / divisor. 0 for a pair of motor
+   * controller channels
+   */
+  int divisor;
+};
+
+/* Indexed by telemetryfield */
+static const struct fieldformat fields[TELEMETRY_NFIELDS] = {
+  {"time", 1},
+  {"lat", 1000000},
+  {"lng", 1000000},
+  {"sats", 1},
+  {"hdop", 100},
+  {"course", 100},
+  {"heading", 10},
+  {"speed", 100},
+  {"amps", 0},
+  {"volts", 0},
+  {"linkloss", 1},
+  {"linkms", 1},
+  {"rssi", 1},
+  {"failsafe", 1},
+  {"peakamps", 0},
+  {"energy", 1},
+};
+
+struct nodestats {
+  struct telemetrycodec codec;
+  unsigned frames;
+  /* Frames the sequence numbers say went missing */
+  unsigned missed;
+  unsigned malformed;
+  bool heard;
+  /* The latest value of each field */
+  struct telemetrysample latest;
+};
+
+static struct nodestats nodes[NNODES];
+static volatile sig_atomic_t running = 1;
+
+uint64_t nowUs(void);
+void stop(int);
+int openPort(const char *path, unsigned baud);
+bool writeAll(int fd, const uint8_t *buf, size_t len);
+bool sendFrame(int fd, unsigned address, enum frametype type,
+	       const uint8_t *payload, size_t len);
+
+/* Reads command lines from stdin, keeping the last good one.
+ * Returns false once stdin is closed
+ */
+bool readCommands(float *forward, float *rotate);
+
+/* Decodes a telemetry frame, prints it and logs it */
+void telemetryFrame(unsigned node, const uint8_t *payload, size_t len,
+		    uint32_t ms, FILE *log, bool quiet);
+
+void printSample(FILE *out, uint32_t ms, unsigned node, unsigned sequence,
+		 const struct telemetrysample *sample);
+void logSample(FILE *log, uint32_t ms, unsigned node, unsigned sequence,
+	       const struct telemetrysample *sample);
+int dumpLog(const char *path);
+int fieldByName(const char *name);
+
+/* Parses the argument of -H, -W or -M into a setpoint.
+ * Returns false if it's malformed
+ */
+bool parseSetpoint(int opt, const char *arg, struct setpoint *sp);
+
+int main(int argc, char **argv)
+{
+  unsigned baud = 115200, rate = 20, address = FRAME_BROADCAST, nslots = 1,
+    slotlen = 50, duration = 0;
+  const char *logpath = NULL;
+  bool quiet = false;
+  uint8_t subscribe[FRAME_MAXPAYLOAD], configure[FRAME_MAXPAYLOAD],
+    setpoint[SETPOINT_MAXSIZE];
+  size_t nsubscribe = 0, nconfigure = 0, nsetpoint = 0, n;
+  struct setpoint sp;
+  int opt, field;
+  char *value;
+  unsigned param;
+  while((opt = getopt(argc, argv, "b:r:a:s:l:S:c:H:W:Mo:d:qD:")) != -1) {
+    switch(opt) {
+    case 'b':
+      baud = atoi(optarg);
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      break;
+    case 'a':
+      address = atoi(optarg);
+      break;
+    case 's':
+      nslots = atoi(optarg);
+      break;
+    case 'l':
+      slotlen = atoi(optarg);
+      break;
+    case 'S':
+      value = strchr(optarg, '=');
+      if(value)
+	*value++ = 0;
+      field = fieldByName(optarg);
+      if(!value || field < 0) {
+	fprintf(stderr, "Expected field=ms, not %s\n", optarg);
+	return 1;
+      }
+      n = telemetryPutRequest(subscribe + nsubscribe,
+			      sizeof(subscribe) - nsubscribe,
+			      (enum telemetryfield)field, atoi(value));
+      if(!n) {
+	fprintf(stderr, "Too many subscriptions\n");
+	return 1;
+      }
+      nsubscribe += n;
+      break;
+    case 'c':
+      value = strchr(optarg, '=');
+      if(value)
+	*value++ = 0;
+      for(param = 0; param < CONFIG_NPARAMS; param++) {
+	if(!strcasecmp(optarg, configName(param)))
+	  break;
+      }
+      if(!value || param == CONFIG_NPARAMS) {
+	fprintf(stderr, "Expected name=value, not %s\n", optarg);
+	return 1;
+      }
+      if(!configLinkSettable(param)) {
+	fprintf(stderr, "%s can only be changed with configtool\n", optarg);
+	return 1;
+      }
+      n = configPutRequest(configure + nconfigure,
+			   sizeof(configure) - nconfigure, param,
+			   strtoul(value, NULL, 0));
+      if(!n) {
+	fprintf(stderr, "Too many parameters\n");
+	return 1;
+      }
+      nconfigure += n;
+      break;
+    case 'H':
+    case 'W':
+    case 'M':
+      if(!parseSetpoint(opt, optarg, &sp)) {
+	fprintf(stderr, "Expected heading[,power] or lat,lng[,power], not "
+		"%s\n", optarg);
+	return 1;
+      }
+      nsetpoint = setpointEncode(setpoint, sizeof(setpoint), &sp);
+      break;
+    case 'o':
+      logpath = optarg;
+      break;
+    case 'd':
+      duration = atoi(optarg);
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    case 'D':
+      return dumpLog(optarg);
+    default:
+      optind = argc + 1;
+      break;
+    }
+  }
+  if(optind != argc - 1) {
+    fprintf(stderr, "Usage: %s [-b baud] [-r commands/s] [-a node] "
+	    "[-s slots] [-l slot ms] [-S field=ms] [-c name=value] "
+	    "[-H heading[,power] | -W lat,lng[,power] | -M] "
+	    "[-o log] [-d seconds] [-q] port\n"
+	    "       %s -D log\n", argv[0], argv[0]);
+    return 1;
+  }
+  if(rate < 1 || rate > MAXRATE || address < 1 || address > FRAME_BROADCAST) {
+    fprintf(stderr, "Need 1 to %d commands/s, and a node from 1 to %d\n",
+	    MAXRATE, FRAME_BROADCAST);
+    return 1;
+  }
+  uint64_t period = 1000000 / rate, cycle = 0;
+  if(nslots > 1) {
+    cycle = nslots * slotlen * 1000ull;
+    if(cycle > period)
+      fprintf(stderr, "%u slots of %u ms only leave room for %.1f "
+	      "commands/s\n", nslots, slotlen, 1000000.0 / cycle);
+  }
+  int port = openPort(argv[optind], baud);
+  if(port < 0)
+    return 1;
+  FILE *log = NULL;
+  if(logpath) {
+    log = fopen(logpath, "wb");
+    if(!log) {
+      perror(logpath);
+      return 1;
+    }
+    fwrite(LOGMAGIC, 4, 1, log);
+    fputc(TELEMETRY_VERSION, log);
+  }
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+  for(unsigned i = 0; i < NNODES; i++)
+    telemetryInit(&nodes[i].codec);
+  struct framedecoder frames;
+  frameDecoderInit(&frames, FRAME_ANYADDRESS);
+  float forward = 0, rotate = 0;
+  bool input = true, answered = false;
+  unsigned commands = 0, blocked = 0;
+  uint64_t start = nowUs(), nextcommand = start, lastcommand = 0,
+    nextrequest = start;
+  while(running) {
+    uint64_t now = nowUs();
+    if(duration && now - start >= duration * 1000000ull)
+      break;
+    if(!answered && (nsubscribe || nconfigure || nsetpoint) &&
+       now >= nextrequest) {
+      if(nsubscribe)
+	sendFrame(port, address, FRAME_SUBSCRIBE, subscribe, nsubscribe);
+      if(nconfigure)
+	sendFrame(port, address, FRAME_CONFIG, configure, nconfigure);
+      if(nsetpoint)
+	sendFrame(port, address, FRAME_SETPOINT, setpoint, nsetpoint);
+      nextrequest = now + REQUESTPERIOD * 1000;
+    }
+    if(now >= nextcommand) {
+      if(cycle && now - lastcommand < cycle) {
+	/* Still the kayaks' turn */
+	blocked++;
+      }
+      else {
+	uint8_t command[4];
+	halfStore(command, singleToHalf(forward));
+	halfStore(command + 2, singleToHalf(rotate));
+	if(!sendFrame(port, address, FRAME_COMMAND, command, sizeof(command)))
+	  break;
+	commands++;
+	lastcommand = now;
+      }
+      nextcommand += period;
+      /* Don't try to catch up after a stall, just carry on at the rate */
+      if(nextcommand < now)
+	nextcommand = now + period;
+    }
+    struct pollfd fds[2];
+    fds[0].fd = port;
+    fds[0].events = POLLIN;
+    fds[1].fd = input ? STDIN_FILENO : -1;
+    fds[1].events = POLLIN;
+    uint64_t until = nextcommand;
+    if(cycle && lastcommand + cycle > until)
+      until = lastcommand + cycle;
+    int timeout = until > now ? (until - now + 999) / 1000 : 0;
+    if(poll(fds, 2, timeout) < 0) {
+      if(errno == EINTR)
+	continue;
+      perror("poll");
+      break;
+    }
+    if(fds[1].revents) {
+      input = readCommands(&forward, &rotate);
+      /* Without a duration, closing stdin ends the run */
+      if(!input && !duration)
+	break;
+    }
+    if(!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+      continue;
+    uint8_t buf[256];
+    ssize_t got = read(port, buf, sizeof(buf));
+    if(got < 0 && errno != EAGAIN && errno != EINTR) {
+      perror(argv[optind]);
+      break;
+    }
+    if(got == 0 || (got < 0 && errno == EIO))
+      break;
+    uint32_t ms = (nowUs() - start) / 1000;
+    for(ssize_t i = 0; i < got; i++) {
+      if(!frameDecode(&frames, buf[i]) || frameType(&frames) != FRAME_TELEMETRY)
+	continue;
+      unsigned node = frameAddress(&frames);
+      size_t len;
+      const uint8_t *payload = framePayload(&frames, &len);
+      telemetryFrame(node, payload, len, ms, log, quiet);
+      if(address == FRAME_BROADCAST || node == address)
+	answered = true;
+    }
+  }
+  /* Leave the kayaks stopped */
+  uint8_t command[4];
+  halfStore(command, singleToHalf(0));
+  halfStore(command + 2, singleToHalf(0));
+  sendFrame(port, address, FRAME_COMMAND, command, sizeof(command));
+  close(port);
+  if(log)
+    fclose(log);
+
+  double seconds = (nowUs() - start) / 1000000.0;
+  printf("Sent %u commands in %.1f s, %.1f/s", commands, seconds,
+	 seconds > 0 ? commands / seconds : 0.0);
+  if(blocked)
+    printf(", %u held back for the slots", blocked);
+  printf("\n%u frames with bad CRCs\n", frames.errors);
+  printf("%4s %8s %8s %8s %8s %8s %8s\n", "node", "frames", "missed",
+	 "bad", "linkloss", "linkms", "failsafe");
+  for(unsigned i = 0; i < NNODES; i++) {
+    struct nodestats *stats = &nodes[i];
+    if(!stats->heard)
+      continue;
+    printf("%4u %8u %8u %8u", i, stats->frames, stats->missed,
+	   stats->malformed);
+    static const enum telemetryfield link[] = {
+      TELEMETRY_LINKLOSS, TELEMETRY_LINKINTERVAL, TELEMETRY_FAILSAFE
+    };
+    for(unsigned j = 0; j < sizeof(link) / sizeof(link[0]); j++) {
+      if(stats->latest.mask & (1ul << link[j]))
+	printf(" %8d", stats->latest.values[link[j]]);
+      else
+	printf(" %8s", "-");
+    }
+    printf("\n");
+  }
+  return 0;
+}
+
+uint64_t nowUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+void stop(int)
+{
+  running = 0;
+}
+
+int openPort(const char *path, unsigned baud)
+{
+  static const struct {
+    unsigned baud;
+    speed_t speed;
+  } speeds[] = {
+    {1200, B1200}, {2400, B2400}, {4800, B4800}, {9600, B9600},
+    {19200, B19200}, {38400, B38400}, {57600, B57600}, {115200, B115200},
+    {230400, B230400}, {460800, B460800}, {921600, B921600},
+  };
+  unsigned i;
+  for(i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+    if(speeds[i].baud == baud)
+      break;
+  }
+  if(i == sizeof(speeds) / sizeof(speeds[0])) {
+    fprintf(stderr, "Unsupported baud rate %u\n", baud);
+    return -1;
+  }
+  int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if(fd < 0) {
+    perror(path);
+    return -1;
+  }
+  struct termios tio;
+  if(tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, speeds[i].speed);
+    cfsetospeed(&tio, speeds[i].speed);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+bool writeAll(int fd, const uint8_t *buf, size_t len)
+{
+  while(len > 0) {
+    ssize_t put = write(fd, buf, len);
+    if(put < 0) {
+      if(errno == EINTR)
+	continue;
+      if(errno != EAGAIN) {
+	perror("write");
+	return false;
+      }
+      /* The port is backed up, which is the link's problem, not ours */
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      poll(&pfd, 1, -1);
+      continue;
+    }
+    buf += put;
+    len -= put;
+  }
+  return true;
+}
+
+bool sendFrame(int fd, unsigned address, enum frametype type,
+	       const uint8_t *payload, size_t len)
+{
+  uint8_t frame[FRAME_MAXENCODED];
+  size_t size = frameEncode(frame, sizeof(frame), address, type, payload, len);
+  return size && writeAll(fd, frame, size);
+}
+
+bool readCommands(float *forward, float *rotate)
+{
+  static char line[256];
+  static size_t len = 0;
+  ssize_t got = read(STDIN_FILENO, line + len, sizeof(line) - 1 - len);
+  if(got < 0)
+    return errno == EAGAIN || errno == EINTR;
+  if(got == 0)
+    return false;
+  len += got;
+  line[len] = 0;
+  char *end;
+  while((end = strchr(line, '\n'))) {
+    *end = 0;
+    float f, r;
+    if(sscanf(line, "%f %f", &f, &r) == 2 && f >= -1 && f <= 1 &&
+       r >= -1 && r <= 1) {
+      *forward = f;
+      *rotate = r;
+    }
+    else {
+      fprintf(stderr, "Expected forward and rotation power from -1 to 1, "
+	      "not %s\n", line);
+    }
+    len -= end + 1 - line;
+    memmove(line, end + 1, len + 1);
+  }
+  /* A line too long for the buffer is thrown away */
+  if(len == sizeof(line) - 1)
+    len = 0;
+  return true;
+}
+
+void telemetryFrame(unsigned node, const uint8_t *payload, size_t len,
+		    uint32_t ms, FILE *log, bool quiet)
+{
+  struct nodestats *stats = &nodes[node];
+  struct telemetrysample sample;
+  uint8_t expected = stats->codec.sequence + 1;
+  if(!telemetryDecode(&stats->codec, payload, len, &sample)) {
+    stats->malformed++;
+    return;
+  }
+  if(stats->heard)
+    stats->missed += (uint8_t)(stats->codec.sequence - expected);
+  stats->heard = true;
+  stats->frames++;
+  for(int i = 0; i < TELEMETRY_NFIELDS; i++) {
+    if(sample.mask & (1ul << i))
+      stats->latest.values[i] = sample.values[i];
+  }
+  stats->latest.mask |= sample.mask;
+  if(!quiet)
+    printSample(stdout, ms, node, stats->codec.sequence, &sample);
+  if(log)
+    logSample(log, ms, node, stats->codec.sequence, &sample);
+}
+
+void printSample(FILE *out, uint32_t ms, unsigned node, unsigned sequence,
+		 const struct telemetrysample *sample)
+{
+  fprintf(out, "%9.3f %3u %3u", ms / 1000.0, node, sequence);
+  for(int i = 0; i < TELEMETRY_NFIELDS; i++) {
+    if(!(sample->mask & (1ul << i)))
+      continue;
+    int32_t value = sample->values[i];
+    int divisor = fields[i].divisor, places = 0;
+    if(divisor == 0) {
+      fprintf(out, " %s=%d/%d", fields[i].name, value & 0xFF,
+	      (value >> 8) & 0xFF);
+      continue;
+    }
+    for(int d = divisor; d > 1; d /= 10)
+      places++;
+    fprintf(out, " %s=%.*f", fields[i].name, places, (double)value / divisor);
+  }
+  fprintf(out, "\n");
+}
+
+static void put32(uint8_t *buf, uint32_t value)
+{
+  for(int i = 0; i < 4; i++)
+    buf[i] = value >> (8 * i);
+}
+
+static uint32_t get32(const uint8_t *buf)
+{
+  return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+void logSample(FILE *log, uint32_t ms, unsigned node, unsigned sequence,
+	       const struct telemetrysample *sample)
+{
+  uint8_t record[10 + 4 * TELEMETRY_NFIELDS];
+  size_t len = 10;
+  put32(record, ms);
+  record[4] = node;
+  record[5] = sequence;
+  put32(record + 6, sample->mask);
+  for(int i = 0; i < TELEMETRY_NFIELDS; i++) {
+    if(sample->mask & (1ul << i)) {
+      put32(record + len, sample->values[i]);
+      len += 4;
+    }
+  }
+  fwrite(record, len, 1, log);
+}
+
+int dumpLog(const char *path)
+{
+  FILE *log = fopen(path, "rb");
+  if(!log) {
+    perror(path);
+    return 1;
+  }
+  uint8_t header[5];
+  if(fread(header, sizeof(header), 1, log) != 1 ||
+     memcmp(header, LOGMAGIC, 4)) {
+    fprintf(stderr, "%s isn't a ground station log\n", path);
+    fclose(log);
+    return 1;
+  }
+  if(header[4] != TELEMETRY_VERSION) {
+    fprintf(stderr, "%s has version %u telemetry, this reads version %u\n",
+	    path, header[4], TELEMETRY_VERSION);
+    fclose(log);
+    return 1;
+  }
+  uint8_t record[10];
+  while(fread(record, sizeof(record), 1, log) == 1) {
+    struct telemetrysample sample;
+    uint8_t value[4];
+    sample.mask = get32(record + 6);
+    if(sample.mask & ~TELEMETRY_ALLFIELDS) {
+      fprintf(stderr, "Bad record in %s\n", path);
+      break;
+    }
+    bool whole = true;
+    for(int i = 0; i < TELEMETRY_NFIELDS && whole; i++) {
+      if(!(sample.mask & (1ul << i)))
+	continue;
+      whole = fread(value, sizeof(value), 1, log) == 1;
+      sample.values[i] = get32(value);
+    }
+    if(!whole) {
+      fprintf(stderr, "%s ends part way through a record\n", path);
+      break;
+    }
+    printSample(stdout, get32(record), record[4], record[5], &sample);
+  }
+  fclose(log);
+  return 0;
+}
+
+int fieldByName(const char *name)
+{
+  for(int i = 0; i < TELEMETRY_NFIELDS; i++) {
+    if(!strcasecmp(name, fields[i].name))
+      return i;
+  }
+  return -1;
+}
+
+bool parseSetpoint(int opt, const char *arg, struct setpoint *sp)
+{
+  double a, b, power = 0.5;
+  memset(sp, 0, sizeof(*sp));
+  switch(opt) {
+  case 'H':
+    if(sscanf(arg, "%lf,%lf", &a, &power) < 1 || a < 0 || a >= 360)
+      return false;
+    sp->kind = SETPOINT_HEADING;
+    sp->heading = (uint16_t)(a * 10 + 0.5) % 3600;
+    break;
+  case 'W':
+    if(sscanf(arg, "%lf,%lf,%lf", &a, &b, &power) < 2 || a < -90 || a > 90 ||
+       b < -180 || b > 180)
+      return false;
+    sp->kind = SETPOINT_WAYPOINT;
+    sp->lat = (int32_t)(a * 1e6 + (a < 0 ? -0.5 : 0.5));
+    sp->lng = (int32_t)(b * 1e6 + (b < 0 ? -0.5 : 0.5));
+    break;
+  default:
+    sp->kind = SETPOINT_MANUAL;
+    break;
+  }
+  if(power < -1 || power > 1)
+    return false;
+  sp->forward = singleToHalf((float)power);
+  return true;
+}
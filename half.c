@@ -0,0 +1,196 @@
+
+#include "half.h"
+
+#include <string.h>
+
+/* Bit layouts:
+ * half:  s eeeee mmmmmmmmmm         bias 15
+ * float: s eeeeeeee mmm...(23)      bias 127
+ */
+#define HALFEXPMASK 0x7C00
+#define HALFMANTMASK 0x03FF
+#define FLTEXPMASK 0x7F800000u
+#define FLTMANTMASK 0x007FFFFFu
+/* Difference between the biases */
+#define BIASDIFF (127 - 15)
+
+static uint32_t fltBits(float f)
+{
+	/* memcpy rather than a pointer cast, so the compiler knows we're
+	 * reading the representation. It becomes a register move.
+	 */
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+static float fltFromBits(uint32_t bits)
+{
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static uint32_t halfToBits(uint16_t h)
+{
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exp = h & HALFEXPMASK;
+	uint32_t mant = h & HALFMANTMASK;
+	if(exp == HALFEXPMASK) {
+		/* Infinity or NaN. Quiet bits line up, so the payload carries over */
+		return sign | FLTEXPMASK | (mant << 13);
+	}
+	if(exp == 0) {
+		if(mant == 0)
+			return sign;
+		/* Subnormal; normalize it so the leading 1 becomes the implicit bit.
+		 * The leading 1 is at bit 31 - clz, and needs to be at bit 10
+		 */
+		int shift = __builtin_clz(mant) - 21;
+		return sign | ((uint32_t)(BIASDIFF + 1 - shift) << 23) |
+			((mant << shift) & HALFMANTMASK) << 13;
+	}
+	return sign | ((((uint32_t)h & 0x7FFF) << 13) + ((uint32_t)BIASDIFF << 23));
+}
+
+#ifdef HALF_TABLES
+
+/* Split tables, from Jeroen van der Meulen's "Fast Half Float Conversions".
+ * The float bits are mantissas[offsets[e] + m] + exponents[e],
+ * where e is the sign and exponent of the half, and m is its mantissa
+ */
+static uint32_t mantissas[2048];
+static uint32_t exponents[64];
+static uint16_t offsets[64];
+
+void halfInit(void)
+{
+	unsigned i;
+	/* The first half of the mantissa table is for subnormals, with their
+	 * exponent folded in, and the second half is for normals
+	 */
+	mantissas[0] = 0;
+	for(i = 1; i < 1024; i++)
+		mantissas[i] = halfToBits(i);
+	for(i = 1024; i < 2048; i++)
+		mantissas[i] = (i - 1024) << 13;
+	for(i = 0; i < 64; i++) {
+		unsigned exp = i & 0x1F;
+		uint32_t sign = (uint32_t)(i & 0x20) << 26;
+		if(exp == 0)
+			exponents[i] = sign;
+		else if(exp == 0x1F)
+			exponents[i] = sign | FLTEXPMASK;
+		else
+			exponents[i] = sign | ((uint32_t)(exp + BIASDIFF) << 23);
+		offsets[i] = exp == 0 ? 0 : 1024;
+	}
+}
+
+float halfToSingle(uint16_t h)
+{
+	unsigned e = h >> 10;
+	return fltFromBits(mantissas[offsets[e] + (h & HALFMANTMASK)] +
+										 exponents[e]);
+}
+
+#else
+
+void halfInit(void)
+{
+}
+
+float halfToSingle(uint16_t h)
+{
+	return fltFromBits(halfToBits(h));
+}
+
+#endif
+
+uint16_t singleToHalf(float f)
+{
+	uint32_t bits = fltBits(f);
+	uint16_t sign = (bits >> 16) & 0x8000;
+	uint32_t exp = (bits & FLTEXPMASK) >> 23;
+	uint32_t mant = bits & FLTMANTMASK;
+	if(exp == 0xFF) {
+		if(mant == 0)
+			return sign | HALFEXPMASK;
+		/* NaN, keep the top of the payload but make sure it stays a NaN */
+		return sign | HALFEXPMASK | 0x0200 | (mant >> 13);
+	}
+	if(exp > BIASDIFF) {
+		/* Normal half, or an overflow. Round to nearest even by adding just
+		 * under half an ulp, plus one more if the result would be odd.
+		 * A carry out of the mantissa correctly bumps the exponent,
+		 * and a carry out of the largest exponent gives infinity.
+		 */
+		uint32_t rebiased = (bits & 0x7FFFFFFF) - ((uint32_t)BIASDIFF << 23);
+		if(rebiased >= ((uint32_t)0x1F << 23))
+			return sign | HALFEXPMASK;
+		rebiased += 0x0FFF + ((rebiased >> 13) & 1);
+		if(rebiased >= ((uint32_t)0x1F << 23))
+			return sign | HALFEXPMASK;
+		return sign | (uint16_t)(rebiased >> 13);
+	}
+	/* Subnormal half, or zero. The value in units of the smallest subnormal
+	 * (2^-24) is the full mantissa shifted right by 126 - exp
+	 */
+	unsigned shift = 126 - exp;
+	if(shift > 24)
+		return sign;
+	mant |= 0x00800000;
+	uint32_t result = mant >> shift;
+	uint32_t rem = mant & ((1u << shift) - 1);
+	uint32_t halfway = 1u << (shift - 1);
+	if(rem > halfway || (rem == halfway && (result & 1)))
+		result++;
+	/* Rounding up out of the subnormals carries into the exponent,
+	 * which is exactly the right answer
+	 */
+	return sign | (uint16_t)result;
+}
+
+int16_t halfToQ15(uint16_t h)
+{
+	int exp = (h & HALFEXPMASK) >> 10;
+	uint32_t mant = h & HALFMANTMASK;
+	int32_t value;
+	if(exp == 0x1F && mant)
+		return 0;
+	if(exp >= 15) {
+		/* At least 1 in magnitude, or infinite */
+		value = 0x7FFF;
+	}
+	else {
+		/* The value is mant * 2^(exp - 25), with the implicit bit for normals,
+		 * and Q15 multiplies that by 2^15, so shift by 10 - exp.
+		 * Subnormals have the same scale as an exponent of 1.
+		 * Below 1 the result always fits in 15 bits.
+		 */
+		if(exp == 0) {
+			value = (mant + (1u << 8)) >> 9;
+		}
+		else if(exp >= 10) {
+			value = (mant | 0x0400) << (exp - 10);
+		}
+		else {
+			unsigned shift = 10 - exp;
+			value = ((mant | 0x0400) + (1u << (shift - 1))) >> shift;
+		}
+	}
+	return (h & 0x8000) ? -value : value;
+}
+
+uint16_t halfLoad(const void *bytes)
+{
+	const uint8_t *b = (const uint8_t *)bytes;
+	return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+void halfStore(void *bytes, uint16_t h)
+{
+	uint8_t *b = (uint8_t *)bytes;
+	b[0] = h & 0xFF;
+	b[1] = h >> 8;
+}
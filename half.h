@@ -0,0 +1,60 @@
+
+#ifndef _HALF_H_
+#define _HALF_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* IEEE 754 binary16 (half precision) conversions.
+ * Halves are carried around as their bit patterns in a uint16_t.
+ * Subnormals, infinities and NaNs are all converted exactly; NaNs keep
+ * as much of their payload as fits, and never turn into infinities.
+ *
+ * Define HALF_TABLES to decode with lookup tables instead of bit
+ * manipulation. The tables take about 8.5 KB of RAM and must be built
+ * with halfInit() before the first conversion.
+ */
+
+/* Builds the decode tables. Does nothing unless HALF_TABLES is defined.
+ * Preconditions: None
+ * Postconditions: halfToSingle can be called
+ */
+void halfInit(void);
+
+/* Widens a half to a float. Exact for every input.
+ * Preconditions: None
+ * Postconditions: The float with the same value as the half is returned
+ */
+float halfToSingle(uint16_t h);
+
+/* Narrows a float to a half, rounding to the nearest half and to the
+ * even one on ties. Values too large for a half become infinity.
+ * Preconditions: None
+ * Postconditions: The nearest half to the float is returned
+ */
+uint16_t singleToHalf(float f);
+
+/* Converts a half straight to Q15 fixed point without going through float,
+ * rounding to nearest. Values outside of -1 to 1 saturate, NaN becomes 0.
+ * Returns the Q15 value as an int16_t, see fixed.h
+ * Preconditions: None
+ * Postconditions: The nearest Q15 value to the half is returned
+ */
+int16_t halfToQ15(uint16_t h);
+
+/* Reads and writes halves in the byte order used on the modem link,
+ * which is little endian, regardless of the byte order of the host.
+ * Preconditions: bytes points to at least 2 valid bytes
+ * Postconditions: The half is read from or written to bytes
+ */
+uint16_t halfLoad(const void *bytes);
+void halfStore(void *bytes, uint16_t h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
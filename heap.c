@@ -1,106 +1,297 @@
 
 #include "heap.h"
-#include <stdlib.h>
+#include "arena.h"
+
 #include <stdbool.h>
 #include <string.h>
 
-struct heap
+#if HP_ARITY < 2
+#error "HP_ARITY must be at least 2"
+#endif
+
+static inline bool hpLess(hpkey lhs, hpkey rhs)
 {
-	void **heap;
-	int (*compare)(void *, void *);
-	unsigned count, max;
-};
+	return (int)(lhs - rhs) < 0;
+}
 
-struct heap *hpCreate(int (*compare)(void *, void *))
+#ifndef HP_PAIRING
+
+static inline void hpPlace(struct heap *hp, unsigned pos, struct hpslot slot)
 {
-	struct heap *hp = malloc(sizeof(struct heap));
-	hp->compare = compare;
-	int DEFAULTMAX = 64;
-	hp->heap = malloc(sizeof(void *[DEFAULTMAX]));
-	hp->max = DEFAULTMAX;
-	hp->count = 0;
+	hp->slots[pos] = slot;
+	slot.node->index = pos;
+}
+
+/* Moves the slot up from pos until its parent is smaller */
+static void hpSiftUp(struct heap *hp, unsigned pos, struct hpslot slot)
+{
+	while(pos > 0) {
+		unsigned parent = (pos - 1) / HP_ARITY;
+		if(!hpLess(slot.key, hp->slots[parent].key))
+			break;
+		hpPlace(hp, pos, hp->slots[parent]);
+		pos = parent;
+	}
+	hpPlace(hp, pos, slot);
+}
+
+/* Moves the slot down from pos until its children are larger */
+static void hpSiftDown(struct heap *hp, unsigned pos, struct hpslot slot)
+{
+	for(;;) {
+		unsigned first = pos * HP_ARITY + 1, child = first, i;
+		if(first >= hp->count)
+			break;
+		for(i = first + 1; i < first + HP_ARITY && i < hp->count; i++) {
+			if(hpLess(hp->slots[i].key, hp->slots[child].key))
+				child = i;
+		}
+		if(!hpLess(hp->slots[child].key, slot.key))
+			break;
+		hpPlace(hp, pos, hp->slots[child]);
+		pos = child;
+	}
+	hpPlace(hp, pos, slot);
+}
+
+struct heap *hpCreate(unsigned capacity)
+{
+	struct heap *hp = arenaAlloc(sizeof(struct heap));
+	if(!hp)
+		return NULL;
+	struct hpslot *slots = arenaAlloc(sizeof(struct hpslot[capacity]));
+	if(!slots) {
+		arenaRelease(hp);
+		return NULL;
+	}
+	hpInit(hp, slots, capacity);
 	return hp;
 }
 
+void hpInit(struct heap *hp, struct hpslot *slots, unsigned capacity)
+{
+	hp->slots = slots;
+	hp->max = capacity;
+	hp->count = 0;
+}
+
 void hpFree(struct heap *hp)
 {
-	free(hp->heap);
-	free(hp);
+	arenaRelease(hp->slots);
+	arenaRelease(hp);
 }
 
-void hpAdd(struct heap *hp, void *data)
+bool hpAdd(struct heap *hp, struct hpnode *node, hpkey key)
 {
+	if(hp->count >= hp->max)
+		return false;
+	struct hpslot slot = {key, node};
 	hp->count++;
-	if(hp->count >= hp->max) {
-		hp->max *= 2;
-		void **buffer = malloc(sizeof(void *[hp->max]));
-		unsigned i;
-		for(i = 0; i < hp->count - 1; i++)
-			buffer[i] = hp->heap[i];
-		free(hp->heap);
-		hp->heap = buffer;
-	}
-	if(hp->count == 1) {
-		hp->heap[0] = data;
-	}
-	else {
-		unsigned pos = hp->count - 1;
-		bool cont = true;
-		while(cont) {
-			if(pos == 0) {
-				hp->heap[0] = data;
-				break;
-			}
-			if(hp->compare(data, hp->heap[pos / 2]) < 0) {
-				hp->heap[pos] = data;
-				cont = false;
-			}
-			else {
-				hp->heap[pos] = hp->heap[pos / 2];
-				pos /= 2;
-			}
-		}
-	}
+	hpSiftUp(hp, hp->count - 1, slot);
+	return true;
 }
 
-void *hpPeek(struct heap *hp)
+struct hpnode *hpPeek(struct heap *hp)
 {
 	if(hp->count > 0)
-		return hp->heap[0];
+		return hp->slots[0].node;
 	return NULL;
 }
 
-void *hpTop(struct heap *hp)
+struct hpnode *hpTop(struct heap *hp)
 {
 	if(hp->count == 0)
 		return NULL;
+	struct hpnode *top = hp->slots[0].node;
+	hpRemove(hp, top);
+	return top;
+}
+
+void hpRemove(struct heap *hp, struct hpnode *node)
+{
+	unsigned pos = node->index;
+	node->index = HP_NOTQUEUED;
 	hp->count--;
-	void *top = hp->heap[0];
-	hp->heap[0] = hp->heap[hp->count];
-	hp->heap[hp->count] = NULL;
-	unsigned pos = 1;
-	while((pos * 2 < hp->count &&
-				 hp->compare(hp->heap[pos - 1], hp->heap[pos * 2]) < 0) ||
-	      (pos*2 - 1 < hp->count &&
-				 hp->compare(hp->heap[pos - 1], hp->heap[pos * 2 - 1]) < 0)) {
-		void *buffer;
-		if(pos * 2 >= hp->count ||
-			 hp->compare(hp->heap[pos * 2 - 1], hp->heap[pos * 2]) > 0) {
-			buffer = hp->heap[pos - 1];
-			hp->heap[pos - 1] = hp->heap[pos * 2 - 1];
-			hp->heap[pos * 2 - 1] = buffer;
-			pos = pos * 2 - 1;
-		}
-		else {
-			buffer = hp->heap[pos - 1];
-			hp->heap[pos - 1] = hp->heap[pos * 2];
-			hp->heap[pos * 2] = buffer;
-			pos = pos * 2;
-		}
+	if(pos == hp->count)
+		return;
+	/* Fill the hole with the last slot, which may need to go either way */
+	struct hpslot last = hp->slots[hp->count];
+	if(pos > 0 && hpLess(last.key, hp->slots[(pos - 1) / HP_ARITY].key))
+		hpSiftUp(hp, pos, last);
+	else
+		hpSiftDown(hp, pos, last);
+}
+
+void hpUpdate(struct heap *hp, struct hpnode *node, hpkey key)
+{
+	unsigned pos = node->index;
+	struct hpslot slot = {key, node};
+	if(hpLess(key, hp->slots[pos].key))
+		hpSiftUp(hp, pos, slot);
+	else
+		hpSiftDown(hp, pos, slot);
+}
+
+hpkey hpKey(struct heap *hp, struct hpnode *node)
+{
+	return hp->slots[node->index].key;
+}
+
+#else
+
+/* Makes the root with the larger key the first child of the other,
+ * and returns the new root
+ */
+static struct hpnode *hpMeld(struct hpnode *lhs, struct hpnode *rhs)
+{
+	if(!lhs)
+		return rhs;
+	if(!rhs)
+		return lhs;
+	if(hpLess(rhs->key, lhs->key)) {
+		struct hpnode *tmp = lhs;
+		lhs = rhs;
+		rhs = tmp;
+	}
+	rhs->prev = lhs;
+	rhs->next = lhs->child;
+	if(lhs->child)
+		lhs->child->prev = rhs;
+	lhs->child = rhs;
+	lhs->next = NULL;
+	lhs->prev = NULL;
+	return lhs;
+}
+
+/* Melds a list of siblings into one tree, in the usual two passes:
+ * meld pairs left to right, then meld the pairs right to left
+ */
+static struct hpnode *hpMeldSiblings(struct hpnode *first)
+{
+	struct hpnode *pairs = NULL;
+	while(first) {
+		struct hpnode *a = first, *b = first->next;
+		first = b ? b->next : NULL;
+		a->next = a->prev = NULL;
+		if(b)
+			b->next = b->prev = NULL;
+		a = hpMeld(a, b);
+		/* Build the pairs up in reverse, through next */
+		a->next = pairs;
+		pairs = a;
+	}
+	struct hpnode *root = NULL;
+	while(pairs) {
+		struct hpnode *next = pairs->next;
+		pairs->next = NULL;
+		root = hpMeld(root, pairs);
+		pairs = next;
 	}
+	return root;
+}
+
+/* Cuts a node which isn't the root, and its subtree, out of the tree */
+static void hpCut(struct hpnode *node)
+{
+	if(node->prev->child == node)
+		node->prev->child = node->next;
+	else
+		node->prev->next = node->next;
+	if(node->next)
+		node->next->prev = node->prev;
+	node->next = node->prev = NULL;
+}
+
+struct heap *hpCreate(unsigned capacity)
+{
+	struct heap *hp = arenaAlloc(sizeof(struct heap));
+	if(!hp)
+		return NULL;
+	hpInit(hp, NULL, capacity);
+	return hp;
+}
+
+void hpInit(struct heap *hp, struct hpslot *slots, unsigned capacity)
+{
+	hp->slots = slots;
+	hp->max = capacity;
+	hp->count = 0;
+	hp->root = NULL;
+}
+
+void hpFree(struct heap *hp)
+{
+	arenaRelease(hp);
+}
+
+bool hpAdd(struct heap *hp, struct hpnode *node, hpkey key)
+{
+	if(hp->count >= hp->max)
+		return false;
+	node->key = key;
+	node->index = 0;
+	node->child = node->next = node->prev = NULL;
+	hp->root = hpMeld(hp->root, node);
+	hp->count++;
+	return true;
+}
+
+struct hpnode *hpPeek(struct heap *hp)
+{
+	return hp->root;
+}
+
+struct hpnode *hpTop(struct heap *hp)
+{
+	struct hpnode *top = hp->root;
+	if(top)
+		hpRemove(hp, top);
 	return top;
 }
 
+void hpRemove(struct heap *hp, struct hpnode *node)
+{
+	if(node == hp->root) {
+		hp->root = hpMeldSiblings(node->child);
+	}
+	else {
+		hpCut(node);
+		hp->root = hpMeld(hp->root, hpMeldSiblings(node->child));
+	}
+	node->child = NULL;
+	node->index = HP_NOTQUEUED;
+	hp->count--;
+}
+
+void hpUpdate(struct heap *hp, struct hpnode *node, hpkey key)
+{
+	if(hpLess(key, node->key)) {
+		/* Decreasing, so the subtree stays in order and can just be cut
+		 * out and melded back in
+		 */
+		node->key = key;
+		if(node != hp->root) {
+			hpCut(node);
+			hp->root = hpMeld(hp->root, node);
+		}
+	}
+	else {
+		hpRemove(hp, node);
+		hp->count++;
+		node->key = key;
+		node->index = 0;
+		hp->root = hpMeld(hp->root, node);
+	}
+}
+
+hpkey hpKey(struct heap *hp, struct hpnode *node)
+{
+	(void)hp;
+	return node->key;
+}
+
+#endif
+
 unsigned hpSize(struct heap *hp)
 {
 	return hp->count;
@@ -2,17 +2,154 @@
 #ifndef __HEAP_H
 #define __HEAP_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* An intrusive min heap, in one of three implementations selected at
+ * compile time. They all have the same interface.
+ *   default      binary implicit heap, in an array
+ *   HP_ARITY=4   4-ary implicit heap. Half as deep, so fewer cache lines
+ *                are touched on the way down, at the cost of more compares
+ *   HP_PAIRING   pairing heap, a tree of the nodes themselves. O(1) inserts
+ *                and no array, but pops are amortized O(log n)
+ *
+ * Whatever is stored embeds a struct hpnode, which the heap uses to find
+ * it again for removal or changing its key. The implicit heaps' arrays hold
+ * each key next to its node pointer, so sifting never dereferences the
+ * nodes, and keys are always compared inline rather than through a
+ * function pointer.
+ *
+ * Keys are compared with wraparound, as tick counts and sequence numbers
+ * are: a comes before b if (int)(a - b) < 0. So all keys in a heap must be
+ * within INT_MAX of each other.
+ */
+typedef unsigned hpkey;
+
+#define HP_NOTQUEUED 0xFFFFFFFF
+
+#ifndef HP_ARITY
+#define HP_ARITY 2
+#endif
+
+#ifdef HP_PAIRING
+
+/* The pairing heap keeps the key in the node. Each node points to its
+ * first child and next sibling, and back to its previous sibling, or its
+ * parent if it's the first child
+ */
+struct hpnode {
+	hpkey key;
+	/* 0 if the node is in a heap, otherwise HP_NOTQUEUED */
+	unsigned index;
+	struct hpnode *child, *next, *prev;
+};
+
+/* Unused, the pairing heap doesn't need an array */
+struct hpslot {
+	hpkey key;
+};
+
+#define HP_SLOTS(n) 1
+
+#else
+
+struct hpnode {
+	/* Where the node is in the heap, or HP_NOTQUEUED */
+	unsigned index;
+};
+
+struct hpslot {
+	hpkey key;
+	struct hpnode *node;
+};
+
+#define HP_SLOTS(n) (n)
+
+#endif
+
 typedef struct heap heap;
 
-struct heap *hpCreate(int (*compare)(void *lhs, void *rhs));
+struct heap {
+	struct hpslot *slots;
+	unsigned count, max;
+#ifdef HP_PAIRING
+	struct hpnode *root;
+#endif
+};
+
+/* Gets the structure a node is embedded in */
+#define hpEntry(node, type, member) \
+	((type *)((char *)(node) - offsetof(type, member)))
+
+/* Creates a heap holding at most capacity nodes, with its slots
+ * allocated from the arena
+ * Preconditions: None
+ * Postconditions: An empty heap, or NULL if the arena is out of room
+ */
+struct heap *hpCreate(unsigned capacity);
+
+/* Initializes a heap in caller provided memory, which holds at most
+ * capacity nodes.
+ * Declare the slots with HP_SLOTS(capacity) entries, which is only 1 for
+ * the pairing heap.
+ * Preconditions: Valid pointers to the heap and to the slots
+ * Postconditions: An empty heap
+ */
+void hpInit(struct heap *hp, struct hpslot *slots, unsigned capacity);
+
+/* Frees a heap made by hpCreate. The nodes are not touched.
+ * Preconditions: A heap from hpCreate
+ * Postconditions: The heap is invalid
+ */
 void hpFree(struct heap *hp);
-void hpAdd(struct heap *hp, void *data);
-void *hpPeek(struct heap *hp);
-void *hpTop(struct heap *hp);
+
+/* Adds a node with the key given.
+ * Returns false if the heap is full.
+ * Preconditions: A valid heap, a node which isn't in any heap
+ * Postconditions: The node is in the heap
+ */
+bool hpAdd(struct heap *hp, struct hpnode *node, hpkey key);
+
+/* Returns the node with the smallest key, or NULL if the heap is empty.
+ * hpTop also removes it.
+ * Preconditions: A valid heap
+ */
+struct hpnode *hpPeek(struct heap *hp);
+struct hpnode *hpTop(struct heap *hp);
+
+/* Removes a node from wherever it is in the heap
+ * Preconditions: A valid heap, a node in that heap
+ * Postconditions: The node is no longer in the heap
+ */
+void hpRemove(struct heap *hp, struct hpnode *node);
+
+/* Changes the key of a node in the heap, either way
+ * Preconditions: A valid heap, a node in that heap
+ * Postconditions: The node is in the heap with the new key
+ */
+void hpUpdate(struct heap *hp, struct hpnode *node, hpkey key);
+
+/* Returns the key of a node in the heap
+ * Preconditions: A valid heap, a node in that heap
+ */
+hpkey hpKey(struct heap *hp, struct hpnode *node);
+
+/* Marks a node as not in any heap, for hpQueued */
+static inline void hpNodeInit(struct hpnode *node)
+{
+	node->index = HP_NOTQUEUED;
+}
+
+/* Whether a node is in a heap */
+static inline bool hpQueued(struct hpnode *node)
+{
+	return node->index != HP_NOTQUEUED;
+}
+
 unsigned hpSize(struct heap *hp);
 
 #ifdef __cplusplus
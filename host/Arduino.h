@@ -0,0 +1,104 @@
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+/* Just enough of the Arduino core for the drivers to run on the host, for
+ * replay. Time is virtual, and the ports are fed from a trace as the
+ * virtual clock reaches each byte. See hostarduino.h for the other side.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+typedef uint8_t byte;
+
+#ifdef __cplusplus
+
+/* One of the kayak's ports, numbered as in enum traceport */
+class HostPort {
+public:
+  HostPort(int port) : port(port) {}
+  /* Polling an empty port takes a little virtual time, so the drivers'
+   * busy waits see the clock move
+   */
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t value);
+  size_t write(const char *str);
+  void begin(unsigned long) {}
+  void end() {}
+  void flush() {}
+  void setTimeout(unsigned long) {}
+private:
+  int port;
+};
+
+class UARTClass : public HostPort {
+public:
+  UARTClass(int port) : HostPort(port) {}
+};
+
+class USARTClass : public HostPort {
+public:
+  USARTClass(int port) : HostPort(port) {}
+};
+
+extern UARTClass Serial1;
+extern USARTClass Serial2, Serial3;
+
+extern "C" {
+#endif
+
+uint32_t GetTickCount(void);
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+void noInterrupts(void);
+void interrupts(void);
+
+/* The math TinyGPS uses */
+#define PI 3.1415926535897932384626433832795
+#define TWO_PI 6.283185307179586476925286766559
+#define radians(deg) ((deg) * (PI / 180.0))
+#define degrees(rad) ((rad) * (180.0 / PI))
+#define sq(x) ((x) * (x))
+
+/* The pins aren't traced, they read low */
+#define INPUT 0
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+void pinMode(uint32_t pin, uint32_t mode);
+int digitalRead(uint32_t pin);
+
+/* The scheduler's timer, which calls TC3_Handler when it runs out */
+typedef int IRQn_Type;
+enum { TC3_IRQn = 30 };
+typedef struct { uint32_t TC_IER, TC_IDR; } TcChannel;
+typedef struct { TcChannel TC_CHANNEL[3]; } Tc;
+extern Tc *TC1;
+#define VARIANT_MCK 84000000
+#define TC_CMR_WAVE 0
+#define TC_CMR_WAVSEL_UP_RC 0
+#define TC_CMR_TCCLKS_TIMER_CLOCK4 0
+#define TC_IER_CPCS 0x10
+void TC_Configure(Tc *tc, uint32_t channel, uint32_t mode);
+void TC_SetRA(Tc *tc, uint32_t channel, uint32_t ra);
+void TC_SetRC(Tc *tc, uint32_t channel, uint32_t rc);
+void TC_Start(Tc *tc, uint32_t channel);
+uint32_t TC_GetStatus(Tc *tc, uint32_t channel);
+void NVIC_EnableIRQ(IRQn_Type irq);
+void pmc_set_writeprotect(uint32_t enable);
+uint32_t pmc_enable_periph_clk(uint32_t id);
+uint32_t pmc_disable_periph_clk(uint32_t id);
+void TC3_Handler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
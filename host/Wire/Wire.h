@@ -0,0 +1,18 @@
+#ifndef _HOST_WIRE_H_
+#define _HOST_WIRE_H_
+
+#include <Arduino.h>
+
+/* The compass's I2C bus. Transactions aren't checked, only the bytes */
+class TwoWire : public HostPort {
+public:
+  TwoWire(int port) : HostPort(port) {}
+  void begin() {}
+  void beginTransmission(int) {}
+  uint8_t endTransmission() { return 0; }
+  uint8_t requestFrom(int, int quantity) { return quantity; }
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef _HOST_CORE_CMINSTR_H_
+#define _HOST_CORE_CMINSTR_H_
+
+/* Replay is single threaded, so exclusive access always succeeds */
+#define __LDREXW(addr) (*(addr))
+#define __STREXW(value, addr) (*(addr) = (value), 0)
+
+#endif
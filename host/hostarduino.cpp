@@ -0,0 +1,300 @@
+
+#include <Arduino.h>
+#include <Wire/Wire.h>
+
+#include "hostarduino.h"
+#include "trace.h"
+
+/* Bytes each port can hold before they're lost, as on the Due */
+#define HOSTRXSIZE 128
+/* Virtual time a poll of an empty port takes, in us */
+#define HOSTPOLLUS 1
+/* How long a driver can wait after the trace runs out before the replay
+ * is over, in us
+ */
+#define HOSTENDUS 1000000
+/* Counts of the scheduler's timer per us, see startTimer */
+#define HOSTTIMERCOUNTS 42
+#define HOSTTIMERUS 64
+
+UARTClass Serial1(TRACE_GPS);
+USARTClass Serial2(TRACE_MODEM);
+USARTClass Serial3(TRACE_MOTOR);
+TwoWire Wire(TRACE_COMPASS);
+
+static Tc tc1;
+Tc *TC1 = &tc1;
+
+struct hostport {
+  uint8_t rx[HOSTRXSIZE];
+  unsigned head, tail;
+  /* Index of the next of the trace's writes to this port */
+  size_t nextwrite;
+  struct hostportstats stats;
+};
+
+static struct {
+  const struct hostevent *events;
+  size_t count;
+  /* Index of the next read in the trace to deliver */
+  size_t next;
+  uint64_t now;
+  struct hostport ports[TRACE_NPORTS];
+  int nports;
+  bool armed;
+  uint32_t rc;
+  uint64_t period, deadline;
+  void (*report)(void);
+} host;
+
+static void hostAdvanceTo(uint64_t time);
+static void hostDeliver(void);
+static size_t hostNextWrite(int port, size_t from);
+static void hostPoll(void);
+
+void hostLoad(const struct hostevent *events, size_t count, int nports)
+{
+  memset(&host, 0, sizeof(host));
+  host.events = events;
+  host.count = count;
+  host.nports = nports < TRACE_NPORTS ? nports : TRACE_NPORTS;
+  for(int i = 0; i < host.nports; i++)
+    host.ports[i].nextwrite = hostNextWrite(i, 0);
+  hostDeliver();
+}
+
+bool hostAdvance(void)
+{
+  while(host.next < host.count && host.events[host.next].dir != TRACE_READ)
+    host.next++;
+  if(host.next >= host.count)
+    return false;
+  uint64_t target = host.events[host.next].time;
+  if(host.armed && host.deadline < target)
+    target = host.deadline;
+  hostAdvanceTo(target > host.now ? target : host.now);
+  return true;
+}
+
+void hostOnEnd(void (*report)(void))
+{
+  host.report = report;
+}
+
+uint64_t hostNow(void)
+{
+  return host.now;
+}
+
+bool hostWaiting(int port)
+{
+  return host.ports[port].head != host.ports[port].tail;
+}
+
+void hostStats(int port, struct hostportstats *stats)
+{
+  struct hostport *p = &host.ports[port];
+  *stats = p->stats;
+  stats->missing = 0;
+  for(size_t i = p->nextwrite; i < host.count; i = hostNextWrite(port, i + 1))
+    stats->missing++;
+}
+
+static void hostAdvanceTo(uint64_t time)
+{
+  for(;;) {
+    while(host.next < host.count &&
+	  host.events[host.next].dir != TRACE_READ)
+      host.next++;
+    bool delivery = host.next < host.count &&
+      host.events[host.next].time <= time;
+    bool timer = host.armed && host.deadline <= time;
+    if(timer && (!delivery || host.deadline <= host.events[host.next].time)) {
+      /* The timer repeats until it's restarted or turned off */
+      if(host.deadline > host.now)
+	host.now = host.deadline;
+      host.deadline += host.period;
+      TC3_Handler();
+    }
+    else if(delivery) {
+      if(host.events[host.next].time > host.now)
+	host.now = host.events[host.next].time;
+      hostDeliver();
+    }
+    else
+      break;
+  }
+  if(time > host.now)
+    host.now = time;
+}
+
+static void hostDeliver(void)
+{
+  for(; host.next < host.count && host.events[host.next].time <= host.now;
+      host.next++) {
+    const struct hostevent *evt = &host.events[host.next];
+    if(evt->dir != TRACE_READ || evt->port >= host.nports)
+      continue;
+    struct hostport *p = &host.ports[evt->port];
+    p->stats.delivered++;
+    if(p->head - p->tail >= HOSTRXSIZE) {
+      p->stats.overrun++;
+      continue;
+    }
+    p->rx[p->head++ % HOSTRXSIZE] = evt->value;
+  }
+}
+
+static void hostPoll(void)
+{
+  if(host.next >= host.count &&
+     host.now >= (host.count ? host.events[host.count - 1].time : 0) +
+     HOSTENDUS) {
+    /* Nothing more is coming, so the driver would wait forever */
+    if(host.report)
+      host.report();
+    exit(0);
+  }
+  hostAdvanceTo(host.now + HOSTPOLLUS);
+}
+
+static size_t hostNextWrite(int port, size_t from)
+{
+  while(from < host.count && (host.events[from].port != port ||
+			      host.events[from].dir != TRACE_WRITE))
+    from++;
+  return from;
+}
+
+int HostPort::available()
+{
+  struct hostport *p = &host.ports[port];
+  if(p->head == p->tail)
+    hostPoll();
+  return p->head - p->tail;
+}
+
+int HostPort::read()
+{
+  struct hostport *p = &host.ports[port];
+  if(p->head == p->tail) {
+    hostPoll();
+    if(p->head == p->tail)
+      return -1;
+  }
+  p->stats.read++;
+  return p->rx[p->tail++ % HOSTRXSIZE];
+}
+
+int HostPort::peek()
+{
+  struct hostport *p = &host.ports[port];
+  if(p->head == p->tail)
+    return -1;
+  return p->rx[p->tail % HOSTRXSIZE];
+}
+
+size_t HostPort::write(uint8_t value)
+{
+  struct hostport *p = &host.ports[port];
+  p->stats.written++;
+  if(p->nextwrite >= host.count || host.events[p->nextwrite].value != value) {
+    if(p->stats.mismatched++ == 0)
+      p->stats.firstmismatch = host.now;
+  }
+  if(p->nextwrite < host.count)
+    p->nextwrite = hostNextWrite(port, p->nextwrite + 1);
+  return 1;
+}
+
+size_t HostPort::write(const char *str)
+{
+  size_t len = 0;
+  for(; str[len]; len++)
+    write((uint8_t)str[len]);
+  return len;
+}
+
+uint32_t GetTickCount(void)
+{
+  return host.now / 1000;
+}
+
+uint32_t millis(void)
+{
+  return host.now / 1000;
+}
+
+uint32_t micros(void)
+{
+  return host.now;
+}
+
+void delay(uint32_t ms)
+{
+  hostAdvanceTo(host.now + ms * 1000ull);
+}
+
+void noInterrupts(void)
+{
+}
+
+void interrupts(void)
+{
+}
+
+void pinMode(uint32_t, uint32_t)
+{
+}
+
+int digitalRead(uint32_t)
+{
+  return LOW;
+}
+
+void TC_Configure(Tc *, uint32_t, uint32_t)
+{
+}
+
+void TC_SetRA(Tc *, uint32_t, uint32_t)
+{
+}
+
+void TC_SetRC(Tc *, uint32_t, uint32_t rc)
+{
+  host.rc = rc;
+}
+
+void TC_Start(Tc *, uint32_t)
+{
+  host.period = (uint64_t)host.rc * HOSTTIMERUS / HOSTTIMERCOUNTS;
+  if(host.period == 0)
+    host.period = 1;
+  host.deadline = host.now + host.period;
+  host.armed = true;
+}
+
+uint32_t TC_GetStatus(Tc *, uint32_t)
+{
+  return 0;
+}
+
+void NVIC_EnableIRQ(IRQn_Type)
+{
+}
+
+void pmc_set_writeprotect(uint32_t)
+{
+}
+
+uint32_t pmc_enable_periph_clk(uint32_t)
+{
+  return 0;
+}
+
+uint32_t pmc_disable_periph_clk(uint32_t id)
+{
+  if(id == TC3_IRQn)
+    host.armed = false;
+  return 0;
+}
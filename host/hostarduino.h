@@ -0,0 +1,57 @@
+#ifndef _HOSTARDUINO_H_
+#define _HOSTARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* The virtual hardware replay runs the drivers on. The trace's reads are
+ * delivered to their ports when the virtual clock reaches them, and
+ * whatever the drivers write is checked against the trace's writes.
+ */
+
+struct hostevent {
+  /* us since the trace started */
+  uint64_t time;
+  int port;
+  int dir;
+  uint8_t value;
+};
+
+struct hostportstats {
+  /* Bytes delivered to the port, and how many of those were read */
+  unsigned delivered;
+  unsigned read;
+  /* Delivered while the port was full, and lost */
+  unsigned overrun;
+  /* Bytes written, and how many differed from the trace */
+  unsigned written;
+  unsigned mismatched;
+  /* The trace's writes that never happened */
+  unsigned missing;
+  /* When the writes first differed, in us, if they did */
+  uint64_t firstmismatch;
+};
+
+/* Sets the hardware up to replay the events, which must stay valid.
+ * The clock starts at 0.
+ */
+void hostLoad(const struct hostevent *events, size_t count, int nports);
+
+/* Moves the clock on to the next timer or byte the trace delivers.
+ * Returns false once the trace has delivered everything.
+ */
+bool hostAdvance(void);
+
+uint64_t hostNow(void);
+
+/* Whether a port has bytes waiting, without the time polling takes */
+bool hostWaiting(int port);
+
+void hostStats(int port, struct hostportstats *stats);
+
+/* Called when a driver is still waiting for a byte a while after the
+ * trace has run out, which ends the replay, after which the program exits
+ */
+void hostOnEnd(void (*report)(void));
+
+#endif
@@ -0,0 +1,405 @@
+
+#include <Arduino.h>
+#include <math.h>
+#include "kayak.h"
+#include "half.h"
+#include "power.h"
+#include "logging.h"
+#include "config.h"
+#include "recorder.h"
+#include "profile.h"
+#include "setpoint.h"
+
+/* Never check for due telemetry more often than this, in ms */
+#define TELEMETRYMINPERIOD 10
+/* The GPS sends a burst of sentences every gpsperiod ms. It's left alone for
+ * GPSBURST ms after a sentence, to get the rest of the burst, and is
+ * listened for again GPSGUARD ms before the next burst is expected
+ */
+#define GPSBURST 300
+#define GPSGUARD 100
+/* How often the heading and motor readings are recorded, in ms */
+#define RECORDERPERIOD 1000
+/* Commands are only recorded when they change, and at most this often,
+ * in ms. The base sends them often enough that the last change is still
+ * recorded this soon after
+ */
+#define COMMANDRECORDPERIOD 100
+/* While the controller is steering itself, commands only keep the
+ * failsafe from tripping, unless the stick is pushed this far, which
+ * takes back manual control
+ */
+#define STICKOVERRIDE Q15(0.2)
+
+struct kayak kayak;
+
+/* Sends the base a frame with whatever telemetry it's subscribed to
+ * that's due, then waits until the next is due
+ */
+void sendTelemetry(void *);
+
+/* Fills out a telemetry sample with at least the fields requested */
+void fillTelemetry(struct telemetrysample *sample, uint32_t fields);
+
+/* Puts a value into a telemetry sample, and marks it as present */
+void telemetrySet(struct telemetrysample *sample,
+		  enum telemetryfield field, int32_t value);
+
+/* Handle a command from the base, and a newly parsed GPS sentence */
+void commandEvent(void *);
+void gpsEvent(void *);
+
+/* Handles the base's other requests, subscribing to telemetry,
+ * changing parameters and giving the controller setpoints
+ */
+void messageEvent(void *, enum frametype type, const uint8_t *payload,
+		  size_t len);
+
+/* Passes a setpoint from the base on to the controller */
+void applySetpoint(const uint8_t *payload, size_t len);
+
+/* Records the readings that aren't recorded as they arrive */
+void recordReadings(void *);
+
+/* Lets the processor into wait mode between GPS bursts. gpsSentence is
+ * called for every sentence parsed, gpsQuiet once the burst is over, and
+ * gpsExpect just before the next
+ */
+void gpsSentence();
+void gpsQuiet(void *);
+void gpsExpect(void *);
+
+/* Records a newly parsed GPS fix, and passes it on to the position
+ * estimator
+ */
+void gpsFix();
+
+void kayakInit(struct scheduler *scheduler)
+{
+  kayak.scheduler = scheduler;
+  halfInit();
+  telemetryInit(&kayak.telemetry);
+  GPSSERIAL.begin(config.gpsbaud);
+  /* The GPS talks whenever it likes until it's been heard from */
+  powerHold(POWER_HOLD_GPS);
+  kayak.gpstimer = TIMER_NONE;
+  kayak.gpsposted = false;
+  kayak.gpsfixtime = TinyGPS::GPS_INVALID_TIME;
+  kayak.recordedforward = kayak.recordedrotate = 0;
+  kayak.commandrecorded = GetTickCount();
+
+  /* The more involved pieces of hardware are handled in a more
+   * more robust manner... Modem and motor controller
+   */
+  LOG(MODEM_CONNECTING);
+  kayak.modem = modemInit(&MODEMSERIAL, config.modembaud,
+			  config.modemtimeout);
+  if(!kayak.modem) {
+    LOG(MODEM_ABSENT);
+  }
+  else {
+    LOG(MODEM_PRESENT);
+    modemOnPacket(kayak.modem, commandEvent, NULL);
+    modemOnMessage(kayak.modem, messageEvent, NULL);
+    modemUseDCD(kayak.modem, config.modemdcd);
+    modemSetNode(kayak.modem, config.nodeid, config.slots, config.slotlength);
+  }
+  failsafeKick();
+  LOG(MOTOR_CONNECTING);
+  kayak.motor = motorInit(&MOTORSERIAL, config.motorbaud,
+			  config.motortimeout, config.motorpoll);
+  if(!kayak.motor) {
+    LOG(MOTOR_ABSENT);
+  }
+  else {
+    LOG(MOTOR_PRESENT);
+  }
+  failsafeKick();
+  LOG(COMPASS_INIT);
+  kayak.compass = compassInit(&COMPASSWIRE, config.compasspoll);
+  kayak.estimator = estimatorInit(kayak.compass, config.estimatorperiod);
+  /* Until the base asks for something else, send the position once a
+   * second, the heading ten times a second, and the rest occasionally
+   */
+  unsigned now = GetTickCount();
+  telemetryStreamsInit(&kayak.streams, config.telemetrybudget, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_TIME, 1000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_LAT, 1000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_LNG, 1000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_HEADING, 100, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_COURSE, 1000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_SPEED, 1000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_SATELLITES, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_HDOP, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_AMPS, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_VOLTS, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_LINKLOSS, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_LINKINTERVAL, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_RSSI, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_FAILSAFE, 1000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_PEAKAMPS, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_ENERGY, 5000, now);
+  registerTimer(TELEMETRYMINPERIOD, sendTelemetry, NULL);
+  if(kayak.motor)
+    kayak.control = controlInit(kayak.motor, kayak.compass,
+				kayak.estimator, config.controlperiod);
+  kayak.failsafe = failsafeInit(kayak.control, config.failsafetimeout,
+				config.failsaferamp);
+  registerPeriodic(RECORDERPERIOD, recordReadings, NULL);
+}
+
+void kayakGPSByte(uint8_t value)
+{
+  /* Update the GPS information; longitude, latitude, number of satellites,
+   * etc. The sentence is handled once everything that's arrived is parsed
+   */
+  if(kayak.gpsdata.encode(value) && !kayak.gpsposted)
+    kayak.gpsposted = postEvent(gpsEvent, NULL) != TIMER_NONE;
+}
+
+void commandEvent(void *)
+{
+  /* Update the setpoints of the controller, which drives the motors */
+  q15 forward = modemForwardPwr(kayak.modem),
+    rotate = modemRotationPwr(kayak.modem);
+  unsigned now = GetTickCount();
+  if((forward != kayak.recordedforward || rotate != kayak.recordedrotate) &&
+     now - kayak.commandrecorded >= COMMANDRECORDPERIOD) {
+    RECORD(COMMAND, forward, rotate);
+    kayak.recordedforward = forward;
+    kayak.recordedrotate = rotate;
+    kayak.commandrecorded = now;
+  }
+  if(kayak.failsafe)
+    failsafeCommand(kayak.failsafe);
+  if(kayak.control &&
+     (controlMode(kayak.control) == CONTROL_MANUAL ||
+      forward > STICKOVERRIDE || forward < -STICKOVERRIDE ||
+      rotate > STICKOVERRIDE || rotate < -STICKOVERRIDE))
+    controlManual(kayak.control, forward, rotate);
+}
+
+void messageEvent(void *, enum frametype type, const uint8_t *payload,
+		  size_t len)
+{
+  switch(type) {
+  case FRAME_SUBSCRIBE:
+    telemetryRequest(&kayak.streams, payload, len, GetTickCount());
+    break;
+  case FRAME_CONFIG:
+    /* Takes effect as the modules next look at the parameter, or at the
+     * next boot for the ones only read in setup
+     */
+    configRequest(&config, payload, len);
+    break;
+  case FRAME_SETPOINT:
+    applySetpoint(payload, len);
+    break;
+  default:
+    break;
+  }
+}
+
+void applySetpoint(const uint8_t *payload, size_t len)
+{
+  struct setpoint sp;
+  if(!kayak.control || !setpointDecode(payload, len, &sp))
+    return;
+  LOG(CONTROL_SETPOINT, sp.kind);
+  q15 forward = halfToQ15(sp.forward);
+  switch(sp.kind) {
+  case SETPOINT_MANUAL:
+    controlManual(kayak.control, 0, 0);
+    break;
+  case SETPOINT_HEADING:
+    controlSetHeading(kayak.control, sp.heading / 10.0f, forward);
+    break;
+  case SETPOINT_WAYPOINT:
+    if(!controlSetWaypoint(kayak.control, sp.lat, sp.lng, forward))
+      LOG(CONTROL_NOFIX);
+    break;
+  }
+}
+
+void gpsEvent(void *)
+{
+  kayak.gpsposted = false;
+  gpsSentence();
+  gpsFix();
+}
+
+void sendTelemetry(void *)
+{
+  PROFILE(TELEMETRY);
+  unsigned now = GetTickCount();
+  uint32_t wait;
+  uint32_t due = telemetryDue(&kayak.streams, now, &wait);
+  if(due) {
+    size_t size = 0;
+    if(kayak.modem && modemIsConn(kayak.modem)) {
+      /* Wait for our turn, so the other kayaks' replies don't collide */
+      uint32_t slot = modemSlotWait(kayak.modem);
+      if(slot) {
+	registerTimer(slot, sendTelemetry, NULL);
+	return;
+      }
+      /* Key frames carry every delta field, so the base can pick them
+       * all up again after missing a frame
+       */
+      uint32_t fields = due | telemetryKeyFields(&kayak.telemetry,
+						 &kayak.streams);
+      struct telemetrysample sample;
+      sample.mask = 0;
+      fillTelemetry(&sample, fields);
+      sample.mask &= fields;
+      uint8_t frame[TELEMETRY_MAXFRAME];
+      size = telemetryEncode(&kayak.telemetry, &sample, frame, sizeof(frame));
+      modemSendPacket(kayak.modem, FRAME_TELEMETRY, frame, size);
+    }
+    /* Whether or not anyone was listening, these fields have had
+     * their turn
+     */
+    telemetrySent(&kayak.streams, due, size, now);
+    telemetryDue(&kayak.streams, now, &wait);
+  }
+  if(wait < TELEMETRYMINPERIOD)
+    wait = TELEMETRYMINPERIOD;
+  registerTimer(wait, sendTelemetry, NULL);
+}
+
+void fillTelemetry(struct telemetrysample *sample, uint32_t fields)
+{
+  /* Mostly just querying TinyGPS for information. Anything TinyGPS
+   * doesn't have is left out of the frame.
+   */
+  /* Compass heading */
+  if(kayak.compass && (fields & (1ul << TELEMETRY_HEADING))) {
+    float heading = compassBearing(kayak.compass);
+    if(!isnan(heading))
+      telemetrySet(sample, TELEMETRY_HEADING, heading * 10);
+  }
+  /* GPS time */
+  int year;
+  byte month, day, hour, minute, second;
+  unsigned long age;
+  kayak.gpsdata.crack_datetime(&year, &month, &day, &hour,
+			       &minute, &second, NULL, &age);
+  if(age != TinyGPS::GPS_INVALID_AGE)
+    telemetrySet(sample, TELEMETRY_TIME,
+		 hour * 3600l + minute * 60l + second);
+  /* GPS latitude and longitude */
+  long lat, lng;
+  kayak.gpsdata.get_position(&lat, &lng, &age);
+  if(age != TinyGPS::GPS_INVALID_AGE) {
+    telemetrySet(sample, TELEMETRY_LAT, lat);
+    telemetrySet(sample, TELEMETRY_LNG, lng);
+  }
+  /* Misc. GPS information. TinyGPS keeps these as integers in
+   * hundredths already, so don't go through its float accessors
+   */
+  if(kayak.gpsdata.satellites() != TinyGPS::GPS_INVALID_SATELLITES)
+    telemetrySet(sample, TELEMETRY_SATELLITES, kayak.gpsdata.satellites());
+  if(kayak.gpsdata.hdop() != TinyGPS::GPS_INVALID_HDOP)
+    telemetrySet(sample, TELEMETRY_HDOP, kayak.gpsdata.hdop());
+  if(kayak.gpsdata.course() != TinyGPS::GPS_INVALID_ANGLE)
+    telemetrySet(sample, TELEMETRY_COURSE, kayak.gpsdata.course());
+  if(kayak.gpsdata.speed() != TinyGPS::GPS_INVALID_SPEED)
+    /* TinyGPS gives hundredths of a knot */
+    telemetrySet(sample, TELEMETRY_SPEED,
+		 kayak.gpsdata.speed() * 1852 / 1000);
+  /* Motor controller readings */
+  if(kayak.motor) {
+    struct channelpair amps = motorAmps(kayak.motor),
+      volts = motorVolts(kayak.motor);
+    telemetrySet(sample, TELEMETRY_AMPS, amps.cA | (amps.cB << 8));
+    telemetrySet(sample, TELEMETRY_VOLTS, volts.cA | (volts.cB << 8));
+    struct channelpair peak = motorPeakAmps(kayak.motor);
+    telemetrySet(sample, TELEMETRY_PEAKAMPS, peak.cA | (peak.cB << 8));
+    telemetrySet(sample, TELEMETRY_ENERGY, motorEnergy(kayak.motor));
+  }
+  /* Command link quality */
+  if(kayak.modem) {
+    struct modemlink link;
+    modemLink(kayak.modem, &link);
+    telemetrySet(sample, TELEMETRY_LINKLOSS, link.loss);
+    telemetrySet(sample, TELEMETRY_LINKINTERVAL, link.interval);
+    if(link.rssi >= 0)
+      telemetrySet(sample, TELEMETRY_RSSI, link.rssi);
+  }
+  if(kayak.failsafe)
+    telemetrySet(sample, TELEMETRY_FAILSAFE,
+		 failsafeTrips(kayak.failsafe) * 2 +
+		 failsafeTripped(kayak.failsafe));
+}
+
+void telemetrySet(struct telemetrysample *sample,
+		  enum telemetryfield field, int32_t value)
+{
+  sample->values[field] = value;
+  sample->mask |= 1ul << field;
+}
+
+void recordReadings(void *)
+{
+  if(kayak.compass) {
+    float heading = compassBearing(kayak.compass);
+    if(!isnan(heading))
+      RECORD(HEADING, (int)(heading * 10));
+  }
+  if(kayak.motor) {
+    struct channelpair amps = motorAmps(kayak.motor),
+      volts = motorVolts(kayak.motor);
+    RECORD(POWER, amps.cA, amps.cB, volts.cA, volts.cB);
+    struct channelpair peak = motorPeakAmps(kayak.motor);
+    RECORD(ENERGY, peak.cA, peak.cB, motorEnergy(kayak.motor));
+  }
+}
+
+void gpsSentence()
+{
+  /* Keep listening until the burst is over */
+  powerHold(POWER_HOLD_GPS);
+  cancelTimer(kayak.gpstimer);
+  kayak.gpstimer = registerTimer(GPSBURST, gpsQuiet, NULL);
+}
+
+void gpsQuiet(void *)
+{
+  powerRelease(POWER_HOLD_GPS);
+  kayak.gpstimer = registerTimer(config.gpsperiod - GPSBURST - GPSGUARD,
+				 gpsExpect, NULL);
+}
+
+void gpsExpect(void *)
+{
+  powerHold(POWER_HOLD_GPS);
+  kayak.gpstimer = TIMER_NONE;
+}
+
+void gpsFix()
+{
+  long lat, lng;
+  unsigned long age;
+  kayak.gpsdata.get_position(&lat, &lng, &age);
+  if(age == TinyGPS::GPS_INVALID_AGE)
+    return;
+  /* The RMC and GGA sentences both carry the fix, so only the first of
+   * them with its time is used
+   */
+  unsigned long date, time;
+  kayak.gpsdata.get_datetime(&date, &time);
+  if(time == kayak.gpsfixtime)
+    return;
+  kayak.gpsfixtime = time;
+  RECORD(GPS, lat, lng, kayak.gpsdata.course(), kayak.gpsdata.speed(),
+	 kayak.gpsdata.satellites());
+  if(!kayak.estimator)
+    return;
+  /* Without both, there's no velocity to correct with */
+  float course = kayak.gpsdata.f_course();
+  float speed = kayak.gpsdata.f_speed_mps();
+  if(course == TinyGPS::GPS_INVALID_F_ANGLE ||
+     speed == TinyGPS::GPS_INVALID_F_SPEED)
+    course = NAN;
+  estimatorGPSFix(kayak.estimator, lat, lng, course, speed);
+}
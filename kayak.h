@@ -0,0 +1,79 @@
+
+#ifndef _KAYAK_H_
+#define _KAYAK_H_
+
+#include "include.h"
+#include "scheduler.h"
+#include "modem.h"
+#include "motor.h"
+#include "compass.h"
+#include "estimator.h"
+#include "control.h"
+#include "failsafe.h"
+#include "telemetry.h"
+
+#include "TinyGPS.h"
+
+/* The kayak's drivers, and the handlers and timers that tie them together.
+ * Shared by the firmware and replay, so a trace is run through the same
+ * code that ran on the kayak.
+ *
+ * Whatever runs the kayak loads the parameters and brings up the scheduler
+ * before kayakInit, then processes the scheduler's events, calls
+ * modemUpdate when the modem has data, and passes each byte from the GPS
+ * to kayakGPSByte.
+ */
+
+/* Group our stuff used for our program, not just program wide globals */
+struct kayak {
+  /* Used to parse GPS data */
+  TinyGPS gpsdata;
+  /* Compass object, keeps track of the bearing of the kayak */
+  struct compass *compass;
+  /* Position estimator, fuses the compass, GPS and motor commands */
+  struct estimator *estimator;
+  /* On-board controller, drives the motors from the bases setpoints */
+  struct control *control;
+  /* Stops the motors when the base goes quiet */
+  struct failsafe *failsafe;
+  /* Modem object, keeps track of the state of the modem */
+  struct modem *modem;
+  /* Motor controller object, keeps track of the state of the motors and battery,
+   * provides interface between the two
+   */
+  struct motorctrl *motor;
+  /* Scheduler object, used to schedule jobs and what not */
+  struct scheduler *scheduler;
+  /* State of the delta encoding of the telemetry sent to the base */
+  struct telemetrycodec telemetry;
+  /* Which telemetry the base wants, and how often */
+  struct telemetrystreams streams;
+  /* Releases or takes back the GPS's hold on wait mode */
+  timerhandle gpstimer;
+  /* Whether a parsed GPS sentence is waiting to be handled */
+  bool gpsposted;
+  /* The time of the last fix handled, from the GPS. Each fix comes in
+   * more than one sentence
+   */
+  unsigned long gpsfixtime;
+  /* The last command recorded, and when */
+  q15 recordedforward, recordedrotate;
+  unsigned commandrecorded;
+};
+
+extern struct kayak kayak;
+
+/* Brings up the GPS port and the drivers, and starts the telemetry and
+ * the recording of the readings
+ * Preconditions: The parameters are loaded, a valid scheduler
+ * Postconditions: Every driver whose hardware was found is running
+ */
+void kayakInit(struct scheduler *scheduler);
+
+/* Parses a byte from the GPS, handling the sentence once it's complete
+ * Preconditions: kayakInit has been called
+ * Postconditions: The byte is part of the GPS's state
+ */
+void kayakGPSByte(uint8_t value);
+
+#endif
@@ -0,0 +1,454 @@
+/* A kayak without the hardware, to try the ground station against and to
+ * load the link. Opens a pseudo terminal, prints the port to give
+ * groundstation, and answers on it as the kayak would, with the kayak's
+ * framing, telemetry, subscription and parameter code.
+ *
+ * Usage: kayaksim [-f file] [-r bytes/s] [-e permille] [-d seconds]
+ *                 [-x seed]
+ *
+ * The parameters are kept in the -f file, kayak.cfg by default, so set its
+ * NODEID, SLOTS, TELEMETRYBUDGET and so on with configtool, or from the
+ * base. Run one per node to try several kayaks on separate ports.
+ *
+ * -r limits how fast bytes get through each way, as the radio would,
+ * and -e corrupts that many in every thousand. It paddles about as it's
+ * told, through the same motor shaping as the kayak, stopping if the
+ * commands stop for FAILSAFETIMEOUT, and prints how the link did when
+ * it's stopped or -d seconds are up. The motors draw a surge as they
+ * spin up, so the peak amps and energy it reports show what the shaping
+ * parameters are worth.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "telemetry.h"
+#include "half.h"
+#include "config.h"
+#include "shape.h"
+
+extern "C" const char *configFile;
+
+/* Where it starts, in millionths of a degree */
+#define STARTLAT 37354100
+#define STARTLNG -121955200
+/* Top speed in km/h, and fastest turn in degrees per second */
+#define TOPSPEED 8.0
+#define TOPTURN 45.0
+/* How often the kayak moves, in ms */
+#define STEP 10
+/* How long the motors take to spin up, in s. Until they have, they draw
+ * more than they do at speed, as much as SPINUPAMPS times the difference.
+ * At speed they draw RUNAMPS times the power, on a steady BATTERY
+ */
+#define SPINUP 0.3
+#define SPINUPAMPS 2.0
+#define RUNAMPS 0.5
+#define BATTERY 0x60
+/* How many amps readings the peak is taken over, as in motor.h */
+#define PEAKREADINGS 8
+#define QUEUESIZE 4096
+
+/* Bytes waiting to go through the simulated radio one way */
+struct link {
+  uint8_t queue[QUEUESIZE];
+  size_t len;
+  /* Bytes the link could carry by now, in millionths */
+  uint64_t credit;
+};
+
+struct kayak {
+  struct framedecoder frames;
+  struct telemetrycodec telemetry;
+  struct telemetrystreams streams;
+  /* When the last frame on the channel ended, in ms */
+  uint32_t slotanchor;
+  float forward, rotate;
+  /* The motor controller's channels, after shaping, and how fast the
+   * motors are actually turning, -1 to 1
+   */
+  q15 out[2];
+  double spin[2];
+  uint32_t lastshape;
+  /* Amps readings, as the motor controller reports them, and the energy
+   * worked out from them, as motorAccount
+   */
+  unsigned amps[2], recent[2][PEAKREADINGS], nextreading;
+  uint32_t lastreading;
+  uint64_t energy;
+  double lat, lng, heading, speed;
+  uint32_t lastcommand;
+  /* Average time between commands, in 1/16 ms, as modemPacketTiming */
+  uint32_t interval;
+  unsigned commands, requests, telemetrysent, trips;
+  bool tripped;
+};
+
+static struct kayak kayak;
+static struct link up, down;
+static volatile sig_atomic_t running = 1;
+static uint32_t seed = 1;
+static unsigned corrupt = 0, corrupted = 0;
+
+uint32_t nowMs(void);
+void stop(int);
+uint32_t simRandom(void);
+
+/* How many of the bytes queued the link has carried by now, which
+ * linkDrop then takes off the queue. A rate of 0 carries everything
+ * straight away
+ */
+size_t linkTake(struct link *link, unsigned rate);
+void linkDrop(struct link *link, unsigned rate, size_t n);
+
+/* Handles a byte from the base, as modemDataByte does */
+void receive(uint8_t byte, uint32_t now);
+void handleFrame(uint32_t now);
+
+/* Sends whatever telemetry is due, as sendTelemetry does, and returns
+ * how long until it next should
+ */
+uint32_t sendTelemetry(uint32_t now);
+void fillTelemetry(struct telemetrysample *sample);
+void paddle(uint32_t now, double dt);
+
+int main(int argc, char **argv)
+{
+  unsigned rate = 0, duration = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "f:r:e:d:x:")) != -1) {
+    switch(opt) {
+    case 'f':
+      configFile = optarg;
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      break;
+    case 'e':
+      corrupt = atoi(optarg);
+      break;
+    case 'd':
+      duration = atoi(optarg);
+      break;
+    case 'x':
+      seed = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-f file] [-r bytes/s] [-e permille] "
+	      "[-d seconds] [-x seed]\n", argv[0]);
+      return 1;
+    }
+  }
+  configLoad(&config);
+  int pty = posix_openpt(O_RDWR | O_NOCTTY);
+  if(pty < 0 || grantpt(pty) || unlockpt(pty)) {
+    perror("Opening a pseudo terminal");
+    return 1;
+  }
+  /* Hold the other end open too, so the port stays up between runs of
+   * the ground station, and make it raw before anyone else opens it
+   */
+  int held = open(ptsname(pty), O_RDWR | O_NOCTTY);
+  struct termios tio;
+  if(held < 0 || tcgetattr(held, &tio)) {
+    perror(ptsname(pty));
+    return 1;
+  }
+  cfmakeraw(&tio);
+  tcsetattr(held, TCSANOW, &tio);
+  fcntl(pty, F_SETFL, fcntl(pty, F_GETFL) | O_NONBLOCK);
+  printf("Node %u on %s\n", config.nodeid, ptsname(pty));
+  fflush(stdout);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  uint32_t start = nowMs(), now = start, moved = start;
+  frameDecoderInit(&kayak.frames, config.nodeid);
+  telemetryInit(&kayak.telemetry);
+  /* The same as the kayak starts with */
+  telemetryStreamsInit(&kayak.streams, config.telemetrybudget, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_TIME, 1000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_LAT, 1000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_LNG, 1000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_HEADING, 100, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_COURSE, 1000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_SPEED, 1000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_SATELLITES, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_HDOP, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_AMPS, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_VOLTS, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_LINKLOSS, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_LINKINTERVAL, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_FAILSAFE, 1000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_PEAKAMPS, 5000, now);
+  telemetrySubscribe(&kayak.streams, TELEMETRY_ENERGY, 5000, now);
+  kayak.lat = STARTLAT;
+  kayak.lng = STARTLNG;
+  kayak.lastcommand = now;
+  kayak.lastshape = now;
+  kayak.lastreading = now;
+  /* Held off until the base is heard from, as the failsafe does */
+  kayak.tripped = true;
+
+  uint32_t pumped = now;
+  while(running) {
+    now = nowMs();
+    if(duration && now - start >= duration * 1000)
+      break;
+    /* The radio carries rate bytes a second each way */
+    uint64_t carried = (uint64_t)(now - pumped) * rate * 1000;
+    pumped = now;
+    up.credit += carried;
+    down.credit += carried;
+    ssize_t got = read(pty, up.queue + up.len, QUEUESIZE - up.len);
+    if(got > 0)
+      up.len += got;
+    size_t n = linkTake(&up, rate);
+    for(size_t i = 0; i < n; i++)
+      receive(up.queue[i], now);
+    linkDrop(&up, rate, n);
+    while(now - moved >= STEP) {
+      moved += STEP;
+      paddle(moved, STEP / 1000.0);
+    }
+    uint32_t wait = sendTelemetry(now);
+    n = linkTake(&down, rate);
+    got = n ? write(pty, down.queue, n) : 0;
+    if(got > 0)
+      linkDrop(&down, rate, got);
+    /* Come back for the bytes the link will have carried by then */
+    if(wait > STEP || up.len || down.len)
+      wait = STEP;
+    struct pollfd pfd;
+    pfd.fd = pty;
+    pfd.events = up.len < QUEUESIZE ? POLLIN : 0;
+    if(poll(&pfd, 1, wait ? wait : 1) < 0 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+  }
+  close(held);
+  close(pty);
+  printf("%u commands, %u requests and %u frames with bad CRCs from the "
+	 "base, %u for other nodes\n", kayak.commands, kayak.requests,
+	 kayak.frames.errors, kayak.frames.ignored);
+  printf("%u telemetry frames sent, failsafe tripped %u times, %u bytes "
+	 "corrupted\n", kayak.telemetrysent, kayak.trips, corrupted);
+  return 0;
+}
+
+uint32_t nowMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void stop(int)
+{
+  running = 0;
+}
+
+uint32_t simRandom(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static uint8_t noise(uint8_t byte)
+{
+  if(corrupt && simRandom() % 1000 < corrupt) {
+    corrupted++;
+    return byte ^ (1 << (simRandom() % 8));
+  }
+  return byte;
+}
+
+size_t linkTake(struct link *link, unsigned rate)
+{
+  if(rate && link->len > link->credit / 1000000)
+    return link->credit / 1000000;
+  return link->len;
+}
+
+void linkDrop(struct link *link, unsigned rate, size_t n)
+{
+  link->len -= n;
+  memmove(link->queue, link->queue + n, link->len);
+  if(rate)
+    link->credit -= n * 1000000ull;
+  /* An idle link doesn't save up */
+  if(!link->len)
+    link->credit = 0;
+}
+
+void receive(uint8_t byte, uint32_t now)
+{
+  byte = noise(byte);
+  bool good = frameDecode(&kayak.frames, byte);
+  if(byte == FRAME_FLAG && frameIdle(&kayak.frames) &&
+     frameFromBase(&kayak.frames))
+    kayak.slotanchor = now;
+  if(good)
+    handleFrame(now);
+}
+
+void handleFrame(uint32_t now)
+{
+  size_t len;
+  const uint8_t *payload = framePayload(&kayak.frames, &len);
+  switch(frameType(&kayak.frames)) {
+  case FRAME_COMMAND:
+    if(len != 4)
+      return;
+    kayak.forward = halfToSingle(halfLoad(payload));
+    kayak.rotate = halfToSingle(halfLoad(payload + 2));
+    if(kayak.commands) {
+      /* An eighth of the way to the new interval, in 1/16 ms */
+      int32_t interval = (now - kayak.lastcommand) * 16;
+      kayak.interval += (interval - (int32_t)kayak.interval) / 8;
+    }
+    kayak.commands++;
+    kayak.lastcommand = now;
+    kayak.tripped = false;
+    break;
+  case FRAME_SUBSCRIBE:
+    kayak.requests++;
+    telemetryRequest(&kayak.streams, payload, len, now);
+    break;
+  case FRAME_CONFIG:
+    kayak.requests++;
+    configRequest(&config, payload, len);
+    break;
+  default:
+    break;
+  }
+}
+
+uint32_t sendTelemetry(uint32_t now)
+{
+  uint32_t wait;
+  uint32_t due = telemetryDue(&kayak.streams, now, &wait);
+  if(!due)
+    return wait;
+  uint32_t slot = frameSlotWait(now, kayak.slotanchor, config.nodeid - 1,
+				config.slots, config.slotlength);
+  if(slot)
+    return slot;
+  struct telemetrysample sample;
+  sample.mask = 0;
+  fillTelemetry(&sample);
+  sample.mask &= due | telemetryKeyFields(&kayak.telemetry, &kayak.streams);
+  uint8_t frame[TELEMETRY_MAXFRAME], encoded[FRAME_MAXENCODED];
+  size_t size = telemetryEncode(&kayak.telemetry, &sample, frame,
+				sizeof(frame));
+  size_t len = frameEncode(encoded, sizeof(encoded), config.nodeid,
+			   FRAME_TELEMETRY, frame, size);
+  /* A full queue loses the frame, as the modem's buffer would */
+  if(down.len + len <= QUEUESIZE) {
+    for(size_t i = 0; i < len; i++)
+      down.queue[down.len++] = noise(encoded[i]);
+    kayak.telemetrysent++;
+  }
+  telemetrySent(&kayak.streams, due, size, now);
+  telemetryDue(&kayak.streams, now, &wait);
+  return wait;
+}
+
+static void telemetrySet(struct telemetrysample *sample,
+			 enum telemetryfield field, int32_t value)
+{
+  sample->values[field] = value;
+  sample->mask |= 1ul << field;
+}
+
+void fillTelemetry(struct telemetrysample *sample)
+{
+  time_t wall = time(NULL);
+  telemetrySet(sample, TELEMETRY_TIME, wall % 86400);
+  telemetrySet(sample, TELEMETRY_LAT, kayak.lat);
+  telemetrySet(sample, TELEMETRY_LNG, kayak.lng);
+  telemetrySet(sample, TELEMETRY_SATELLITES, 9);
+  telemetrySet(sample, TELEMETRY_HDOP, 90);
+  telemetrySet(sample, TELEMETRY_COURSE, kayak.heading * 100);
+  telemetrySet(sample, TELEMETRY_HEADING, kayak.heading * 10);
+  telemetrySet(sample, TELEMETRY_SPEED, kayak.speed * 100);
+  telemetrySet(sample, TELEMETRY_AMPS, kayak.amps[0] | (kayak.amps[1] << 8));
+  telemetrySet(sample, TELEMETRY_VOLTS, BATTERY | (BATTERY << 8));
+  unsigned peak[2] = {0, 0};
+  for(int i = 0; i < 2; i++) {
+    for(int j = 0; j < PEAKREADINGS; j++) {
+      if(kayak.recent[i][j] > peak[i])
+	peak[i] = kayak.recent[i][j];
+    }
+  }
+  telemetrySet(sample, TELEMETRY_PEAKAMPS, peak[0] | (peak[1] << 8));
+  telemetrySet(sample, TELEMETRY_ENERGY, kayak.energy / 1000);
+  unsigned total = kayak.commands + kayak.frames.errors;
+  telemetrySet(sample, TELEMETRY_LINKLOSS,
+	       total ? kayak.frames.errors * 1000 / total : 0);
+  telemetrySet(sample, TELEMETRY_LINKINTERVAL, kayak.interval / 16);
+  telemetrySet(sample, TELEMETRY_FAILSAFE, kayak.trips * 2 + kayak.tripped);
+}
+
+void paddle(uint32_t now, double dt)
+{
+  /* Commands arrive between steps, so one can be newer than now */
+  if(!kayak.tripped &&
+     (int32_t)(now - kayak.lastcommand) > (int32_t)config.failsafetimeout) {
+    kayak.tripped = true;
+    kayak.trips++;
+  }
+  /* Through the same shaping as the kayak's motors */
+  if(now - kayak.lastshape >= config.motorperiod) {
+    kayak.lastshape = now;
+    struct shapeparams params;
+    shapeSetup(&params, config.motorperiod, config.stickdeadband, config.expo,
+	       config.motorrise, config.motorfall, config.motormix);
+    shapeStep(&params, kayak.tripped ? 0 : q15FromFloat(kayak.forward),
+	      kayak.tripped ? 0 : q15FromFloat(kayak.rotate), kayak.out);
+  }
+  for(int i = 0; i < 2; i++) {
+    double power = q15ToFloat(kayak.out[i]);
+    double amps = SPINUPAMPS * fabs(power - kayak.spin[i]) +
+      RUNAMPS * fabs(kayak.spin[i]);
+    kayak.amps[i] = fmin(amps, 1) * 0x7F;
+    kayak.spin[i] += (power - kayak.spin[i]) * dt / SPINUP;
+  }
+  if(now - kayak.lastreading >= config.motorpoll) {
+    for(int i = 0; i < 2; i++)
+      kayak.recent[i][kayak.nextreading] = kayak.amps[i];
+    kayak.nextreading = (kayak.nextreading + 1) % PEAKREADINGS;
+    kayak.energy += (uint64_t)(kayak.amps[0] + kayak.amps[1]) * BATTERY *
+      (now - kayak.lastreading);
+    kayak.lastreading = now;
+  }
+  /* Channel A is forward and B rotation, unless the kayak mixes them */
+  float forward = kayak.spin[0], rotate = kayak.spin[1];
+  if(config.motormix) {
+    forward = (kayak.spin[0] + kayak.spin[1]) / 2;
+    rotate = (kayak.spin[0] - kayak.spin[1]) / 2;
+  }
+  kayak.heading = fmod(kayak.heading + rotate * TOPTURN * dt + 360, 360);
+  kayak.speed = fabs(forward) * TOPSPEED;
+  /* km to millionths of a degree */
+  double km = forward * TOPSPEED * dt / 3600, radians = kayak.heading * M_PI / 180;
+  kayak.lat += km * cos(radians) / 111.32 * 1e6;
+  kayak.lng += km * sin(radians) / (111.32 * cos(kayak.lat * 1e-6 * M_PI / 180)) *
+    1e6;
+}
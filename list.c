@@ -1,94 +1,120 @@
 
 #include "list.h"
+#include "arena.h"
 
 #include <stdbool.h>
-#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
+typedef unsigned short listindex;
+
+/* Marks the end of the free list, or an empty list */
+#define LISTNIL 0xFFFF
+
 typedef struct listnode listnode;
 
 struct listnode {
-	listnode *prev, *next;
+	listindex prev, next;
 	void *data;
 };
 
 struct list {
-	listnode *current;
+	listnode *nodes;
+	unsigned capacity;
 	unsigned size;
+	listindex current;
+	/* Unused nodes, linked through next */
+	listindex freelist;
 };
 
+int _dbgListCheck(list *lst);
+
 #ifdef _LIST_DEBUG_
 #define listCheck _dbgListCheck
 #else
-int listCheck(list *lst) { return true; }
+static inline int listCheck(list *lst) { (void)lst; return true; }
 #endif
 
 list *listCreate()
 {
-	list *lst = (list *)malloc(sizeof(list));
-	lst->current = NULL;
+	return listCreateCapacity(LISTDEFAULTCAPACITY);
+}
+
+list *listCreateCapacity(unsigned capacity)
+{
+	if(capacity == 0 || capacity >= LISTNIL)
+		return NULL;
+	/* One allocation for the list and all of its nodes */
+	list *lst = (list *)arenaAlloc(sizeof(list) + sizeof(listnode[capacity]));
+	if(!lst)
+		return NULL;
+	lst->nodes = (listnode *)(lst + 1);
+	lst->capacity = capacity;
 	lst->size = 0;
+	lst->current = LISTNIL;
+	listindex i;
+	for(i = 0; i < capacity; i++)
+		lst->nodes[i].next = i + 1;
+	lst->nodes[capacity - 1].next = LISTNIL;
+	lst->freelist = 0;
 	return lst;
 }
 
 void listFree(list *lst)
 {
 	assert(listCheck(lst));
-	if(lst->current) {
-		listnode *start = lst->current;
-		do {
-			listnode *next = lst->current->next;
-			free(lst->current);
-			lst->current = next;
-		} while(lst->current != start);
-	}
-	free(lst);
+	arenaRelease(lst);
 }
 
-void listInsert(list *lst, void *data)
+int listInsert(list *lst, void *data)
 {
 	assert(lst && listCheck(lst));
-	listnode *node = (listnode *)malloc(sizeof(listnode));
-	if(lst->current) {
+	listindex index = lst->freelist;
+	if(index == LISTNIL)
+		return false;
+	listnode *nodes = lst->nodes,
+		*node = &nodes[index];
+	lst->freelist = node->next;
+	if(lst->current != LISTNIL) {
+		listnode *cur = &nodes[lst->current];
 		node->next = lst->current;
-		node->prev = lst->current->prev;
-		node->prev->next = node;
-		node->next->prev = node;
-		if(lst->current->next == lst->current) {
-			lst->current->next = node;
-		}
+		node->prev = cur->prev;
+		nodes[node->prev].next = index;
+		cur->prev = index;
 	}
 	else {
-		node->next = node;
-		node->prev = node;
+		node->next = index;
+		node->prev = index;
 	}
-	lst->current = node;
+	lst->current = index;
 	node->data = data;
 	lst->size++;
+	return true;
 }
 
 void listDeleteCurrent(list *lst)
 {
-	assert(lst && lst->current && listCheck(lst));
-	listnode *next = lst->current->next,
-		*prev = lst->current->prev;
-	free(lst->current);
+	assert(lst && lst->current != LISTNIL && listCheck(lst));
+	listindex index = lst->current;
+	listnode *nodes = lst->nodes,
+		*node = &nodes[index];
 	lst->size--;
 	if(lst->size == 0) {
-		lst->current = NULL;
+		lst->current = LISTNIL;
 	}
 	else {
-		lst->current = next;
-		next->prev = prev;
-		prev->next = next;
+		lst->current = node->next;
+		nodes[node->next].prev = node->prev;
+		nodes[node->prev].next = node->next;
 	}
+	node->next = lst->freelist;
+	lst->freelist = index;
 }
 
 void *listGetCurrent(list *lst)
 {
-	assert(lst && lst->current && listCheck(lst));
-	return lst->current->data;
+	assert(lst && lst->current != LISTNIL && listCheck(lst));
+	return lst->nodes[lst->current].data;
 }
 
 int listSize(list *lst)
@@ -100,29 +126,50 @@ int listSize(list *lst)
 void listMoveBack(list *lst)
 {
 	assert(lst && listCheck(lst));
-	if(lst->current)
-		lst->current = lst->current->prev;
+	if(lst->current != LISTNIL)
+		lst->current = lst->nodes[lst->current].prev;
 }
 
 void listMoveForward(list *lst)
 {
 	assert(lst && listCheck(lst));
-	if(lst->current)
-		lst->current = lst->current->next;
+	if(lst->current != LISTNIL)
+		lst->current = lst->nodes[lst->current].next;
 }
 
 int _dbgListCheck(list *lst)
 {
-	if(!lst->current)
-		return true;
-	listnode *node = lst->current;
-	int listsize = lst->size,
-		i;
-	for(i = 0; i < listsize; i++, node = node->next) {
-		if(node != node->next->prev || node != node->prev->next) {
+	listnode *nodes = lst->nodes;
+	unsigned i, count;
+	listindex index;
+	if(lst->size > lst->capacity)
+		return 0;
+	/* The ring has size nodes, each linked both ways, and comes back
+	 * around to the current node
+	 */
+	if(lst->size == 0) {
+		if(lst->current != LISTNIL)
 			return 0;
+	}
+	else {
+		index = lst->current;
+		for(i = 0; i < lst->size; i++) {
+			if(index >= lst->capacity)
+				return 0;
+			listnode *node = &nodes[index];
+			if(node->next >= lst->capacity || node->prev >= lst->capacity ||
+				 nodes[node->next].prev != index || nodes[node->prev].next != index)
+				return 0;
+			index = node->next;
 		}
+		if(index != lst->current)
+			return 0;
 	}
-	return true;
+	/* And every other node is on the free list */
+	count = 0;
+	for(index = lst->freelist; index != LISTNIL; index = nodes[index].next) {
+		if(index >= lst->capacity || ++count > lst->capacity)
+			return 0;
+	}
+	return count == lst->capacity - lst->size;
 }
-
@@ -6,12 +6,27 @@
 extern "C" {
 #endif
 
+/* A circular list with a cursor.
+ * The nodes all live in one array allocated with the list, and are
+ * linked by index, so inserting and deleting never touch the heap.
+ * Define _LIST_DEBUG_ to check the lists invariants on every call.
+ */
 typedef struct list list;
 
+/* Number of nodes listCreate makes room for */
+#define LISTDEFAULTCAPACITY 32
+
+/* Creates a list with room for capacity elements, or LISTDEFAULTCAPACITY
+ * with listCreate. Returns NULL if out of memory.
+ */
 list *listCreate();
+list *listCreateCapacity(unsigned capacity);
 void listFree(list *lst);
 
-void listInsert(list *lst, void *data);
+/* Inserts before the current element, and makes the new element current.
+ * Returns false if the list is full.
+ */
+int listInsert(list *lst, void *data);
 void listDeleteCurrent(list *lst);
 void *listGetCurrent(list *lst);
 
@@ -25,4 +40,3 @@ void listMoveForward(list *lst);
 #endif
 
 #endif
-
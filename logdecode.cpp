@@ -0,0 +1,211 @@
+/* Turns the binary log records the kayak sends over the debug port back
+ * into text.
+ *
+ * Usage: logdecode [-r recorderfile] [-t tracefile] [-s schedulefile] [file]
+ * Reads from stdin without a file, so it can be given the serial port
+ * directly, or a capture of it.
+ * Bulk data sent along with the log is written out to a file of its own,
+ * a flight recorder download to recorderfile for recdecode, a trace
+ * of the peripherals' traffic to tracefile for replay, and a trace of
+ * the scheduler's operations to schedulefile for bench. Without the
+ * option it's ignored.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logmsgs.h"
+
+struct logformat {
+  const char *name;
+  const char *module;
+  int level;
+  unsigned nargs;
+  const char *format;
+};
+
+#define LOGFORMAT(name, module, level, nargs, format) \
+  {#name, #module, level, nargs, format},
+static const struct logformat formats[] = {
+  LOGMESSAGES(LOGFORMAT)
+};
+#undef LOGFORMAT
+
+static const unsigned nformats = sizeof(formats) / sizeof(formats[0]);
+
+static const char *levels[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+
+size_t getVarint(const uint8_t *buf, size_t len, uint32_t *value);
+void printRecord(const uint8_t *record, size_t len);
+void printFormatted(const char *format, const int32_t *args, unsigned nargs);
+
+int main(int argc, char **argv)
+{
+  FILE *input = stdin;
+  /* Where each kind of bulk data goes, from LOGRAW_FIRST up */
+  FILE *raw[0x100 - LOGRAW_FIRST] = {NULL};
+  int opt;
+  while((opt = getopt(argc, argv, "r:t:s:")) != -1) {
+    unsigned id;
+    switch(opt) {
+    case 'r':
+      id = LOGRAW_RECORDER;
+      break;
+    case 't':
+      id = LOGRAW_TRACE;
+      break;
+    case 's':
+      id = LOGRAW_SCHEDULE;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-r recorderfile] [-t tracefile] "
+	      "[-s schedulefile] [file]\n", argv[0]);
+      return 1;
+    }
+    raw[id - LOGRAW_FIRST] = fopen(optarg, "wb");
+    if(!raw[id - LOGRAW_FIRST]) {
+      perror(optarg);
+      return 1;
+    }
+  }
+  if(optind < argc) {
+    input = fopen(argv[optind], "rb");
+    if(!input) {
+      perror(argv[optind]);
+      return 1;
+    }
+  }
+  /* Anything that isn't a whole record with a good checksum is skipped,
+   * a byte at a time, until the next sync byte
+   */
+  uint8_t record[LOGMAXLENGTH + 3];
+  size_t have = 0;
+  unsigned skipped = 0;
+  int c;
+  while((c = fgetc(input)) != EOF) {
+    record[have++] = c;
+    while(have > 0) {
+      if(record[0] != LOGSYNC || (have > 1 && record[1] > LOGMAXLENGTH)) {
+	memmove(record, record + 1, --have);
+	skipped++;
+	continue;
+      }
+      if(have < 2 || have < (size_t)record[1] + 3)
+	break;
+      size_t len = record[1];
+      uint8_t check = 0;
+      for(size_t i = 0; i < len; i++)
+	check ^= record[i + 2];
+      if(check != record[len + 2]) {
+	memmove(record, record + 1, --have);
+	skipped++;
+	continue;
+      }
+      if(skipped) {
+	fprintf(stderr, "Skipped %u bytes\n", skipped);
+	skipped = 0;
+      }
+      if(record[2] >= LOGRAW_FIRST) {
+	FILE *out = raw[record[2] - LOGRAW_FIRST];
+	if(out)
+	  fwrite(record + 3, 1, len - 1, out);
+      }
+      else
+	printRecord(record + 2, len);
+      have -= len + 3;
+      memmove(record, record + len + 3, have);
+    }
+  }
+  if(input != stdin)
+    fclose(input);
+  for(unsigned i = 0; i < sizeof(raw) / sizeof(raw[0]); i++)
+    if(raw[i])
+      fclose(raw[i]);
+  return 0;
+}
+
+void printRecord(const uint8_t *record, size_t len)
+{
+  unsigned id = record[0];
+  if(id >= nformats) {
+    printf("Unknown message %u, is the decoder out of date?\n", id);
+    return;
+  }
+  const struct logformat *fmt = &formats[id];
+  size_t pos = 1;
+  uint32_t ticks;
+  size_t used = getVarint(record + pos, len - pos, &ticks);
+  if(!used) {
+    printf("Truncated %s\n", fmt->name);
+    return;
+  }
+  pos += used;
+  int32_t args[LOGMAXARGS];
+  unsigned nargs;
+  for(nargs = 0; nargs < LOGMAXARGS && pos < len; nargs++) {
+    uint32_t zigzag;
+    used = getVarint(record + pos, len - pos, &zigzag);
+    if(!used)
+      break;
+    pos += used;
+    args[nargs] = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+  }
+  printf("%10u %-5s %-7s ", ticks, levels[fmt->level], fmt->module);
+  if(nargs != fmt->nargs)
+    printf("(%u arguments, expected %u) ", nargs, fmt->nargs);
+  printFormatted(fmt->format, args, nargs);
+  printf("\n");
+}
+
+void printFormatted(const char *format, const int32_t *args, unsigned nargs)
+{
+  unsigned arg = 0;
+  for(const char *c = format; *c; c++) {
+    if(*c != '%') {
+      putchar(*c);
+      continue;
+    }
+    c++;
+    if(*c == '%') {
+      putchar('%');
+      continue;
+    }
+    if(!*c)
+      break;
+    if(arg >= nargs) {
+      printf("?");
+      continue;
+    }
+    int32_t value = args[arg++];
+    switch(*c) {
+    case 'd':
+      printf("%d", value);
+      break;
+    case 'u':
+      printf("%u", (uint32_t)value);
+      break;
+    case 'x':
+      printf("%x", (uint32_t)value);
+      break;
+    case 'c':
+      putchar(value);
+      break;
+    default:
+      printf("?");
+      break;
+    }
+  }
+}
+
+size_t getVarint(const uint8_t *buf, size_t len, uint32_t *value)
+{
+  *value = 0;
+  for(size_t i = 0; i < len && i < 5; i++) {
+    *value |= (uint32_t)(buf[i] & 0x7F) << (7 * i);
+    if(!(buf[i] & 0x80))
+      return i + 1;
+  }
+  return 0;
+}
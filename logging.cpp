@@ -0,0 +1,180 @@
+
+#include "logging.h"
+#include "include.h"
+#include "scheduler.h"
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+/* Size of the ring buffer, must be a power of 2 */
+#ifndef LOGBUFSIZE
+#define LOGBUFSIZE 1024
+#endif
+#if LOGBUFSIZE & (LOGBUFSIZE - 1)
+#error "LOGBUFSIZE must be a power of 2"
+#endif
+/* How often the DMA is checked on while there's something to send, in ms.
+ * At 115200 baud the port sends about 115 bytes in that time.
+ */
+#define LOGDRAINPERIOD 10
+
+static struct {
+  uint8_t buffer[LOGBUFSIZE];
+  /* Free running, wrapped on use */
+  unsigned head, tail;
+  /* Bytes handed to the DMA, from the tail */
+  unsigned sending;
+  /* Records lost since the last one that fit */
+  unsigned dropped;
+  bool started;
+  bool draining;
+} logring;
+
+void logDrain(void *);
+size_t logEncode(uint8_t *record, unsigned id, unsigned nargs,
+		 const int32_t *args);
+size_t logPutVarint(uint8_t *buf, uint32_t value);
+
+void logInit(void)
+{
+  /* The Arduino core has set the port up, but it writes a byte at a time.
+   * Take over the transmit side with the peripheral DMA controller.
+   */
+  UART->UART_PTCR = UART_PTCR_TXTDIS;
+  UART->UART_TCR = 0;
+  UART->UART_PTCR = UART_PTCR_TXTEN;
+  logring.started = true;
+  if(logring.head != logring.tail) {
+    logring.draining = true;
+    registerTimer(0, logDrain, NULL);
+  }
+}
+
+void logRecord(unsigned id, unsigned nargs, ...)
+{
+  int32_t values[LOGMAXARGS];
+  if(nargs > LOGMAXARGS)
+    nargs = LOGMAXARGS;
+  va_list args;
+  va_start(args, nargs);
+  for(unsigned i = 0; i < nargs; i++)
+    values[i] = va_arg(args, int);
+  va_end(args);
+  uint8_t record[LOGMAXRECORD];
+  size_t size = logEncode(record, id, nargs, values);
+  if(logring.dropped) {
+    /* Say how much went missing before anything else */
+    uint8_t lost[LOGMAXRECORD];
+    int32_t count = logring.dropped;
+    size_t lostsize = logEncode(lost, LOGMSG_LOG_DROPPED, 1, &count);
+    if(LOGBUFSIZE - (logring.head - logring.tail) < lostsize + size) {
+      logring.dropped++;
+      return;
+    }
+    logring.dropped = 0;
+    for(size_t i = 0; i < lostsize; i++)
+      logring.buffer[logring.head++ & (LOGBUFSIZE - 1)] = lost[i];
+  }
+  if(LOGBUFSIZE - (logring.head - logring.tail) < size) {
+    logring.dropped++;
+    return;
+  }
+  for(size_t i = 0; i < size; i++)
+    logring.buffer[logring.head++ & (LOGBUFSIZE - 1)] = record[i];
+  if(logring.started && !logring.draining) {
+    logring.draining = true;
+    registerTimer(0, logDrain, NULL);
+  }
+}
+
+bool logRaw(unsigned id, const uint8_t *data, size_t len)
+{
+  if(len > logRawRoom())
+    return false;
+  uint8_t check = id;
+  logring.buffer[logring.head++ & (LOGBUFSIZE - 1)] = LOGSYNC;
+  logring.buffer[logring.head++ & (LOGBUFSIZE - 1)] = len + 1;
+  logring.buffer[logring.head++ & (LOGBUFSIZE - 1)] = id;
+  for(size_t i = 0; i < len; i++) {
+    logring.buffer[logring.head++ & (LOGBUFSIZE - 1)] = data[i];
+    check ^= data[i];
+  }
+  logring.buffer[logring.head++ & (LOGBUFSIZE - 1)] = check;
+  if(logring.started && !logring.draining) {
+    logring.draining = true;
+    registerTimer(0, logDrain, NULL);
+  }
+  return true;
+}
+
+size_t logRawRoom(void)
+{
+  /* Sync, length, ID and checksum */
+  size_t room = LOGBUFSIZE - (logring.head - logring.tail);
+  if(room < 4)
+    return 0;
+  room -= 4;
+  return room < LOGMAXRAW ? room : LOGMAXRAW;
+}
+
+void logDrain(void *)
+{
+  /* Whatever the DMA was given last time has gone out once the
+   * counter runs down
+   */
+  if(UART->UART_TCR != 0) {
+    registerTimer(LOGDRAINPERIOD, logDrain, NULL);
+    return;
+  }
+  logring.tail += logring.sending;
+  logring.sending = 0;
+  unsigned pending = logring.head - logring.tail;
+  if(pending == 0) {
+    logring.draining = false;
+    return;
+  }
+  /* The DMA can only send up to the end of the buffer, the rest goes
+   * next time
+   */
+  unsigned start = logring.tail & (LOGBUFSIZE - 1);
+  unsigned size = pending;
+  if(start + size > LOGBUFSIZE)
+    size = LOGBUFSIZE - start;
+  logring.sending = size;
+  UART->UART_TPR = (uint32_t)(uintptr_t)&logring.buffer[start];
+  UART->UART_TCR = size;
+  registerTimer(LOGDRAINPERIOD, logDrain, NULL);
+}
+
+size_t logEncode(uint8_t *record, unsigned id, unsigned nargs,
+		 const int32_t *args)
+{
+  record[0] = LOGSYNC;
+  size_t size = 2;
+  record[size++] = id;
+  size += logPutVarint(&record[size], GetTickCount());
+  for(unsigned i = 0; i < nargs; i++) {
+    /* Zigzag, so small negative numbers are short too */
+    size += logPutVarint(&record[size],
+			 ((uint32_t)args[i] << 1) ^ (args[i] >> 31));
+  }
+  record[1] = size - 2;
+  uint8_t check = 0;
+  for(size_t i = 2; i < size; i++)
+    check ^= record[i];
+  record[size++] = check;
+  return size;
+}
+
+size_t logPutVarint(uint8_t *buf, uint32_t value)
+{
+  size_t i = 0;
+  do {
+    buf[i] = value & 0x7F;
+    value >>= 7;
+    if(value)
+      buf[i] |= 0x80;
+    i++;
+  } while(value);
+  return i;
+}
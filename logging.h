@@ -0,0 +1,91 @@
+#ifndef _LOGGING_H_
+#define _LOGGING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "logmsgs.h"
+
+/* Structured binary logging.
+ * LOG(name, args...) appends a record with the message ID and its integer
+ * arguments to a RAM ring buffer, which is sent out the debug port by DMA
+ * in the background. Nothing waits on the serial port.
+ * logdecode turns the records back into text on the host.
+ *
+ * Messages more verbose than their module's level are compiled out
+ * entirely. The level defaults to LOG_DEBUG, or LOG_WARN in the release
+ * version, and can be set per module with -DLOGLEVEL_<module>.
+ *
+ * Only call LOG from the main loop, never from an interrupt handler.
+ */
+
+#ifndef LOGLEVEL_DEFAULT
+#ifndef RELEASE_VERSION
+#define LOGLEVEL_DEFAULT LOG_DEBUG
+#else
+#define LOGLEVEL_DEFAULT LOG_WARN
+#endif
+#endif
+
+#ifndef LOGLEVEL_MAIN
+#define LOGLEVEL_MAIN LOGLEVEL_DEFAULT
+#endif
+#ifndef LOGLEVEL_SCHED
+/* Draining the log registers a timer, so don't log that by default */
+#define LOGLEVEL_SCHED LOG_INFO
+#endif
+#ifndef LOGLEVEL_MODEM
+#define LOGLEVEL_MODEM LOGLEVEL_DEFAULT
+#endif
+#ifndef LOGLEVEL_MOTOR
+#define LOGLEVEL_MOTOR LOGLEVEL_DEFAULT
+#endif
+#ifndef LOGLEVEL_COMPASS
+#define LOGLEVEL_COMPASS LOGLEVEL_DEFAULT
+#endif
+
+#define LOGID(name, module, level, nargs, format) LOGMSG_##name,
+enum logmessage {
+  LOGMESSAGES(LOGID)
+  LOGMSG_COUNT
+};
+#undef LOGID
+
+/* Whether each message is compiled in, and how many arguments it takes */
+#define LOGENABLED(name, module, level, nargs, format) \
+  LOGON_##name = (level) <= LOGLEVEL_##module,
+#define LOGNARGS(name, module, level, nargs, format) LOGARGS_##name = nargs,
+enum {
+  LOGMESSAGES(LOGENABLED)
+  LOGMESSAGES(LOGNARGS)
+};
+#undef LOGENABLED
+#undef LOGNARGS
+
+#define LOG(name, ...)							\
+  do {									\
+    if(LOGON_##name)							\
+      logRecord(LOGMSG_##name, LOGARGS_##name, ##__VA_ARGS__);		\
+  } while(0)
+
+/* Starts sending the log out the debug port. Records logged before this
+ * are kept until then.
+ * Preconditions: The debug port and the scheduler have been initialized
+ */
+void logInit(void);
+
+/* Appends a record to the ring buffer, use LOG instead.
+ * Dropped, and counted, if the buffer is full.
+ */
+void logRecord(unsigned id, unsigned nargs, ...);
+
+/* Sends bulk data, up to LOGMAXRAW bytes, along with the log, in a record
+ * with the given LOGRAW_ ID.
+ * Returns false, and sends nothing, if there isn't room for all of it.
+ * Bulk data is never dropped, so callers should wait and try again.
+ */
+bool logRaw(unsigned id, const uint8_t *data, size_t len);
+
+/* How much bulk data logRaw would take right now */
+size_t logRawRoom(void);
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef _LOGMSGS_H_
+#define _LOGMSGS_H_
+
+/* Every message the kayak can log, shared with the host decoder.
+ * Only the ID and the arguments are sent, the decoder fills them into the
+ * format. Arguments are integers, print them with %d, %u, %x or %c.
+ *
+ * X(name, module, level, number of arguments, format)
+ *
+ * New messages go on the end, so old logs still decode.
+ */
+#define LOGMESSAGES(X) \
+  X(LOG_DROPPED, MAIN, LOG_WARN, 1, "%u log records dropped") \
+  X(ALLOC_FAILED, MAIN, LOG_ERROR, 1, "Could not allocate memory for module %u") \
+  X(MODEM_CONNECTING, MAIN, LOG_INFO, 0, "Attempting to connect the modem") \
+  X(MODEM_ABSENT, MAIN, LOG_WARN, 0, "Modem not connected") \
+  X(MODEM_PRESENT, MAIN, LOG_INFO, 0, "Modem connected") \
+  X(MOTOR_CONNECTING, MAIN, LOG_INFO, 0, "Attempting to connect the motor controller") \
+  X(MOTOR_ABSENT, MAIN, LOG_WARN, 0, "Motor controller not connected") \
+  X(MOTOR_PRESENT, MAIN, LOG_INFO, 0, "Motor controller connected") \
+  X(COMPASS_INIT, MAIN, LOG_INFO, 0, "Initializing the compass") \
+  X(MEM_ARENA, MAIN, LOG_INFO, 5, "Arena: %u of %u bytes, peak %u, %u allocations, %u failed") \
+  X(MEM_EVENTS, MAIN, LOG_INFO, 5, "Events: %u of %u bytes, peak %u, %u allocations, %u failed") \
+  X(POWER_RESIDENCY, MAIN, LOG_INFO, 3, "Power mode %u: %u permille, entered %u times") \
+  X(SCHED_FULL, SCHED, LOG_ERROR, 0, "Too many timers registered") \
+  X(SCHED_REGISTER, SCHED, LOG_DEBUG, 1, "Registering timer for %u ms from now") \
+  X(MODEM_CHECKING, MODEM, LOG_DEBUG, 0, "Checking for modem connection") \
+  X(MODEM_CONNECTED, MODEM, LOG_INFO, 0, "Modem connected to the base") \
+  X(MODEM_DISCONNECTED, MODEM, LOG_WARN, 0, "Connection lost") \
+  X(MODEM_BYTE, MODEM, LOG_DEBUG, 1, "Received data: %x") \
+  X(MODEM_PACKET, MODEM, LOG_DEBUG, 4, "Packet: forward %x (%d), rotation %x (%d)") \
+  X(MOTOR_CHECKING, MOTOR, LOG_DEBUG, 0, "Checking for motor controller connection") \
+  X(MOTOR_NOAMPS, MOTOR, LOG_WARN, 0, "Could not read amps") \
+  X(MOTOR_AMPS, MOTOR, LOG_DEBUG, 3, "Read amp values: %d, %u, %u") \
+  X(MOTOR_NOVOLTS, MOTOR, LOG_WARN, 0, "Could not read voltages") \
+  X(MOTOR_VOLTS, MOTOR, LOG_DEBUG, 3, "Read volt values: %d, %u, %u") \
+  X(MOTOR_SPEED, MOTOR, LOG_DEBUG, 2, "Motor commands %x, %x") \
+  X(COMPASS_UPDATE, COMPASS, LOG_DEBUG, 0, "Compass Update") \
+  X(CONFIG_LOADED, MAIN, LOG_INFO, 0, "Configuration loaded") \
+  X(CONFIG_DEFAULTS, MAIN, LOG_WARN, 0, "No saved configuration, using the defaults") \
+  X(RECORDER_FULL, MAIN, LOG_WARN, 0, "Flash is behind, dropping recorder records") \
+  X(RECORDER_DOWNLOAD, MAIN, LOG_INFO, 1, "Recorder download started, %u records dropped so far") \
+  X(TRACE_DROPPED, MAIN, LOG_ERROR, 1, "%u trace events dropped, the trace can't be replayed") \
+  X(PROFILE_INTERVAL, MAIN, LOG_INFO, 1, "Profile of the last %u ms") \
+  X(PROFILE_PROBE, MAIN, LOG_INFO, 5, "Probe %u: %u calls, %u to %u cycles, %u in all") \
+  X(MODEM_LINK_LOST, MODEM, LOG_WARN, 1, "No packets from the base for %u ms") \
+  X(MODEM_LINK_BACK, MODEM, LOG_INFO, 1, "Packets from the base again after %u ms") \
+  X(MODEM_DROPPED, MODEM, LOG_WARN, 1, "Link silent for %u ms, hanging up") \
+  X(MODEM_RECONNECTING, MODEM, LOG_INFO, 1, "Resetting the modem, next retry in %u ms") \
+  X(MODEM_NORESPONSE, MODEM, LOG_WARN, 1, "Modem didn't answer in state %u") \
+  X(MODEM_RSSI, MODEM, LOG_INFO, 1, "Modem signal register %u") \
+  X(FAILSAFE_TRIPPED, MAIN, LOG_WARN, 1, "No command for %u ms, stopping the motors") \
+  X(FAILSAFE_CLEARED, MAIN, LOG_INFO, 1, "Commands again after %u ms") \
+  X(CONTROL_SETPOINT, MAIN, LOG_INFO, 1, "Setpoint of kind %u from the base") \
+  X(CONTROL_NOFIX, MAIN, LOG_WARN, 0, "No position yet, waypoint ignored") \
+  X(PROFILE_EVENT, MAIN, LOG_INFO, 5, "Event %x: %u calls, %u to %u cycles, %u in all")
+
+/* Modules which can have their level set separately, with
+ * -DLOGLEVEL_<module>=<level>
+ */
+#define LOGMODULES(X) \
+  X(MAIN) \
+  X(SCHED) \
+  X(MODEM) \
+  X(MOTOR) \
+  X(COMPASS)
+
+/* Which module failed to allocate memory, for ALLOC_FAILED */
+enum logallocmodule {
+  LOGALLOC_SCHEDULER,
+  LOGALLOC_MODEM,
+  LOGALLOC_MOTOR,
+  LOGALLOC_COMPASS,
+  LOGALLOC_ESTIMATOR,
+  LOGALLOC_CONTROL,
+  LOGALLOC_FAILSAFE
+};
+
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+/* A record on the wire is
+ *   LOGSYNC
+ *   length of what follows, up to the checksum
+ *   message ID
+ *   tick count, varint
+ *   arguments, zigzag varints
+ *   checksum, the xor of every byte from the message ID on
+ * Varints are 7 bits per byte, least significant first, with the top bit
+ * set on all but the last byte, as in the telemetry.
+ */
+#define LOGSYNC 0xA5
+#define LOGMAXARGS 5
+#define LOGMAXRECORD (3 + 5 + LOGMAXARGS * 5 + 1)
+
+/* Records with these IDs carry bulk data instead of a message, a flight
+ * recorder download, a trace of the peripherals' traffic, or a trace of
+ * the scheduler's operations. They have no tick count, and what follows
+ * the ID is the data itself, up to LOGMAXRAW bytes.
+ */
+#define LOGRAW_RECORDER 0xFF
+#define LOGRAW_TRACE 0xFE
+#define LOGRAW_SCHEDULE 0xFD
+#define LOGRAW_FIRST LOGRAW_SCHEDULE
+#define LOGMAXRAW 128
+/* Longest the length byte of any record can be */
+#define LOGMAXLENGTH (LOGMAXRAW + 1)
+
+#endif
@@ -2,6 +2,15 @@
 #include "modem.h"
 
 #include "scheduler.h"
+#include "arena.h"
+#include "config.h"
+#include "half.h"
+#include "frame.h"
+#include "logging.h"
+#include "recorder.h"
+#include "trace.h"
+#include "failsafe.h"
+#include "power.h"
 
 const char *IDENTIFY = "+++";
 const char *CONNSTR = "CONNECT";
@@ -14,22 +23,47 @@ const char *GOODRESPONSE = "OK\r\n";
 const int GOODRESPONSELEN = 2;
 
 const char *CMD_RESET = "ATZ\n";
+/* Undocumented, see modemCheckAttached. Lower is a stronger signal */
+const char *CMD_SIGNAL = "ats361?\r";
+const char *CMD_HANGUP = "ath\r";
 
 /* The ICL323 chip has a minimum limit on the maximum baud rate at 250000,
  * however we need a baud rate that the Due can run at, so choose the next
  * one down.
  */
-const int MODEMBAUD = 115200;
-
-float fltHalfToSingle(void *value);
-float fltSingleToHalf(void *value);
 
 #define PACKETSIZE 4
 
+/* The modem wants a second of silence either side of +++, and a little
+ * longer than that to answer, in ms
+ */
+#define MODEMGUARD 1000
+#define MODEMRESPONSE 1500
+/* How long to wait for the base to call back before resetting the modem,
+ * doubling every time it doesn't, in ms
+ */
+#define MODEMBACKOFFMIN 1000
+#define MODEMBACKOFFMAX 32000
+/* Bounds on how long the link can be quiet before it's called lost, in ms.
+ * Until the interval between packets is known, the first limit is used.
+ */
+#define MODEMMINSILENCE 30
+#define MODEMFIRSTPACKET 500
+/* Which kayak this is, until told otherwise */
+#define MODEMDEFAULTNODE 1
+/* The DCD pin number when it isn't wired up */
+#define MODEMNODCD 0
+/* Longest line the modem replies to a command with */
+#define MODEMLINESIZE 16
+
 enum modemstate {
   UNATTACHED,
   ATTACHED,
   CONNECTED,
+  /* Reconnecting. Each waits for the modem to answer a command */
+  ESCAPING,
+  QUERYING,
+  HANGINGUP,
 };
 
 struct modem {
@@ -43,25 +77,65 @@ struct modem {
    * Corresponds to an index in one of the strings above.
    */
   int statecheck;
-  /* The following corresponds with SCU's specifications */
-  /* A buffer for kayak commands, sent as 2 half precision values.
-   * Used to temporarily store the next packets values
+  /* Receives the frames the base sends while connected */
+  struct framedecoder frames;
+  /* This kayak's address, and its reply slot */
+  unsigned node;
+  unsigned nslots;
+  unsigned slotlen;
+  /* When the last frame from the base ended, which the slots are timed
+   * from
    */
-  char buffer[4];
-  /* The last complete packet recieved.
+  unsigned slotanchor;
+  /* The last complete command recieved, as 2 half precision values.
    * Only modified when a full command has been sent
    */
   char prevpacket[4];
-  /* Where the packet in transit is relative to the number of bytes needed
-   * for a full packet to be recieved.
+  /* Pin the modem's carrier detect is wired to, if it is, which reads low
+   * while there's a carrier
    */
-  int packetboundary;
+  int dcd;
   /* Whether or not a packet has been recieved since connecting to the
    * other modem
    */
   bool hasPacket;
   /* Whether or not SCU's base station expects a packet currently */
   bool needsPacket;
+  /* Called through the scheduler when a command packet arrives */
+  void (*onpacket)(void *data);
+  void *onpacketdata;
+  /* Called straight away for any other frame from the base */
+  void (*onmessage)(void *data, enum frametype type,
+		    const uint8_t *payload, size_t len);
+  void *onmessagedata;
+  /* Whether the packet event has been posted and not yet handled, so a
+   * burst of packets only results in one event
+   */
+  bool packetposted;
+  /* A reply to a command being received, and how much of it there is */
+  char line[MODEMLINESIZE];
+  unsigned linelen;
+  /* Link quality. The interval between packets and its mean deviation
+   * are in 1/16 ms, the loss in permille
+   */
+  unsigned lastpacket;
+  unsigned interval;
+  unsigned jitter;
+  int loss;
+  unsigned received;
+  unsigned lost;
+  /* Whether packets are arriving as often as they should */
+  bool linkup;
+  unsigned linklost;
+  /* The last signal register read */
+  int rssi;
+  unsigned reconnects;
+  /* Fires when the link has been quiet too long */
+  timerhandle watchdog;
+  /* Steps the reconnect along, or gives up on the modem answering */
+  timerhandle cycletimer;
+  /* How long to wait before the next reconnect, in ms */
+  unsigned backoff;
 };
 
 /* Terrible thing, used to remove any unneeded data from the serial object.
@@ -70,47 +144,114 @@ struct modem {
  */
 void modemClear(USARTClass *serial);
 
-struct modem *modemInit(USARTClass *serial, int timeout)
+/* Runs the packet handler, posted when a packet completes */
+void modemPacketEvent(struct modem *modem);
+
+/* Handle a byte from the modem in a call, or in command mode */
+void modemDataByte(struct modem *modem, char check);
+void modemCommandByte(struct modem *modem, char check);
+
+/* Handles a complete frame from the base */
+void modemFrame(struct modem *modem);
+
+/* The call has dropped, wait for the base to call back */
+void modemCarrierLost(struct modem *modem);
+
+/* Handles a line the modem sent in command mode */
+void modemResponse(struct modem *modem, const char *line);
+
+/* Resets the link statistics and starts watching for silence when
+ * the modem connects to the base
+ */
+void modemConnected(struct modem *modem);
+
+/* Updates the link statistics when a packet arrives */
+void modemPacketTiming(struct modem *modem);
+
+/* How long without a packet before the link is lost, in ms */
+unsigned modemSilenceLimit(struct modem *modem);
+
+/* Watchdog timer, marks the link lost, then starts reconnecting */
+void modemSilence(struct modem *modem);
+
+/* Marks the link as lost, if it wasn't already */
+void modemLinkDown(struct modem *modem);
+
+/* Reconnect sequence: escape to command mode, read the signal register,
+ * then hang up and wait for the base to call. Each step is started by
+ * the modem's reply to the last, so nothing blocks. The escape is skipped
+ * when the modem is known to be in command mode already.
+ */
+void modemCycle(struct modem *modem);
+
+/* Waits for the base to call, resetting the modem if it doesn't */
+void modemWaitConnect(struct modem *modem);
+
+/* Timer for when the modem doesn't answer a command */
+void modemNoResponse(struct modem *modem);
+
+/* Changes the state, and records it */
+void modemSetState(struct modem *modem, enum modemstate state);
+
+/* Holds the processor out of wait mode, which stops the UART, whenever
+ * something may arrive from the modem. That's any time it's attached:
+ * the base sends subscriptions, configuration and setpoints whenever it
+ * likes, and its commands early when it's running behind, so there's no
+ * quiet time to plan around. Only sleep mode is left while connected.
+ */
+void modemPowerPlan(struct modem *modem);
+
+struct modem *modemInit(USARTClass *serial, unsigned long baud, int timeout)
 {
   /* Just verify that we have valid information */
   if(!serial || timeout <= 0)
     return NULL;
   /* Attempt to allocate memory for the modem */
-  struct modem *modem = (struct modem *)malloc(sizeof(struct modem));
+  struct modem *modem = (struct modem *)arenaAlloc(sizeof(struct modem));
   if(!modem) {
-    DEBUGSERIAL.print("Not enough memory!\r\n");
+    LOG(ALLOC_FAILED, LOGALLOC_MODEM);
     return NULL;
   }
   /* Initialize our information to a state of ignorance */
   memset(modem, 0, sizeof(*modem));
   modem->state = UNATTACHED;
   modem->statecheck = 0;
-  modem->packetboundary = 0;
+  modem->dcd = MODEMNODCD;
+  modem->node = MODEMDEFAULTNODE;
+  modem->nslots = 1;
+  frameDecoderInit(&modem->frames, modem->node);
+  modem->watchdog = TIMER_NONE;
+  modem->cycletimer = TIMER_NONE;
+  modem->backoff = MODEMBACKOFFMIN;
+  modem->rssi = -1;
   modem->serial = serial;
-  modem->serial->begin(MODEMBAUD);
+  modem->serial->begin(baud);
   /* Start fixing that ignorance */
   if(modemCheckAttached(modem, timeout)) {
     modem->state = ATTACHED;
+    modemPowerPlan(modem);
   }
   else {
     /* We couldn't find a modem on the specified port,
      * so we're done here.
      */
-    free(modem);
+    arenaRelease(modem);
     return NULL;
   }
-  registerTimer(100, (void (*)(void *))modemUpdate, modem);
   return modem;
 }
 
 void modemFree(struct modem *modem)
 {
+  cancelTimer(modem->watchdog);
+  cancelTimer(modem->cycletimer);
+  powerRelease(POWER_HOLD_MODEM);
   /* Break out of any existing connections before trying to reset */
-  modem->serial->write(IDENTIFY);
+  modem->serial->write(TRACEOUTSTR(TRACE_MODEM, IDENTIFY));
   delay(500);
   /* Put the modem in its default state */
-  modem->serial->write(CMD_RESET);
-  free(modem);
+  modem->serial->write(TRACEOUTSTR(TRACE_MODEM, CMD_RESET));
+  arenaRelease(modem);
 }
 
 bool modemIsConn(struct modem *modem)
@@ -121,6 +262,26 @@ bool modemIsConn(struct modem *modem)
     return false;
 }
 
+bool modemLinkUp(struct modem *modem)
+{
+  return modem->state == CONNECTED && modem->linkup;
+}
+
+void modemLink(struct modem *modem, struct modemlink *link)
+{
+  link->interval = modem->interval >> 4;
+  link->jitter = modem->jitter >> 4;
+  link->loss = modem->loss;
+  link->received = modem->received;
+  link->lost = modem->lost;
+  link->rssi = modem->rssi;
+  link->up = modemLinkUp(modem);
+  link->linklost = modem->linklost;
+  link->reconnects = modem->reconnects;
+  link->badframes = modem->frames.errors;
+  link->otherframes = modem->frames.ignored;
+}
+
 bool modemCheckAttached(struct modem *modem, int timeout)
 {
   /* The modem needs to be sent a +++ before it can accept commands.
@@ -129,19 +290,20 @@ bool modemCheckAttached(struct modem *modem, int timeout)
    */
   int inputstate = 0;
   for(; timeout > 0 && inputstate < GOODRESPONSELEN;) {
-    modem->serial->write(IDENTIFY);
+    modem->serial->write(TRACEOUTSTR(TRACE_MODEM, IDENTIFY));
     /* The modem can take some time before it will respond, 
      * and won't respond if we interrupt it, so wait a couple seconds
      */
     delay(1000);
     timeout -= 1000;
-    DEBUGPRINT("Checking for modem connection\r\n");
+    failsafeKick();
+    LOG(MODEM_CHECKING);
     if(modem->serial->available() > 0) {
       /* We got some information, now compare it to the expected return.
        * Basically an implementation of a miniature state machine for strings
        */
       while(modem->serial->available() > 0 && inputstate < GOODRESPONSELEN) {
-	char check = modem->serial->read();
+	char check = TRACEIN(TRACE_MODEM, modem->serial->read());
 	if(check == GOODRESPONSE[inputstate]) {
 	  /* Got the expected character, so advance to the next state */
 	  inputstate++;
@@ -193,7 +355,7 @@ bool modemCheckAttached(struct modem *modem, int timeout)
   /* Clear out anything else the modem may have sent */
   modemClear(modem->serial);
   /* Close any connections, so the modems state matches our default */
-  modem->serial->write("ath\r\n");
+  modem->serial->write(TRACEOUTSTR(TRACE_MODEM, "ath\r\n"));
   while(modem->serial->available() == 0);
   delay(10);
   modemClear(modem->serial);
@@ -202,115 +364,412 @@ bool modemCheckAttached(struct modem *modem, int timeout)
 void modemUpdate(struct modem *modem)
 {
   /* Updates the modems state based on what has been recieved */
-  if(modem->serial->available() > 0) {
+  while(modem->serial->available() > 0) {
+    char check = TRACEIN(TRACE_MODEM, modem->serial->read());
     if(modem->state == CONNECTED)
-      DEBUGPRINT("Checking for floating point values or for NO CARRIER\r\n");
-    while(modem->serial->available() > 0) {
-      if(modem->state != CONNECTED) {
-	/* If the modem is not connected, then we need to look for
-	 * when a connection is made. Nothing else should be returned
-	 * by the modem, I hope.
-	 * Do this with a state machine
-	 */
-	char check = modem->serial->read();
-	if(CONNSTR[modem->statecheck] == check) {
-	  modem->statecheck++;
-	  if(modem->statecheck >= CONNSTRLEN) {
-	    /* We have connected!!!1! */
-	    modem->state = CONNECTED;
-	    modem->statecheck = 0;
-	    DEBUGSERIAL.print("Modem Connected\r\n");
-	    modem->hasPacket = false;
-	    modem->needsPacket = false;
-	    modemClear(modem->serial);
-	  }
-	}
-	else if(CONNSTR[0] == check) {
-	  modem->statecheck = 1;
-	}
-	else {
-	  modem->statecheck = 0;
-	}
-      }
-      else {
-	/* We must already be connected. Check for NO CARRIER */
-	char check = modem->serial->read();
-	modem->buffer[modem->packetboundary] = check;
-	DEBUGSERIAL.print("Received data: ");
-	DEBUGSERIAL.println(check, HEX);
-	if(DISCONNSTR[modem->statecheck] == check) {
-	  modem->statecheck++;
-	  if(modem->statecheck >= DISCONNSTRLEN) {
-	    modem->state = ATTACHED;
-	    modem->statecheck = 0;
-	    DEBUGSERIAL.print("Connection lost\r\n");
-	    memset(modem->prevpacket, 0, sizeof(modem->prevpacket));
-	  }
-	}
-	modem->packetboundary = (modem->packetboundary + 1) % 4;
-	if(modem->packetboundary == 0) {
-	  modem->needsPacket = true;
-	  modem->hasPacket = true;
-	  memcpy(modem->prevpacket, modem->buffer, sizeof(modem->prevpacket));
-	}
-      }
+      modemDataByte(modem, check);
+    else
+      modemCommandByte(modem, check);
+  }
+  /* The modem says NO CARRIER when the call drops, which is as good a
+   * time as any to look at the pin
+   */
+  if(modem->state == CONNECTED && modem->dcd != MODEMNODCD &&
+     digitalRead(modem->dcd) == HIGH)
+    modemCarrierLost(modem);
+}
+
+void modemDataByte(struct modem *modem, char check)
+{
+  /* We must already be connected */
+  LOG(MODEM_BYTE, (uint8_t)check);
+  /* A frame cut off by the carrier dropping would otherwise keep the
+   * decoder waiting for its end, and NO CARRIER with it
+   */
+  frameGap(&modem->frames, GetTickCount(), config.framegap);
+  bool good = frameDecode(&modem->frames, check);
+  if((uint8_t)check == FRAME_FLAG && frameIdle(&modem->frames) &&
+     frameFromBase(&modem->frames))
+    /* Every kayak hears the end of every frame from the base, so they
+     * agree on this. Other kayaks' replies don't count, as nobody hears
+     * their own
+     */
+    modem->slotanchor = GetTickCount();
+  if(good) {
+    modemFrame(modem);
+    return;
+  }
+  /* The modem only talks between frames, or after one it cut off, so
+   * only look for NO CARRIER there, unless the carrier detect pin is
+   * telling us instead
+   */
+  if(modem->dcd != MODEMNODCD || !frameIdle(&modem->frames)) {
+    modem->statecheck = 0;
+    return;
+  }
+  if(DISCONNSTR[modem->statecheck] == check) {
+    modem->statecheck++;
+    if(modem->statecheck >= DISCONNSTRLEN) {
+      modem->statecheck = 0;
+      modemCarrierLost(modem);
+    }
+  }
+  else
+    modem->statecheck = DISCONNSTR[0] == check;
+}
+
+void modemFrame(struct modem *modem)
+{
+  size_t len;
+  const uint8_t *payload = framePayload(&modem->frames, &len);
+  enum frametype type = frameType(&modem->frames);
+  if(type != FRAME_COMMAND) {
+    if(modem->onmessage)
+      modem->onmessage(modem->onmessagedata, type, payload, len);
+    return;
+  }
+  if(len != sizeof(modem->prevpacket))
+    return;
+  modem->needsPacket = true;
+  modem->hasPacket = true;
+  memcpy(modem->prevpacket, payload, sizeof(modem->prevpacket));
+  modemPacketTiming(modem);
+  LOG(MODEM_PACKET, halfLoad(modem->prevpacket), modemForwardPwr(modem),
+      halfLoad(&modem->prevpacket[2]), modemRotationPwr(modem));
+  if(modem->onpacket && !modem->packetposted)
+    modem->packetposted =
+      postEvent((void (*)(void *))modemPacketEvent, modem) != TIMER_NONE;
+}
+
+void modemCarrierLost(struct modem *modem)
+{
+  LOG(MODEM_DISCONNECTED);
+  memset(modem->prevpacket, 0, sizeof(modem->prevpacket));
+  modemLinkDown(modem);
+  /* The modem's back in command mode, so give the base a chance to
+   * call back before resetting it
+   */
+  modemWaitConnect(modem);
+}
+
+void modemCommandByte(struct modem *modem, char check)
+{
+  /* If the modem is not connected, then we need to look for
+   * when a connection is made, which can happen in the middle of
+   * anything else. Do this with a state machine
+   */
+  if(CONNSTR[modem->statecheck] == check) {
+    modem->statecheck++;
+    if(modem->statecheck >= CONNSTRLEN) {
+      /* We have connected!!!1! */
+      modem->statecheck = 0;
+      modem->linelen = 0;
+      modemConnected(modem);
+      return;
     }
-    if(modem->state == CONNECTED) {
-      DEBUGPRINT("Data read: ");
-      DEBUGPRINT(modem->packetboundary);
-      DEBUGPRINT("\r\nHas Packet: ");
-      DEBUGPRINT(modemHasPacket(modem));
-      short actual = (modem->prevpacket[0] << 8) + modem->prevpacket[1];
-      float fwd = modemForwardPwr(modem);
-      DEBUGPRINT("\r\nForward Power: ");
-      DEBUGSERIAL.print(actual, HEX);
-      DEBUGPRINT(" ");
-      DEBUGPRINT(fwd);
-      actual = (modem->prevpacket[2] << 8) + modem->prevpacket[3];
-      DEBUGPRINT("\r\n");
-      float rot = modemRotationPwr(modem);
-      DEBUGPRINT("\r\nRotation Power: ");
-      DEBUGSERIAL.print(actual, HEX);
-      DEBUGPRINT(" ");
-      DEBUGPRINT(rot);
-      DEBUGPRINT("\r\n");
+  }
+  else
+    modem->statecheck = CONNSTR[0] == check;
+  /* Everything else the modem says is a line in reply to a command */
+  if(check == '\r' || check == '\n') {
+    if(modem->linelen > 0) {
+      modem->line[modem->linelen] = 0;
+      modemResponse(modem, modem->line);
     }
+    modem->linelen = 0;
   }
-  registerTimer(100, (void (*)(void *))modemUpdate, modem);
+  else if(modem->linelen < sizeof(modem->line) - 1)
+    modem->line[modem->linelen++] = check;
 }
 
-void modemSendPacket(struct modem *modem, void *packet, size_t size)
+void modemConnected(struct modem *modem)
+{
+  cancelTimer(modem->cycletimer);
+  modem->cycletimer = TIMER_NONE;
+  LOG(MODEM_CONNECTED);
+  modem->hasPacket = false;
+  modem->needsPacket = false;
+  frameDecoderInit(&modem->frames, modem->node);
+  modem->slotanchor = GetTickCount();
+  modem->backoff = MODEMBACKOFFMIN;
+  /* The link isn't up until the base is heard from */
+  modem->lastpacket = GetTickCount();
+  modem->interval = 0;
+  modem->linkup = false;
+  modemSetState(modem, CONNECTED);
+  cancelTimer(modem->watchdog);
+  modem->watchdog = registerTimer(MODEMFIRSTPACKET,
+				  (void (*)(void *))modemSilence, modem);
+  modemClear(modem->serial);
+}
+
+void modemPacketTiming(struct modem *modem)
+{
+  /* The base sends commands at a steady rate, so a gap much longer
+   * than usual means packets were lost on the way.
+   * The averages are kept in 1/16 ms, and move an eighth of the way to
+   * each new gap.
+   */
+  unsigned now = GetTickCount();
+  unsigned gap = now - modem->lastpacket;
+  modem->lastpacket = now;
+  if(!modem->linkup) {
+    modem->linkup = true;
+    LOG(MODEM_LINK_BACK, gap);
+    RECORD(LINK, 1);
+  }
+  else if(modem->interval == 0) {
+    modem->interval = gap << 4;
+    modem->jitter = 0;
+  }
+  else {
+    unsigned mean = modem->interval >> 4;
+    unsigned lost = 0;
+    if(mean > 0 && gap > mean + mean / 2)
+      lost = (gap + mean / 2) / mean - 1;
+    modem->lost += lost;
+    modem->received++;
+    int loss = lost * 1000 / (lost + 1);
+    modem->loss += (loss - modem->loss) / 8;
+    /* Lost packets shouldn't make the interval look longer */
+    int error = (int)(gap << 4) / (int)(lost + 1) - (int)modem->interval;
+    modem->interval += error / 8;
+    modem->jitter += ((error < 0 ? -error : error) - (int)modem->jitter) / 8;
+  }
+  rescheduleTimer(modem->watchdog, modemSilenceLimit(modem));
+}
+
+unsigned modemSilenceLimit(struct modem *modem)
+{
+  /* A few intervals without a packet is a lost link */
+  if(modem->interval == 0)
+    return MODEMFIRSTPACKET;
+  unsigned limit = (3 * modem->interval + 4 * modem->jitter) >> 4;
+  if(limit < MODEMMINSILENCE)
+    limit = MODEMMINSILENCE;
+  if(limit > config.modemdrop)
+    limit = config.modemdrop;
+  return limit;
+}
+
+void modemSilence(struct modem *modem)
+{
+  modem->watchdog = TIMER_NONE;
+  if(modem->state != CONNECTED)
+    return;
+  if(modem->dcd != MODEMNODCD && digitalRead(modem->dcd) == HIGH) {
+    modemCarrierLost(modem);
+    return;
+  }
+  unsigned silent = GetTickCount() - modem->lastpacket;
+  if(silent >= config.modemdrop) {
+    /* The modem still thinks it's connected, but nothing's getting
+     * through, so hang up and start over
+     */
+    LOG(MODEM_DROPPED, silent);
+    modemLinkDown(modem);
+    /* Stop sending, so there's quiet before the +++ */
+    modemSetState(modem, ESCAPING);
+    modem->cycletimer = registerTimer(MODEMGUARD,
+				      (void (*)(void *))modemCycle, modem);
+    return;
+  }
+  unsigned limit = modemSilenceLimit(modem);
+  if(silent >= limit) {
+    modemLinkDown(modem);
+    LOG(MODEM_LINK_LOST, silent);
+    limit = config.modemdrop;
+  }
+  modem->watchdog = registerTimer(limit - silent,
+				  (void (*)(void *))modemSilence, modem);
+}
+
+void modemLinkDown(struct modem *modem)
+{
+  if(!modem->linkup)
+    return;
+  modem->linkup = false;
+  modem->linklost++;
+  RECORD(LINK, 0);
+}
+
+void modemCycle(struct modem *modem)
+{
+  /* Takes the modem back to command mode, reads its signal register,
+   * and hangs up, so it's ready for the base to connect again.
+   * The +++ needs a guard time of silence on either side.
+   */
+  modem->cycletimer = TIMER_NONE;
+  cancelTimer(modem->watchdog);
+  modem->watchdog = TIMER_NONE;
+  modem->linelen = 0;
+  modem->statecheck = 0;
+  LOG(MODEM_RECONNECTING, modem->backoff);
+  modem->reconnects++;
+  if(modem->state == ATTACHED) {
+    /* The call dropped or was hung up, so the modem's already in command
+     * mode, where it wouldn't answer the +++. If it did miss a CONNECT,
+     * it won't answer this either, and the next try starts with the +++
+     */
+    modem->serial->write(TRACEOUTSTR(TRACE_MODEM, CMD_SIGNAL));
+    modemSetState(modem, QUERYING);
+    modem->cycletimer = registerTimer(MODEMRESPONSE,
+				      (void (*)(void *))modemNoResponse, modem);
+    return;
+  }
+  modem->serial->write(TRACEOUTSTR(TRACE_MODEM, IDENTIFY));
+  modemSetState(modem, ESCAPING);
+  modem->cycletimer = registerTimer(MODEMGUARD + MODEMRESPONSE,
+				    (void (*)(void *))modemNoResponse, modem);
+}
+
+void modemResponse(struct modem *modem, const char *line)
+{
+  bool ok = !strcmp(line, "OK");
+  switch(modem->state) {
+  case ESCAPING:
+    if(ok) {
+      modem->serial->write(TRACEOUTSTR(TRACE_MODEM, CMD_SIGNAL));
+      modemSetState(modem, QUERYING);
+      rescheduleTimer(modem->cycletimer, MODEMRESPONSE);
+    }
+    break;
+  case QUERYING:
+    if(line[0] >= '0' && line[0] <= '9') {
+      modem->rssi = atoi(line);
+      LOG(MODEM_RSSI, modem->rssi);
+    }
+    else if(!ok)
+      break;
+    modem->serial->write(TRACEOUTSTR(TRACE_MODEM, CMD_HANGUP));
+    modemSetState(modem, HANGINGUP);
+    rescheduleTimer(modem->cycletimer, MODEMRESPONSE);
+    break;
+  case HANGINGUP:
+    if(ok) {
+      /* Wait longer each time the base doesn't call back */
+      modemWaitConnect(modem);
+      modem->backoff *= 2;
+      if(modem->backoff > MODEMBACKOFFMAX)
+	modem->backoff = MODEMBACKOFFMAX;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void modemWaitConnect(struct modem *modem)
+{
+  modemSetState(modem, ATTACHED);
+  cancelTimer(modem->cycletimer);
+  cancelTimer(modem->watchdog);
+  modem->watchdog = TIMER_NONE;
+  modem->cycletimer = registerTimer(modem->backoff,
+				    (void (*)(void *))modemCycle, modem);
+}
+
+void modemNoResponse(struct modem *modem)
+{
+  /* The modem didn't answer, try again later */
+  LOG(MODEM_NORESPONSE, modem->state);
+  modemSetState(modem, UNATTACHED);
+  modem->cycletimer = registerTimer(modem->backoff,
+				    (void (*)(void *))modemCycle, modem);
+  modem->backoff *= 2;
+  if(modem->backoff > MODEMBACKOFFMAX)
+    modem->backoff = MODEMBACKOFFMAX;
+}
+
+void modemSetState(struct modem *modem, enum modemstate state)
+{
+  if(modem->state == state)
+    return;
+  modem->state = state;
+  RECORD(MODEM, state);
+  modemPowerPlan(modem);
+}
+
+void modemPowerPlan(struct modem *modem)
+{
+  if(modem->state == UNATTACHED)
+    /* Nothing's coming until the next reconnect talks to it */
+    powerRelease(POWER_HOLD_MODEM);
+  else
+    powerHold(POWER_HOLD_MODEM);
+}
+
+void modemOnPacket(struct modem *modem, void (*handler)(void *data),
+		   void *data)
+{
+  modem->onpacket = handler;
+  modem->onpacketdata = data;
+}
+
+void modemPacketEvent(struct modem *modem)
+{
+  modem->packetposted = false;
+  if(modem->onpacket)
+    modem->onpacket(modem->onpacketdata);
+}
+
+void modemOnMessage(struct modem *modem,
+		    void (*handler)(void *data, enum frametype type,
+				    const uint8_t *payload, size_t len),
+		    void *data)
+{
+  modem->onmessage = handler;
+  modem->onmessagedata = data;
+}
+
+void modemSetNode(struct modem *modem, unsigned node, unsigned nslots,
+		  unsigned slotlen)
+{
+  modem->node = node;
+  modem->nslots = nslots;
+  modem->slotlen = slotlen;
+  frameDecoderInit(&modem->frames, node);
+}
+
+unsigned modemSlotWait(struct modem *modem)
+{
+  /* Slots are numbered from 0, nodes from 1 */
+  return frameSlotWait(GetTickCount(), modem->slotanchor, modem->node - 1,
+		       modem->nslots, modem->slotlen);
+}
+
+void modemUseDCD(struct modem *modem, int pin)
+{
+  modem->dcd = pin;
+  if(pin != MODEMNODCD)
+    pinMode(pin, INPUT);
+}
+
+void modemSendPacket(struct modem *modem, enum frametype type,
+		     const void *payload, size_t size)
 {
   if(modem->state != CONNECTED)
     return;
-  byte *b = (byte *)packet;
-  for(int i = 0; i < size; i++) {
-    modem->serial->write(b[i]);
+  uint8_t frame[FRAME_MAXENCODED];
+  size_t len = frameEncode(frame, sizeof(frame), modem->node, type,
+			   payload, size);
+  for(size_t i = 0; i < len; i++) {
+    modem->serial->write(TRACEOUT(TRACE_MODEM, frame[i]));
   }
 }
 
-float modemForwardPwr(struct modem *modem)
+q15 modemForwardPwr(struct modem *modem)
 {
   if(modem->state != CONNECTED)
     return 0;
-  short value = (modem->prevpacket[0] << 8) + modem->prevpacket[1];
-  if(value > 127)
-    value = -value + 127;
-  float pwr = value / 127.0;
-  DEBUGPRINT("\r\nForward Power\r\n");
-  return fltHalfToSingle(modem->prevpacket);
+  return halfToQ15(halfLoad(modem->prevpacket));
 }
 
-float modemRotationPwr(struct modem *modem)
+q15 modemRotationPwr(struct modem *modem)
 {
   if(modem->state != CONNECTED)
     return 0;
-  short value = (modem->prevpacket[2] << 8) + modem->prevpacket[3];
-  if(value > 127)
-    value = -value + 127;
-  float pwr = value / 127.0;
-  DEBUGPRINT("\r\nRotation Power\r\n");
-  return fltHalfToSingle(&(modem->prevpacket[2]));
+  return halfToQ15(halfLoad(&modem->prevpacket[2]));
 }
 
 bool modemHasPacket(struct modem *modem)
@@ -323,69 +782,10 @@ void modemClear(USARTClass *serial)
   /* Clear the buffer. I'd really rather just hack the Arduino library
    * so it doesn't waste CPU cycles */
   while(serial->available())
-    serial->read();
+    TRACEIN(TRACE_MODEM, serial->read());
 }
 
 bool modemNeedsPacket(struct modem *modem)
 {
   return modem->needsPacket;
 }
-
-short fltSingleToHalf(float value)
-{
-  if(value == 0.00)
-    return 0;
-  int negative = ((((*((int *) &value)) & 0x80000000)) >> 16);
-  int exponent = ((((*((int *) &value)) & 0x7f800000) >> 23) - 127 + 15) << 10;
-  int mantissa = ((((*((int *) &value)) & 0x007fe000)) >> 13);
-  DEBUGPRINT("Hex form: 0x");
-  DEBUGPRINTHEX(*((unsigned *)&value));
-  DEBUGPRINT("\r\nConverting down\r\nNegative: ");
-  DEBUGPRINTHEX(negative);
-  DEBUGPRINT("\r\nExponent: ");
-  DEBUGPRINTHEX(exponent);
-  DEBUGPRINT("\r\nMantissa: ");
-  DEBUGPRINTHEX(mantissa);
-  DEBUGPRINT("\r\n");
-  negative &= 0x8000;
-  exponent &= 0x7c00;
-  mantissa &= 0x03ff;
-  short final = negative + exponent + mantissa;
-  return final;
-}
-
-float fltHalfToSingle(void *value)
-{
-  union dest {
-    float fp;
-    unsigned int val;
-  } data;
-  union src {
-    unsigned short value;
-    unsigned char bytes[2];
-  } *source = (union src *)value;
-  if(source->value == 0)
-    return 0.0;
-  int sign = (source->value & 0x8000);
-  DEBUGPRINT("\r\nInitial sign: ");
-  DEBUGPRINTHEX(sign);
-  DEBUGPRINT("\r\n");
-  sign <<= 16;
-  int exp = (((source->value & 0x7C00) >> 10) - 15 + 127);
-  exp <<= 23;
-  int mantissa = (source->value & 0x3ff);
-  mantissa <<= 13;
-  DEBUGPRINT("Converting up:\r\nValue: ");
-  DEBUGPRINTHEX(source->value);
-  DEBUGPRINT("\r\nSign: ");
-  DEBUGPRINT(sign);
-  DEBUGPRINT("\r\nExponent: ");
-  DEBUGPRINT(exp);
-  DEBUGPRINT("\r\nMantissa: ");
-  DEBUGPRINT(mantissa);
-  DEBUGPRINT("\r\nResult: ");
-  data.val = sign + exp + mantissa;
-  DEBUGPRINT(data.fp);
-  DEBUGPRINT("\r\n");
-  return data.fp;
-}
@@ -4,17 +4,19 @@
 
 #include <Arduino.h>
 #include "include.h"
+#include "fixed.h"
+#include "frame.h"
 
 struct modem;
 
 
 /* Initializes the modem and a datastructure to keep track of it
- * Tries to connect for timeout seconds
+ * Opens the serial port at baud, and tries to connect for timeout ms
  * Preconditions: A usable serial port,
  * 								A positive amount of time to check for the modem
  * Postconditions: A valid modem structure, or NULL if there was no modem attached
  */
-struct modem *modemInit(USARTClass *serial, int timeout);
+struct modem *modemInit(USARTClass *serial, unsigned long baud, int timeout);
 
 /* Frees the modem, disconnects the modem, puts it into a safe state.
  * Preconditions: A valid modem object
@@ -24,6 +26,8 @@ void modemFree(struct modem *);
 
 
 /* Checks for information from the modem, updates the state accordingly.
+ * Call whenever the modem's serial port has data, such as from its
+ * serialEvent.
  * Preconditions: A valid modem object
  * Postconditions: The modem has up to date information about the state
  *								 of the hardware, and recieved any new information from
@@ -31,6 +35,49 @@ void modemFree(struct modem *);
  */
 void modemUpdate(struct modem *);
 
+/* Sets the function called, through the scheduler, when a command
+ * packet has been received. Packets which arrive before the handler has
+ * run only result in one call, and the handler should use the latest.
+ * Preconditions: A valid modem object
+ * Postconditions: handler is called with data for every new packet
+ */
+void modemOnPacket(struct modem *modem, void (*handler)(void *data),
+		   void *data);
+
+/* Sets the function called with every frame from the base other than a
+ * command. It's called from modemUpdate, and the payload is only good
+ * until it returns.
+ * Preconditions: A valid modem object
+ * Postconditions: handler is called with every other frame
+ */
+void modemOnMessage(struct modem *modem,
+		    void (*handler)(void *data, enum frametype type,
+				    const uint8_t *payload, size_t len),
+		    void *data);
+
+/* Sets which kayak this is, 1 to 254, and so which frames from the base
+ * it takes, and its slot for replying. With nslots of 1 or less, it
+ * replies whenever it likes. See frame.h
+ * Preconditions: A valid modem object
+ * Postconditions: Only frames for node or everyone are received
+ */
+void modemSetNode(struct modem *modem, unsigned node, unsigned nslots,
+		  unsigned slotlen);
+
+/* Returns how many ms until this kayak's reply slot opens, 0 if it's
+ * open now
+ * Preconditions: A valid modem object
+ * Postconditions: The modem object is in the same state as before
+ */
+unsigned modemSlotWait(struct modem *modem);
+
+/* Watches the modem's carrier detect on pin to tell when the call drops,
+ * rather than the modem saying NO CARRIER. 0 stops watching it.
+ * Preconditions: A valid modem object, pin is low while there's a carrier
+ * Postconditions: The pin is an input
+ */
+void modemUseDCD(struct modem *modem, int pin);
+
 /* Basic modem queries */
 
 /* Whether or not the modem has connected to another modem
@@ -40,6 +87,46 @@ void modemUpdate(struct modem *);
  */
 bool modemIsConn(struct modem *);
 
+/* Whether commands are arriving from the base as often as usual.
+ * This goes false within a few packet intervals of the base going quiet,
+ * well before the modem notices the call has dropped.
+ * Preconditions: A valid modem object
+ * Postconditions: The modem object is in the same state as before
+ */
+bool modemLinkUp(struct modem *);
+
+struct modemlink {
+  /* Mean time between command packets, and its mean deviation, in ms.
+   * Zero until two packets have arrived
+   */
+  unsigned interval;
+  unsigned jitter;
+  /* Recent packet loss in permille, estimated from gaps in the packets */
+  int loss;
+  /* Packets received and estimated lost since power on */
+  unsigned received;
+  unsigned lost;
+  /* Signal register from the last reconnect, lower is stronger,
+   * -1 if it's never been read
+   */
+  int rssi;
+  bool up;
+  /* How many times the link has been lost, and the modem reset */
+  unsigned linklost;
+  unsigned reconnects;
+  /* Frames from the base dropped for a bad CRC or length */
+  unsigned badframes;
+  /* Frames from the base for other kayaks */
+  unsigned otherframes;
+};
+
+/* Gets the link quality statistics.
+ * Preconditions: A valid modem object, and somewhere to put the statistics
+ * Postconditions: link is filled in,
+ *                 the modem object is in the same state as before
+ */
+void modemLink(struct modem *, struct modemlink *link);
+
 /* Whether or not the modem is even attached.
  * Precondtions: A valid modem object
  *							 A positive timeout
@@ -47,17 +134,18 @@ bool modemIsConn(struct modem *);
  */
 bool modemCheckAttached(struct modem *, int timeout);
 
-/* Returns a floating point value corresponding to the power to be sent
+/* Returns a Q15 fixed point value corresponding to the power to be sent
  * to the motors. In the range of -1.0 to 1.0; where 1.0 is the maximum
  * power, 0.0 is no power, and -1.0 is reverse.
- * These values are currently obtained from packets corresponding to
- * Santa Clara's format, but eventually this functionality will be removed
- * and put in a more suitable location.
+ * The half precision values sent by the base are converted without
+ * going through float, and saturate outside of that range.
+ * These values come from the last FRAME_COMMAND, but eventually this
+ * functionality will be removed and put in a more suitable location.
  * Preconditions: A valid modem object, which has recieved a packet
  * Postconditions: The modem object is in the same state as before
  */
-float modemForwardPwr(struct modem *modem);
-float modemRotationPwr(struct modem *modem);
+q15 modemForwardPwr(struct modem *modem);
+q15 modemRotationPwr(struct modem *modem);
 
 /* Whether or not the modem has a packet.
  * False on initialization, true after the first command has been recieved
@@ -74,10 +162,12 @@ bool modemHasPacket(struct modem *);
  */
 bool modemNeedsPacket(struct modem *);
 
-/* Sends a packet back to the base.
- * Preconditions: A valid modem object, which is connected
+/* Sends a frame of the type given back to the base.
+ * Preconditions: A valid modem object, which is connected,
+ *                size is at most FRAME_MAXPAYLOAD
  * Postconditions: The modem object is in the same state as before
  */
-void modemSendPacket(struct modem *, void *packet, size_t size);
+void modemSendPacket(struct modem *, enum frametype type,
+		     const void *payload, size_t size);
 
 #endif
@@ -2,6 +2,13 @@
 #include "motor.h"
 
 #include "scheduler.h"
+#include "logging.h"
+#include "arena.h"
+#include "config.h"
+#include "trace.h"
+#include "profile.h"
+#include "shape.h"
+#include "failsafe.h"
 
 /* Structure used to keep up with the state of the motor controller */
 struct motorctrl
@@ -10,6 +17,29 @@ struct motorctrl
   USARTClass *serial;
   /* Whether or not the motor controller was detected */
   bool attached;
+  /* The last readings from the motor controller */
+  struct channelpair amps, volts;
+  /* The timers polling the motor controller, so they can be stopped */
+  timerhandle amptimer, watttimer;
+  unsigned pollms;
+  /* The powers asked for, and what's been sent after shaping */
+  q15 forward, rotate;
+  q15 out[2];
+  unsigned lastsent;
+  bool sent;
+  timerhandle shapetimer;
+  /* Whether the output has caught up with the powers asked for, so the
+   * shaping only wakes up to refresh the motor controller
+   */
+  bool settled;
+  /* The last few amps readings, for the peak */
+  uint8_t recent[2][MOTORPEAKREADINGS];
+  unsigned nextreading;
+  /* Energy used, in the controller's units for ms, and when it was
+   * last added to
+   */
+  uint64_t energy;
+  unsigned lastreading;
 };
 
 /* Checks whether the motor controller is attached
@@ -54,32 +84,65 @@ void motorWriteByte(USARTClass *serial, byte b);
  */
 void motorWriteBytes(USARTClass *serial, const void *bytes, size_t len);
 
-struct motorctrl *motorInit(USARTClass *serial, int timeout)
+/* Steps the shaped powers towards those asked for, and sends them if
+ * they've changed. Runs every MOTORPERIOD ms
+ * Preconditions: A valid motor controller object
+ * Postconditions: The motor controller has the latest shaped powers
+ */
+void motorShape(struct motorctrl *motor);
+
+/* Sends the powers of channels A and B to the motor controller
+ * Preconditions: A valid motor controller object
+ * Postconditions: The motor controller powers the motors as specified
+ */
+void motorWriteSpeed(struct motorctrl *motor, q15 chA, q15 chB);
+
+/* Adds an amps reading to the peak and energy
+ * Preconditions: A valid motor controller object
+ * Postconditions: The peak and energy include the reading
+ */
+void motorAccount(struct motorctrl *motor, struct channelpair amps);
+
+/* Longest the motor controller goes without a command, in ms */
+#define MOTORREFRESH 200
+
+struct motorctrl *motorInit(USARTClass *serial, unsigned long baud,
+			    int timeout, unsigned pollms)
 {
-  struct motorctrl *motor = (struct motorctrl *)malloc(sizeof(struct motorctrl));
+  struct motorctrl *motor =
+    (struct motorctrl *)arenaAlloc(sizeof(struct motorctrl));
   if(!motor)
     return NULL;
   memset(motor, 0, sizeof(struct motorctrl));
-  /* The motor controller communicates at 9600 baud */
+  /* The motor controller normally communicates at 9600 baud */
   motor->serial = serial;
-  motor->serial->begin(9600);
+  motor->serial->begin(baud);
+  motor->pollms = pollms;
   if(!motorCheckAttached(motor, timeout)) {
-    free(motor);
+    arenaRelease(motor);
     return NULL;
   }
-  /* Once a second, query the motor controller
+  /* Periodically query the motor controller
    * on how much power it's consuming
    */
-  registerTimer(1000, (void (*)(void *))motorCheckWatt, motor);
-  registerTimer(1000, (void (*)(void *))motorCheckAmp, motor);
+  motor->watttimer = registerTimer(pollms, (void (*)(void *))motorCheckWatt,
+				   motor);
+  motor->amptimer = registerTimer(pollms, (void (*)(void *))motorCheckAmp,
+				  motor);
+  motor->lastreading = GetTickCount();
+  motor->shapetimer = registerPeriodic(config.motorperiod,
+				       (void (*)(void *))motorShape, motor);
   return motor;
 }
 
 void motorFree(struct motorctrl *motor)
 {
-  /* Turn off the motors, then free the memory */
-  motorSetSpeed(motor, 0, 0);
-  free(motor);
+  /* Stop polling, turn off the motors, then free the memory */
+  cancelTimer(motor->watttimer);
+  cancelTimer(motor->amptimer);
+  cancelTimer(motor->shapetimer);
+  motorWriteSpeed(motor, 0, 0);
+  arenaRelease(motor);
 }
 
 struct channelpair motorCheckAmp(struct motorctrl *motor)
@@ -89,27 +152,23 @@ struct channelpair motorCheckAmp(struct motorctrl *motor)
    * Where the numbers are in hex and range from 0 to 7F
    * \n is a newline
    */
+  /* Keep polling even if this read fails */
+  motor->amptimer = registerTimer(motor->pollms,
+				  (void (*)(void *))motorCheckAmp, motor);
   char buffer[7];
   if(!motorWriteCmd(motor, "?a", buffer, sizeof(char[6]), 1000)) {
-    DEBUGPRINT("Could not read amps!\r\n");
+    LOG(MOTOR_NOAMPS);
     return {0, 0};
   }
   struct channelpair values;
   memset(&values, 0, sizeof(values));
   buffer[6] = 0;
-  DEBUGSERIAL.print("Values read:\r\n");
-  DEBUGSERIAL.print(buffer);
-  DEBUGSERIAL.print("\r\n");
   /* Convert the values to integers */
   int check = sscanf(buffer, "%xd\n%xd\n", &values.cA, &values.cB);
-  DEBUGSERIAL.print("Read amp values: ");
-  DEBUGSERIAL.print(check);
-  DEBUGSERIAL.print(", ");
-  DEBUGSERIAL.print(values.cA);
-  DEBUGSERIAL.print(", ");
-  DEBUGSERIAL.print(values.cB);
-  DEBUGSERIAL.print("\r\n");
-  registerTimer(1000, (void (*)(void *))motorCheckAmp, motor);
+  motor->amps = values;
+  LOG(MOTOR_AMPS, check, values.cA, values.cB);
+  if(check == 2)
+    motorAccount(motor, values);
   return values;
 }
 
@@ -120,36 +179,71 @@ struct channelpair motorCheckWatt(struct motorctrl *motor)
    * Where the numbers are in hex and range from 0 to 7F
    * \r is a carriage return
    */
+  motor->watttimer = registerTimer(motor->pollms,
+				   (void (*)(void *))motorCheckWatt, motor);
   char buffer[7];
   if(!motorWriteCmd(motor, "?v", buffer, sizeof(char[6]), 1000)) {
-    DEBUGPRINT("Could not read voltages!\r\n");
+    LOG(MOTOR_NOVOLTS);
     return {0, 0};
   }
   struct channelpair values;
   memset(&values, 0, sizeof(values));
   buffer[6] = 0;
-  DEBUGSERIAL.print("Values read:\r\n");
-  DEBUGSERIAL.print(buffer);
-  DEBUGSERIAL.print("\r\n");
   /* Convert the values to integers */
   int check = sscanf(buffer, "%xd\n%xd\n", &values.cA, &values.cB);
-  DEBUGSERIAL.print("Read volt values: ");
-  DEBUGSERIAL.print(check);
-  DEBUGSERIAL.print(", ");
-  DEBUGSERIAL.print(values.cA);
-  DEBUGSERIAL.print(", ");
-  DEBUGSERIAL.print(values.cB);
-  DEBUGSERIAL.print("\r\n");
-  registerTimer(1000, (void (*)(void *))motorCheckWatt, motor);
+  motor->volts = values;
+  LOG(MOTOR_VOLTS, check, values.cA, values.cB);
   return values;
 }
 
+struct channelpair motorAmps(struct motorctrl *motor)
+{
+  return motor->amps;
+}
+
+struct channelpair motorVolts(struct motorctrl *motor)
+{
+  return motor->volts;
+}
+
+struct channelpair motorPeakAmps(struct motorctrl *motor)
+{
+  struct channelpair peak = {0, 0};
+  for(int i = 0; i < MOTORPEAKREADINGS; i++) {
+    if(motor->recent[0][i] > peak.cA)
+      peak.cA = motor->recent[0][i];
+    if(motor->recent[1][i] > peak.cB)
+      peak.cB = motor->recent[1][i];
+  }
+  return peak;
+}
+
+uint32_t motorEnergy(struct motorctrl *motor)
+{
+  return motor->energy / 1000;
+}
+
+void motorAccount(struct motorctrl *motor, struct channelpair amps)
+{
+  unsigned now = GetTickCount();
+  motor->recent[0][motor->nextreading] = amps.cA;
+  motor->recent[1][motor->nextreading] = amps.cB;
+  motor->nextreading = (motor->nextreading + 1) % MOTORPEAKREADINGS;
+  /* Count the whole time since the last reading at this one's draw, and
+   * the battery volts as last read. Both channels run off the battery,
+   * the second ?v reading is the controller's own supply
+   */
+  motor->energy += (uint64_t)(amps.cA + amps.cB) * motor->volts.cA *
+    (now - motor->lastreading);
+  motor->lastreading = now;
+}
+
 int motorWriteCmd(struct motorctrl *motor, const char *cmd,
 		  void *buffer, size_t size, int timeout)
 {
   /* Clear out the serial buffer, we don't want to worry about overflow */
   while(motor->serial->available())
-    motor->serial->read();
+    TRACEIN(TRACE_MOTOR, motor->serial->read());
   /* Write the comand to the motor controller, followed by an EOL so the
    * controller knows it's recieved an entire command 
    */
@@ -174,15 +268,9 @@ int motorWriteCmd(struct motorctrl *motor, const char *cmd,
    * Typical state machine logic
    */
   for(i = 0;
-      cmd[i] && delta * TICKSPERTENMS < timeout;
+      cmd[i] && delta * config.tickspertenms < timeout;
       delta = GetTickCount() - starttime) {
     char ret = motorReadByte(motor->serial);
-    if(ret == '\r') {
-      DEBUGPRINT("\r\n");
-    }
-    else {
-      DEBUGPRINT(ret);
-    }
     if(ret == cmd[i]) {
       i++;
     }
@@ -202,42 +290,74 @@ int motorWriteCmd(struct motorctrl *motor, const char *cmd,
   }
   byte *buf = (byte *)buffer;
   for(i = 0;
-      i < size && delta * TICKSPERTENMS < timeout;
+      i < size && delta * config.tickspertenms < timeout;
       i++, delta = GetTickCount() - starttime) {
     buf[i] = motorReadByte(motor->serial);
   }
   return i;
 }
 
-void motorSetSpeed(struct motorctrl *motor, float fwd, float rot)
+void motorSetSpeed(struct motorctrl *motor, q15 fwd, q15 rot)
+{
+  /* Picked up by the next motorShape */
+  if(fwd == motor->forward && rot == motor->rotate)
+    return;
+  motor->forward = fwd;
+  motor->rotate = rot;
+  if(motor->settled) {
+    motor->settled = false;
+    rescheduleTimer(motor->shapetimer, config.motorperiod);
+  }
+}
+
+void motorShape(struct motorctrl *motor)
+{
+  PROFILE(MOTOR_SPEED);
+  /* The parameters can change at any time, so work the steps out again */
+  struct shapeparams params;
+  shapeSetup(&params, config.motorperiod, config.stickdeadband, config.expo,
+	     config.motorrise, config.motorfall, config.motormix);
+  /* Only bother the motor controller when something changes, or often
+   * enough that its own watchdog doesn't stop the motors
+   */
+  unsigned now = GetTickCount();
+  bool changed = shapeStep(&params, motor->forward, motor->rotate,
+			   motor->out);
+  if(changed || !motor->sent || now - motor->lastsent >= MOTORREFRESH) {
+    motorWriteSpeed(motor, motor->out[0], motor->out[1]);
+    motor->sent = true;
+    motor->lastsent = now;
+  }
+  /* Once the output stops changing it's reached the powers asked for,
+   * and there's nothing to do until they change or the refresh is due
+   */
+  motor->settled = !changed;
+  /* The period is read again each time, as the base can change it */
+  unsigned next = config.motorperiod;
+  if(motor->settled)
+    next = MOTORREFRESH - (now - motor->lastsent);
+  rescheduleTimer(motor->shapetimer, next);
+}
+
+void motorWriteSpeed(struct motorctrl *motor, q15 chA, q15 chB)
 {
   /* This is a simple command which doesn't require a response
    * from the motor controller, so just build it and run it.
+   * Everything is integer, the Due has no FPU.
    */
-  int forward = fwd * 0x7F,
-    rotation = rot * 0x7F;
-  char cmdA = 'A',
-    cmdB = 'B';
-  /* Set channel A */
-  if(forward < 0) {
-    /* All values should be positive, the motor controller determines
-     * sign based on the case of the command character
-     */
-    forward = -forward;
-    cmdA = 'a';
-  }
-  char buffer[10];
-  sprintf(buffer, "!%c%02X\r\n", cmdA, forward);
-  DEBUGPRINT(buffer);
-  motorWriteString(motor->serial, buffer);
-  /* Set channel B */
-  if(rotation < 0) {
-    rotation = -rotation;
-    cmdB = 'b';
+  const char *hex = "0123456789ABCDEF";
+  char buffer[] = "!A00\r\n";
+  q15 powers[2] = {chA, chB};
+  int values[2];
+  for(int i = 0; i < 2; i++) {
+    buffer[1] = 'A' + i;
+    int value = motorScale(powers[i], &buffer[1]);
+    buffer[2] = hex[value >> 4];
+    buffer[3] = hex[value & 0xF];
+    values[i] = buffer[1] << 8 | value;
+    motorWriteString(motor->serial, buffer);
   }
-  sprintf(buffer, "!%c%02X\r\n", cmdB, rotation);
-  DEBUGPRINT(buffer);
-  motorWriteString(motor->serial, buffer);
+  LOG(MOTOR_SPEED, values[0], values[1]);
   motor->serial->flush();
 }
 
@@ -257,14 +377,14 @@ bool motorCheckAttached(struct motorctrl *motor, int timeout)
    */
   int inputstate = 0;
   timeout *= 10;
-  DEBUGSERIAL.print("Connecting motor controller\r\n");
   for(; timeout > 0 && inputstate < statelen;) {
-    DEBUGSERIAL.print("Checking for motor controller connection\r\n");
+    LOG(MOTOR_CHECKING);
     for(int i = 0; i < 20; i++)
       motorWriteByte(motor->serial, '\r');
     /* Give the motor controller a chance to respond, wait 50 ms */
     delay(50);
     timeout -= 50;
+    failsafeKick();
     if(motor->serial->available() > 0) {
       while(motor->serial->available() > 0 && inputstate < statelen) {
 	char check = motorReadByte(motor->serial);
@@ -305,7 +425,7 @@ bool motorCheckAttached(struct motorctrl *motor, int timeout)
 char motorReadByte(USARTClass *serial)
 {
   /* Just strip off the parity bit */
-  return serial->read() & 0x7f;
+  return TRACEIN(TRACE_MOTOR, serial->read()) & 0x7f;
 }
 
 void motorWriteString(USARTClass *serial, const char *str)
@@ -346,5 +466,5 @@ void motorWriteByte(USARTClass *serial, byte b)
     temp <<= 1;
   }
   b = (b >> 1) | parity;
-  serial->write(b);
+  serial->write(TRACEOUT(TRACE_MOTOR, b));
 }
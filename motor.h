@@ -2,10 +2,54 @@
 #ifndef _MOTOR_H_
 #define _MOTOR_H_
 
-#define RELEASE_VERSION
-
 #include <Arduino.h>
 #include "include.h"
+#include "fixed.h"
+
+/* Largest magnitude command the motor controller accepts */
+#ifndef MOTORMAXCMD
+#define MOTORMAXCMD 0x7F
+#endif
+
+/* Powers smaller than this are treated as 0, so noise on the bases
+ * joystick doesn't hum the motors. The rest of the range is stretched
+ * to cover 1 to MOTORMAXCMD.
+ */
+#ifndef MOTORDEADBAND
+#define MOTORDEADBAND Q15(0.02)
+#endif
+
+/* Scale from the Q15 range past the deadband to the command range, as a
+ * 16.16 fixed point factor so scaling is a multiply and a shift
+ */
+#define MOTORSCALE (((MOTORMAXCMD - 1) << 16) / (Q15_ONE - MOTORDEADBAND))
+
+/* Converts a power to the motor controllers command range.
+ * Returns the magnitude of the command, and sets the command character
+ * to lower case if the power is negative.
+ * Preconditions: A Q15 power, a valid command character
+ * Postconditions: The magnitude of the scaled command is returned
+ */
+static inline int motorScale(q15 power, char *cmd)
+{
+  int value = power;
+  if(value < 0) {
+    /* All values should be positive, the motor controller determines
+     * sign based on the case of the command character
+     */
+    value = -value;
+    *cmd += 'a' - 'A';
+  }
+  if(value <= MOTORDEADBAND)
+    return 0;
+  value = (((value - MOTORDEADBAND) * MOTORSCALE + 0x8000) >> 16) + 1;
+  if(value > MOTORMAXCMD)
+    value = MOTORMAXCMD;
+  return value;
+}
+
+/* How many amps readings the peak is taken over */
+#define MOTORPEAKREADINGS 8
 
 struct motorctrl;
 
@@ -18,12 +62,14 @@ struct channelpair {
 };
 
 /* Initializes the motor controller object connected to the serial port
+ * at baud, which is read every pollms.
  * If no motor controller is detected in the required timeout, returns NULL.
- * Preconditions: A valid serial port, a positive timeout
+ * Preconditions: A valid serial port, a positive timeout and poll period
  * Postconditions: The motor controller is detected within the timeout and
  *                 then initialized.
  */
-struct motorctrl *motorInit(USARTClass *serial, int timeout);
+struct motorctrl *motorInit(USARTClass *serial, unsigned long baud,
+			    int timeout, unsigned pollms);
 
 /* Frees the motor controller, turns off the motors
  * Preconditions: A valid motor controller object
@@ -49,12 +95,15 @@ int motorWriteCmd(struct motorctrl *, const char *cmd,
 
 /* Sets the speeds of the motors
  * Uses a differential controller
- * Preconditions: A valid motor object, floating point values between -1 and 1
+ * The powers are shaped on their way to the motor controller, see
+ * shape.h, every MOTORPERIOD ms, so a step in power is spread over the
+ * next few periods.
+ * Preconditions: A valid motor object, Q15 fixed point values between -1 and 1
  *								1 is full power forward, 0 is off, -1 is full power reverse
  * Postconditions: The motor controller powers the motors at the percent
- *                 specified.
+ *                 specified, once the shaping has caught up.
  */
-void motorSetSpeed(struct motorctrl *, float forward, float rotate);
+void motorSetSpeed(struct motorctrl *, q15 forward, q15 rotate);
 
 /* Reads the number of amps that the motor controller is providing
  * to the motors. Returns in a channel pair struct, corresponding to
@@ -74,4 +123,21 @@ struct channelpair motorCheckAmp(struct motorctrl *);
  */
 struct channelpair motorCheckWatt(struct motorctrl *);
 
+/* Returns the last amps and volts read by motorCheckAmp and motorCheckWatt
+ * Preconditons: A valid motor object.
+ * Postconditions: The motor objects state remains the same
+ */
+struct channelpair motorAmps(struct motorctrl *);
+struct channelpair motorVolts(struct motorctrl *);
+
+/* Returns the highest amps of each channel in the last MOTORPEAKREADINGS
+ * readings, and the energy used since the motor controller was found,
+ * as the amps of both channels times the battery volts, in the
+ * controller's units for seconds
+ * Preconditons: A valid motor object.
+ * Postconditions: The motor objects state remains the same
+ */
+struct channelpair motorPeakAmps(struct motorctrl *);
+uint32_t motorEnergy(struct motorctrl *);
+
 #endif
@@ -0,0 +1,126 @@
+
+#include "power.h"
+#include "include.h"
+#include "scheduler.h"
+
+#include <Arduino.h>
+
+/* The real time timer counts the 32768 Hz slow clock divided by this,
+ * which is close enough to 1 ms per count
+ */
+#define RTTPRESCALE 32
+#define RTTHZ (32768 / RTTPRESCALE)
+
+static volatile uint32_t powerHolds = 0;
+static struct powerstats powerAccounting;
+/* When the processor last woke up, in us, so the time running is known */
+static uint32_t powerLastWake = 0;
+
+/* Peripherals the Arduino core may turn on that nothing here uses */
+static const uint32_t powerUnused[] = {
+  ID_ADC, ID_DACC, ID_PWM, ID_CAN0, ID_CAN1, ID_SPI0, ID_SSC, ID_HSMCI,
+  ID_TWI0, ID_EMAC, ID_SMC,
+  ID_TC0, ID_TC1, ID_TC2, ID_TC4, ID_TC5, ID_TC6, ID_TC7, ID_TC8,
+};
+
+uint32_t powerSerialBusy(void);
+unsigned powerWait(unsigned ms);
+
+void powerInit(void)
+{
+  pmc_set_writeprotect(false);
+  for(unsigned i = 0; i < sizeof(powerUnused) / sizeof(powerUnused[0]); i++)
+    pmc_disable_periph_clk(powerUnused[i]);
+  memset(&powerAccounting, 0, sizeof(powerAccounting));
+  powerLastWake = micros();
+}
+
+void powerHold(uint32_t holds)
+{
+  noInterrupts();
+  powerHolds |= holds;
+  interrupts();
+}
+
+void powerRelease(uint32_t holds)
+{
+  noInterrupts();
+  powerHolds &= ~holds;
+  interrupts();
+}
+
+void powerIdle(struct scheduler *s)
+{
+  /* Interrupts stay masked from the check until the processor is asleep.
+   * A pending interrupt still wakes it, so nothing that arrives in
+   * between can be slept through.
+   */
+  __disable_irq();
+  uint32_t now = micros();
+  powerAccount(&powerAccounting, POWER_RUN, now - powerLastWake);
+  unsigned untilnext = schedulerIdleTime(s);
+  enum powermode mode = powerSelect(untilnext, powerHolds | powerSerialBusy());
+  switch(mode) {
+  case POWER_RUN:
+    break;
+  case POWER_SLEEP:
+    __WFI();
+    break;
+  case POWER_WAIT: {
+    unsigned slept = powerWait(powerDuration(mode, untilnext));
+    /* SysTick was stopped along with everything else */
+    for(unsigned i = 0; i < slept; i++)
+      TimeTick_Increment();
+    break;
+  }
+  default:
+    break;
+  }
+  /* Let whatever woke us run first, so the tick count is up to date */
+  __enable_irq();
+  powerLastWake = micros();
+  powerAccount(&powerAccounting, mode, powerLastWake - now);
+  if(mode == POWER_WAIT)
+    schedulerResume(s);
+}
+
+void powerStats(struct powerstats *stats)
+{
+  *stats = powerAccounting;
+}
+
+uint32_t powerSerialBusy(void)
+{
+  /* Wait mode stops the baud rate generators, so anything still being
+   * shifted out would be garbled
+   */
+  if(!(UART->UART_SR & UART_SR_TXEMPTY) ||
+     !(USART0->US_CSR & US_CSR_TXEMPTY) ||
+     !(USART1->US_CSR & US_CSR_TXEMPTY) ||
+     !(USART3->US_CSR & US_CSR_TXEMPTY))
+    return POWER_HOLD_SERIAL;
+  return 0;
+}
+
+unsigned powerWait(unsigned ms)
+{
+  /* The real time timer runs off the slow clock, so it keeps counting in
+   * wait mode, and its alarm is what wakes us back up
+   */
+  pmc_enable_periph_clk(ID_RTT);
+  RTT->RTT_MR = RTT_MR_RTPRES(RTTPRESCALE) | RTT_MR_RTTRST;
+  RTT->RTT_AR = (uint64_t)ms * RTTHZ / 1000 - 1;
+  pmc_set_fast_startup_input(PMC_FSMR_RTTAL);
+  /* The PLL can't be running when entering wait mode, so drop down to
+   * the internal RC oscillator first
+   */
+  pmc_switch_mck_to_mainck(PMC_MCKR_PRES_CLK_1);
+  pmc_switch_mainck_to_fastrc(CKGR_MOR_MOSCRCF_4_MHz);
+  pmc_disable_pllack();
+  pmc_enable_waitmode();
+  /* Awake again, bring the crystal and the PLL back up to 84 MHz */
+  SystemInit();
+  uint32_t ticks = RTT->RTT_VR;
+  (void)RTT->RTT_SR;
+  return (uint64_t)ticks * 1000 / RTTHZ;
+}
@@ -0,0 +1,30 @@
+#ifndef _POWER_H_
+#define _POWER_H_
+
+#include "powerplan.h"
+
+struct scheduler;
+
+/* Turns off the clocks of the peripherals the kayak doesn't use
+ * Preconditions: The Arduino core has been initialized
+ * Postconditions: Only the used peripherals are clocked
+ */
+void powerInit(void);
+
+/* Marks peripherals as having I/O under way, or finished with it.
+ * holds is a mask of enum powerhold.
+ */
+void powerHold(uint32_t holds);
+void powerRelease(uint32_t holds);
+
+/* Idles until there's something to do, in the deepest mode that's safe.
+ * Replaces a bare __WFI() in the main loop.
+ * Preconditions: A valid scheduler
+ * Postconditions: The tick count and the scheduler's timer are correct,
+ * even if the clocks were stopped
+ */
+void powerIdle(struct scheduler *s);
+
+void powerStats(struct powerstats *stats);
+
+#endif
@@ -0,0 +1,38 @@
+
+#include "powerplan.h"
+
+enum powermode powerSelect(uint32_t untilnext, uint32_t holds)
+{
+	if(untilnext == 0)
+		return POWER_RUN;
+	/* Anything in the middle of a transfer would lose its clock */
+	if(holds)
+		return POWER_SLEEP;
+	/* Coming back from wait mode costs more than a short sleep saves */
+	if(untilnext < POWER_WAITMIN)
+		return POWER_SLEEP;
+	return POWER_WAIT;
+}
+
+uint32_t powerDuration(enum powermode mode, uint32_t untilnext)
+{
+	if(mode != POWER_WAIT)
+		return 0;
+	if(untilnext > POWER_WAITMAX)
+		untilnext = POWER_WAITMAX;
+	return untilnext - POWER_WAITLATENCY;
+}
+
+void powerAccount(struct powerstats *stats, enum powermode mode, uint32_t us)
+{
+	stats->residency[mode] += us;
+	stats->entries[mode]++;
+}
+
+const char *powerModeName(enum powermode mode)
+{
+	static const char *names[POWER_NMODES] = {"run", "sleep", "wait"};
+	if(mode >= POWER_NMODES)
+		return "?";
+	return names[mode];
+}
@@ -0,0 +1,91 @@
+#ifndef _POWERPLAN_H_
+#define _POWERPLAN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Choice of sleep mode, shared by the kayak and the host simulator.
+ *
+ * The SAM3X has three modes the controller uses:
+ *   run    Nothing to wait for, keep going
+ *   sleep  WFI, the core clock stops, any interrupt wakes it in a few
+ *          cycles. Peripherals keep running.
+ *   wait   Every clock but the 32 kHz slow clock stops, and only the real
+ *          time timer alarm wakes it. Waking up and restarting the PLL
+ *          takes a couple of ms, and the UARTs can't receive anything.
+ * Backup mode loses the RAM, so it's never used.
+ */
+enum powermode {
+	POWER_RUN,
+	POWER_SLEEP,
+	POWER_WAIT,
+	POWER_NMODES
+};
+
+/* Peripherals which may have I/O under way. While any of them is held,
+ * the processor is never put in wait mode.
+ * The motor controller and the compass have no hold, as they're only
+ * talked to from start to finish within one event, and the processor
+ * only idles between events.
+ */
+enum powerhold {
+	POWER_HOLD_MODEM = 0x01,
+	POWER_HOLD_GPS = 0x02,
+	/* Listening for commands on the debug port */
+	POWER_HOLD_DEBUG = 0x04,
+	/* Set when any serial port still has data to send */
+	POWER_HOLD_SERIAL = 0x10
+};
+
+/* Passed as the time until the next deadline when nothing is scheduled */
+#define POWER_FOREVER 0xFFFFFFFF
+/* Least time to the next deadline worth going into wait mode for, in ms */
+#ifndef POWER_WAITMIN
+#define POWER_WAITMIN 20
+#endif
+/* Time it takes to get back from wait mode, in ms. The wake up alarm is
+ * set this much early, so the deadline isn't missed.
+ */
+#define POWER_WAITLATENCY 3
+/* Longest time spent in wait mode at once, in ms. The loop has to come
+ * round to kick the watchdog, which is never set shorter than 1.5 s
+ */
+#define POWER_WAITMAX 1000
+
+/* Time in each mode, in us, and the number of times each was entered */
+struct powerstats {
+	uint64_t residency[POWER_NMODES];
+	uint32_t entries[POWER_NMODES];
+};
+
+/* Picks the deepest mode which can't miss anything.
+ * untilnext is the time until the next timer is due, in ms, 0 if an event
+ * is already waiting to be processed, or POWER_FOREVER.
+ * Preconditions: None
+ * Postconditions: The mode to idle in is returned
+ */
+enum powermode powerSelect(uint32_t untilnext, uint32_t holds);
+
+/* How long to stay in the mode selected, in ms. Sleep mode is left at the
+ * next interrupt, so this is only meaningful for wait mode.
+ * Preconditions: untilnext was passed to powerSelect, which chose mode
+ */
+uint32_t powerDuration(enum powermode mode, uint32_t untilnext);
+
+/* Records us spent in a mode
+ * Preconditions: A valid powerstats
+ * Postconditions: The residency in the mode is increased by us
+ */
+void powerAccount(struct powerstats *stats, enum powermode mode, uint32_t us);
+
+const char *powerModeName(enum powermode mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+/* Projects how long the kayak spends in each sleep mode, and how long a
+ * battery lasts, from a trace of its activity. Runs on the host, with the
+ * same mode selection as the kayak.
+ *
+ * Usage: powersim [-c capacity mAh] [-b board mA] [trace]
+ *
+ * Each line of the trace is one pass through the main loop:
+ *   <busy ms> <ms until the next timer> [holds]
+ * where holds is the enum powerhold mask, in hex, of the peripherals
+ * with I/O under way while idle. Use - for a loop with no timers
+ * registered. Lines starting with # are ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "powerplan.h"
+
+/* Typical SAM3X8E supply current in each mode at 84 MHz, in mA, from the
+ * datasheet. Only the chip, the rest of the board is the -b option.
+ */
+static const double modeCurrent[POWER_NMODES] = {
+  /* Run, executing from flash with every peripheral we use clocked */
+  50.0,
+  /* Sleep */
+  20.0,
+  /* Wait */
+  0.03,
+};
+
+int main(int argc, char **argv)
+{
+  double capacity = 0, board = 0;
+  int opt;
+  while((opt = getopt(argc, argv, "c:b:")) != -1) {
+    switch(opt) {
+    case 'c':
+      capacity = atof(optarg);
+      break;
+    case 'b':
+      board = atof(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-c capacity mAh] [-b board mA] [trace]\n",
+	      argv[0]);
+      return 1;
+    }
+  }
+  FILE *trace = stdin;
+  if(optind < argc) {
+    trace = fopen(argv[optind], "r");
+    if(!trace) {
+      perror(argv[optind]);
+      return 1;
+    }
+  }
+  struct powerstats stats;
+  memset(&stats, 0, sizeof(stats));
+  char line[256];
+  unsigned lineno = 0;
+  while(fgets(line, sizeof(line), trace)) {
+    lineno++;
+    if(line[0] == '#' || line[0] == '\n')
+      continue;
+    unsigned busy, holds = 0;
+    char next[32];
+    int fields = sscanf(line, "%u %31s %x", &busy, next, &holds);
+    if(fields < 2) {
+      fprintf(stderr, "Line %u isn't <busy> <next> [holds]\n", lineno);
+      continue;
+    }
+    uint32_t untilnext = strcmp(next, "-") ? strtoul(next, NULL, 10) :
+      POWER_FOREVER;
+    powerAccount(&stats, POWER_RUN, busy * 1000);
+    enum powermode mode = powerSelect(untilnext, holds);
+    if(untilnext == POWER_FOREVER)
+      untilnext = POWER_WAITMAX;
+    if(mode == POWER_WAIT) {
+      /* Time waking up is spent running on the RC oscillator, count it as
+       * running to be safe
+       */
+      uint32_t waited = powerDuration(mode, untilnext);
+      powerAccount(&stats, POWER_WAIT, waited * 1000);
+      powerAccount(&stats, POWER_RUN, (untilnext - waited) * 1000);
+    }
+    else if(mode == POWER_SLEEP)
+      powerAccount(&stats, POWER_SLEEP, untilnext * 1000);
+  }
+  if(trace != stdin)
+    fclose(trace);
+  uint64_t total = 0;
+  for(int i = 0; i < POWER_NMODES; i++)
+    total += stats.residency[i];
+  if(total == 0) {
+    fprintf(stderr, "Empty trace\n");
+    return 1;
+  }
+  double average = board;
+  printf("%-6s %12s %8s %10s\n", "mode", "ms", "share", "entries");
+  for(int i = 0; i < POWER_NMODES; i++) {
+    double share = (double)stats.residency[i] / total;
+    average += share * modeCurrent[i];
+    printf("%-6s %12.1f %7.2f%% %10u\n", powerModeName((enum powermode)i),
+	   stats.residency[i] / 1000.0, share * 100, stats.entries[i]);
+  }
+  double always = board + modeCurrent[POWER_RUN];
+  printf("Average current %.2f mA, %.2f mA without sleeping\n",
+	 average, always);
+  if(capacity > 0)
+    printf("Runtime %.1f h, %.1f h without sleeping\n",
+	   capacity / average, capacity / always);
+  return 0;
+}
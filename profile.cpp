@@ -0,0 +1,104 @@
+
+#include "profile.h"
+
+#if !defined(RELEASE_VERSION) && defined(__SAM3X8E__)
+
+#include "include.h"
+#include "scheduler.h"
+#include "logging.h"
+
+#include <Arduino.h>
+
+/* How often the probes are reported, in ms */
+#define PROFILEPERIOD 10000
+
+struct probestats {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  /* Fits 51 s of cycles, more than the period */
+  uint32_t total;
+};
+
+static struct {
+  struct probestats probes[PROBE_COUNT];
+  /* Keyed by the callback, in the order they were first seen */
+  void (*procs[PROFILEEVENTS])(void *);
+  struct probestats events[PROFILEEVENTS];
+  int nevents;
+  uint32_t started;
+} profile;
+
+void profileReport(void *);
+void profileReset(void);
+void profileCount(struct probestats *stats, uint32_t cycles);
+
+void profileInit(void)
+{
+  cyclesInit();
+  profileReset();
+  registerTimer(PROFILEPERIOD, profileReport, NULL);
+}
+
+void profileAdd(enum profileprobe probe, uint32_t cycles)
+{
+  profileCount(&profile.probes[probe], cycles);
+}
+
+void profileAddEvent(void (*proc)(void *), uint32_t cycles)
+{
+  profileAdd(PROBE_EVENT, cycles);
+  int i;
+  for(i = 0; i < profile.nevents && profile.procs[i] != proc; i++);
+  if(i == profile.nevents) {
+    if(i == PROFILEEVENTS)
+      return;
+    profile.procs[i] = proc;
+    profile.nevents++;
+  }
+  profileCount(&profile.events[i], cycles);
+}
+
+void profileCount(struct probestats *stats, uint32_t cycles)
+{
+  if(stats->count == 0 || cycles < stats->min)
+    stats->min = cycles;
+  if(cycles > stats->max)
+    stats->max = cycles;
+  stats->total += cycles;
+  stats->count++;
+}
+
+void profileReport(void *)
+{
+  /* The timer interrupt's probe changes under us otherwise */
+  struct probestats probes[PROBE_COUNT];
+  noInterrupts();
+  memcpy(probes, profile.probes, sizeof(probes));
+  uint32_t interval = GetTickCount() - profile.started;
+  profileReset();
+  interrupts();
+  LOG(PROFILE_INTERVAL, interval);
+  for(int i = 0; i < PROBE_COUNT; i++) {
+    if(probes[i].count)
+      LOG(PROFILE_PROBE, i, probes[i].count, probes[i].min, probes[i].max,
+	  probes[i].total);
+  }
+  /* Events only run from the loop, which this is, so these are still */
+  for(int i = 0; i < profile.nevents; i++) {
+    struct probestats *stats = &profile.events[i];
+    LOG(PROFILE_EVENT, (uintptr_t)profile.procs[i], stats->count, stats->min,
+	stats->max, stats->total);
+  }
+  profile.nevents = 0;
+  memset(profile.events, 0, sizeof(profile.events));
+  registerTimer(PROFILEPERIOD, profileReport, NULL);
+}
+
+void profileReset(void)
+{
+  memset(profile.probes, 0, sizeof(profile.probes));
+  profile.started = GetTickCount();
+}
+
+#endif
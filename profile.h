@@ -0,0 +1,79 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+
+/* Where the processor's time goes, measured with the DWT cycle counter.
+ *
+ * PROFILE(name) at the top of a block times the rest of the block, and
+ * adds it to the probe's count, minimum, maximum and total. Every
+ * PROFILEPERIOD ms the probes are logged as PROFILE_PROBE, numbered in
+ * the order below, and started over. PROFILE_INTERVAL gives the ms they
+ * cover, so total / (ms * 84000) is the share of the processor the probe
+ * took.
+ *
+ * Probes nest, an event's time includes any probe inside it. The counter
+ * stops while the processor sleeps, which no probe spans.
+ *
+ * PROFILEEVENT(proc) is a probe keyed by the callback an event runs,
+ * reported as PROFILE_EVENT with the callback's address, which the map
+ * file names. Only the first PROFILEEVENTS callbacks seen in a period
+ * get their own, the EVENT probe still counts every event.
+ *
+ * Compiled out entirely in the release version, and on the host.
+ */
+#define PROFILEPROBES(X) \
+  X(TIMER_IRQ) \
+  X(EVENT) \
+  X(MOTOR_SPEED) \
+  X(TELEMETRY) \
+  X(GPS_PARSE)
+
+#define PROFILEID(name) PROBE_##name,
+enum profileprobe {
+  PROFILEPROBES(PROFILEID)
+  PROBE_COUNT
+};
+#undef PROFILEID
+
+#if !defined(RELEASE_VERSION) && defined(__SAM3X8E__)
+
+#include "cycles.h"
+
+#define PROFILE(name) struct profilescope profile_##name(PROBE_##name)
+#define PROFILEEVENT(proc) struct profileeventscope profile_event(proc)
+
+/* Callbacks timed separately in each period */
+#define PROFILEEVENTS 16
+
+/* Starts the cycle counter and the reports
+ * Preconditions: The scheduler and the log have been initialized
+ */
+void profileInit(void);
+
+void profileAdd(enum profileprobe probe, uint32_t cycles);
+void profileAddEvent(void (*proc)(void *), uint32_t cycles);
+
+struct profilescope {
+  enum profileprobe probe;
+  uint32_t start;
+  profilescope(enum profileprobe probe) : probe(probe), start(cyclesNow()) {}
+  ~profilescope() { profileAdd(probe, cyclesNow() - start); }
+};
+
+struct profileeventscope {
+  void (*proc)(void *);
+  uint32_t start;
+  profileeventscope(void (*proc)(void *)) : proc(proc), start(cyclesNow()) {}
+  ~profileeventscope() { profileAddEvent(proc, cyclesNow() - start); }
+};
+
+#else
+
+#define PROFILE(name) do {} while(0)
+#define PROFILEEVENT(proc) do {} while(0)
+#define profileInit() do {} while(0)
+
+#endif
+
+#endif
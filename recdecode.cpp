@@ -0,0 +1,162 @@
+/* Turns a flight recorder download back into text.
+ *
+ * Usage: recdecode [file]
+ * Reads from stdin without a file. The download comes out of the debug
+ * port as bulk data in the log, so get it with
+ *   logdecode -r flight.rec < /dev/ttyACM0
+ * after sending the kayak RECORDER_DOWNLOADCMD, then
+ *   recdecode flight.rec
+ * Pages are printed in the order they were written, whatever order they
+ * arrived in, and a page sent twice is only printed once.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "recorder.h"
+
+struct recordformat {
+  const char *name;
+  unsigned nfields;
+  const char *fields;
+};
+
+#define RECORDFORMAT(name, nfields, fields) {#name, nfields, fields},
+static const struct recordformat formats[] = {
+  RECORDTYPES(RECORDFORMAT)
+};
+#undef RECORDFORMAT
+
+struct page {
+  uint32_t sequence;
+  uint8_t data[RECORDER_PAGESIZE];
+};
+
+uint32_t get32(const uint8_t *buf);
+size_t getVarint(const uint8_t *buf, size_t len, uint32_t *value);
+int comparePages(const void *lhs, const void *rhs);
+void printPage(const struct page *page);
+void printFields(const char *names, const int32_t *values, unsigned n);
+
+int main(int argc, char **argv)
+{
+  FILE *input = stdin;
+  if(argc > 1) {
+    input = fopen(argv[1], "rb");
+    if(!input) {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+  struct page *pages = NULL;
+  size_t npages = 0, capacity = 0;
+  unsigned bad = 0;
+  uint8_t data[RECORDER_PAGESIZE];
+  while(fread(data, 1, sizeof(data), input) == sizeof(data)) {
+    if(get32(data) != RECORDER_MAGIC) {
+      bad++;
+      continue;
+    }
+    if(npages == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      pages = (struct page *)realloc(pages, capacity * sizeof(*pages));
+      if(!pages) {
+	fprintf(stderr, "Out of memory\n");
+	return 1;
+      }
+    }
+    pages[npages].sequence = get32(data + 4);
+    memcpy(pages[npages].data, data, sizeof(data));
+    npages++;
+  }
+  if(input != stdin)
+    fclose(input);
+  if(bad)
+    fprintf(stderr, "Skipped %u pages without a header\n", bad);
+  qsort(pages, npages, sizeof(*pages), comparePages);
+  for(size_t i = 0; i < npages; i++) {
+    if(i > 0 && pages[i].sequence == pages[i - 1].sequence)
+      continue;
+    if(i > 0 && pages[i].sequence != pages[i - 1].sequence + 1)
+      printf("--- %u pages missing\n",
+	     pages[i].sequence - pages[i - 1].sequence - 1);
+    printPage(&pages[i]);
+  }
+  free(pages);
+  return 0;
+}
+
+void printPage(const struct page *page)
+{
+  const uint8_t *data = page->data;
+  uint32_t ticks = get32(data + 8);
+  size_t pos = RECORDER_HEADERSIZE;
+  while(pos < RECORDER_PAGESIZE && data[pos] != RECORDER_END) {
+    unsigned type = data[pos++];
+    uint32_t delta;
+    size_t used = getVarint(data + pos, RECORDER_PAGESIZE - pos, &delta);
+    if(!used) {
+      printf("Truncated record in page %u\n", page->sequence);
+      return;
+    }
+    pos += used;
+    ticks += delta;
+    if(type >= RECORD_NTYPES) {
+      /* Can't know how many fields to skip */
+      printf("%10u Unknown record %u, is the decoder out of date?\n",
+	     ticks, type);
+      return;
+    }
+    const struct recordformat *fmt = &formats[type];
+    int32_t values[RECORDER_MAXFIELDS];
+    unsigned n;
+    for(n = 0; n < fmt->nfields; n++) {
+      uint32_t zigzag;
+      used = getVarint(data + pos, RECORDER_PAGESIZE - pos, &zigzag);
+      if(!used)
+	break;
+      pos += used;
+      values[n] = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+    }
+    printf("%10u %-8s", ticks, fmt->name);
+    printFields(fmt->fields, values, n);
+    printf("\n");
+  }
+}
+
+void printFields(const char *names, const int32_t *values, unsigned n)
+{
+  const char *name = names;
+  for(unsigned i = 0; i < n; i++) {
+    size_t len = strcspn(name, " ");
+    printf(" %.*s=%d", (int)len, name, values[i]);
+    name += len;
+    if(*name)
+      name++;
+  }
+}
+
+int comparePages(const void *lhs, const void *rhs)
+{
+  uint32_t a = ((const struct page *)lhs)->sequence,
+    b = ((const struct page *)rhs)->sequence;
+  return a < b ? -1 : a > b;
+}
+
+uint32_t get32(const uint8_t *buf)
+{
+  return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+size_t getVarint(const uint8_t *buf, size_t len, uint32_t *value)
+{
+  *value = 0;
+  for(size_t i = 0; i < len && i < 5; i++) {
+    *value |= (uint32_t)(buf[i] & 0x7F) << (7 * i);
+    if(!(buf[i] & 0x80))
+      return i + 1;
+  }
+  return 0;
+}
@@ -0,0 +1,260 @@
+
+#include "recorder.h"
+#include "include.h"
+#include "scheduler.h"
+#include "config.h"
+#include "logging.h"
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+/* 128 KB of log, just below the parameter block */
+#define RECORDERPAGES 512
+#define RECORDERBASE (IFLASH1_ADDR + IFLASH1_SIZE - \
+		      (CONFIG_PAGES + RECORDERPAGES) * IFLASH1_PAGE_SIZE)
+/* How often the flash is checked on while a page is waiting, in ms */
+#define RECORDERSERVICE 5
+/* Erase page and write page */
+#define EEFCCMD_EWP 0x03
+/* Wait states the flash needs while it's being written at 84 MHz. Set
+ * around each write, since coming out of wait mode puts back the core's
+ * setting
+ */
+#define FLASHWRITEWAIT 6
+#define NOPAGE -1
+
+#if RECORDER_PAGESIZE != IFLASH1_PAGE_SIZE
+#error "The recorder's pages must be flash pages"
+#endif
+
+static struct {
+  /* One page is filled while the other waits for the flash */
+  uint32_t pages[2][RECORDER_PAGESIZE / sizeof(uint32_t)];
+  int filling;
+  int pending;
+  /* Bytes used in the page being filled */
+  unsigned used;
+  /* When the last record in the page was written */
+  uint32_t last;
+  /* Flash page the pending page goes to */
+  unsigned next;
+  uint32_t sequence;
+  unsigned dropped;
+  bool servicing;
+  /* Whether a page is being programmed, and the flash mode to put back
+   * once it's done
+   */
+  bool programming;
+  uint32_t mode;
+} recorder;
+
+void recorderService(void *);
+/* Starts the flash servicing if it isn't already. If there's no timer to
+ * be had, the next page handed off tries again
+ */
+void recorderKick(void);
+void recorderStartPage(void);
+const uint8_t *recorderFlashPage(unsigned page);
+size_t recorderPutVarint(uint8_t *buf, uint32_t value);
+void recorderPut32(uint8_t *buf, uint32_t value);
+uint32_t recorderGet32(const uint8_t *buf);
+
+void recorderInit(void)
+{
+  /* The newest page is the one with the highest sequence number, and
+   * the log carries on after it
+   */
+  bool found = false;
+  unsigned newest = 0;
+  uint32_t sequence = 0;
+  for(unsigned i = 0; i < RECORDERPAGES; i++) {
+    const uint8_t *page = recorderFlashPage(i);
+    if(recorderGet32(page) != RECORDER_MAGIC)
+      continue;
+    uint32_t seq = recorderGet32(page + 4);
+    if(!found || (int32_t)(seq - sequence) > 0) {
+      found = true;
+      newest = i;
+      sequence = seq;
+    }
+  }
+  recorder.next = found ? (newest + 1) % RECORDERPAGES : 0;
+  recorder.sequence = sequence + 1;
+  recorder.filling = 0;
+  recorder.pending = NOPAGE;
+  recorder.dropped = 0;
+  recorder.servicing = false;
+  recorder.programming = false;
+  recorderStartPage();
+  RECORD(BOOT, RECORDER_VERSION);
+}
+
+void recorderWrite(enum recordtype type, unsigned nfields, ...)
+{
+  uint8_t fields[RECORDER_MAXFIELDS * 5];
+  size_t fieldsize = 0;
+  if(nfields > RECORDER_MAXFIELDS)
+    nfields = RECORDER_MAXFIELDS;
+  va_list args;
+  va_start(args, nfields);
+  for(unsigned i = 0; i < nfields; i++) {
+    int32_t value = va_arg(args, int);
+    fieldsize += recorderPutVarint(&fields[fieldsize],
+				   ((uint32_t)value << 1) ^ (value >> 31));
+  }
+  va_end(args);
+  uint32_t now = GetTickCount();
+  /* Type and the longest time */
+  if(recorder.used + 1 + 5 + fieldsize > RECORDER_PAGESIZE) {
+    /* Page is full, hand it off to the flash */
+    if(recorder.pending != NOPAGE) {
+      if(recorder.dropped++ == 0)
+	LOG(RECORDER_FULL);
+      recorderKick();
+      return;
+    }
+    recorder.pending = recorder.filling;
+    recorder.filling ^= 1;
+    recorderStartPage();
+    recorderKick();
+  }
+  uint8_t *page = (uint8_t *)recorder.pages[recorder.filling];
+  page[recorder.used++] = type;
+  recorder.used += recorderPutVarint(&page[recorder.used], now - recorder.last);
+  memcpy(&page[recorder.used], fields, fieldsize);
+  recorder.used += fieldsize;
+  recorder.last = now;
+}
+
+void recorderKick(void)
+{
+  if(!recorder.servicing)
+    recorder.servicing =
+      registerTimer(0, recorderService, NULL) != TIMER_NONE;
+}
+
+void recorderService(void *)
+{
+  /* The flash may still be busy with the last page. Checking back this
+   * often also keeps the processor out of wait mode until it's done
+   */
+  if(!(EFC1->EEFC_FSR & EEFC_FSR_FRDY)) {
+    recorder.servicing =
+      registerTimer(RECORDERSERVICE, recorderService, NULL) != TIMER_NONE;
+    return;
+  }
+  if(recorder.programming) {
+    EFC1->EEFC_FMR = recorder.mode;
+    recorder.programming = false;
+  }
+  if(recorder.pending == NOPAGE) {
+    recorder.servicing = false;
+    return;
+  }
+  recorder.mode = EFC1->EEFC_FMR;
+  EFC1->EEFC_FMR = (recorder.mode & ~EEFC_FMR_FWS_Msk) |
+    EEFC_FMR_FWS(FLASHWRITEWAIT);
+  recorder.programming = true;
+  /* Writing to the page's addresses fills the latch buffer, then the
+   * controller erases and programs the page on its own
+   */
+  unsigned flashpage = (RECORDERBASE - IFLASH1_ADDR) / IFLASH1_PAGE_SIZE +
+    recorder.next;
+  volatile uint32_t *latch = (volatile uint32_t *)recorderFlashPage(recorder.next);
+  const uint32_t *words = recorder.pages[recorder.pending];
+  for(unsigned i = 0; i < RECORDER_PAGESIZE / sizeof(uint32_t); i++)
+    latch[i] = words[i];
+  EFC1->EEFC_FCR = EEFC_FCR_FKEY(0x5A) | EEFC_FCR_FARG(flashpage) |
+    EEFC_FCR_FCMD(EEFCCMD_EWP);
+  recorder.next = (recorder.next + 1) % RECORDERPAGES;
+  recorder.pending = NOPAGE;
+  /* Come back to put the wait states back once it's programmed */
+  recorder.servicing =
+    registerTimer(RECORDERSERVICE, recorderService, NULL) != TIMER_NONE;
+}
+
+void recorderStartPage(void)
+{
+  uint8_t *page = (uint8_t *)recorder.pages[recorder.filling];
+  memset(page, RECORDER_END, RECORDER_PAGESIZE);
+  recorder.last = GetTickCount();
+  recorderPut32(page, RECORDER_MAGIC);
+  recorderPut32(page + 4, recorder.sequence++);
+  recorderPut32(page + 8, recorder.last);
+  recorder.used = RECORDER_HEADERSIZE;
+}
+
+void recorderDownloadStart(struct recorderdownload *dl)
+{
+  /* The page waiting for the flash will have been written by the time
+   * the download gets to it, since it's last
+   */
+  dl->page = recorder.next;
+  if(recorder.pending != NOPAGE)
+    dl->page = (dl->page + 1) % RECORDERPAGES;
+  dl->remaining = RECORDERPAGES + 1;
+  dl->offset = 0;
+  memcpy(dl->current, recorder.pages[recorder.filling], RECORDER_PAGESIZE);
+}
+
+size_t recorderDownloadNext(struct recorderdownload *dl, uint8_t *buf,
+			    size_t size)
+{
+  const uint8_t *page;
+  for(;;) {
+    if(dl->remaining == 0)
+      return 0;
+    page = dl->remaining == 1 ? dl->current : recorderFlashPage(dl->page);
+    /* Pages which have never been written aren't worth sending */
+    if(dl->offset == 0 && recorderGet32(page) != RECORDER_MAGIC) {
+      dl->remaining--;
+      dl->page = (dl->page + 1) % RECORDERPAGES;
+      continue;
+    }
+    break;
+  }
+  if(size > RECORDER_PAGESIZE - dl->offset)
+    size = RECORDER_PAGESIZE - dl->offset;
+  memcpy(buf, page + dl->offset, size);
+  dl->offset += size;
+  if(dl->offset == RECORDER_PAGESIZE) {
+    dl->offset = 0;
+    dl->remaining--;
+    dl->page = (dl->page + 1) % RECORDERPAGES;
+  }
+  return size;
+}
+
+unsigned recorderDropped(void)
+{
+  return recorder.dropped;
+}
+
+const uint8_t *recorderFlashPage(unsigned page)
+{
+  return (const uint8_t *)(RECORDERBASE + page * RECORDER_PAGESIZE);
+}
+
+size_t recorderPutVarint(uint8_t *buf, uint32_t value)
+{
+  size_t i = 0;
+  do {
+    buf[i] = value & 0x7F;
+    value >>= 7;
+    if(value)
+      buf[i] |= 0x80;
+    i++;
+  } while(value);
+  return i;
+}
+
+void recorderPut32(uint8_t *buf, uint32_t value)
+{
+  for(int i = 0; i < 4; i++)
+    buf[i] = value >> (8 * i);
+}
+
+uint32_t recorderGet32(const uint8_t *buf)
+{
+  return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
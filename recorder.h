@@ -0,0 +1,102 @@
+#ifndef _RECORDER_H_
+#define _RECORDER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Flight recorder, a circular log of what the kayak did, kept in flash so
+ * it survives a reset or a dead battery.
+ *
+ * Records are buffered in RAM a page at a time. A full page is handed to
+ * the flash controller, which programs it while the program carries on,
+ * so recording never waits on the flash. The oldest page is overwritten
+ * once the log is full.
+ *
+ * The log is in the lower half of the second flash bank, below the
+ * parameter block, so the program must fit in the first bank.
+ *
+ * Each page is
+ *   RECORDER_MAGIC  4 bytes
+ *   sequence        4 bytes, incremented for every page written
+ *   time            4 bytes, the tick count of the first record
+ *   records, until a type of RECORDER_END
+ * and each record is
+ *   type            1 byte
+ *   time            varint, ms since the previous record in the page
+ *   fields          zigzag varints, as many as the type has
+ * Multibyte values are little endian, varints are as in the telemetry.
+ *
+ * X(name, number of fields, field names)
+ * New types go on the end, so old logs still decode.
+ */
+#define RECORDTYPES(X) \
+  X(BOOT, 1, "version") \
+  X(GPS, 5, "lat lng course speed satellites") \
+  X(HEADING, 1, "heading") \
+  X(COMMAND, 2, "forward rotate") \
+  X(POWER, 4, "ampsA ampsB voltsA voltsB") \
+  X(MODEM, 1, "state") \
+  X(LINK, 1, "up") \
+  X(FAILSAFE, 1, "tripped") \
+  X(ENERGY, 3, "peakampsA peakampsB energy")
+
+#define RECORDID(name, nfields, fields) RECORD_##name,
+enum recordtype {
+  RECORDTYPES(RECORDID)
+  RECORD_NTYPES
+};
+#undef RECORDID
+
+#define RECORDNFIELDS(name, nfields, fields) RECFIELDS_##name = nfields,
+enum {
+  RECORDTYPES(RECORDNFIELDS)
+};
+#undef RECORDNFIELDS
+
+#define RECORDER_MAGIC 0x4345524B
+#define RECORDER_PAGESIZE 256
+#define RECORDER_HEADERSIZE 12
+/* Erased flash, the rest of the page is unused */
+#define RECORDER_END 0xFF
+#define RECORDER_MAXFIELDS 5
+#define RECORDER_MAXRECORD (1 + 5 + RECORDER_MAXFIELDS * 5)
+/* Incremented when the meaning of the records changes */
+#define RECORDER_VERSION 1
+
+/* Sent by the host to ask for the recorder's contents */
+#define RECORDER_DOWNLOADCMD 'D'
+
+#define RECORD(name, ...) \
+  recorderWrite(RECORD_##name, RECFIELDS_##name, ##__VA_ARGS__)
+
+/* Finds the end of the log, so recording carries on after it
+ * Preconditions: The scheduler has been initialized
+ * Postconditions: A BOOT record has been written
+ */
+void recorderInit(void);
+
+/* Adds a record, use RECORD instead.
+ * The record is dropped, and counted, if both page buffers are full.
+ */
+void recorderWrite(enum recordtype type, unsigned nfields, ...);
+
+/* Reads the log out, oldest page first, then the page being filled.
+ * Start a download with recorderDownloadStart, then call
+ * recorderDownloadNext until it returns 0.
+ */
+struct recorderdownload {
+  unsigned page;
+  unsigned remaining;
+  unsigned offset;
+  /* Copy of the page being filled when the download started */
+  uint8_t current[RECORDER_PAGESIZE];
+};
+
+void recorderDownloadStart(struct recorderdownload *dl);
+size_t recorderDownloadNext(struct recorderdownload *dl, uint8_t *buf,
+			    size_t size);
+
+/* How many records have been dropped since startup */
+unsigned recorderDropped(void);
+
+#endif
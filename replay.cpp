@@ -0,0 +1,238 @@
+/* Runs the drivers through a trace of the peripherals' traffic captured
+ * on the kayak, against a virtual clock, so a failure in the field can be
+ * reproduced at the desk, the same way every time, and faster than it
+ * happened.
+ *
+ * Usage: replay [-v] [-f configfile] [-d start,length]... tracefile
+ * Get the trace by building the kayak with make TRACE=1, and pulling it
+ * out of the log with logdecode -t tracefile. The parameters are read from
+ * configfile, as with configtool, so use the kayak's.
+ * -v prints the drivers' log messages as they happen.
+ * -d drops everything the modem receives for length seconds from start
+ * seconds into the trace, to see how the kayak copes with the link going
+ * down. It can be given more than once.
+ *
+ * The drivers, the controller, the failsafe, the scheduler and the GPS
+ * parser are the kayak's own code, built against the virtual hardware in
+ * host/, and wired together by kayakInit as they are on the kayak.
+ * Everything they write is checked against what the kayak wrote.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "include.h"
+#include "kayak.h"
+#include "power.h"
+#include "config.h"
+#include "logging.h"
+#include "recorder.h"
+#include "trace.h"
+#include "hostarduino.h"
+
+extern "C" const char *configFile;
+
+/* Most link outages that can be injected */
+#define MAXOUTAGES 16
+
+static const char *portnames[TRACE_NPORTS] = {
+  "GPS", "modem", "motor", "compass"
+};
+
+#define LOGNAME(name, module, level, nargs, format) #name,
+static const char *lognames[] = {
+  LOGMESSAGES(LOGNAME)
+};
+#undef LOGNAME
+
+static bool verbose = false;
+static unsigned packets = 0;
+static clock_t started;
+/* Injected link outages, in us */
+static uint64_t outagestart[MAXOUTAGES], outageend[MAXOUTAGES];
+static int outages = 0;
+
+struct hostevent *loadTrace(const char *filename, size_t *count);
+void report(void);
+bool inOutage(uint64_t now);
+
+int main(int argc, char **argv)
+{
+  int opt;
+  double start, length;
+  while((opt = getopt(argc, argv, "vf:d:")) != -1) {
+    switch(opt) {
+    case 'v':
+      verbose = true;
+      break;
+    case 'f':
+      configFile = optarg;
+      break;
+    case 'd':
+      if(outages >= MAXOUTAGES ||
+	 sscanf(optarg, "%lf,%lf", &start, &length) != 2 || length <= 0) {
+	fprintf(stderr, "Bad outage %s, give at most %d as start,length\n",
+		optarg, MAXOUTAGES);
+	return 1;
+      }
+      outagestart[outages] = start * 1e6;
+      outageend[outages] = (start + length) * 1e6;
+      outages++;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-v] [-f configfile] [-d start,length]... "
+	      "tracefile\n", argv[0]);
+      return 1;
+    }
+  }
+  if(optind >= argc) {
+    fprintf(stderr, "Usage: %s [-v] [-f configfile] [-d start,length]... "
+	    "tracefile\n", argv[0]);
+    return 1;
+  }
+  size_t count;
+  struct hostevent *events = loadTrace(argv[optind], &count);
+  if(!events)
+    return 1;
+  configLoad(&config);
+  hostLoad(events, count, TRACE_NPORTS);
+  hostOnEnd(report);
+  started = clock();
+  /* Brought up as in setup() */
+  struct scheduler *scheduler = schedulerInit();
+  kayakInit(scheduler);
+  /* And run as in loop(), with the serial events */
+  do {
+    while(schedulerProcessEvents(scheduler));
+    if(kayak.modem && hostWaiting(TRACE_MODEM)) {
+      if(inOutage(hostNow()))
+	while(hostWaiting(TRACE_MODEM))
+	  MODEMSERIAL.read();
+      else
+	modemUpdate(kayak.modem);
+    }
+    while(hostWaiting(TRACE_GPS))
+      kayakGPSByte(GPSSERIAL.read());
+  } while(hostAdvance());
+  report();
+  free(events);
+  return 0;
+}
+
+struct hostevent *loadTrace(const char *filename, size_t *count)
+{
+  FILE *input = fopen(filename, "rb");
+  if(!input) {
+    perror(filename);
+    return NULL;
+  }
+  struct hostevent *events = NULL;
+  size_t capacity = 0;
+  uint64_t time = 0;
+  int header;
+  *count = 0;
+  while((header = fgetc(input)) != EOF) {
+    uint32_t delta = 0;
+    int c, shift = 0;
+    do {
+      c = fgetc(input);
+      if(c == EOF)
+	break;
+      delta |= (uint32_t)(c & 0x7F) << shift;
+      shift += 7;
+    } while(c & 0x80);
+    int value = fgetc(input);
+    if(value == EOF) {
+      fprintf(stderr, "Trace ends in the middle of an event\n");
+      break;
+    }
+    if(*count == capacity) {
+      capacity = capacity ? capacity * 2 : 1024;
+      events = (struct hostevent *)realloc(events, capacity * sizeof(*events));
+      if(!events) {
+	fprintf(stderr, "Out of memory\n");
+	fclose(input);
+	return NULL;
+      }
+    }
+    time += delta;
+    events[*count].time = time;
+    events[*count].port = header >> 1;
+    events[*count].dir = header & 1;
+    events[*count].value = value;
+    (*count)++;
+  }
+  fclose(input);
+  return events;
+}
+
+bool inOutage(uint64_t now)
+{
+  for(int i = 0; i < outages; i++)
+    if(now >= outagestart[i] && now < outageend[i])
+      return true;
+  return false;
+}
+
+void report(void)
+{
+  double wall = (double)(clock() - started) / CLOCKS_PER_SEC;
+  double virt = hostNow() / 1e6;
+  printf("Replayed %.3f s of trace in %.3f s", virt, wall);
+  if(wall > 0)
+    printf(", %.0f times real time", virt / wall);
+  printf("\n%u commands from the base\n", packets);
+  if(kayak.failsafe)
+    printf("Failsafe tripped %u times%s\n", failsafeTrips(kayak.failsafe),
+	   failsafeTripped(kayak.failsafe) ? ", and is still tripped" : "");
+  printf("%-8s %9s %9s %7s %9s %9s %7s\n", "port", "delivered", "read",
+	 "overrun", "written", "different", "missing");
+  bool diverged = false;
+  for(int i = 0; i < TRACE_NPORTS; i++) {
+    struct hostportstats stats;
+    hostStats(i, &stats);
+    printf("%-8s %9u %9u %7u %9u %9u %7u\n", portnames[i], stats.delivered,
+	   stats.read, stats.overrun, stats.written, stats.mismatched,
+	   stats.missing);
+    if(stats.mismatched) {
+      printf("  %s writes first differed at %.6f s\n", portnames[i],
+	     stats.firstmismatch / 1e6);
+      diverged = true;
+    }
+  }
+  if(diverged)
+    printf("The drivers did not do what they did on the kayak\n");
+}
+
+void logRecord(unsigned id, unsigned nargs, ...)
+{
+  if(id == LOGMSG_MODEM_PACKET)
+    packets++;
+  if(!verbose)
+    return;
+  printf("%10.3f %s", hostNow() / 1e6, id < LOGMSG_COUNT ? lognames[id] : "?");
+  va_list args;
+  va_start(args, nargs);
+  for(unsigned i = 0; i < nargs; i++)
+    printf(" %d", va_arg(args, int));
+  va_end(args);
+  printf("\n");
+}
+
+void recorderWrite(enum recordtype, unsigned, ...)
+{
+  /* There's no flash to record to */
+}
+
+void powerHold(uint32_t)
+{
+  /* Nor any sleep modes to stay out of */
+}
+
+void powerRelease(uint32_t)
+{
+}
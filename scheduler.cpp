@@ -7,110 +7,224 @@
 #include "semaphore.h"
 #include "heap.h"
 #include "list.h"
+#include "arena.h"
+#include "logging.h"
+#include "profile.h"
+#include "trace.h"
+
+/* The most events that can be waiting at once */
+#define MAXEVENTS 32
+#if MAXEVENTS > 256
+#error "Timer handles only have room for 256 events"
+#endif
+/* Delay used when an event is due already, in us.
+ * I'm not certain how fast we can get the timer to go,
+ * hopefully 0.1 ms is good enough.
+ * Faster timers don't seem to work
+ */
+#define IMMEDIATEUS 100
+
+enum eventstate {
+  EVENT_FREE,
+  EVENT_QUEUED,
+  EVENT_READY,
+};
 
 typedef struct event {
-  /* Ticks are in approximage ms, according to the libsam library.
-   * timetick.h, line 38
-   * rticks is the absolute number of ticks before the event is to be processed
+  /* Events are kept in the queued heap keyed by the absolute number of
+   * ticks at which they are to be processed. Ticks are in approximate ms,
+   * according to the libsam library. timetick.h, line 38
+   * Once due they move to the ready heap, keyed by the order they
+   * became due in.
    */
-  unsigned rticks;
+  struct hpnode node;
   void (*proc)(void *data);
   void *data;
+  /* How often a periodic timer fires, 0 for one that fires once */
+  unsigned period;
+  enum eventstate state;
+  /* Changed every time the event is reused, so that handles to its
+   * previous uses can be told apart
+   */
+  unsigned generation;
 } event;
 
 struct scheduler {
-  heap *queued;
-  heap *ready;
+  heap queued;
+  heap ready;
+  struct hpslot queuedslots[HP_SLOTS(MAXEVENTS)];
+  struct hpslot readyslots[HP_SLOTS(MAXEVENTS)];
+  /* Events come from a pool rather than the heap, so a handle can always
+   * be checked against the event it refers to, even after it's been freed.
+   * The pool only reuses the first word of a free event, which is the
+   * heap node, so the state and generation survive being freed.
+   */
+  struct pool *events;
+  unsigned generation;
   int readysem;
   unsigned currentId;
 } *scheduler = NULL;
 
-int cmpTime(event *lhs, event *rhs);
-void startTimer(Tc *tc, uint32_t channel, IRQn_Type irq, uint32_t frequency);
+void startTimer(Tc *tc, uint32_t channel, IRQn_Type irq, uint32_t periodus);
+void schedulerArm(unsigned now);
+event *eventAlloc(void);
+void eventRelease(event *evt);
+event *eventLookup(timerhandle timer);
+timerhandle timerAdd(unsigned deltams, unsigned period,
+		     void (*proc)(void *data), void *data);
 
-void registerTimer(unsigned deltams, void (*proc)(void *data), void *data)
+timerhandle registerTimer(unsigned deltams, void (*proc)(void *data), void *data)
 {
-  event *evt = (event *)malloc(sizeof(event));
+  return timerAdd(deltams, 0, proc, data);
+}
+
+timerhandle registerPeriodic(unsigned periodms, void (*proc)(void *data),
+			     void *data)
+{
+  return timerAdd(periodms, periodms, proc, data);
+}
+
+timerhandle timerAdd(unsigned deltams, unsigned period,
+		     void (*proc)(void *data), void *data)
+{
+  semDown(&scheduler->readysem);
+  event *evt = eventAlloc();
   if(!evt) {
-    DEBUGSERIAL.print("Could not allocate memory to register timer!!!\r\n");
+    semUp(&scheduler->readysem);
+    LOG(SCHED_FULL);
+    return TIMER_NONE;
   }
-  evt->rticks = deltams + GetTickCount();
   evt->proc = proc;
   evt->data = data;
+  evt->period = period;
+  evt->state = EVENT_QUEUED;
+  unsigned now = GetTickCount();
+  hpAdd(&scheduler->queued, &evt->node, deltams + now);
+  TRACESCHED(TRACE_SCHED_REGISTER, poolIndex(scheduler->events, evt),
+	     deltams + now);
+  /* Only need to restart the timer if this is the new first event */
+  if(hpPeek(&scheduler->queued) == &evt->node)
+    schedulerArm(now);
+  timerhandle timer = (evt->generation << 8) |
+    poolIndex(scheduler->events, evt);
+  semUp(&scheduler->readysem);
+  LOG(SCHED_REGISTER, deltams);
+  return timer;
+}
+
+bool cancelTimer(timerhandle timer)
+{
+  semDown(&scheduler->readysem);
+  event *evt = eventLookup(timer);
+  if(!evt) {
+    semUp(&scheduler->readysem);
+    return false;
+  }
+  TRACESCHED(TRACE_SCHED_CANCEL, poolIndex(scheduler->events, evt), 0);
+  if(evt->state == EVENT_QUEUED) {
+    bool first = hpPeek(&scheduler->queued) == &evt->node;
+    hpRemove(&scheduler->queued, &evt->node);
+    if(first)
+      schedulerArm(GetTickCount());
+  }
+  else {
+    hpRemove(&scheduler->ready, &evt->node);
+  }
+  eventRelease(evt);
+  semUp(&scheduler->readysem);
+  return true;
+}
+
+bool rescheduleTimer(timerhandle timer, unsigned deltams)
+{
   semDown(&scheduler->readysem);
-  hpAdd(scheduler->queued, evt);
-  event *newtop = (event *)hpPeek(scheduler->queued);
+  event *evt = eventLookup(timer);
+  if(!evt) {
+    semUp(&scheduler->readysem);
+    return false;
+  }
+  unsigned now = GetTickCount();
+  TRACESCHED(TRACE_SCHED_RESCHEDULE, poolIndex(scheduler->events, evt),
+	     deltams + now);
+  if(evt->state == EVENT_QUEUED) {
+    hpUpdate(&scheduler->queued, &evt->node, deltams + now);
+  }
+  else {
+    /* It already came due, so take it back out of the ready queue */
+    hpRemove(&scheduler->ready, &evt->node);
+    hpAdd(&scheduler->queued, &evt->node, deltams + now);
+    evt->state = EVENT_QUEUED;
+  }
+  /* The first event may have changed either way, so always rearm */
+  schedulerArm(now);
   semUp(&scheduler->readysem);
-  float freq = 1000.0f / (newtop->rticks - GetTickCount());
-  DEBUGPRINT("Registering timer for ");
-  DEBUGPRINT(deltams);
-  DEBUGPRINT(" ms from now with frequency ");
-  DEBUGPRINT(freq);
-  DEBUGPRINT(".\r\n");
-  startTimer(TC1, 0, TC3_IRQn, freq);
+  return true;
 }
 
 void TC3_Handler()
 {
   /* This is called by the sam3x code when it recieves a timer interrupt.
    * It will not be called again before the GetStatus is called.
-   * We need to do three things:
-   * Get the event to be processed
-   * Put it into the ready queue
+   * We need to do two things:
+   * Move the events which are due into the ready queue
    * Start the timer for the next event
+   * The timer can go off early if the first event was rescheduled,
+   * so check that each event really is due.
    */
-  int t1 = GetTickCount();
-  int islocked = semTryDown(&scheduler->readysem);
-  if(islocked) {
-    event *evt = (event *)hpTop(scheduler->queued);
-    event *next = (event *)hpPeek(scheduler->queued);
-    /* The schedule heap needs to be in FIFO order,
-     * so set base the ID on the number of events that
-     * have entered the heap.
-     */
-    evt->rticks = scheduler->currentId;
-    scheduler->currentId++;
-    
-    hpAdd(scheduler->ready, evt);
-    /* Let any other timers on TC1 go */
-    TC_GetStatus(TC1, 0);
-    semUp(&scheduler->readysem);
+  PROFILE(TIMER_IRQ);
+  unsigned now = GetTickCount();
+  /* Let any other timers on TC1 go */
+  TC_GetStatus(TC1, 0);
+  if(semTryDown(&scheduler->readysem) == 1) {
+    struct hpnode *node;
+    while((node = hpPeek(&scheduler->queued)) &&
+	  (int)(hpKey(&scheduler->queued, node) - now) <= 0) {
+      hpTop(&scheduler->queued);
+      TRACESCHED(TRACE_SCHED_DUE,
+		 poolIndex(scheduler->events, hpEntry(node, event, node)), 0);
+      /* The ready heap needs to be in FIFO order,
+       * so base the ID on the number of events that
+       * have entered the heap.
+       */
+      hpAdd(&scheduler->ready, node, scheduler->currentId);
+      hpEntry(node, event, node)->state = EVENT_READY;
+      scheduler->currentId++;
+    }
     /* We register the next timer (or disable the timer)
      * before we execute the event code because the event
      * code may need to register another timer
      */
-    DEBUGPRINT("\r\nHandling timer event\r\n");
-    if(next) {
-      int deltat = next->rticks - t1;
-      /* deltat may be negative */
-      if(deltat < 1) {
-	DEBUGPRINT("Starting timer immediately from now\r\n");
-	/* We have another event which is due now, so process it ASAP.
-	 * I'm not certain how fast we can get the timer to go,
-	 * hopefully 0.1 ms is good enough.
-	 * Faster timers don't seem to work
-	 */
-	startTimer(TC1, 0, TC3_IRQn, 10000);
-      }
-      else {
-	float freq = 1000.0f / deltat;
-	DEBUGPRINT("Starting timer for ");
-	DEBUGPRINT(deltat);
-	DEBUGPRINT(" ms from now.\r\n");
-	startTimer(TC1, 0, TC3_IRQn, freq);
-      }
+    schedulerArm(now);
+    semUp(&scheduler->readysem);
+  }
+  else {
+    /* We didn't get the lock, so try again after letting the other code go */
+    startTimer(TC1, 0, TC3_IRQn, IMMEDIATEUS);
+  }
+}
+
+void schedulerArm(unsigned now)
+{
+  /* Starts the timer for the first queued event, or turns it off if there
+   * aren't any. Needs the lock held.
+   */
+  struct hpnode *next = hpPeek(&scheduler->queued);
+  if(next) {
+    int deltat = hpKey(&scheduler->queued, next) - now;
+    /* deltat may be negative */
+    if(deltat < 1) {
+      /* We have another event which is due now, so process it ASAP. */
+      startTimer(TC1, 0, TC3_IRQn, IMMEDIATEUS);
     }
     else {
-      /* Turn the clock off, we shouldn't need it
-       * Save our entropy!!!
-       */
-      DEBUGPRINT("Turning timer off\r\n");
-      pmc_disable_periph_clk((uint32_t)TC3_IRQn);
+      startTimer(TC1, 0, TC3_IRQn, deltat * 1000);
     }
   }
   else {
-    /* We didn't get the lock, so try again after letting the other code go */
-    startTimer(TC1, 0, TC3_IRQn, 10000);
+    /* Turn the clock off, we shouldn't need it
+     * Save our entropy!!!
+     */
+    pmc_disable_periph_clk((uint32_t)TC3_IRQn);
   }
 }
 
@@ -119,13 +233,26 @@ struct scheduler *schedulerInit(void)
   /* The scheduler is a singleton :( */
   if(scheduler)
     return NULL;
-  scheduler = (struct scheduler *)malloc(sizeof(struct scheduler));
-  if(!scheduler) {
-    DEBUGSERIAL.print("Could not allocate enough memory!\r\n");
+  struct scheduler *s =
+    (struct scheduler *)arenaAlloc(sizeof(struct scheduler));
+  if(!s) {
+    LOG(ALLOC_FAILED, LOGALLOC_SCHEDULER);
     return NULL;
   }
-  scheduler->queued = hpCreate((int (*)(void *, void *))cmpTime);
-  scheduler->ready = hpCreate((int (*)(void *, void *))cmpTime);
+  s->events = poolCreate(sizeof(event), MAXEVENTS);
+  if(!s->events) {
+    LOG(ALLOC_FAILED, LOGALLOC_SCHEDULER);
+    return NULL;
+  }
+  hpInit(&s->queued, s->queuedslots, MAXEVENTS);
+  hpInit(&s->ready, s->readyslots, MAXEVENTS);
+  for(int i = 0; i < MAXEVENTS; i++) {
+    event *evt = (event *)poolBlock(s->events, i);
+    evt->state = EVENT_FREE;
+    evt->generation = 0;
+  }
+  scheduler = s;
+  scheduler->generation = 0;
   scheduler->currentId = 1;
   scheduler->readysem = 1;
   return scheduler;
@@ -133,29 +260,133 @@ struct scheduler *schedulerInit(void)
 
 bool schedulerProcessEvents(struct scheduler *s)
 {
-  event *evt = (event *)hpTop(s->ready);
-  if(evt) {
-    assert(evt->proc);
-    evt->proc(evt->data);
-    return true;
+  semDown(&s->readysem);
+  struct hpnode *node = hpTop(&s->ready);
+  if(!node) {
+    semUp(&s->readysem);
+    return false;
+  }
+  /* Free the event before running it, so it can register itself again
+   * even when every other event is in use. A periodic event is queued
+   * again instead, so it never needs a free one.
+   */
+  event *evt = hpEntry(node, event, node);
+  TRACESCHED(TRACE_SCHED_RUN, poolIndex(s->events, evt), 0);
+  void (*proc)(void *data) = evt->proc;
+  void *data = evt->data;
+  if(evt->period) {
+    unsigned now = GetTickCount();
+    evt->state = EVENT_QUEUED;
+    hpAdd(&s->queued, &evt->node, now + evt->period);
+    TRACESCHED(TRACE_SCHED_REGISTER, poolIndex(s->events, evt),
+	       now + evt->period);
+    if(hpPeek(&s->queued) == &evt->node)
+      schedulerArm(now);
+  }
+  else {
+    eventRelease(evt);
+  }
+  semUp(&s->readysem);
+  assert(proc);
+  {
+    PROFILEEVENT(proc);
+    proc(data);
+  }
+  return true;
+}
+
+unsigned schedulerIdleTime(struct scheduler *s)
+{
+  unsigned idle = SCHEDULER_FOREVER;
+  semDown(&s->readysem);
+  struct hpnode *next = hpPeek(&s->queued);
+  if(hpSize(&s->ready) > 0)
+    idle = 0;
+  else if(next) {
+    int deltat = hpKey(&s->queued, next) - GetTickCount();
+    idle = deltat > 0 ? deltat : 0;
   }
-  return false;
+  semUp(&s->readysem);
+  return idle;
+}
+
+void schedulerResume(struct scheduler *s)
+{
+  semDown(&s->readysem);
+  if(hpPeek(&s->queued)) {
+    /* Let the interrupt handler move whatever came due while we were out */
+    startTimer(TC1, 0, TC3_IRQn, IMMEDIATEUS);
+  }
+  semUp(&s->readysem);
+}
+
+void schedulerStats(struct scheduler *s, struct memstats *stats)
+{
+  poolStats(s->events, stats);
+}
+
+event *eventAlloc(void)
+{
+  event *evt = (event *)poolAlloc(scheduler->events);
+  if(!evt)
+    return NULL;
+  /* Handles need a nonzero generation to never be TIMER_NONE */
+  scheduler->generation = (scheduler->generation + 1) & 0xFFFFFF;
+  if(scheduler->generation == 0)
+    scheduler->generation = 1;
+  evt->generation = scheduler->generation;
+  return evt;
+}
+
+void eventRelease(event *evt)
+{
+  evt->state = EVENT_FREE;
+  poolFree(scheduler->events, evt);
+}
+
+event *eventLookup(timerhandle timer)
+{
+  unsigned index = timer & 0xFF;
+  if(timer == TIMER_NONE || index >= MAXEVENTS)
+    return NULL;
+  event *evt = (event *)poolBlock(scheduler->events, index);
+  if(evt->state == EVENT_FREE || evt->generation != timer >> 8)
+    return NULL;
+  return evt;
 }
 
-int cmpTime(event *lhs, event *rhs)
+timerhandle postEvent(void (*proc)(void *data), void *data)
 {
-  assert(lhs && rhs);
-  return rhs->rticks - lhs->rticks;
+  semDown(&scheduler->readysem);
+  event *evt = eventAlloc();
+  if(!evt) {
+    semUp(&scheduler->readysem);
+    LOG(SCHED_FULL);
+    return TIMER_NONE;
+  }
+  evt->proc = proc;
+  evt->data = data;
+  evt->state = EVENT_READY;
+  /* Behind everything that's already due, like the interrupt handler does */
+  hpAdd(&scheduler->ready, &evt->node, scheduler->currentId);
+  TRACESCHED(TRACE_SCHED_POST, poolIndex(scheduler->events, evt), 0);
+  scheduler->currentId++;
+  timerhandle handle = (evt->generation << 8) |
+    poolIndex(scheduler->events, evt);
+  semUp(&scheduler->readysem);
+  return handle;
 }
 
-void startTimer(Tc *tc, uint32_t channel, IRQn_Type irq, uint32_t frequency)
+void startTimer(Tc *tc, uint32_t channel, IRQn_Type irq, uint32_t periodus)
 {
   /* Black magic box */
   pmc_set_writeprotect(false);
   pmc_enable_periph_clk((uint32_t)irq);
   TC_Configure(tc, channel, TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC | TC_CMR_TCCLKS_TIMER_CLOCK4);
-  /* 128 because we selected TIMER_CLOCK4 above */
-  uint32_t rc = VARIANT_MCK / 128 / frequency;
+  /* 128 because we selected TIMER_CLOCK4 above.
+   * That's 656250 Hz, or exactly 21/32 counts per us
+   */
+  uint32_t rc = (uint64_t)periodus * (VARIANT_MCK / 128 / 15625) / 64;
   TC_SetRA(tc, channel, rc / 2); //50% high, 50% low
   TC_SetRC(tc, channel, rc);
   TC_Start(tc, channel);
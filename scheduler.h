@@ -1,11 +1,73 @@
-
 #ifndef _SCHEDULER_H_
 #define _SCHEDULER_H_
 
+#include "arena.h"
+
 struct scheduler;
 
+/* Identifies a registered timer. Handles go stale once the timer has
+ * fired or been cancelled, and the calls below then safely do nothing.
+ */
+typedef unsigned timerhandle;
+
+/* Never a valid handle */
+#define TIMER_NONE 0
+
 struct scheduler *schedulerInit(void);
-void registerTimer(unsigned deltams, void (*proc)(void *data), void *data);
+
+/* Calls proc with data once, deltams from now.
+ * Returns a handle to the timer, or TIMER_NONE if too many timers are
+ * already registered.
+ */
+timerhandle registerTimer(unsigned deltams, void (*proc)(void *data), void *data);
+
+/* Calls proc with data every periodms, starting periodms from now, until
+ * the timer is cancelled. The next call is queued before proc runs, so
+ * proc can move it with rescheduleTimer, and the handle stays good.
+ * Returns a handle to the timer, or TIMER_NONE if too many timers are
+ * already registered. Once registered, it can't be lost to a full pool.
+ */
+timerhandle registerPeriodic(unsigned periodms, void (*proc)(void *data),
+			     void *data);
+
+/* Queues proc to be called with data as soon as the events already
+ * waiting have been processed, without involving the timer.
+ * Used by the sources of events, like a packet arriving, so the main loop
+ * only does what's pending. Not safe to call from an interrupt handler.
+ * Returns a handle which can be cancelled, or TIMER_NONE if too many
+ * events are already registered.
+ */
+timerhandle postEvent(void (*proc)(void *data), void *data);
+
+/* Stops a timer from firing. Returns false if the handle was stale.
+ * A timer which has come due but not yet been processed is also stopped.
+ */
+bool cancelTimer(timerhandle timer);
+
+/* Moves a timer to fire deltams from now instead.
+ * Returns false if the handle was stale.
+ */
+bool rescheduleTimer(timerhandle timer, unsigned deltams);
+
 bool schedulerProcessEvents(struct scheduler *s);
 
+/* Returned by schedulerIdleTime when no timers are registered */
+#define SCHEDULER_FOREVER 0xFFFFFFFF
+
+/* How long until there's something to do, in ms. 0 if an event is
+ * waiting to be processed, SCHEDULER_FOREVER if nothing is registered.
+ */
+unsigned schedulerIdleTime(struct scheduler *s);
+
+/* Restarts the timer after its clock has been stopped, such as by wait
+ * mode, so events that came due in the meantime are processed
+ * Preconditions: The tick count has been brought up to date
+ */
+void schedulerResume(struct scheduler *s);
+
+/* How many of the scheduler's events are in use, at most and right now,
+ * and how many timers couldn't be registered
+ */
+void schedulerStats(struct scheduler *s, struct memstats *stats);
+
 #endif
@@ -0,0 +1,72 @@
+
+#include "setpoint.h"
+
+#include "half.h"
+
+static void putInt32(uint8_t *buf, int32_t value)
+{
+	uint32_t bits = value;
+	int i;
+	for(i = 0; i < 4; i++)
+		buf[i] = bits >> (8 * i);
+}
+
+static int32_t getInt32(const uint8_t *buf)
+{
+	uint32_t bits = 0;
+	int i;
+	for(i = 0; i < 4; i++)
+		bits |= (uint32_t)buf[i] << (8 * i);
+	return bits;
+}
+
+static size_t setpointSize(enum setpointkind kind)
+{
+	switch(kind) {
+	case SETPOINT_MANUAL:
+		return 3;
+	case SETPOINT_HEADING:
+		return 5;
+	case SETPOINT_WAYPOINT:
+		return 11;
+	}
+	return 0;
+}
+
+size_t setpointEncode(uint8_t *buf, size_t size, const struct setpoint *sp)
+{
+	size_t len = setpointSize(sp->kind);
+	if(!len || size < len)
+		return 0;
+	buf[0] = sp->kind;
+	halfStore(buf + 1, sp->forward);
+	if(sp->kind == SETPOINT_HEADING) {
+		buf[3] = sp->heading & 0xFF;
+		buf[4] = sp->heading >> 8;
+	}
+	else if(sp->kind == SETPOINT_WAYPOINT) {
+		putInt32(buf + 3, sp->lat);
+		putInt32(buf + 7, sp->lng);
+	}
+	return len;
+}
+
+bool setpointDecode(const uint8_t *buf, size_t len, struct setpoint *sp)
+{
+	if(len < 1 || len != setpointSize((enum setpointkind)buf[0]))
+		return false;
+	sp->kind = (enum setpointkind)buf[0];
+	sp->forward = halfLoad(buf + 1);
+	sp->heading = 0;
+	sp->lat = sp->lng = 0;
+	if(sp->kind == SETPOINT_HEADING) {
+		sp->heading = buf[3] | (uint16_t)buf[4] << 8;
+		if(sp->heading >= 3600)
+			return false;
+	}
+	else if(sp->kind == SETPOINT_WAYPOINT) {
+		sp->lat = getInt32(buf + 3);
+		sp->lng = getInt32(buf + 7);
+	}
+	return true;
+}
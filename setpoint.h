@@ -0,0 +1,63 @@
+
+#ifndef _SETPOINT_H_
+#define _SETPOINT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Setpoints for the kayak's own controller, sent by the base in
+ * FRAME_SETPOINT frames, so the kayak steers itself rather than being
+ * steered over the link. Shared by the kayak and the base station.
+ *
+ * The payload is
+ *   kind      1 byte, a setpointkind
+ *   forward   2 bytes, half precision forward power
+ * followed for SETPOINT_HEADING by
+ *   heading   2 bytes, tenths of a degree from north
+ * or for SETPOINT_WAYPOINT by
+ *   lat, lng  4 bytes each, millionths of a degree
+ * all little endian.
+ */
+enum setpointkind {
+	/* Back to steering by the command frames, forward is ignored */
+	SETPOINT_MANUAL,
+	/* Hold a compass heading */
+	SETPOINT_HEADING,
+	/* Go to a position and stop there */
+	SETPOINT_WAYPOINT,
+};
+
+#define SETPOINT_MAXSIZE 11
+
+struct setpoint {
+	enum setpointkind kind;
+	/* Half precision */
+	uint16_t forward;
+	uint16_t heading;
+	int32_t lat, lng;
+};
+
+/* Writes a setpoint as a FRAME_SETPOINT payload, for the base.
+ * Returns the number of bytes written, or 0 if there isn't room.
+ * Preconditions: buf has room for size bytes, a valid setpoint
+ * Postconditions: The setpoint is written to buf
+ */
+size_t setpointEncode(uint8_t *buf, size_t size, const struct setpoint *sp);
+
+/* Reads a FRAME_SETPOINT payload.
+ * Returns false if it's malformed, or the heading is 360 degrees or more.
+ * Preconditions: buf has len bytes
+ * Postconditions: sp holds the setpoint if it's good
+ */
+bool setpointDecode(const uint8_t *buf, size_t len, struct setpoint *sp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,97 @@
+
+#include "shape.h"
+
+static q15 shapeLimit(uint32_t periodms, uint32_t ms)
+{
+	uint32_t step;
+	if(ms == 0)
+		return 0;
+	step = (uint32_t)Q15_ONE * periodms / ms;
+	/* A limit that rounds to nothing would never get anywhere */
+	if(step == 0)
+		return 1;
+	return step > Q15_ONE ? Q15_ONE : step;
+}
+
+void shapeSetup(struct shapeparams *params, uint32_t periodms,
+								uint32_t deadband, uint32_t expo, uint32_t risems,
+								uint32_t fallms, bool mix)
+{
+	params->deadband = q15Clamp(deadband * Q15_ONE / 1000);
+	params->expo = q15Clamp(expo * Q15_ONE / 1000);
+	params->rise = shapeLimit(periodms, risems);
+	params->fall = shapeLimit(periodms, fallms);
+	params->mix = mix;
+}
+
+q15 shapeCurve(q15 power, q15 deadband, q15 expo)
+{
+	int32_t value = power < 0 ? -power : power, cube;
+	if(value <= deadband)
+		return 0;
+	if(deadband > 0)
+		value = (value - deadband) * (int32_t)Q15_ONE / (Q15_ONE - deadband);
+	if(expo > 0) {
+		cube = q15Mul(q15Mul(value, value), value);
+		value += q15Mul(expo, cube - value);
+	}
+	return power < 0 ? -value : value;
+}
+
+q15 shapeSlew(q15 output, q15 target, q15 rise, q15 fall)
+{
+	int32_t limit;
+	/* Slow to a stop before reversing */
+	if((output > 0 && target < 0) || (output < 0 && target > 0)) {
+		if(fall > 0)
+			target = 0;
+		else
+			output = 0;
+	}
+	if((target >= 0 ? target : -target) > (output >= 0 ? output : -output))
+		limit = rise;
+	else
+		limit = fall;
+	if(limit <= 0)
+		return target;
+	if(target > output + limit)
+		return output + limit;
+	if(target < output - limit)
+		return output - limit;
+	return target;
+}
+
+bool shapeStep(const struct shapeparams *params, q15 forward, q15 rotate,
+							 q15 out[2])
+{
+	int32_t target[2], biggest;
+	q15 next;
+	bool changed = false;
+	int i;
+	forward = shapeCurve(forward, params->deadband, params->expo);
+	rotate = shapeCurve(rotate, params->deadband, params->expo);
+	if(params->mix) {
+		target[0] = forward + rotate;
+		target[1] = forward - rotate;
+		biggest = target[0] < 0 ? -target[0] : target[0];
+		if(target[1] > biggest || -target[1] > biggest)
+			biggest = target[1] < 0 ? -target[1] : target[1];
+		if(biggest > Q15_ONE) {
+			for(i = 0; i < 2; i++)
+				target[i] = target[i] * Q15_ONE / biggest;
+		}
+	}
+	else {
+		target[0] = forward;
+		target[1] = rotate;
+	}
+	for(i = 0; i < 2; i++) {
+		next = shapeSlew(out[i], q15Clamp(target[i]), params->rise,
+										 params->fall);
+		if(next != out[i]) {
+			out[i] = next;
+			changed = true;
+		}
+	}
+	return changed;
+}
@@ -0,0 +1,69 @@
+
+#ifndef _SHAPE_H_
+#define _SHAPE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fixed.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Shaping of the powers on their way to the motor controller, shared by
+ * the kayak and the host tools.
+ *
+ * Each step, the forward and rotation powers go through
+ *   deadband  powers closer to 0 than the deadband are 0, and the rest of
+ *             the range is stretched to cover 0 to 1 again
+ *   curve     a blend of the power and its cube, so the middle of the
+ *             stick is gentler without losing full power
+ *   mix       optionally into left and right thrust, forward plus and
+ *             minus rotation, scaled down together if either is over 1
+ *             so the turn keeps its shape
+ *   slew      each output moves towards that by at most rise per step
+ *             when speeding up, and fall when slowing down. Going from
+ *             forward to reverse slows to 0 first
+ * A step in the command then reaches the motors as a ramp, rather than as
+ * a current spike.
+ */
+struct shapeparams {
+	q15 deadband;
+	/* Share of the curve that's the cube, 0 for linear */
+	q15 expo;
+	/* Most an output changes in a step, 0 for no limit */
+	q15 rise, fall;
+	/* Send left and right thrust rather than forward and rotation */
+	bool mix;
+};
+
+/* Works the parameters out from the units they're configured in, for
+ * steps of periodms. deadband and expo are in permille, and risems and
+ * fallms are the least time to go from 0 to full power and back, 0 for
+ * no limit
+ * Preconditions: A valid params object, a positive period
+ * Postconditions: params is ready for shapeStep
+ */
+void shapeSetup(struct shapeparams *params, uint32_t periodms,
+								uint32_t deadband, uint32_t expo, uint32_t risems,
+								uint32_t fallms, bool mix);
+
+/* Steps the outputs towards the shaped forward and rotation powers.
+ * Returns whether the outputs changed.
+ * Preconditions: Valid params, out holds the last outputs, 0 to start
+ * Postconditions: out holds the outputs for this step
+ */
+bool shapeStep(const struct shapeparams *params, q15 forward, q15 rotate,
+							 q15 out[2]);
+
+/* The deadband and curve, for one power */
+q15 shapeCurve(q15 power, q15 deadband, q15 expo);
+
+/* Moves an output towards target, as limited by rise and fall */
+q15 shapeSlew(q15 output, q15 target, q15 rise, q15 fall);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,35 +1,51 @@
-
 #include <Arduino.h>
 #include <Wire/Wire.h>
 #include "include.h"
-#include "scheduler.h"
-#include "list.h"
-#include "modem.h"
-#include "motor.h"
-#include "compass.h"
-
-#include "TinyGPS.h"
-
-/* Group our stuff used for our program, not just program wide globals */
-struct kayak {
-  /* Used to parse GPS data */
-  TinyGPS gpsdata;
-  /* Compass object, keeps track of the bearing of the kayak */
-  struct compass *compass;
-  /* Modem object, keeps track of the state of the modem */
-  struct modem *modem;
-  /* Motor controller object, keeps track of the state of the motors and battery,
-   * provides interface between the two
-   */
-  struct motorctrl *motor;
-  /* Scheduler object, used to schedule jobs and what not */
-  struct scheduler *scheduler;
-  /* The total power used by the motors */
-  unsigned powerused;
-} kayak;
+#include "kayak.h"
+#include "arena.h"
+#include "power.h"
+#include "logging.h"
+#include "config.h"
+#include "recorder.h"
+#include "trace.h"
+#include "profile.h"
+
+/* How often the memory use is reported over the debug port, in ms */
+#define MEMREPORTPERIOD 10000
+/* Recorder download, how much goes into a log record, and how often the
+ * log is checked for room, in ms
+ */
+#define DOWNLOADCHUNK 64
+#define DOWNLOADPERIOD 10
+/* How long the debug port is kept out of wait mode after the kayak
+ * starts, or after the last byte it received, in ms. Opening the
+ * programming port resets the Due, so that's when a download is asked
+ * for. After that, wait mode can lose the first byte sent.
+ */
+#define DEBUGLISTEN 60000
+
+/* Flight recorder contents being sent over the debug port */
+static struct recorderdownload download;
+static bool downloading;
+/* Gives up the debug port's hold on wait mode */
+static timerhandle debugtimer;
+
+/* Logs how much of the arena and the scheduler's event pool are in use,
+ * at most and right now, and how many allocations have failed
+ */
+void memoryReport(void *);
+
+/* Logs the share of time spent in each sleep mode */
+void powerReport(void);
 
-/* Used to send all of the data that Santa Clara's packet format specifies */
-void sendPacket();
+/* Sends the flight recorder's contents over the debug port, as raw log
+ * records, as fast as the log drains
+ */
+void downloadPump(void *);
+
+/* Keeps the debug port listening for another DEBUGLISTEN ms */
+void debugListen(void);
+void debugQuiet(void *);
 
 void enableTRNG(void);
 uint32_t trandom(void);
@@ -40,145 +56,132 @@ void setup(void)
    * Debug output (USB connection), GPS (3.3 V TTL Serial)
    * and the compass (I2C)
    */
-  DEBUGSERIAL.begin(115200);
-  kayak.scheduler = schedulerInit();
-  GPSSERIAL.begin(38400);
-  
-  /* The more involved pieces of hardware are handled in a more
-   * more robust manner... Modem and motor controller
+  bool loaded = configLoad(&config);
+  DEBUGSERIAL.begin(config.debugbaud);
+  powerInit();
+  struct scheduler *scheduler = schedulerInit();
+  logInit();
+  recorderInit();
+#ifdef TRACE
+  traceInit();
+#endif
+  profileInit();
+  if(loaded)
+    LOG(CONFIG_LOADED);
+  else
+    LOG(CONFIG_DEFAULTS);
+  kayakInit(scheduler);
+  /* Everything which lives for the whole run has been allocated. Sealing
+   * the arena makes any later allocation show up as a failure, rather
+   * than slowly eating the memory
    */
-  DEBUGPRINT("Attempting to connect the modem\r\n");
-  kayak.modem = modemInit(&MODEMSERIAL, 1000);
-  if(!kayak.modem) {
-    DEBUGSERIAL.print("Modem not connected\r\n");
-  }
-  else {
-    DEBUGSERIAL.print("Modem connected\r\n");
-  }
-  DEBUGPRINT("Attempting to connect the motor controller\r\n");
-  kayak.motor = motorInit(&MOTORSERIAL, 100);
-  if(!kayak.motor) {
-    DEBUGSERIAL.print("Motor controller not connected\r\n");
-  }
-  else {
-    DEBUGSERIAL.print("Motor controller connected\r\n");
-  }
-  DEBUGPRINT("Initializing the compass\r\n");
-  kayak.compass = compassInit(&COMPASSWIRE);
+  arenaSeal();
+  registerTimer(MEMREPORTPERIOD, memoryReport, NULL);
+  downloading = false;
+  debugtimer = TIMER_NONE;
+  debugListen();
 }
 
 void loop()
 {
   /* Puts the processor to sleep until an interrupt occurs (such as a timer,
-   * or serial input.)
+   * or serial input), or until the next timer if nothing is listening
+   * for input.
    * From:
    * http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.dui0552a/CIHCAEJD.html
    */
-  __WFI();
-  /* The scheduler may have gotten some events to process, so let it run */
+  powerIdle(kayak.scheduler);
+  /* Everything that needs doing has been posted to the scheduler, by a
+   * timer, or by the serial events below, so only that runs
+   */
   while(schedulerProcessEvents(kayak.scheduler));
+#ifdef TRACE
+  traceScheduleFlush();
+#endif
+  /* Still coming round, so the watchdog can wait */
+  failsafeKick();
+}
 
-  /* Update the powers sent to the motors */
-  if(kayak.modem && kayak.motor && modemHasPacket(kayak.modem)) {
-    motorSetSpeed(kayak.motor,
-		  modemForwardPwr(kayak.modem),
-		  modemRotationPwr(kayak.modem));
-  }
-  /* Update the GPS information; longitude, latitude, number of satellites, etc. */
-  if(GPSSERIAL.available() > 0) {
-    bool encoded = false;
-    // DEBUGSERIAL.write("Reading GPS Data:\r\n");
-    while(GPSSERIAL.available() > 0 && !encoded){
-      byte value = GPSSERIAL.read();
-      // DEBUGSERIAL.write(value);
-      encoded = kayak.gpsdata.encode(value);
+void GPSSERIALEVENT()
+{
+  PROFILE(GPS_PARSE);
+  while(GPSSERIAL.available() > 0)
+    kayakGPSByte(TRACEIN(TRACE_GPS, GPSSERIAL.read()));
+}
+
+void DEBUGSERIALEVENT()
+{
+  while(DEBUGSERIAL.available() > 0) {
+    debugListen();
+    if(DEBUGSERIAL.read() == RECORDER_DOWNLOADCMD && !downloading) {
+      LOG(RECORDER_DOWNLOAD, recorderDropped());
+      recorderDownloadStart(&download);
+      downloading = postEvent(downloadPump, NULL) != TIMER_NONE;
     }
-    DEBUGSERIAL.write("\r\n");
-  }
-  /* Update the modem information, and if we need to send information back
-   * to the base, do so now.
-   */
-  if(kayak.modem && modemNeedsPacket(kayak.modem)) {
-      sendPacket();
   }
 }
 
-void sendPacket()
+void MODEMSERIALEVENT()
 {
-  /* Packet structure corresponding to Santa Clara's format,
-   * mostly just querying TinyGPS for information
-   */
-  struct {
-    /* Compass Data */
-    short heading;
-    /* GPS Data */
-    float time;
-    int lat;
-    char lathem;
-    int lng;
-    char lnghem;
-    byte satellites;
-    short hdilution;
-    short course;
-    short magcourse;
-    short groundspeed;
-  } packet;
-  memset(&packet, 0, sizeof(packet));
-  /* Fill out the structure with the required data */
-  /* Compass heading */
-  if(kayak.compass)
-    packet.heading = compassBearing(kayak.compass);
-  int year;
-  byte month, day, hour, minute, second;
-  /* GPS time */
-  kayak.gpsdata.crack_datetime(&year, &month, &day, &hour,
-			       &minute, &second);
-  packet.time = hour * 3600.0f + minute * 60.0f + second;
-  /* GPS latitude and longitude */
-  long lat, lng;
-  kayak.gpsdata.get_position(&lat, &lng);
-  if(lat < 0) {
-    lat = -lat;
-    packet.lathem = 'S';
-  }
-  else {
-    packet.lathem = 'N';
-  }
-  if(lng < 0) {
-    lng = -lng;
-    packet.lnghem = 'E';
+  if(kayak.modem)
+    modemUpdate(kayak.modem);
+}
+
+void debugListen(void)
+{
+  if(rescheduleTimer(debugtimer, DEBUGLISTEN))
+    return;
+  powerHold(POWER_HOLD_DEBUG);
+  debugtimer = registerTimer(DEBUGLISTEN, debugQuiet, NULL);
+}
+
+void debugQuiet(void *)
+{
+  debugtimer = TIMER_NONE;
+  powerRelease(POWER_HOLD_DEBUG);
+}
+
+void memoryReport(void *)
+{
+  struct memstats stats;
+  arenaStats(&stats);
+  LOG(MEM_ARENA, stats.inuse, stats.size, stats.peak, stats.allocations,
+      stats.failures);
+  if(kayak.scheduler) {
+    schedulerStats(kayak.scheduler, &stats);
+    LOG(MEM_EVENTS, stats.inuse, stats.size, stats.peak, stats.allocations,
+	stats.failures);
   }
-  else {
-    packet.lnghem = 'W';
+  powerReport();
+  registerTimer(MEMREPORTPERIOD, memoryReport, NULL);
+}
+
+void downloadPump(void *)
+{
+  uint8_t chunk[DOWNLOADCHUNK];
+  while(logRawRoom() >= sizeof(chunk)) {
+    size_t size = recorderDownloadNext(&download, chunk, sizeof(chunk));
+    if(size == 0) {
+      downloading = false;
+      return;
+    }
+    logRaw(LOGRAW_RECORDER, chunk, size);
   }
-  packet.lat = (int)lat;
-  packet.lng = (int)lng;
-  /* Misc. GPS information */
-  packet.satellites = (byte)kayak.gpsdata.satellites();
-  packet.hdilution = (short)kayak.gpsdata.hdop();
-  packet.course = (short)kayak.gpsdata.f_course() * 100;
-  packet.magcourse = (short)kayak.gpsdata.f_course() * 100;
-  packet.groundspeed = (short)kayak.gpsdata.f_speed_kmph();
-  /* For verification */
-  DEBUGSERIAL.print("\r\nLatitude: ");
-  DEBUGSERIAL.print(packet.lat);
-  DEBUGSERIAL.println(packet.lathem);
-  DEBUGSERIAL.print("Longitude: ");
-  DEBUGSERIAL.print(packet.lng);
-  DEBUGSERIAL.println(packet.lnghem);
-  DEBUGSERIAL.print("GPS Heading: ");
-  DEBUGSERIAL.println(packet.course);
-  DEBUGSERIAL.print("Compass Heading: ");
-  DEBUGSERIAL.println(packet.heading);
-  DEBUGSERIAL.print("Speed (km/h): ");
-  DEBUGSERIAL.println(packet.groundspeed);
-  DEBUGSERIAL.print("Number of satellites: ");
-  DEBUGSERIAL.println(packet.satellites);
-  DEBUGSERIAL.print("Horizontal Dilution: ");
-  DEBUGSERIAL.println(packet.hdilution);
-  if(kayak.modem)
-    /* Send the packet that we filled out */
-    modemSendPacket(kayak.modem, &packet, sizeof(packet));
+  registerTimer(DOWNLOADPERIOD, downloadPump, NULL);
+}
+
+void powerReport(void)
+{
+  struct powerstats stats;
+  powerStats(&stats);
+  uint64_t total = 0;
+  for(int i = 0; i < POWER_NMODES; i++)
+    total += stats.residency[i];
+  if(total == 0)
+    return;
+  for(int i = 0; i < POWER_NMODES; i++)
+    LOG(POWER_RESIDENCY, i, (unsigned)(stats.residency[i] * 1000 / total),
+	stats.entries[i]);
 }
 
 void enableTRNG(void)
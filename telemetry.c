@@ -0,0 +1,319 @@
+
+#include "telemetry.h"
+
+#include <string.h>
+
+const enum telemetryencoding telemetrySchema[TELEMETRY_NFIELDS] = {
+	/* Time only ticks forward, and the position only moves a little
+	 * between replies, so those are sent as changes
+	 */
+	[TELEMETRY_TIME] = TELEMETRY_DELTA,
+	[TELEMETRY_LAT] = TELEMETRY_DELTA,
+	[TELEMETRY_LNG] = TELEMETRY_DELTA,
+	[TELEMETRY_SATELLITES] = TELEMETRY_FIXED8,
+	[TELEMETRY_HDOP] = TELEMETRY_VARINT,
+	[TELEMETRY_COURSE] = TELEMETRY_VARINT,
+	[TELEMETRY_HEADING] = TELEMETRY_VARINT,
+	[TELEMETRY_SPEED] = TELEMETRY_VARINT,
+	[TELEMETRY_AMPS] = TELEMETRY_FIXED16,
+	[TELEMETRY_VOLTS] = TELEMETRY_FIXED16,
+	[TELEMETRY_LINKLOSS] = TELEMETRY_VARINT,
+	[TELEMETRY_LINKINTERVAL] = TELEMETRY_VARINT,
+	[TELEMETRY_RSSI] = TELEMETRY_FIXED8,
+	[TELEMETRY_FAILSAFE] = TELEMETRY_VARINT,
+	[TELEMETRY_PEAKAMPS] = TELEMETRY_FIXED16,
+	/* Only ever goes up */
+	[TELEMETRY_ENERGY] = TELEMETRY_DELTA,
+};
+
+static size_t putVarint(uint8_t *buf, size_t size, uint32_t value)
+{
+	size_t i = 0;
+	do {
+		if(i >= size)
+			return 0;
+		buf[i] = value & 0x7F;
+		value >>= 7;
+		if(value)
+			buf[i] |= 0x80;
+		i++;
+	} while(value);
+	return i;
+}
+
+static size_t getVarint(const uint8_t *buf, size_t len, uint32_t *value)
+{
+	size_t i;
+	*value = 0;
+	for(i = 0; i < len && i < 5; i++) {
+		*value |= (uint32_t)(buf[i] & 0x7F) << (7 * i);
+		if(!(buf[i] & 0x80))
+			return i + 1;
+	}
+	return 0;
+}
+
+static uint32_t zigzag(int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static unsigned fixedWidth(enum telemetryencoding enc)
+{
+	switch(enc) {
+	case TELEMETRY_FIXED8:
+		return 1;
+	case TELEMETRY_FIXED16:
+		return 2;
+	case TELEMETRY_FIXED32:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+void telemetryInit(struct telemetrycodec *codec)
+{
+	memset(codec, 0, sizeof(*codec));
+}
+
+size_t telemetryEncode(struct telemetrycodec *codec,
+											 const struct telemetrysample *sample,
+											 uint8_t *buf, size_t size)
+{
+	uint32_t mask = sample->mask & TELEMETRY_ALLFIELDS;
+	bool key = codec->keycount == 0;
+	size_t pos, n;
+	int i;
+	if(size < 3)
+		return 0;
+	buf[0] = TELEMETRY_VERSION;
+	buf[1] = codec->sequence;
+	buf[2] = key ? TELEMETRY_KEYFRAME : 0;
+	pos = 3;
+	n = putVarint(buf + pos, size - pos, mask);
+	if(!n)
+		return 0;
+	pos += n;
+	for(i = 0; i < TELEMETRY_NFIELDS; i++) {
+		if(!(mask & (1ul << i)))
+			continue;
+		int32_t value = sample->values[i];
+		enum telemetryencoding enc = telemetrySchema[i];
+		unsigned width = fixedWidth(enc), b;
+		if(width) {
+			if(pos + width > size)
+				return 0;
+			for(b = 0; b < width; b++)
+				buf[pos++] = (uint32_t)value >> (8 * b);
+			continue;
+		}
+		if(enc == TELEMETRY_DELTA && !key)
+			n = putVarint(buf + pos, size - pos, zigzag(value - codec->last[i]));
+		else
+			n = putVarint(buf + pos, size - pos, zigzag(value));
+		if(!n)
+			return 0;
+		pos += n;
+	}
+	/* Only commit the new references once the whole frame fit */
+	for(i = 0; i < TELEMETRY_NFIELDS; i++) {
+		if(mask & (1ul << i))
+			codec->last[i] = sample->values[i];
+	}
+	codec->sequence++;
+	if(key)
+		codec->keycount = TELEMETRY_KEYINTERVAL;
+	codec->keycount--;
+	return pos;
+}
+
+size_t telemetryDecode(struct telemetrycodec *codec,
+											 const uint8_t *buf, size_t len,
+											 struct telemetrysample *sample)
+{
+	uint32_t mask, raw;
+	size_t pos, n;
+	bool key;
+	int i;
+	if(len < 3 || buf[0] != TELEMETRY_VERSION)
+		return 0;
+	key = buf[2] & TELEMETRY_KEYFRAME;
+	/* Any missed frame might have moved any of the delta references,
+	 * including those of fields this key frame doesn't carry
+	 */
+	if(buf[1] != (uint8_t)(codec->sequence + 1))
+		codec->synced = 0;
+	codec->sequence = buf[1];
+	pos = 3;
+	n = getVarint(buf + pos, len - pos, &mask);
+	if(!n || (mask & ~TELEMETRY_ALLFIELDS))
+		return 0;
+	pos += n;
+	sample->mask = 0;
+	for(i = 0; i < TELEMETRY_NFIELDS; i++) {
+		if(!(mask & (1ul << i)))
+			continue;
+		enum telemetryencoding enc = telemetrySchema[i];
+		unsigned width = fixedWidth(enc), b;
+		int32_t value;
+		if(width) {
+			uint32_t bits = 0;
+			if(pos + width > len)
+				return 0;
+			for(b = 0; b < width; b++)
+				bits |= (uint32_t)buf[pos++] << (8 * b);
+			/* Sign extend the narrower fields */
+			value = (int32_t)(bits << (32 - 8 * width)) >> (32 - 8 * width);
+		}
+		else {
+			n = getVarint(buf + pos, len - pos, &raw);
+			if(!n)
+				return 0;
+			pos += n;
+			value = unzigzag(raw);
+			if(enc == TELEMETRY_DELTA) {
+				if(key)
+					codec->synced |= 1ul << i;
+				else if(!(codec->synced & (1ul << i)))
+					continue;
+				else
+					value += codec->last[i];
+			}
+		}
+		codec->last[i] = value;
+		sample->values[i] = value;
+		sample->mask |= 1ul << i;
+	}
+	return pos;
+}
+
+uint32_t telemetryKeyFields(const struct telemetrycodec *codec,
+														const struct telemetrystreams *streams)
+{
+	uint32_t mask = 0;
+	int i;
+	if(codec->keycount != 0)
+		return 0;
+	for(i = 0; i < TELEMETRY_NFIELDS; i++) {
+		if(telemetrySchema[i] == TELEMETRY_DELTA && streams->period[i])
+			mask |= 1ul << i;
+	}
+	return mask;
+}
+
+/* Burst the token bucket can save up, in thousandths of a byte */
+#define TELEMETRY_BURST (2 * TELEMETRY_MAXFRAME * 1000)
+
+static void refill(struct telemetrystreams *streams, uint32_t now)
+{
+	uint32_t elapsed = now - streams->refilled;
+	int32_t tokens;
+	streams->refilled = now;
+	/* Avoid overflowing after a long quiet spell */
+	if(elapsed > TELEMETRY_BURST)
+		elapsed = TELEMETRY_BURST;
+	tokens = streams->tokens + (int32_t)(elapsed * streams->budget);
+	if(tokens > TELEMETRY_BURST)
+		tokens = TELEMETRY_BURST;
+	streams->tokens = tokens;
+}
+
+void telemetryStreamsInit(struct telemetrystreams *streams,
+													uint32_t budget, uint32_t now)
+{
+	memset(streams, 0, sizeof(*streams));
+	streams->budget = budget;
+	streams->tokens = TELEMETRY_BURST;
+	streams->refilled = now;
+}
+
+void telemetrySubscribe(struct telemetrystreams *streams,
+												enum telemetryfield field, uint32_t period,
+												uint32_t now)
+{
+	if(field >= TELEMETRY_NFIELDS)
+		return;
+	streams->period[field] = period;
+	streams->due[field] = now;
+}
+
+bool telemetryRequest(struct telemetrystreams *streams,
+											const uint8_t *buf, size_t len, uint32_t now)
+{
+	size_t pos = 0, n;
+	uint32_t period;
+	while(pos < len) {
+		uint8_t field = buf[pos++];
+		n = getVarint(buf + pos, len - pos, &period);
+		if(!n || field >= TELEMETRY_NFIELDS)
+			return false;
+		pos += n;
+		telemetrySubscribe(streams, (enum telemetryfield)field, period, now);
+	}
+	return true;
+}
+
+size_t telemetryPutRequest(uint8_t *buf, size_t size,
+													 enum telemetryfield field, uint32_t period)
+{
+	size_t n;
+	if(size < 2)
+		return 0;
+	buf[0] = field;
+	n = putVarint(buf + 1, size - 1, period);
+	return n ? n + 1 : 0;
+}
+
+uint32_t telemetryDue(struct telemetrystreams *streams, uint32_t now,
+											uint32_t *wait)
+{
+	uint32_t mask = 0, soonest = UINT32_MAX;
+	int i;
+	for(i = 0; i < TELEMETRY_NFIELDS; i++) {
+		if(!streams->period[i])
+			continue;
+		int32_t until = (int32_t)(streams->due[i] - now);
+		if(until <= 0) {
+			mask |= 1ul << i;
+			soonest = 0;
+		}
+		else if((uint32_t)until < soonest) {
+			soonest = until;
+		}
+	}
+	refill(streams, now);
+	if(streams->tokens < 0) {
+		/* Over budget, wait until the debt is paid off */
+		uint32_t paid = (-streams->tokens + streams->budget - 1) /
+			streams->budget;
+		if(paid > soonest)
+			soonest = paid;
+		mask = 0;
+	}
+	*wait = soonest;
+	return mask;
+}
+
+void telemetrySent(struct telemetrystreams *streams, uint32_t mask,
+									 size_t bytes, uint32_t now)
+{
+	int i;
+	for(i = 0; i < TELEMETRY_NFIELDS; i++) {
+		if(!(mask & (1ul << i)) || !streams->period[i])
+			continue;
+		streams->due[i] += streams->period[i];
+		/* If we've fallen a whole period behind, skip ahead rather than
+		 * sending a burst to catch up
+		 */
+		if((int32_t)(streams->due[i] - now) <= 0)
+			streams->due[i] = now + streams->period[i];
+	}
+	refill(streams, now);
+	streams->tokens -= (int32_t)(bytes * 1000);
+}
@@ -0,0 +1,216 @@
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Telemetry frame format, shared by the kayak and the base station.
+ *
+ * A frame is:
+ *   version   1 byte, TELEMETRY_VERSION
+ *   sequence  1 byte, incremented for every frame
+ *   flags     1 byte, TELEMETRY_KEYFRAME
+ *   mask      varint, bit n set if field n is present
+ *   fields    the present fields in order, encoded as the schema says
+ *
+ * Multibyte fixed fields are little endian. Varints are 7 bits per byte,
+ * least significant group first, with the top bit set on all but the last
+ * byte. Signed varints are zigzag encoded. Delta fields are the signed
+ * difference from the last value sent for that field, except in key frames
+ * where they're sent whole. A base that missed a frame resynchronizes each
+ * delta field at the next key frame that carries it, so the kayak puts
+ * every subscribed delta field in its key frames, see telemetryKeyFields.
+ */
+#define TELEMETRY_VERSION 5
+#define TELEMETRY_KEYFRAME 0x01
+/* Every this many frames is a key frame */
+#define TELEMETRY_KEYINTERVAL 16
+/* Largest possible frame */
+#define TELEMETRY_MAXFRAME 64
+
+enum telemetryfield {
+  /* Seconds since midnight, UTC */
+  TELEMETRY_TIME,
+  /* Millionths of a degree, north and east are positive */
+  TELEMETRY_LAT,
+  TELEMETRY_LNG,
+  TELEMETRY_SATELLITES,
+  /* Horizontal dilution of precision, in hundredths */
+  TELEMETRY_HDOP,
+  /* GPS course over the ground, hundredths of a degree */
+  TELEMETRY_COURSE,
+  /* Compass heading, tenths of a degree */
+  TELEMETRY_HEADING,
+  /* Ground speed, hundredths of a km/h */
+  TELEMETRY_SPEED,
+  /* Motor controller readings, channel A in the low byte and channel B
+   * in the high byte, each as the controller reports them, 0 to 0x7F
+   */
+  TELEMETRY_AMPS,
+  TELEMETRY_VOLTS,
+  /* Command link quality, as the kayak sees it. Loss in permille, the
+   * interval between commands in ms, and the modem's signal register
+   */
+  TELEMETRY_LINKLOSS,
+  TELEMETRY_LINKINTERVAL,
+  TELEMETRY_RSSI,
+  /* Times the command failsafe has tripped, doubled, plus one while
+   * it's tripped
+   */
+  TELEMETRY_FAILSAFE,
+  /* The highest of the last few amps readings, as TELEMETRY_AMPS, and
+   * the energy used since boot, see motorEnergy
+   */
+  TELEMETRY_PEAKAMPS,
+  TELEMETRY_ENERGY,
+  TELEMETRY_NFIELDS
+};
+
+#define TELEMETRY_ALLFIELDS ((1ul << TELEMETRY_NFIELDS) - 1)
+
+enum telemetryencoding {
+  TELEMETRY_FIXED8,
+  TELEMETRY_FIXED16,
+  TELEMETRY_FIXED32,
+  TELEMETRY_VARINT,
+  TELEMETRY_DELTA,
+};
+
+/* Describes how each field is put on the air, indexed by telemetryfield */
+extern const enum telemetryencoding telemetrySchema[TELEMETRY_NFIELDS];
+
+/* One set of readings. Fields that aren't in the mask are ignored */
+struct telemetrysample {
+  int32_t values[TELEMETRY_NFIELDS];
+  uint32_t mask;
+};
+
+/* Encoder and decoder state, the last values of the delta fields */
+struct telemetrycodec {
+  int32_t last[TELEMETRY_NFIELDS];
+  uint8_t sequence;
+  /* Frames until the next key frame, for the encoder */
+  uint8_t keycount;
+  /* The delta fields whose references are good, for the decoder */
+  uint32_t synced;
+};
+
+/* Resets the codec, so the next frame encoded is a key frame or the
+ * decoder waits for a key frame
+ * Preconditions: A valid codec
+ * Postconditions: The codec is in its initial state
+ */
+void telemetryInit(struct telemetrycodec *codec);
+
+/* Encodes the fields of the sample that are in its mask into buf.
+ * Returns the number of bytes written, or 0 if buf is too small.
+ * Preconditions: A valid codec and sample, buf has room for size bytes
+ * Postconditions: The frame is in buf, and the codec is updated to match
+ */
+size_t telemetryEncode(struct telemetrycodec *codec,
+		       const struct telemetrysample *sample,
+		       uint8_t *buf, size_t size);
+
+/* Telemetry subscriptions.
+ * The base subscribes to each field with the period it wants it at,
+ * and fields that come due around the same time share a frame. Frames are
+ * only sent while the link budget, in bytes per second, allows it.
+ *
+ * A subscription request from the base is a list of pairs of
+ *   field     1 byte, a telemetryfield
+ *   period    varint, in ms. 0 unsubscribes
+ */
+struct telemetrystreams {
+  uint32_t period[TELEMETRY_NFIELDS];
+  uint32_t due[TELEMETRY_NFIELDS];
+  /* Token bucket for the link budget, in thousandths of a byte.
+   * Goes negative when a frame is sent on credit.
+   */
+  uint32_t budget;
+  int32_t tokens;
+  uint32_t refilled;
+};
+
+/* Initializes the subscriptions with nothing subscribed
+ * Preconditions: A valid streams object, a positive budget in bytes/s,
+ *                the current time in ms
+ * Postconditions: No fields are subscribed
+ */
+void telemetryStreamsInit(struct telemetrystreams *streams,
+			  uint32_t budget, uint32_t now);
+
+/* Subscribes to a field, due first at now, or unsubscribes with a
+ * period of 0
+ * Preconditions: A valid streams object and field
+ * Postconditions: The field is sent every period ms
+ */
+void telemetrySubscribe(struct telemetrystreams *streams,
+			enum telemetryfield field, uint32_t period,
+			uint32_t now);
+
+/* Applies a subscription request from the base.
+ * Returns false if the request is malformed, but applies any pairs
+ * before the problem.
+ * Preconditions: A valid streams object, buf has len bytes
+ * Postconditions: The subscriptions in the request are in effect
+ */
+bool telemetryRequest(struct telemetrystreams *streams,
+		      const uint8_t *buf, size_t len, uint32_t now);
+
+/* Appends a pair to a subscription request, for the base.
+ * Returns the number of bytes written, or 0 if there isn't room.
+ * Preconditions: buf has room for size bytes
+ * Postconditions: The pair is written to buf
+ */
+size_t telemetryPutRequest(uint8_t *buf, size_t size,
+			   enum telemetryfield field, uint32_t period);
+
+/* Returns the mask of fields that should be sent now.
+ * Returns 0 if nothing is due or the link budget is used up, and sets
+ * wait to the number of ms until something could be sent.
+ * Preconditions: A valid streams object, a valid wait pointer
+ * Postconditions: The streams objects state remains the same
+ */
+uint32_t telemetryDue(struct telemetrystreams *streams, uint32_t now,
+		      uint32_t *wait);
+
+/* Records that the fields in mask were sent in a frame of bytes bytes
+ * Preconditions: A valid streams object
+ * Postconditions: The fields are due again a period from when they
+ *                 were due, and the budget is charged
+ */
+void telemetrySent(struct telemetrystreams *streams, uint32_t mask,
+		   size_t bytes, uint32_t now);
+
+/* Returns the delta fields that are subscribed to, if the next frame
+ * encoded is a key frame, and 0 otherwise. Sending them as well as the
+ * fields that are due lets a base that missed a frame pick all of them up
+ * again at once.
+ * Preconditions: A valid codec and streams object
+ * Postconditions: Neither object's state changes
+ */
+uint32_t telemetryKeyFields(const struct telemetrycodec *codec,
+			    const struct telemetrystreams *streams);
+
+/* Decodes a frame into sample. The mask of the sample is set to the
+ * fields that were decoded. A delta field is left out of the mask until
+ * a key frame has carried it, and again after any frame is missed.
+ * Returns the number of bytes used, or 0 if the frame is malformed.
+ * Preconditions: A valid codec and sample, buf has len bytes
+ * Postconditions: The sample holds the fields of the frame
+ */
+size_t telemetryDecode(struct telemetrycodec *codec,
+		       const uint8_t *buf, size_t len,
+		       struct telemetrysample *sample);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
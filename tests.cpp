@@ -0,0 +1,683 @@
+/* Checks of the code the kayak shares with the host tools.
+ *
+ * make check builds and runs them. Each test prints what it checked if it
+ * fails, and the run fails if any of them did.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "heap.h"
+#include "telemetry.h"
+#include "frame.h"
+#include "config.h"
+#include "half.h"
+#include "shape.h"
+#include "setpoint.h"
+#include "scheduler.h"
+#include "estimator.h"
+#include "control.h"
+#include "motor.h"
+#include "host/hostarduino.h"
+
+struct test {
+  const char *name;
+  /* Returns whether the test passed */
+  bool (*run)(void);
+};
+
+/* Reports a failed check, and fails the test it's in */
+#define CHECK(cond, ...)						\
+  do {									\
+    if(!(cond)) {							\
+      printf("  line %d: %s: ", __LINE__, #cond);			\
+      printf(__VA_ARGS__);						\
+      printf("\n");							\
+      return false;							\
+    }									\
+  } while(0)
+
+/* Frames of the position and heading, as the kayak sends them, with one
+ * frame lost on the way. Every position the base decodes must be the one
+ * sent, and the base must have the position again once a key frame has
+ * carried it. keyfields says whether the kayak adds the delta fields to
+ * its key frames, as it does since the base could otherwise go a long
+ * time, or forever, without a key frame that has the position.
+ */
+bool telemetryDropped(bool keyfields)
+{
+  struct telemetrycodec kayak, base;
+  struct telemetrystreams streams;
+  telemetryInit(&kayak);
+  telemetryInit(&base);
+  /* The position every 10 frames, the heading every frame. The 10 doesn't
+   * divide the key interval, so only some key frames are due a position
+   */
+  telemetryStreamsInit(&streams, 1000, 0);
+  telemetrySubscribe(&streams, TELEMETRY_LAT, 1000, 0);
+  telemetrySubscribe(&streams, TELEMETRY_LNG, 1000, 0);
+  telemetrySubscribe(&streams, TELEMETRY_HEADING, 100, 0);
+  int32_t lat = 30242545, lng = -97826347;
+  /* The frame that's lost, which carries the position, and the first
+   * key frame after it
+   */
+  const unsigned dropped = 20,
+    resync = (dropped / TELEMETRY_KEYINTERVAL + 1) * TELEMETRY_KEYINTERVAL;
+  unsigned decoded = 0, firstafter = 0;
+  for(unsigned frame = 0; frame < 100; frame++) {
+    uint32_t now = frame * 100, wait;
+    uint32_t due = telemetryDue(&streams, now, &wait), fields = due;
+    CHECK(due, "nothing due at frame %u", frame);
+    if(keyfields)
+      fields |= telemetryKeyFields(&kayak, &streams);
+    lat += 37;
+    lng -= 11;
+    struct telemetrysample sample, received;
+    sample.values[TELEMETRY_LAT] = lat;
+    sample.values[TELEMETRY_LNG] = lng;
+    sample.values[TELEMETRY_HEADING] = frame % 3600;
+    sample.mask = fields;
+    uint8_t buf[TELEMETRY_MAXFRAME];
+    size_t size = telemetryEncode(&kayak, &sample, buf, sizeof(buf));
+    CHECK(size, "frame %u didn't fit", frame);
+    telemetrySent(&streams, due, size, now);
+    if(frame == dropped) {
+      CHECK(fields & (1ul << TELEMETRY_LAT), "frame %u has no position",
+	    frame);
+      continue;
+    }
+    CHECK(telemetryDecode(&base, buf, size, &received) == size,
+	  "frame %u is malformed", frame);
+    CHECK(received.mask & (1ul << TELEMETRY_HEADING),
+	  "frame %u lost the heading", frame);
+    if(received.mask & (1ul << TELEMETRY_LAT)) {
+      CHECK(received.values[TELEMETRY_LAT] == lat &&
+	    received.values[TELEMETRY_LNG] == lng,
+	    "frame %u decoded %d, %d for %d, %d", frame,
+	    received.values[TELEMETRY_LAT], received.values[TELEMETRY_LNG],
+	    lat, lng);
+      decoded++;
+      if(frame > dropped && !firstafter)
+	firstafter = frame;
+    }
+  }
+  CHECK(firstafter, "the position never came back");
+  CHECK(firstafter >= resync, "the position came back at frame %u, before "
+	"the key frame at %u", firstafter, resync);
+  if(keyfields)
+    CHECK(firstafter == resync, "the position came back at frame %u, not "
+	  "with the key frame at %u", firstafter, resync);
+  CHECK(decoded, "no positions decoded");
+  return true;
+}
+
+bool telemetryDroppedKey(void)
+{
+  return telemetryDropped(true);
+}
+
+bool telemetryDroppedDue(void)
+{
+  return telemetryDropped(false);
+}
+
+/* A frame cut off part way by the carrier dropping, then the modem saying
+ * so. Once the line has been quiet for the guard time, the decoder must
+ * be between frames for NO CARRIER, and take the next frame whole.
+ */
+bool frameCutOff(void)
+{
+  const char *result = "\r\nNO CARRIER\r\n";
+  const uint32_t guard = 200;
+  struct framedecoder dec;
+  frameDecoderInit(&dec, 1);
+  uint8_t command[4] = {1, 2, 3, 4}, buf[FRAME_MAXENCODED];
+  size_t len = frameEncode(buf, sizeof(buf), 1, FRAME_COMMAND, command,
+			   sizeof(command));
+  CHECK(len > 4, "the frame didn't fit");
+  uint32_t now = 1000;
+  for(size_t i = 0; i < len / 2; i++, now++) {
+    CHECK(!frameGap(&dec, now, guard), "byte %u was taken as a gap",
+	  (unsigned)i);
+    CHECK(!frameDecode(&dec, buf[i]), "half a frame decoded");
+  }
+  CHECK(!frameIdle(&dec), "the decoder left the frame early");
+  now += guard + 1;
+  for(const char *c = result; *c; c++, now++) {
+    bool cut = frameGap(&dec, now, guard);
+    CHECK(cut == (c == result), "the gap was%s taken before byte %u",
+	  cut ? "" : "n't", (unsigned)(c - result));
+    CHECK(!frameDecode(&dec, *c), "the result decoded as a frame");
+    CHECK(frameIdle(&dec), "the result was taken as part of a frame");
+  }
+  CHECK(dec.errors == 1, "%u errors for one frame cut off", dec.errors);
+  for(size_t i = 0; i < len; i++, now++) {
+    CHECK(!frameGap(&dec, now, guard), "byte %u was taken as a gap",
+	  (unsigned)i);
+    if(frameDecode(&dec, buf[i])) {
+      size_t got;
+      const uint8_t *payload = framePayload(&dec, &got);
+      CHECK(i == len - 1, "the frame ended at byte %u of %u", (unsigned)i,
+	    (unsigned)len);
+      CHECK(got == sizeof(command) && !memcmp(payload, command, got),
+	    "the frame after came out wrong");
+      return true;
+    }
+  }
+  CHECK(false, "the frame after the cut off one didn't decode");
+}
+
+/* What kayak 2 hears: kayak 1's reply, then a command from the base for
+ * kayak 1, then one for itself. Only the base's frames may start slot 0,
+ * as kayak 1 never hears its own reply.
+ */
+bool frameSlotAnchor(void)
+{
+  struct framedecoder dec;
+  frameDecoderInit(&dec, 2);
+  uint8_t buf[3 * FRAME_MAXENCODED], reply[8] = {0}, command[4] = {0};
+  size_t len = frameEncode(buf, sizeof(buf), 1, FRAME_TELEMETRY, reply,
+			   sizeof(reply));
+  size_t replyend = len;
+  len += frameEncode(buf + len, sizeof(buf) - len, 1, FRAME_COMMAND,
+		     command, sizeof(command));
+  len += frameEncode(buf + len, sizeof(buf) - len, 2, FRAME_COMMAND,
+		     command, sizeof(command));
+  unsigned anchors = 0, frames = 0;
+  for(size_t i = 0; i < len; i++) {
+    if(frameDecode(&dec, buf[i]))
+      frames++;
+    if(buf[i] != FRAME_FLAG || !frameIdle(&dec))
+      continue;
+    CHECK(frameFromBase(&dec) == (i != replyend - 1),
+	  "the frame ending at byte %u was%s taken for the base's",
+	  (unsigned)i, frameFromBase(&dec) ? "" : "n't");
+    anchors += frameFromBase(&dec);
+  }
+  CHECK(anchors == 2, "%u frames from the base, not 2", anchors);
+  CHECK(frames == 1 && dec.ignored == 2, "%u frames for kayak 2, %u ignored",
+	frames, dec.ignored);
+  return true;
+}
+
+/* The value of a half, worked out the slow way */
+static double halfReference(uint16_t h)
+{
+  int exp = (h >> 10) & 0x1F, mant = h & 0x3FF;
+  double value;
+  if(exp == 0x1F)
+    value = mant ? NAN : INFINITY;
+  else if(exp == 0)
+    value = ldexp(mant, -24);
+  else
+    value = ldexp(mant | 0x400, exp - 25);
+  return (h & 0x8000) ? -value : value;
+}
+
+/* Every half, widened to float and to Q15 */
+bool halfDecodeAll(void)
+{
+  halfInit();
+  for(uint32_t h = 0; h <= 0xFFFF; h++) {
+    double ref = halfReference(h);
+    float got = halfToSingle(h);
+    if(isnan(ref)) {
+      CHECK(isnan(got), "%04X is NaN, decoded to %g", h, got);
+      CHECK(halfToQ15(h) == 0, "%04X is NaN, Q15 %d", h, halfToQ15(h));
+      continue;
+    }
+    CHECK(got == ref && signbit(got) == signbit(ref),
+	  "%04X decoded to %.10g, not %.10g", h, got, ref);
+    CHECK(singleToHalf(got) == h, "%04X came back as %04X", h,
+	  singleToHalf(got));
+    /* Round to nearest, ties away from 0, and saturate */
+    double q = floor(fabs(ref) * 32768 + 0.5);
+    if(q > 0x7FFF)
+      q = 0x7FFF;
+    if(ref < 0)
+      q = -q;
+    CHECK(halfToQ15(h) == q, "%04X (%.10g) is %d in Q15, not %g", h, ref,
+	  halfToQ15(h), q);
+  }
+  return true;
+}
+
+/* Floats halfway between each pair of neighbouring halves, and either
+ * side of halfway. Halfway goes to the half with the even mantissa,
+ * including from the largest half to infinity.
+ */
+bool halfEncodeTies(void)
+{
+  for(uint32_t h = 0; h < 0x7C00; h++) {
+    int exp = h >> 10;
+    double ulp = ldexp(1, (exp ? exp : 1) - 25);
+    float mid = halfReference(h) + ulp / 2;
+    uint16_t even = (h & 1) ? h + 1 : h;
+    float below = nextafterf(mid, 0), above = nextafterf(mid, INFINITY);
+    CHECK(singleToHalf(mid) == even, "%.10g is %04X, not %04X", mid,
+	  singleToHalf(mid), even);
+    CHECK(singleToHalf(-mid) == (even | 0x8000), "%.10g is %04X, not %04X",
+	  -mid, singleToHalf(-mid), even | 0x8000);
+    CHECK(singleToHalf(below) == h, "%.10g is %04X, not %04X", below,
+	  singleToHalf(below), h);
+    CHECK(singleToHalf(above) == h + 1, "%.10g is %04X, not %04X", above,
+	  singleToHalf(above), h + 1);
+  }
+  CHECK(singleToHalf(INFINITY) == 0x7C00 && singleToHalf(-1e10f) == 0xFC00,
+	"infinities are %04X and %04X", singleToHalf(INFINITY),
+	singleToHalf(-1e10f));
+  CHECK((singleToHalf(NAN) & 0x7FFF) > 0x7C00, "NaN is %04X",
+	singleToHalf(NAN));
+  return true;
+}
+
+/* Every half through the Q15 command path, against the same deadband and
+ * scaling done in double. Rounding in the 16.16 scale may be a count out.
+ */
+bool commandQ15Path(void)
+{
+  for(uint32_t h = 0; h <= 0xFFFF; h++) {
+    double power = halfReference(h);
+    if(isnan(power))
+      continue;
+    char cmd = 'A';
+    int got = motorScale(halfToQ15(h), &cmd);
+    double magnitude = fmin(fabs(power) * 32768, Q15_ONE), ref = 0;
+    if(magnitude >= MOTORDEADBAND + 0.5)
+      ref = fmin((magnitude - MOTORDEADBAND) * (MOTORMAXCMD - 1) /
+		 (Q15_ONE - MOTORDEADBAND) + 1, MOTORMAXCMD);
+    CHECK(fabs(got - ref) <= 1, "%04X (%.10g) is %d, not %.2f", h, power,
+	  got, ref);
+    CHECK(cmd == (power < 0 && halfToQ15(h) ? 'a' : 'A'),
+	  "%04X (%.10g) is %c", h, power, cmd);
+  }
+  return true;
+}
+
+extern "C" const char *configFile;
+
+/* A request from the base changing a parameter it may change, between two
+ * it may not. Only the one in the middle changes.
+ */
+bool configLinkOnly(void)
+{
+  /* Nothing's read back, so the saves can go nowhere */
+  configFile = "/dev/null";
+  configDefaults(&config);
+  uint8_t buf[32];
+  size_t len = configPutRequest(buf, sizeof(buf), CONFIG_NODEID, 7);
+  len += configPutRequest(buf + len, sizeof(buf) - len, CONFIG_EXPO, 500);
+  len += configPutRequest(buf + len, sizeof(buf) - len, CONFIG_MODEMBAUD,
+			  9600);
+  CHECK(configLinkSettable(CONFIG_EXPO) &&
+	!configLinkSettable(CONFIG_NODEID) &&
+	!configLinkSettable(CONFIG_MODEMBAUD) &&
+	!configLinkSettable(CONFIG_NPARAMS), "the wrong parameters are settable");
+  unsigned changed = configRequest(&config, buf, len);
+  CHECK(changed == 1, "%u parameters changed", changed);
+  CHECK(config.expo == 500, "expo is %u", config.expo);
+  CHECK(config.nodeid == 1 && config.modembaud == 115200,
+	"node %u and baud %u were changed", config.nodeid, config.modembaud);
+  return true;
+}
+
+/* The boat controlClosedLoop steers. Its motors are shaped as motorShape
+ * shapes them, and it turns and speeds up a bit slower than the estimator
+ * thinks a kayak does, in degrees/s and m/s at full power and s
+ */
+#define BOATTURNRATE 24.0f
+#define BOATSPEED 1.6f
+#define BOATTAU 3.0f
+/* Where it starts, in millionths of a degree */
+#define BOATLAT 30242545l
+#define BOATLNG -97826347l
+/* Meters per millionth of a degree of latitude */
+#define METERSPERMICRODEG 0.1113195f
+
+struct boat {
+  /* What the controller last asked for, and what the motors are doing */
+  q15 forward, rotate;
+  q15 out[2];
+  /* Degrees from north, m/s, meters east and north of the start */
+  float heading, speed, x, y;
+};
+
+static struct boat boat;
+/* The arena only has room for one scheduler, which controlClosedLoop
+ * starts and the tests after it carry on with
+ */
+static struct scheduler *testscheduler;
+
+/* The controller and estimator drive the boat rather than the drivers */
+void motorSetSpeed(struct motorctrl *, q15 forward, q15 rotate)
+{
+  boat.forward = forward;
+  boat.rotate = rotate;
+}
+
+float compassBearing(struct compass *)
+{
+  return boat.heading;
+}
+
+void logRecord(unsigned, unsigned, ...)
+{
+}
+
+/* Runs the controller and the boat for ms, with a GPS fix every second.
+ * Returns the largest heading error from heading, if it isn't NaN
+ */
+float boatRun(struct scheduler *scheduler, struct estimator *est,
+	      unsigned ms, float heading)
+{
+  const float dt = config.motorperiod / 1000.0f;
+  float worst = 0;
+  for(unsigned t = 0; t < ms; t += config.motorperiod) {
+    delay(config.motorperiod);
+    while(schedulerProcessEvents(scheduler));
+    struct shapeparams params;
+    shapeSetup(&params, config.motorperiod, config.stickdeadband, config.expo,
+	       config.motorrise, config.motorfall, config.motormix);
+    shapeStep(&params, boat.forward, boat.rotate, boat.out);
+    float thrust = q15ToFloat(boat.out[0]), turn = q15ToFloat(boat.out[1]);
+    if(config.motormix) {
+      thrust = (q15ToFloat(boat.out[0]) + q15ToFloat(boat.out[1])) / 2;
+      turn = (q15ToFloat(boat.out[0]) - q15ToFloat(boat.out[1])) / 2;
+    }
+    boat.heading = fmodf(boat.heading + turn * BOATTURNRATE * dt + 360, 360);
+    boat.speed += (thrust * BOATSPEED - boat.speed) * dt / (BOATTAU + dt);
+    float rad = boat.heading * (float)(M_PI / 180.0);
+    boat.x += boat.speed * sinf(rad) * dt;
+    boat.y += boat.speed * cosf(rad) * dt;
+    if(GetTickCount() % 1000 < config.motorperiod) {
+      float lat = BOATLAT + boat.y / METERSPERMICRODEG,
+	lng = BOATLNG + boat.x / (METERSPERMICRODEG *
+				  cosf(BOATLAT / 1e6f * (float)(M_PI / 180.0)));
+      estimatorGPSFix(est, lroundf(lat), lroundf(lng), boat.heading,
+		      boat.speed);
+    }
+    float err = fabsf(headingDiff(boat.heading, heading));
+    if(!isnan(heading) && err > worst)
+      worst = err;
+  }
+  return worst;
+}
+
+/* The controller and estimator steering a simulated boat, first holding a
+ * heading, then going to a waypoint sent as a setpoint frame's payload
+ */
+bool controlClosedLoop(void)
+{
+  hostLoad(NULL, 0, 0);
+  configDefaults(&config);
+  memset(&boat, 0, sizeof(boat));
+  /* The motors and compass are only passed back to the boat */
+  struct motorctrl *motor = (struct motorctrl *)&boat;
+  struct compass *compass = (struct compass *)&boat;
+  struct scheduler *scheduler = schedulerInit();
+  testscheduler = scheduler;
+  struct estimator *est = estimatorInit(compass, config.estimatorperiod);
+  struct control *ctrl = controlInit(motor, compass, est,
+				     config.controlperiod);
+  CHECK(scheduler && est && ctrl, "couldn't set up the controller");
+  /* Sit still until the estimator has a fix */
+  boatRun(scheduler, est, 3000, NAN);
+  CHECK(estimatorPose(est).valid, "no fix after 3 s");
+
+  /* The turn, then any overshoot, then holding it. Corrections too small
+   * to get past the stick deadband only come once the integral builds up,
+   * so it settles slowly
+   */
+  controlSetHeading(ctrl, 90, Q15(0.5));
+  boatRun(scheduler, est, 5000, NAN);
+  float worst = boatRun(scheduler, est, 30000, 90);
+  CHECK(worst < 12, "overshot 90 degrees by %.1f", worst);
+  worst = boatRun(scheduler, est, 10000, 90);
+  CHECK(worst < 2, "held 90 degrees to within %.1f", worst);
+  CHECK(boat.x > 20, "only went %.1f m east", boat.x);
+
+  /* 60 m north and 30 m west of where it is now */
+  float wx = boat.x - 30, wy = boat.y + 60;
+  struct setpoint sp, got;
+  sp.kind = SETPOINT_WAYPOINT;
+  sp.forward = singleToHalf(0.8f);
+  sp.lat = lroundf(BOATLAT + wy / METERSPERMICRODEG);
+  sp.lng = lroundf(BOATLNG + wx / (METERSPERMICRODEG *
+				   cosf(BOATLAT / 1e6f * (float)(M_PI / 180.0))));
+  uint8_t payload[SETPOINT_MAXSIZE];
+  size_t len = setpointEncode(payload, sizeof(payload), &sp);
+  CHECK(len && setpointDecode(payload, len, &got) &&
+	got.kind == SETPOINT_WAYPOINT && got.lat == sp.lat &&
+	got.lng == sp.lng && got.forward == sp.forward,
+	"the setpoint didn't survive encoding");
+  CHECK(controlSetWaypoint(ctrl, got.lat, got.lng, halfToQ15(got.forward)),
+	"the waypoint was refused");
+  boatRun(scheduler, est, 120000, NAN);
+  float miss = hypotf(boat.x - wx, boat.y - wy);
+  CHECK(controlMode(ctrl) == CONTROL_HEADING, "never arrived, %.1f m off",
+	miss);
+  CHECK(miss < 6, "stopped %.1f m from the waypoint", miss);
+  CHECK(boat.speed < 0.1f, "still doing %.2f m/s", boat.speed);
+  return true;
+}
+
+/* Random adds, pops, removals and key changes, with the heap checked
+ * after each against a linear scan of what should be in it. The keys
+ * start just short of wrapping, as the scheduler's tick counts do after
+ * 49 days. make check runs it against each of heap.h's implementations.
+ */
+#define HEAPCHECKNODES 40
+
+bool heapAgainstScan(void)
+{
+  static struct hpslot slots[HP_SLOTS(HEAPCHECKNODES)];
+  struct heap hp;
+  struct hpnode nodes[HEAPCHECKNODES];
+  hpkey keys[HEAPCHECKNODES];
+  bool queued[HEAPCHECKNODES];
+  hpInit(&hp, slots, HEAPCHECKNODES);
+  for(unsigned i = 0; i < HEAPCHECKNODES; i++) {
+    hpNodeInit(&nodes[i]);
+    queued[i] = false;
+  }
+  const hpkey start = 0xFFFFFFFF - 5000;
+  uint32_t rand = 1;
+  unsigned count = 0;
+  for(unsigned step = 0; step < 20000; step++) {
+    rand = rand * 1664525 + 1013904223;
+    unsigned n = (rand >> 8) % HEAPCHECKNODES;
+    hpkey key = start + step + (rand >> 12) % 10000;
+    /* Lowest key by a scan, before the operation */
+    int first = -1;
+    for(unsigned i = 0; i < HEAPCHECKNODES; i++) {
+      if(queued[i] && (first < 0 || (int)(keys[i] - keys[first]) < 0))
+	first = i;
+    }
+    switch((rand >> 28) % 8) {
+    case 0:
+    case 1:
+    case 2:
+      if(queued[n])
+	break;
+      CHECK(hpAdd(&hp, &nodes[n], key), "adding %u at step %u", n, step);
+      keys[n] = key;
+      queued[n] = true;
+      count++;
+      break;
+    case 3:
+    case 4: {
+      struct hpnode *top = hpTop(&hp);
+      if(first < 0) {
+	CHECK(!top, "popped from an empty heap at step %u", step);
+	break;
+      }
+      CHECK(top, "nothing popped at step %u", step);
+      unsigned i = top - nodes;
+      CHECK(keys[i] == keys[first], "popped %08x, not %08x, at step %u",
+	    keys[i], keys[first], step);
+      queued[i] = false;
+      count--;
+      break;
+    }
+    case 5:
+      if(!queued[n])
+	break;
+      hpRemove(&hp, &nodes[n]);
+      queued[n] = false;
+      count--;
+      break;
+    default:
+      if(!queued[n])
+	break;
+      hpUpdate(&hp, &nodes[n], key);
+      keys[n] = key;
+      break;
+    }
+    CHECK(hpSize(&hp) == count, "%u nodes, not %u, at step %u",
+	  hpSize(&hp), count, step);
+    first = -1;
+    for(unsigned i = 0; i < HEAPCHECKNODES; i++) {
+      CHECK(hpQueued(&nodes[i]) == queued[i], "node %u %s at step %u", i,
+	    queued[i] ? "lost" : "still queued", step);
+      if(!queued[i])
+	continue;
+      CHECK(hpKey(&hp, &nodes[i]) == keys[i], "node %u has key %08x, not "
+	    "%08x, at step %u", i, hpKey(&hp, &nodes[i]), keys[i], step);
+      if(first < 0 || (int)(keys[i] - keys[first]) < 0)
+	first = i;
+    }
+    struct hpnode *peek = hpPeek(&hp);
+    if(first < 0) {
+      CHECK(!peek, "the empty heap has a first node at step %u", step);
+    }
+    else {
+      CHECK(peek && hpKey(&hp, peek) == keys[first],
+	    "the first key isn't %08x at step %u", keys[first], step);
+    }
+  }
+  return true;
+}
+
+/* A fix without a course or speed only corrects the position. It used to
+ * be taken as due north, which dragged the velocity round with it.
+ */
+bool estimatorNoCourse(void)
+{
+  struct estimator *est = estimatorInit(NULL, config.estimatorperiod);
+  CHECK(est, "couldn't set up the estimator");
+  /* Heading east at 2 m/s */
+  for(int i = 0; i < 20; i++)
+    estimatorGPSFix(est, BOATLAT, BOATLNG + i * 18, 90, 2);
+  struct pose before = estimatorPose(est);
+  CHECK(before.vx > 1.9f && fabsf(before.vy) < 0.1f,
+	"velocity %.2f %.2f after the fixes", before.vx, before.vy);
+  estimatorGPSFix(est, BOATLAT, BOATLNG + 20 * 18, NAN, NAN);
+  struct pose after = estimatorPose(est);
+  CHECK(after.vx == before.vx && after.vy == before.vy &&
+	after.heading == before.heading,
+	"velocity %.2f %.2f, heading %.1f, was %.2f %.2f, %.1f", after.vx,
+	after.vy, after.heading, before.vx, before.vy, before.heading);
+  CHECK(after.x > before.x, "the position wasn't corrected");
+  return true;
+}
+
+/* Without a compass, the heading is only valid from the first GPS course
+ * until the courses stop, as they do when the kayak does
+ */
+bool estimatorHeadingStale(void)
+{
+  struct estimator *est = estimatorInit(NULL, config.estimatorperiod);
+  CHECK(testscheduler && est, "couldn't set up the estimator");
+  CHECK(!estimatorPose(est).headingvalid, "valid before any course");
+  estimatorGPSFix(est, BOATLAT, BOATLNG, 90, 2);
+  CHECK(estimatorPose(est).headingvalid, "not valid after a course");
+  for(unsigned t = 0; t < 10000; t += config.estimatorperiod) {
+    delay(config.estimatorperiod);
+    while(schedulerProcessEvents(testscheduler));
+    estimatorGPSFix(est, BOATLAT, BOATLNG, NAN, NAN);
+  }
+  CHECK(!estimatorPose(est).headingvalid, "still valid 10 s after the last "
+	"course");
+  return true;
+}
+
+static unsigned periodicruns;
+
+void periodicCount(void *)
+{
+  periodicruns++;
+}
+
+void periodicNothing(void *)
+{
+}
+
+/* A periodic timer keeps firing while every other event is taken. The
+ * estimator, controller and motors used to register themselves again
+ * each time, and stopped for good if the pool was full just then.
+ */
+bool schedulerPeriodicFull(void)
+{
+  CHECK(testscheduler, "no scheduler");
+  periodicruns = 0;
+  timerhandle periodic = registerPeriodic(10, periodicCount, NULL);
+  CHECK(periodic != TIMER_NONE, "couldn't register the periodic timer");
+  timerhandle fillers[32];
+  unsigned nfillers = 0;
+  while(nfillers < 32 &&
+	(fillers[nfillers] = registerTimer(60000, periodicNothing, NULL)) !=
+	TIMER_NONE)
+    nfillers++;
+  CHECK(nfillers < 32, "the scheduler never filled up");
+  for(unsigned t = 0; t < 100; t++) {
+    delay(1);
+    while(schedulerProcessEvents(testscheduler));
+  }
+  for(unsigned i = 0; i < nfillers; i++)
+    cancelTimer(fillers[i]);
+  CHECK(periodicruns >= 9, "ran %u times in 100 ms", periodicruns);
+  CHECK(cancelTimer(periodic), "the handle went stale");
+  unsigned runs = periodicruns;
+  for(unsigned t = 0; t < 50; t++) {
+    delay(1);
+    while(schedulerProcessEvents(testscheduler));
+  }
+  CHECK(periodicruns == runs, "ran %u times after being cancelled",
+	periodicruns - runs);
+  return true;
+}
+
+static const struct test tests[] = {
+  {"heap against a linear scan", heapAgainstScan},
+  {"telemetry frame dropped, key frames with delta fields",
+   telemetryDroppedKey},
+  {"telemetry frame dropped, key frames with due fields only",
+   telemetryDroppedDue},
+  {"frame cut off by the carrier dropping", frameCutOff},
+  {"slot 0 started by the base only", frameSlotAnchor},
+  {"every half decoded", halfDecodeAll},
+  {"floats between halves encoded", halfEncodeTies},
+  {"every half through the Q15 command path", commandQ15Path},
+  {"config request with parameters the base can't set", configLinkOnly},
+  {"controller steering a simulated boat", controlClosedLoop},
+  {"GPS fix without a course", estimatorNoCourse},
+  {"heading stale without courses", estimatorHeadingStale},
+  {"periodic timer with the scheduler full", schedulerPeriodicFull},
+};
+
+static const unsigned ntests = sizeof(tests) / sizeof(tests[0]);
+
+int main()
+{
+  unsigned failed = 0;
+  for(unsigned i = 0; i < ntests; i++) {
+    bool passed = tests[i].run();
+    printf("%-60s %s\n", tests[i].name, passed ? "ok" : "FAILED");
+    if(!passed)
+      failed++;
+  }
+  printf("%u of %u tests failed\n", failed, ntests);
+  return failed ? 1 : 0;
+}
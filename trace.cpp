@@ -0,0 +1,176 @@
+
+#include "trace.h"
+
+#ifdef TRACE
+
+#include "include.h"
+#include "scheduler.h"
+#include "logging.h"
+
+#include <Arduino.h>
+
+/* How often the trace is handed to the log, in ms */
+#define TRACEFLUSHPERIOD 10
+/* Header, the longest time, and the value */
+#define TRACEMAXEVENT (1 + 5 + 1)
+/* The op, the event and the longest key */
+#define TRACEMAXSCHED (1 + 1 + 5)
+
+static struct {
+  uint8_t buffer[LOGMAXRAW];
+  unsigned used;
+  /* Time of the last event, in us */
+  uint32_t last;
+  unsigned dropped;
+  unsigned reported;
+  bool started;
+  bool flushing;
+} trace;
+
+/* Kept apart from the peripherals' trace, as the interrupt handler adds
+ * to it
+ */
+static struct {
+  uint8_t buffer[LOGMAXRAW];
+  volatile unsigned used;
+  volatile unsigned dropped;
+  unsigned reported;
+} tracesched;
+
+void traceEvent(enum traceport port, enum tracedir dir, uint8_t value);
+bool traceFlush(void);
+void traceFlushTimer(void *);
+
+void traceInit(void)
+{
+  trace.used = 0;
+  trace.dropped = 0;
+  trace.reported = 0;
+  trace.flushing = false;
+  trace.last = micros();
+  tracesched.used = 0;
+  tracesched.dropped = 0;
+  tracesched.reported = 0;
+  trace.started = true;
+}
+
+int traceIn(enum traceport port, int value)
+{
+  if(value >= 0)
+    traceEvent(port, TRACE_READ, value);
+  return value;
+}
+
+uint8_t traceOut(enum traceport port, uint8_t value)
+{
+  traceEvent(port, TRACE_WRITE, value);
+  return value;
+}
+
+const char *traceOutString(enum traceport port, const char *str)
+{
+  for(const char *c = str; *c; c++)
+    traceEvent(port, TRACE_WRITE, *c);
+  return str;
+}
+
+void traceEvent(enum traceport port, enum tracedir dir, uint8_t value)
+{
+  if(!trace.started)
+    return;
+  if(trace.used + TRACEMAXEVENT > sizeof(trace.buffer) && !traceFlush()) {
+    /* The time carries over to the next event that makes it */
+    trace.dropped++;
+    return;
+  }
+  uint32_t now = micros();
+  uint32_t delta = now - trace.last;
+  trace.last = now;
+  trace.buffer[trace.used++] = (port << 1) | dir;
+  do {
+    trace.buffer[trace.used] = delta & 0x7F;
+    delta >>= 7;
+    if(delta)
+      trace.buffer[trace.used] |= 0x80;
+    trace.used++;
+  } while(delta);
+  trace.buffer[trace.used++] = value;
+  if(!trace.flushing) {
+    trace.flushing = true;
+    registerTimer(TRACEFLUSHPERIOD, traceFlushTimer, NULL);
+  }
+}
+
+bool traceFlush(void)
+{
+  if(trace.used && !logRaw(LOGRAW_TRACE, trace.buffer, trace.used))
+    return false;
+  trace.used = 0;
+  return true;
+}
+
+void traceFlushTimer(void *)
+{
+  trace.flushing = false;
+  if(!traceFlush()) {
+    trace.flushing = true;
+    registerTimer(TRACEFLUSHPERIOD, traceFlushTimer, NULL);
+  }
+  if(trace.dropped != trace.reported) {
+    LOG(TRACE_DROPPED, trace.dropped - trace.reported);
+    trace.reported = trace.dropped;
+  }
+}
+
+void traceSchedule(enum traceschedop op, unsigned event, unsigned key)
+{
+  if(!trace.started)
+    return;
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  unsigned used = tracesched.used;
+  if(used + TRACEMAXSCHED > sizeof(tracesched.buffer)) {
+    tracesched.dropped++;
+    __set_PRIMASK(primask);
+    return;
+  }
+  tracesched.buffer[used++] = op;
+  tracesched.buffer[used++] = event;
+  if(op == TRACE_SCHED_REGISTER || op == TRACE_SCHED_RESCHEDULE) {
+    do {
+      tracesched.buffer[used] = key & 0x7F;
+      key >>= 7;
+      if(key)
+	tracesched.buffer[used] |= 0x80;
+      used++;
+    } while(key);
+  }
+  tracesched.used = used;
+  __set_PRIMASK(primask);
+}
+
+void traceScheduleFlush(void)
+{
+  if(!trace.started)
+    return;
+  /* Copied out first, as logging can register a timer, which is traced */
+  uint8_t chunk[sizeof(tracesched.buffer)];
+  __disable_irq();
+  unsigned len = tracesched.used;
+  if(len > logRawRoom())
+    /* Try again next time round */
+    len = 0;
+  memcpy(chunk, tracesched.buffer, len);
+  if(len)
+    tracesched.used = 0;
+  unsigned dropped = tracesched.dropped;
+  __enable_irq();
+  if(len)
+    logRaw(LOGRAW_SCHEDULE, chunk, len);
+  if(dropped != tracesched.reported) {
+    LOG(TRACE_DROPPED, dropped - tracesched.reported);
+    tracesched.reported = dropped;
+  }
+}
+
+#endif
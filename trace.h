@@ -0,0 +1,97 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+/* Capture of every byte to and from the peripherals, with the time it
+ * was read or written, so field failures can be replayed on the host.
+ *
+ * Only compiled in when built with TRACE defined, make TRACE=1. Otherwise
+ * the TRACE macros are just their value. The trace is sent along with the
+ * log as LOGRAW_TRACE records, pulled out with logdecode -t, and run
+ * through the drivers again with replay.
+ *
+ * Each event in the trace is
+ *   port << 1 | direction  1 byte
+ *   time                   varint, us since the previous event
+ *   value                  1 byte
+ * The first event's time is from traceInit.
+ *
+ * The debug port has to keep up with the trace, so run it fast.
+ * An event dropped for lack of room is logged as TRACE_DROPPED.
+ *
+ * The scheduler's timer operations are traced too, as LOGRAW_SCHEDULE
+ * records, pulled out with logdecode -s, and replayed through each of the
+ * heaps with bench -s. Each operation is
+ *   op     1 byte, a traceschedop
+ *   event  1 byte, the event's index in the scheduler's pool
+ *   key    varint, the tick it's due at, for register and reschedule only
+ * Operations are traced from the interrupt handler as well, and handed
+ * to the log by traceScheduleFlush from the main loop.
+ */
+
+enum traceport {
+  TRACE_GPS,
+  TRACE_MODEM,
+  TRACE_MOTOR,
+  TRACE_COMPASS,
+  TRACE_NPORTS
+};
+
+enum tracedir {
+  TRACE_READ,
+  TRACE_WRITE
+};
+
+enum traceschedop {
+  /* registerTimer, and rescheduleTimer, which moves the event either way */
+  TRACE_SCHED_REGISTER,
+  TRACE_SCHED_RESCHEDULE,
+  /* postEvent, straight onto the ready queue */
+  TRACE_SCHED_POST,
+  TRACE_SCHED_CANCEL,
+  /* The interrupt handler moved the first queued event to the ready queue */
+  TRACE_SCHED_DUE,
+  /* The first ready event was taken off to be run */
+  TRACE_SCHED_RUN,
+  TRACE_SCHED_NOPS
+};
+
+#ifdef TRACE
+
+/* Wrap a byte read from a port, or about to be written to it.
+ * Reads which returned -1 aren't traced.
+ */
+#define TRACEIN(port, value) traceIn(port, value)
+#define TRACEOUT(port, value) traceOut(port, value)
+#define TRACEOUTSTR(port, str) traceOutString(port, str)
+
+/* Starts tracing, events before this are ignored
+ * Preconditions: The log has been initialized
+ */
+void traceInit(void);
+
+int traceIn(enum traceport port, int value);
+uint8_t traceOut(enum traceport port, uint8_t value);
+const char *traceOutString(enum traceport port, const char *str);
+
+/* Trace a scheduler operation. Safe to call from the interrupt handler */
+#define TRACESCHED(op, event, key) traceSchedule(op, event, key)
+
+void traceSchedule(enum traceschedop op, unsigned event, unsigned key);
+
+/* Hands the scheduler's operations traced so far to the log. Call from
+ * the main loop
+ */
+void traceScheduleFlush(void);
+
+#else
+
+#define TRACEIN(port, value) (value)
+#define TRACEOUT(port, value) (value)
+#define TRACEOUTSTR(port, str) (str)
+#define TRACESCHED(op, event, key) do { } while(0)
+
+#endif
+
+#endif